@@ -6,6 +6,7 @@
 #include <vector>
 #include <cmath>
 #include <sstream>
+#include <algorithm>
 #include "clutil.h"
 
 #ifdef USE_DOUBLE
@@ -14,38 +15,22 @@ typedef double real_t;
 typedef float real_t;
 #endif
 
+//page aligned: buffers share host memory on unified memory devices
+typedef CLAlignedVector< real_t > Matrix;
+
 //------------------------------------------------------------------------------
-std::vector< real_t > create_matrix(int cols, int rows) {
-	std::vector< real_t > m(cols * rows);
+Matrix create_matrix(int cols, int rows) {
+	Matrix m(cols * rows);
 	srand(time(0));
-	for(std::vector<real_t>::iterator i = m.begin();
+	for(Matrix::iterator i = m.begin();
 	    i != m.end(); ++i) *i = rand() % 10; 
 	return m;
 }
 
 
 //------------------------------------------------------------------------------
-void host_matmul(const std::vector< real_t >& A,
-	             const std::vector< real_t >& B,
-	             std::vector< real_t >& C, 
-	             int a_columns,
-	             int b_columns) {
-	const int rows = a_columns;
-	const int columns = b_columns;
-	for(int r = 0; r != rows; ++r) {
-		for(int c = 0; c != columns; ++c) {
-			C[r*b_columns + c] = 0;
-			for(int ic = 0; ic != a_columns; ++ic) {
-				C[r*b_columns + c] += A[r*a_columns + ic]
-				                      * B[ic*b_columns + c];
-			}
-		}
-	}
-}
-
-//------------------------------------------------------------------------------
-bool check_result(const std::vector< real_t >& v1,
-	              const std::vector< real_t >& v2,
+bool check_result(const Matrix& v1,
+	              const Matrix& v2,
 	              double eps) {
     for(int i = 0; i != v1.size(); ++i) {
     	if(double(std::fabs(v1[i] - v2[i])) > eps) return false;
@@ -59,124 +44,147 @@ int main(int argc, char** argv) {
         std::cerr << "usage: " << argv[0]
                   << " <platform name> <device type = default | cpu | gpu "
                      "| acc | all>  <device num> <OpenCL source file path>"
-                     " <kernel name>"
+                     " <kernel name(s): name | name1,name2... | all>"
                   << std::endl;
         exit(EXIT_FAILURE);   
     }
     const int SIZE = 16; //16 x 16
     const size_t BYTE_SIZE = SIZE * SIZE * sizeof(real_t);
     const int BLOCK_SIZE = 4; //4 x 4 tiles
+    //tiled_matmul: each work item computes a 4 x 2 tile of the output
+    const int TM = 4;
+    const int TN = 2;
+    const int TK = 8;
     //setup text header that will be prefixed to opencl code
     std::ostringstream clheaderStream;
-    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n';
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n'
+                   << "#define TM " << TM << '\n'
+                   << "#define TN " << TN << '\n'
+                   << "#define TK " << TK << '\n';
 #ifdef USE_DOUBLE    
     clheaderStream << "#define DOUBLE\n";
     const double EPS = 0.000000001;
 #else
     const double EPS = 0.00001;
 #endif    
+    //build program once and create all kernels; switching between kernels
+    //does not require recompilation
     CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), false,
-                               argv[4], argv[5], clheaderStream.str());
+                               argv[4], 0, clheaderStream.str());
+    std::vector< std::string > kernelNames;
+    if(std::string(argv[5]) == "all") {
+        //only the kernels taking (A, B, C, SIZE) arguments, plus the shape
+        //and leading dimensions of gemm; half storage and epilogue kernels
+        //are run by 23_half_precision and 24_gemm_epilogue
+        const char* SUPPORTED[] = {"matmul", "block_matmul", "tiled_matmul",
+                                   "gemm"};
+        for(size_t i = 0; i != sizeof(SUPPORTED) / sizeof(const char*); ++i) {
+            if(clenv.kernels.count(SUPPORTED[i]))
+                kernelNames.push_back(SUPPORTED[i]);
+        }
+    } else {
+        std::istringstream names(argv[5]);
+        std::string name;
+        while(std::getline(names, name, ',')) kernelNames.push_back(name);
+    }
    
     cl_int status;
     //create input and output matrices
-    std::vector<real_t> A = create_matrix(SIZE, SIZE);
-    std::vector<real_t> B = create_matrix(SIZE, SIZE);
-    std::vector<real_t> C(SIZE * SIZE,real_t(0));
-    std::vector<real_t> refC(SIZE * SIZE,real_t(0));        
-    
-    //allocate output buffer on OpenCL device
-    cl_mem devC = clCreateBuffer(clenv.context,
-                                 CL_MEM_WRITE_ONLY,
-                                 BYTE_SIZE,
-                                 0,
-                                 &status);
-    check_cl_error(status, "clCreateBuffer");
+    Matrix A = create_matrix(SIZE, SIZE);
+    Matrix B = create_matrix(SIZE, SIZE);
+    Matrix C(SIZE * SIZE,real_t(0));
+    Matrix refC(SIZE * SIZE,real_t(0));
+
+    //allocate buffers on OpenCL device: on devices sharing memory with the
+    //host the buffers are created on top of A, B, C (zero-copy), otherwise
+    //input data are copied
+    CLHostBuffer devA = create_host_buffer(clenv, CL_MEM_READ_ONLY,
+                                           &A[0], BYTE_SIZE);
+    CLHostBuffer devB = create_host_buffer(clenv, CL_MEM_READ_ONLY,
+                                           &B[0], BYTE_SIZE);
+    CLHostBuffer devC = create_host_buffer(clenv, CL_MEM_WRITE_ONLY,
+                                           &C[0], BYTE_SIZE);
+    std::cout << (devA.zeroCopy ? "zero-copy buffers" : "device buffers")
+              << std::endl;
 
-    //allocate input buffers on OpenCL devices and copy data
-    cl_mem devA = clCreateBuffer(clenv.context,
-                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                 BYTE_SIZE,
-                                 &A[0], //<-- copy data from A
-                                 &status);
-    check_cl_error(status, "clCreateBuffer");                              
-    cl_mem devB = clCreateBuffer(clenv.context,
-                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                 BYTE_SIZE,
-                                 &B[0], //<-- copy data from B
-                                 &status);
-    check_cl_error(status, "clCreateBuffer");                              
+    host_gemm(SIZE, SIZE, SIZE, &A[0], SIZE, &B[0], SIZE, &refC[0], SIZE);
 
-    //set kernel parameters
-    status = clSetKernelArg(clenv.kernel, //kernel
-                            0,      //parameter id
-                            sizeof(cl_mem), //size of parameter
-                            &devA); //pointer to parameter
-    check_cl_error(status, "clSetKernelArg(A)");
-    status = clSetKernelArg(clenv.kernel, //kernel
-                            1,      //parameter id
-                            sizeof(cl_mem), //size of parameter
-                            &devB); //pointer to parameter
-    check_cl_error(status, "clSetKernelArg(B)");
-    status = clSetKernelArg(clenv.kernel, //kernel
-                            2,      //parameter id
-                            sizeof(cl_mem), //size of parameter
-                            &devC); //pointer to parameter
-    check_cl_error(status, "clSetKernelArg(C)");
-    status = clSetKernelArg(clenv.kernel, //kernel
-                            3,      //parameter id
-                            sizeof(int), //size of parameter
-                            &SIZE); //pointer to parameter
-    check_cl_error(status, "clSetKernelArg(SIZE)");
+    for(size_t k = 0; k != kernelNames.size(); ++k) {
+        cl_kernel kernel = get_kernel(clenv, kernelNames[k]);
+        //clear output: a kernel which does not write all of C must not pass
+        //with the results of the previous kernel
+        std::fill(C.begin(), C.end(), real_t(0));
+        write_host_buffer(clenv.commandQueue, devC);
+        //set kernel parameters
+        status = clSetKernelArg(kernel, //kernel
+                                0,      //parameter id
+                                sizeof(cl_mem), //size of parameter
+                                &devA.buffer); //pointer to parameter
+        check_cl_error(status, "clSetKernelArg(A)");
+        status = clSetKernelArg(kernel, //kernel
+                                1,      //parameter id
+                                sizeof(cl_mem), //size of parameter
+                                &devB.buffer); //pointer to parameter
+        check_cl_error(status, "clSetKernelArg(B)");
+        status = clSetKernelArg(kernel, //kernel
+                                2,      //parameter id
+                                sizeof(cl_mem), //size of parameter
+                                &devC.buffer); //pointer to parameter
+        check_cl_error(status, "clSetKernelArg(C)");
+        status = clSetKernelArg(kernel, //kernel
+                                3,      //parameter id
+                                sizeof(int), //size of parameter
+                                &SIZE); //pointer to parameter
+        check_cl_error(status, "clSetKernelArg(SIZE)");
+        //gemm: N, K and leading dimensions of A, B, C
+        const bool gemm = kernelNames[k] == "gemm";
+        for(int i = 4; gemm && i != 9; ++i) {
+            status = clSetKernelArg(kernel, i, sizeof(int), &SIZE);
+            check_cl_error(status, "clSetKernelArg(gemm)");
+        }
 
 
-    //setup kernel launch configuration
-    //total number of threads == number of array elements
-    const size_t globalWorkSize[2] = {SIZE, SIZE};
-    //number of per-workgroup local threads
-    const size_t localWorkSize[2] = {BLOCK_SIZE, BLOCK_SIZE}; 
+        //setup kernel launch configuration
+        //total number of threads == number of array elements
+        //the register tiled kernels compute TM x TN elements per thread
+        const bool tiled = gemm || kernelNames[k] == "tiled_matmul";
+        const size_t globalWorkSize[2] = {size_t(tiled ? SIZE / TN : SIZE),
+                                          size_t(tiled ? SIZE / TM : SIZE)};
+        //number of per-workgroup local threads
+        const size_t localWorkSize[2] = {BLOCK_SIZE, BLOCK_SIZE}; 
 
-    //launch kernel
-    status = clEnqueueNDRangeKernel(clenv.commandQueue, //queue
-                                    clenv.kernel, //kernel                                   
-                                    2, //number of dimensions for work-items
-                                    0, //global work offset
-                                    globalWorkSize, //total number of threads
-                                    localWorkSize, //threads per workgroup
-                                    0, //number of events that need to
-                                       //complete before kernel executed
-                                    0, //list of events that need to complete
-                                       //before kernel executed
-                                    0); //event object identifying this
-                                        //particular kernel execution instance
+        //launch kernel
+        status = clEnqueueNDRangeKernel(clenv.commandQueue, //queue
+                                        kernel, //kernel
+                                        2, //number of dimensions for
+                                           //work-items
+                                        0, //global work offset
+                                        globalWorkSize, //total number of
+                                                        //threads
+                                        localWorkSize, //threads per workgroup
+                                        0, //number of events that need to
+                                           //complete before kernel executed
+                                        0, //list of events that need to
+                                           //complete before kernel executed
+                                        0); //event object identifying this
+                                            //particular kernel execution
+                                            //instance
 
-    check_cl_error(status, "clEnqueueNDRangeKernel");
+        check_cl_error(status, "clEnqueueNDRangeKernel");
     
-    //read back and check results
-    status = clEnqueueReadBuffer(clenv.commandQueue,
-                                 devC,
-                                 CL_TRUE, //blocking read
-                                 0, //offset
-                                 BYTE_SIZE, //byte size of data
-                                 &C[0], //destination buffer in host memory
-                                 0, //number of events that need to
-                                    //complete before transfer executed
-                                 0, //list of events that need to complete
-                                    //before transfer executed
-                                 0); //event identifying this specific operation
-    check_cl_error(status, "clEnqueueReadBuffer");
+        //read back (or map when zero-copy) and check results
+        read_host_buffer(clenv.commandQueue, devC);
     
-    host_matmul(A, B, refC, SIZE, SIZE);
-
-    if(check_result(refC, C, EPS)) {
-    	std::cout << "PASSED" << std::endl;
-    } else {
-    	std::cout << "FAILED" << std::endl;
-    }	
+        if(check_result(refC, C, EPS)) {
+        	std::cout << kernelNames[k] << ": PASSED" << std::endl;
+        } else {
+        	std::cout << kernelNames[k] << ": FAILED" << std::endl;
+        }
+    }
 
-    check_cl_error(clReleaseMemObject(devA), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devB), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devC), "clReleaseMemObject");
+    release_host_buffer(devA);
+    release_host_buffer(devB);
+    release_host_buffer(devC);
     release_clenv(clenv);
    
     return 0;
@@ -18,18 +18,21 @@ typedef double real_t;
 typedef float real_t;
 #endif
 
+//page aligned: buffers share host memory on unified memory devices
+typedef CLAlignedVector< real_t > Vector;
+
 //------------------------------------------------------------------------------
-std::vector< real_t > create_vector(int size) {
-    std::vector< real_t > m(size);
+Vector create_vector(int size) {
+    Vector m(size);
     srand(time(0));
-    for(std::vector<real_t>::iterator i = m.begin();
+    for(Vector::iterator i = m.begin();
         i != m.end(); ++i) *i = rand() % 10; 
     return m;
 }
 
 //------------------------------------------------------------------------------
-real_t host_dot_product(const std::vector< real_t >& v1,
-                        const std::vector< real_t >& v2) {
+real_t host_dot_product(const Vector& v1,
+                        const Vector& v2) {
    return std::inner_product(v1.begin(), v1.end(), v2.begin(), real_t(0));
 }
 
@@ -68,50 +71,42 @@ int main(int argc, char** argv) {
    
     cl_int status;
     //create input and output matrices
-    std::vector<real_t> V1 = create_vector(SIZE);
-    std::vector<real_t> V2 = create_vector(SIZE);
+    Vector V1 = create_vector(SIZE);
+    Vector V2 = create_vector(SIZE);
+    Vector partialDot(REDUCED_SIZE);
     real_t hostDot = std::numeric_limits< real_t >::quiet_NaN();
     real_t deviceDot = std::numeric_limits< real_t >::quiet_NaN();      
     
-    //allocate output buffer on OpenCL device
+    //allocate buffers on OpenCL device: on devices sharing memory with the
+    //host the buffers are created on top of the host arrays (zero-copy),
+    //otherwise input data are copied
     //the partialReduction array contains a sequence of dot products
     //computed on sub-arrays of size BLOCK_SIZE
-    cl_mem partialReduction = clCreateBuffer(clenv.context,
-                                             CL_MEM_WRITE_ONLY,
-                                             REDUCED_BYTE_SIZE,
-                                             0,
-                                             &status);
-    check_cl_error(status, "clCreateBuffer");
-
-    //allocate input buffers on OpenCL devices and copy data
-    cl_mem devV1 = clCreateBuffer(clenv.context,
-                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                  BYTE_SIZE,
-                                  &V1[0], //<-- copy data from V1
-                                  &status);
-    check_cl_error(status, "clCreateBuffer");                              
-    cl_mem devV2 = clCreateBuffer(clenv.context,
-                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                  BYTE_SIZE,
-                                  &V2[0], //<-- copy data from V2
-                                  &status);
-    check_cl_error(status, "clCreateBuffer");                              
+    CLHostBuffer partialReduction =
+        create_host_buffer(clenv, CL_MEM_WRITE_ONLY, &partialDot[0],
+                           REDUCED_BYTE_SIZE);
+    CLHostBuffer devV1 = create_host_buffer(clenv, CL_MEM_READ_ONLY,
+                                            &V1[0], BYTE_SIZE);
+    CLHostBuffer devV2 = create_host_buffer(clenv, CL_MEM_READ_ONLY,
+                                            &V2[0], BYTE_SIZE);
+    std::cout << (devV1.zeroCopy ? "zero-copy buffers" : "device buffers")
+              << std::endl;
 
     //set kernel parameters
     status = clSetKernelArg(clenv.kernel, //kernel
                             0,      //parameter id
                             sizeof(cl_mem), //size of parameter
-                            &devV1); //pointer to parameter
+                            &devV1.buffer); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(V1)");
     status = clSetKernelArg(clenv.kernel, //kernel
                             1,      //parameter id
                             sizeof(cl_mem), //size of parameter
-                            &devV2); //pointer to parameter
+                            &devV2.buffer); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(V2)");
     status = clSetKernelArg(clenv.kernel, //kernel
                             2,      //parameter id
                             sizeof(cl_mem), //size of parameter
-                            &partialReduction); //pointer to parameter
+                            &partialReduction.buffer); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(devOut)");
    
 
@@ -137,20 +132,8 @@ int main(int argc, char** argv) {
 
     check_cl_error(status, "clEnqueueNDRangeKernel");
     
-    //read back and print results
-    std::vector< real_t > partialDot(REDUCED_SIZE); 
-    status = clEnqueueReadBuffer(clenv.commandQueue,
-                                 partialReduction,
-                                 CL_TRUE, //blocking read
-                                 0, //offset
-                                 REDUCED_BYTE_SIZE, //byte size of data
-                                 &partialDot[0], //destination buffer in host memory
-                                 0, //number of events that need to
-                                    //complete before transfer executed
-                                 0, //list of events that need to complete
-                                    //before transfer executed
-                                 0); //event identifying this specific operation
-    check_cl_error(status, "clEnqueueReadBuffer");
+    //read back (or map when zero-copy) and print results
+    read_host_buffer(clenv.commandQueue, partialReduction);
     
     deviceDot = std::accumulate(partialDot.begin(),
                                 partialDot.end(), real_t(0));
@@ -164,9 +147,9 @@ int main(int argc, char** argv) {
         std::cout << "FAILED" << std::endl;
     }   
 
-    check_cl_error(clReleaseMemObject(devV1), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devV2), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(partialReduction), "clReleaseMemObject");
+    release_host_buffer(devV1);
+    release_host_buffer(devV2);
+    release_host_buffer(partialReduction);
     release_clenv(clenv);
    
     return 0;
@@ -18,6 +18,17 @@
 // ('aprun' on Cray) ./a.out "Intel(R) OpenCL" default 0 \
 // ./src/kernels/05_dot_product_vec.cl dotprod 268435456 1024 8
 //
+// CPU device fission: append '/<partition>' to the device type to run one
+// partition per affinity domain concurrently, e.g. 'cpu/numa' creates one
+// sub-device per NUMA node, each owning a first-touch allocated slice of the
+// input vectors; see create_sub_devices in clutil.h for partition types
+//
+// Streaming: inputs that do not fit into a single device buffer
+// (CL_DEVICE_MAX_MEM_ALLOC_SIZE) are processed in chunks, transferring the
+// next chunk while the kernel runs on the current one; set the
+// CLUTIL_STREAM_CHUNK environment variable to the chunk size in bytes to
+// force streaming, see create_stream in clutil.h
+//
 // The host version of the dot product is either std::inner_product or
 // a block version in case the size is a multiple of 16ki which
 // usually result in a 3 to 4x speedup on most systems.
@@ -87,6 +98,214 @@ real_t host_dot_product(const std::vector< real_t >& v1,
    return std::inner_product(v1.begin(), v1.end(), v2.begin(), real_t(0));
 }
 
+//------------------------------------------------------------------------------
+//runs one dot product per sub-device concurrently on a slice of the input;
+//returns elapsed time in milliseconds
+double device_dot_partitioned(const CLEnv& clenv,
+                              const std::vector< real_t >& V1,
+                              const std::vector< real_t >& V2,
+                              int BLOCK_SIZE,
+                              int CL_ELEMENT_SIZE,
+                              std::vector< real_t >& partialDot) {
+    const size_t numPartitions = clenv.subQueues.size();
+    //split work items evenly in multiples of the workgroup size
+    const size_t globalItems = V1.size() / CL_ELEMENT_SIZE;
+    const size_t localItems = BLOCK_SIZE;
+    const std::vector< CLRange > ranges =
+        partition_ndrange(std::vector< double >(numPartitions, 1.0), 1,
+                          &globalItems, &localItems);
+    std::vector< size_t > inSizes;
+    std::vector< size_t > outSizes;
+    std::vector< const void* > v1Slices;
+    std::vector< const void* > v2Slices;
+    for(size_t p = 0; p != numPartitions; ++p) {
+        const size_t first = ranges[p].offset[0] * CL_ELEMENT_SIZE;
+        inSizes.push_back(ranges[p].global[0] * CL_ELEMENT_SIZE
+                          * sizeof(real_t));
+        outSizes.push_back(ranges[p].global[0] / BLOCK_SIZE * sizeof(real_t));
+        //first == size for empty partitions: pointer not dereferenced
+        v1Slices.push_back(&V1[0] + first);
+        v2Slices.push_back(&V2[0] + first);
+    }
+    //first-touch allocation: each slice is initialized by its sub-device
+    const std::vector< cl_mem > devV1 = create_partitioned_buffers(clenv,
+                                  CL_MEM_READ_ONLY, inSizes, v1Slices);
+    const std::vector< cl_mem > devV2 = create_partitioned_buffers(clenv,
+                                  CL_MEM_READ_ONLY, inSizes, v2Slices);
+    const std::vector< cl_mem > devOut = create_partitioned_buffers(clenv,
+                                  CL_MEM_WRITE_ONLY, outSizes,
+                                  std::vector< const void* >(numPartitions));
+    timespec start = {0, 0};
+    timespec end = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t p = 0; p != numPartitions; ++p) {
+        if(ranges[p].global[0] == 0) continue;
+        //arguments are captured at enqueue time: the same kernel object
+        //can be reused for all the partitions
+        cl_int status = clSetKernelArg(clenv.kernel, 0, sizeof(cl_mem),
+                                       &devV1[p]);
+        check_cl_error(status, "clSetKernelArg(V1)");
+        status = clSetKernelArg(clenv.kernel, 1, sizeof(cl_mem), &devV2[p]);
+        check_cl_error(status, "clSetKernelArg(V2)");
+        status = clSetKernelArg(clenv.kernel, 2, sizeof(cl_mem), &devOut[p]);
+        check_cl_error(status, "clSetKernelArg(devOut)");
+        status = clEnqueueNDRangeKernel(clenv.subQueues[p], clenv.kernel, 1,
+                                        0, ranges[p].global, &localItems,
+                                        0, 0, 0);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        check_cl_error(clFlush(clenv.subQueues[p]), "clFlush");
+    }
+    for(size_t p = 0; p != numPartitions; ++p)
+        check_cl_error(clFinish(clenv.subQueues[p]), "clFinish");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    partialDot.resize(globalItems / BLOCK_SIZE);
+    for(size_t p = 0; p != numPartitions; ++p) {
+        if(ranges[p].global[0] == 0) continue;
+        cl_int status = clEnqueueReadBuffer(clenv.subQueues[p], devOut[p],
+                                            CL_TRUE, 0, outSizes[p],
+                                            &partialDot[ranges[p].offset[0]
+                                                        / BLOCK_SIZE],
+                                            0, 0, 0);
+        check_cl_error(status, "clEnqueueReadBuffer");
+        check_cl_error(clReleaseMemObject(devV1[p]), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(devV2[p]), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(devOut[p]), "clReleaseMemObject");
+    }
+    return time_diff_ms(start, end);
+}
+
+//------------------------------------------------------------------------------
+//streams the input vectors through double buffered device memory: each item
+//of the stream is the input of one workgroup and produces one partial dot
+//product; returns elapsed time in milliseconds
+double device_dot_streamed(const CLEnv& clenv,
+                           const std::vector< real_t >& V1,
+                           const std::vector< real_t >& V2,
+                           int BLOCK_SIZE,
+                           int CL_ELEMENT_SIZE,
+                           std::vector< real_t >& partialDot,
+                           size_t& numChunks) {
+    const size_t itemElements = size_t(BLOCK_SIZE) * CL_ELEMENT_SIZE;
+    const size_t totalItems = V1.size() / itemElements;
+    partialDot.resize(totalItems);
+    std::vector< CLStreamArray > inputs(2);
+    inputs[0].host = const_cast< real_t* >(&V1[0]);
+    inputs[1].host = const_cast< real_t* >(&V2[0]);
+    inputs[0].itemBytes = inputs[1].itemBytes = itemElements * sizeof(real_t);
+    inputs[0].halo = inputs[1].halo = 0;
+    std::vector< CLStreamArray > outputs(1);
+    outputs[0].host = &partialDot[0];
+    outputs[0].itemBytes = sizeof(real_t);
+    outputs[0].halo = 0;
+    const int DEPTH = 2;
+    CLStream stream =
+        create_stream(clenv, inputs, outputs, totalItems,
+                      stream_chunk_items(get_device_id(clenv.context),
+                                         inputs, outputs, DEPTH),
+                      DEPTH);
+    numChunks = (totalItems + stream.chunkItems - 1) / stream.chunkItems;
+    const cl_kernel kernel = clenv.kernel;
+    timespec start = {0, 0};
+    timespec end = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_stream(stream, [kernel, BLOCK_SIZE](cl_command_queue queue,
+                                            const CLStreamChunk& c,
+                                            cl_uint numEvents,
+                                            const cl_event* events) {
+        check_cl_error(clSetKernelArg(kernel, 0, sizeof(cl_mem),
+                                      &c.inputs[0]), "clSetKernelArg(V1)");
+        check_cl_error(clSetKernelArg(kernel, 1, sizeof(cl_mem),
+                                      &c.inputs[1]), "clSetKernelArg(V2)");
+        check_cl_error(clSetKernelArg(kernel, 2, sizeof(cl_mem),
+                                      &c.outputs[0]),
+                       "clSetKernelArg(devOut)");
+        const size_t globalWorkSize[1] = {c.count * BLOCK_SIZE};
+        const size_t localWorkSize[1] = {size_t(BLOCK_SIZE)};
+        cl_event ev;
+        cl_int status = clEnqueueNDRangeKernel(queue, kernel, 1, 0,
+                                               globalWorkSize, localWorkSize,
+                                               numEvents, events, &ev);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        return ev;
+    });
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    release_stream(stream);
+    return time_diff_ms(start, end);
+}
+
+//------------------------------------------------------------------------------
+//BLOCK_SIZE sets both the workgroup size and the size of the local
+//reduction buffer: each candidate is timed with its own build of the kernel
+//on a separate context (the whole device, not partitioned); the selected
+//size is stored in the tuning database and later runs only look it up
+int tune_block_size(const char* platformName,
+                    const std::string& deviceType,
+                    int deviceNum,
+                    const char* clSourcePath,
+                    const char* kernelName,
+                    int SIZE,
+                    int CL_ELEMENT_SIZE,
+                    const CLSpec& spec) {
+    CLEnv tuneEnv = create_clenv(platformName,
+                                 deviceType.substr(0, deviceType.find('/')),
+                                 deviceNum, true, 0, 0);
+    const cl_device_id device = get_device_id(tuneEnv.context);
+    const std::string source = load_text(clSourcePath);
+    const size_t BYTE_SIZE = SIZE * sizeof(real_t);
+    cl_int status;
+    cl_mem buffers[3];
+    for(int i = 0; i != 3; ++i) {
+        buffers[i] = clCreateBuffer(tuneEnv.context, CL_MEM_READ_WRITE,
+                                    BYTE_SIZE, 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+    const size_t globalWorkSize[1] = {size_t(SIZE / CL_ELEMENT_SIZE)};
+    //last candidate built, reused for warmup and repeats
+    size_t builtSize = 0;
+    cl_program program = 0;
+    cl_kernel kernel = 0;
+    const CLTuneRun run = [&](const CLLocalSize& local) {
+        if(local.size[0] != builtSize) {
+            if(kernel) check_cl_error(clReleaseKernel(kernel),
+                                      "clReleaseKernel");
+            if(program) check_cl_error(clReleaseProgram(program),
+                                       "clReleaseProgram");
+            CLSpec candidate = spec;
+            spec_set(candidate, "BLOCK_SIZE", local.size[0]);
+            program = build_program(tuneEnv.context, device,
+                                    spec_prefix(candidate) + "\n" + source);
+            kernel = clCreateKernel(program, kernelName, &status);
+            check_cl_error(status, "clCreateKernel");
+            for(int i = 0; i != 3; ++i) {
+                status = clSetKernelArg(kernel, i, sizeof(cl_mem),
+                                        &buffers[i]);
+                check_cl_error(status, "clSetKernelArg");
+            }
+            builtSize = local.size[0];
+        }
+        size_t maxGroupSize = 0;
+        status = clGetKernelWorkGroupInfo(kernel, device,
+                                          CL_KERNEL_WORK_GROUP_SIZE,
+                                          sizeof(size_t), &maxGroupSize, 0);
+        check_cl_error(status, "clGetKernelWorkGroupInfo");
+        if(local.size[0] > maxGroupSize) return -1.0;
+        return timeEnqueueNDRangeKernel(tuneEnv.commandQueue, kernel, 1, 0,
+                                        globalWorkSize, local.size, 0, 0);
+    };
+    const CLLocalSize local =
+        autotune_local_size(device, kernelName, spec_prefix(spec), 1,
+                            globalWorkSize,
+                            local_size_candidates(device, 0, 1,
+                                                  globalWorkSize),
+                            run);
+    if(kernel) check_cl_error(clReleaseKernel(kernel), "clReleaseKernel");
+    if(program) check_cl_error(clReleaseProgram(program), "clReleaseProgram");
+    for(int i = 0; i != 3; ++i)
+        check_cl_error(clReleaseMemObject(buffers[i]), "clReleaseMemObject");
+    release_clenv(tuneEnv);
+    return int(local.size[0]);
+}
+
 //------------------------------------------------------------------------------
 bool check_result(real_t v1, real_t v2, double eps) {
     if(double(std::fabs(v1 - v2)) > eps) return false;
@@ -99,9 +318,12 @@ int main(int argc, char** argv) {
     if(argc < 9) {
         std::cerr << "usage: " << argv[0]
                   << " <platform name> <device type = default | cpu | gpu "
-                     "| acc | all>  <device num> <OpenCL source file path>"
-                     " <kernel name> <size> <local OpenCL memory block size>"
-                     "<vec element width>"
+                     "| acc | all>[/<partition = numa | l3 | l2 | l1 | <n> >]"
+                     "  <device num> <OpenCL source file path>"
+                     " <kernel name> <size> <local OpenCL memory block size"
+                     " | auto> <vec element width>\n"
+                     "'auto' selects the block size through the autotuner, "
+                     "see autotune_local_size in clutil.h"
                   << std::endl;
         exit(EXIT_FAILURE);   
     }
@@ -111,21 +333,28 @@ int main(int argc, char** argv) {
     const int CPU_BLOCK_SIZE = 16384; //use block dot product if SIZE divisible
                                       //by this value
     const size_t BYTE_SIZE = SIZE * sizeof(real_t);
-    const int BLOCK_SIZE = atoi(argv[argc - 2]); //local cache for reduction
-                                                 //in OpenCL kernel
-                                                 //equal to local workgroup size
+    //kernel specialization, prefixed to opencl code
+    CLSpec spec;
+    spec_set(spec, "VEC_WIDTH", CL_ELEMENT_SIZE);
+#ifdef USE_DOUBLE
+    spec_flag(spec, "DOUBLE");
+#endif
+    //local cache for reduction in OpenCL kernel equal to local workgroup
+    //size
+    const int BLOCK_SIZE =
+        std::string(argv[argc - 2]) == "auto"
+        && SIZE > 0 && CL_ELEMENT_SIZE > 0 ?
+        tune_block_size(argv[1], argv[2], atoi(argv[3]), argv[4], argv[5],
+                        SIZE, CL_ELEMENT_SIZE, spec)
+        : atoi(argv[argc - 2]);
     const int REDUCED_SIZE = SIZE / BLOCK_SIZE;
     const int REDUCED_BYTE_SIZE = REDUCED_SIZE * sizeof(real_t);
     
     std::cout << "Size:          " << SIZE << std::endl
               << "Local size:    " << BLOCK_SIZE << std::endl
               << "Element width: " << CL_ELEMENT_SIZE << std::endl;
-    //setup text header that will be prefixed to opencl code
-    std::ostringstream clheaderStream;
-    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE      << '\n';
-    clheaderStream << "#define VEC_WIDTH "  << CL_ELEMENT_SIZE << '\n';
+    spec_set(spec, "BLOCK_SIZE", BLOCK_SIZE);
 #ifdef USE_DOUBLE    
-    clheaderStream << "#define DOUBLE\n";
     const double EPS = 0.000000001;
 #else
     const float EPS = 0.00001;
@@ -133,7 +362,7 @@ int main(int argc, char** argv) {
     const bool PROFILE_ENABLE_OPTION = true;    
     CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]),
                                PROFILE_ENABLE_OPTION,
-                               argv[4], argv[5], clheaderStream.str());
+                               argv[4], argv[5], spec_prefix(spec));
    
     cl_int status;
     //create input and output matrices
@@ -141,6 +370,49 @@ int main(int argc, char** argv) {
     std::vector<real_t> V2 = create_vector(SIZE);
     real_t hostDot = std::numeric_limits< real_t >::quiet_NaN();
     real_t deviceDot = std::numeric_limits< real_t >::quiet_NaN();      
+//PARTITIONED DEVICE: ONE DOT PRODUCT PER SUB-DEVICE
+    if(!clenv.subQueues.empty()) {
+        std::cout << "Partitions:    " << clenv.subQueues.size() << std::endl;
+        std::vector< real_t > partialDot;
+        const double partitionedTime_ms =
+            device_dot_partitioned(clenv, V1, V2, BLOCK_SIZE,
+                                   CL_ELEMENT_SIZE, partialDot);
+        deviceDot = std::accumulate(partialDot.begin(),
+                                    partialDot.end(), real_t(0));
+        hostDot = host_dot_product(V1, V2);
+        std::cout << deviceDot << ' ' << hostDot << std::endl;
+        if(check_result(hostDot, deviceDot, EPS)) {
+            std::cout << "PASSED" << std::endl;
+            std::cout << "kernel (all partitions): " << partitionedTime_ms
+                      << "ms" << std::endl;
+        } else {
+            std::cout << "FAILED" << std::endl;
+        }
+        release_clenv(clenv);
+        return 0;
+    }
+//STREAMED: INPUT LARGER THAN MAX BUFFER SIZE OR CLUTIL_STREAM_CHUNK SET
+    if(stream_required(get_device_id(clenv.context), BYTE_SIZE)) {
+        std::vector< real_t > partialDot;
+        size_t numChunks = 0;
+        const double streamTime_ms =
+            device_dot_streamed(clenv, V1, V2, BLOCK_SIZE, CL_ELEMENT_SIZE,
+                                partialDot, numChunks);
+        std::cout << "Chunks:        " << numChunks << std::endl;
+        deviceDot = std::accumulate(partialDot.begin(),
+                                    partialDot.end(), real_t(0));
+        hostDot = host_dot_product(V1, V2);
+        std::cout << deviceDot << ' ' << hostDot << std::endl;
+        if(check_result(hostDot, deviceDot, EPS)) {
+            std::cout << "PASSED" << std::endl;
+            std::cout << "transfer + kernel (streamed): " << streamTime_ms
+                      << "ms" << std::endl;
+        } else {
+            std::cout << "FAILED" << std::endl;
+        }
+        release_clenv(clenv);
+        return 0;
+    }
 //ALLOCATE DATA AND COPY TO DEVICE    
     //allocate output buffer on OpenCL device
     //the partialReduction array contains a sequence of dot products
@@ -2,10 +2,12 @@
 //Author: Ugo Varetto
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 #include <ctime>
 #include <vector>
 #include <cmath>
 #include <sstream>
+#include <chrono>
 #include "clutil.h"
 
 #ifdef USE_DOUBLE
@@ -15,37 +17,56 @@ typedef float real_t;
 #endif
 
 //------------------------------------------------------------------------------
-std::vector< real_t > create_matrix(int cols, int rows) {
-	std::vector< real_t > m(cols * rows);
-	srand(time(0));
-	for(std::vector<real_t>::iterator i = m.begin();
+//host matrices are allocated from pinned memory
+typedef CLPinnedVector< real_t > PinnedMatrix;
+
+//------------------------------------------------------------------------------
+void init_matrix(PinnedMatrix& m) {
+	for(PinnedMatrix::iterator i = m.begin();
 	    i != m.end(); ++i) *i = rand() % 10; 
-	return m;
 }
 
 
 //------------------------------------------------------------------------------
-void host_matmul(const std::vector< real_t >& A,
-	             const std::vector< real_t >& B,
-	             std::vector< real_t >& C, 
-	             int a_columns,
-	             int b_columns) {
-	const int rows = a_columns;
-	const int columns = b_columns;
-	for(int r = 0; r != rows; ++r) {
-		for(int c = 0; c != columns; ++c) {
-			C[r*b_columns + c] = 0;
-			for(int ic = 0; ic != a_columns; ++ic) {
-				C[r*b_columns + c] += A[r*a_columns + ic]
-				                      * B[ic*b_columns + c];
-			}
-		}
-	}
+//C (M x N) = A (M x K) x B (K x N), row major; lda, ldb, ldc: distance in
+//elements between consecutive rows of A, B and C
+struct Shape {
+    int M;
+    int N;
+    int K;
+    int lda;
+    int ldb;
+    int ldc;
+};
+
+//------------------------------------------------------------------------------
+Shape square_shape(int SIZE) {
+    const Shape s = {SIZE, SIZE, SIZE, SIZE, SIZE, SIZE};
+    return s;
+}
+
+//------------------------------------------------------------------------------
+//<size> or <M>x<N>x<K>; leading dimensions default to the number of columns
+Shape parse_shape(const char* text) {
+    Shape s = square_shape(0);
+    if(sscanf(text, "%dx%dx%d", &s.M, &s.N, &s.K) != 3) {
+        s = square_shape(atoi(text));
+    }
+    s.lda = s.K;
+    s.ldb = s.N;
+    s.ldc = s.N;
+    return s;
+}
+
+//------------------------------------------------------------------------------
+bool square(const Shape& s) {
+    return s.M == s.N && s.N == s.K && s.lda == s.M && s.ldb == s.M
+           && s.ldc == s.M;
 }
 
 //------------------------------------------------------------------------------
 bool check_result(const std::vector< real_t >& v1,
-	              const std::vector< real_t >& v2,
+	              const PinnedMatrix& v2,
 	              double eps) {
     for(int i = 0; i != v1.size(); ++i) {
     	if(double(std::fabs(v1[i] - v2[i])) > eps) return false;
@@ -53,66 +74,274 @@ bool check_result(const std::vector< real_t >& v1,
     return true;
 }
 
+//------------------------------------------------------------------------------
+//register tiling of tiled_matmul and gemm: each work item computes TM x TN
+//elements of the output; TM = TN = 1 for the other kernels
+struct Tiling {
+    int TM;
+    int TN;
+    int TK;
+};
+
+//------------------------------------------------------------------------------
+//size and tiling constraints of tiled_matmul, see kernel source
+bool valid_tiling(int SIZE, int BLOCK_SIZE, const Tiling& t) {
+    const int rows = BLOCK_SIZE * t.TM;
+    const int columns = BLOCK_SIZE * t.TN;
+    return t.TM > 0 && t.TN > 0 && t.TK > 0
+           && SIZE % rows == 0 && SIZE % columns == 0 && SIZE % t.TK == 0
+           && rows % 4 == 0 && columns % 4 == 0 && t.TK % 4 == 0;
+}
+
+//------------------------------------------------------------------------------
+double gflops(const Shape& s, double ms) {
+    return 2 * double(s.M) * s.N * s.K / (ms * 1E6);
+}
+
+//------------------------------------------------------------------------------
+//one work item per TM x TN output elements; gemm does not require sizes to
+//be evenly divisible: the grid is padded to a multiple of the workgroup size
+//and out of range work items do not write
+CLNDRange global_size(const Shape& s, const Tiling& t, int BLOCK_SIZE,
+                      bool gemm) {
+    if(!gemm) return CLNDRange(s.N / t.TN, s.M / t.TM);
+    const int columns = (s.N + t.TN - 1) / t.TN;
+    const int rows = (s.M + t.TM - 1) / t.TM;
+    return CLNDRange((columns + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE,
+                     (rows + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE);
+}
+
+//------------------------------------------------------------------------------
+//size argument(s) following A, B, C
+void set_size_args(cl_kernel kernel, const Shape& s, bool gemm) {
+    const int args[] = {s.M, s.N, s.K, s.lda, s.ldb, s.ldc};
+    for(int i = 0; i != (gemm ? 6 : 1); ++i) {
+        const cl_int status = clSetKernelArg(kernel, 3 + i, sizeof(int),
+                                             &args[i]);
+        check_cl_error(status, "clSetKernelArg(size)");
+    }
+}
+
+//------------------------------------------------------------------------------
+//BLOCK_SIZE is a compile time constant: each candidate workgroup size is
+//timed with its own build of the kernel on a separate context; the selected
+//size is stored in the tuning database and later runs only look it up
+int tune_block_size(const char* platformName,
+                    const char* deviceType,
+                    int deviceNum,
+                    const char* clSourcePath,
+                    const char* kernelName,
+                    const Shape& shape,
+                    const std::string& defines,
+                    const Tiling& tiling) {
+    CLEnv tuneEnv = create_clenv(platformName, deviceType, deviceNum, true,
+                                 0, 0);
+    const cl_device_id device = get_device_id(tuneEnv.context);
+    const std::string source = load_text(clSourcePath);
+    const size_t byteSizes[3] = {shape.M * shape.lda * sizeof(real_t),
+                                 shape.K * shape.ldb * sizeof(real_t),
+                                 shape.M * shape.ldc * sizeof(real_t)};
+    cl_int status;
+    cl_mem buffers[3];
+    for(int i = 0; i != 3; ++i) {
+        buffers[i] = clCreateBuffer(tuneEnv.context, CL_MEM_READ_WRITE,
+                                    byteSizes[i], 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+    const bool gemm = std::string(kernelName) == "gemm";
+    const bool tiled = !gemm && (tiling.TM > 1 || tiling.TN > 1);
+    //gemm: candidates are taken from the grid padded to a multiple of 64,
+    //each candidate is then launched on the grid padded to its own size
+    const CLNDRange global = global_size(shape, tiling, gemm ? 64 : 1, gemm);
+    //last candidate built, reused for warmup and repeats
+    int builtSize = 0;
+    cl_program program = 0;
+    cl_kernel kernel = 0;
+    const CLTuneRun run = [&](const CLLocalSize& local) {
+        const int b = int(local.size[0]);
+        if(tiled && !valid_tiling(shape.M, b, tiling)) return -1.0;
+        if(b != builtSize) {
+            if(kernel) check_cl_error(clReleaseKernel(kernel),
+                                      "clReleaseKernel");
+            if(program) check_cl_error(clReleaseProgram(program),
+                                       "clReleaseProgram");
+            std::ostringstream header;
+            header << "#define BLOCK_SIZE " << b << '\n' << defines;
+            program = build_program(tuneEnv.context, device,
+                                    header.str() + "\n" + source);
+            kernel = clCreateKernel(program, kernelName, &status);
+            check_cl_error(status, "clCreateKernel");
+            for(int i = 0; i != 3; ++i) {
+                status = clSetKernelArg(kernel, i, sizeof(cl_mem),
+                                        &buffers[i]);
+                check_cl_error(status, "clSetKernelArg");
+            }
+            set_size_args(kernel, shape, gemm);
+            builtSize = b;
+        }
+        size_t maxGroupSize = 0;
+        status = clGetKernelWorkGroupInfo(kernel, device,
+                                          CL_KERNEL_WORK_GROUP_SIZE,
+                                          sizeof(size_t), &maxGroupSize, 0);
+        check_cl_error(status, "clGetKernelWorkGroupInfo");
+        if(local.size[0] * local.size[1] > maxGroupSize) return -1.0;
+        return timeEnqueueNDRangeKernel(tuneEnv.commandQueue, kernel, 2, 0,
+                                        global_size(shape, tiling, b,
+                                                    gemm).size,
+                                        local.size, 0, 0);
+    };
+    const CLLocalSize local =
+        autotune_local_size(device, kernelName, defines, 2, global.size,
+                            local_size_candidates(device, 0, 2,
+                                                  global.size, true),
+                            run);
+    if(kernel) check_cl_error(clReleaseKernel(kernel), "clReleaseKernel");
+    if(program) check_cl_error(clReleaseProgram(program), "clReleaseProgram");
+    for(int i = 0; i != 3; ++i)
+        check_cl_error(clReleaseMemObject(buffers[i]), "clReleaseMemObject");
+    release_clenv(tuneEnv);
+    return int(local.size[0]);
+}
+
 //------------------------------------------------------------------------------
 int main(int argc, char** argv) {
     if(argc < 8) {
         std::cerr << "usage: " << argv[0]
                   << " <platform name> <device type = default | cpu | gpu "
                      "| acc | all>  <device num> <OpenCL source file path>"
-                     " <kernel name> <matrix size> <workgroup size>"
+                     " <kernel name> <matrix size | MxNxK, gemm only>"
+                     " <workgroup size | auto>"
+                     " [TM TN TK, tiled_matmul and gemm only, default ="
+                     " 4 4 16 [lda ldb ldc, gemm only, default = K N N]]\n"
+                     "'auto' selects the workgroup size through the "
+                     "autotuner, see autotune_local_size in clutil.h\n"
+                     "tiled_matmul is also compared with block_matmul"
                   << std::endl;
         exit(EXIT_FAILURE);   
     }
-    const int SIZE = atoi(argv[6]);
-    const size_t BYTE_SIZE = SIZE * SIZE * sizeof(real_t);
-    const int BLOCK_SIZE = atoi(argv[7]); //4 x 4 tiles
-    if( SIZE < 1 || BLOCK_SIZE < 1 || (SIZE % BLOCK_SIZE) != 0) {
+    Shape shape = parse_shape(argv[6]);
+    const bool TILED = std::string(argv[5]) == "tiled_matmul";
+    const bool GEMM = std::string(argv[5]) == "gemm";
+    if(GEMM && argc > 13) {
+        shape.lda = atoi(argv[11]);
+        shape.ldb = atoi(argv[12]);
+        shape.ldc = atoi(argv[13]);
+    }
+    const int SIZE = shape.M;
+    if(shape.M < 1 || shape.N < 1 || shape.K < 1 || shape.lda < shape.K
+       || shape.ldb < shape.N || shape.ldc < shape.N
+       || (!GEMM && !square(shape))) {
+        std::cerr << "ERROR - sizes *must* be greater than zero, leading "
+                     "dimensions *must* not be less than the number of "
+                     "columns; only gemm supports non-square matrices"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const size_t A_BYTE_SIZE = shape.M * shape.lda * sizeof(real_t);
+    const size_t B_BYTE_SIZE = shape.K * shape.ldb * sizeof(real_t);
+    const size_t C_BYTE_SIZE = shape.M * shape.ldc * sizeof(real_t);
+    Tiling tiling = {1, 1, 1};
+    CLSpec spec;
+#ifdef USE_DOUBLE
+    spec_flag(spec, "DOUBLE");
+#endif
+    if(TILED || GEMM) {
+        tiling.TM = argc > 8 ? atoi(argv[8]) : 4;
+        tiling.TN = argc > 9 ? atoi(argv[9]) : 4;
+        tiling.TK = argc > 10 ? atoi(argv[10]) : 16;
+        spec_set(spec, "TM", tiling.TM);
+        spec_set(spec, "TN", tiling.TN);
+        spec_set(spec, "TK", tiling.TK);
+    }
+    const std::string defines = spec_prefix(spec);
+    if(tiling.TM < 1 || tiling.TN < 1 || tiling.TK < 1) {
+        std::cerr << "ERROR - TM, TN and TK *must* be greater than zero"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int BLOCK_SIZE = std::string(argv[7]) == "auto" ?
+                           tune_block_size(argv[1], argv[2], atoi(argv[3]),
+                                           argv[4], argv[5], shape, defines,
+                                           tiling)
+                           : atoi(argv[7]); //4 x 4 tiles
+    if(BLOCK_SIZE < 1 || (!GEMM && (SIZE % BLOCK_SIZE) != 0)) {
     	std::cerr << "ERROR - size and block size *must* be greater than zero "
     	             "and size *must* be evenly divsible by block size"
     	          << std::endl;
     	exit(EXIT_FAILURE);
     }
+    if(TILED && !valid_tiling(SIZE, BLOCK_SIZE, tiling)) {
+        std::cerr << "ERROR - size *must* be evenly divisible by "
+                     "block size x TM, block size x TN and TK; TK, "
+                     "block size x TM and block size x TN *must* be "
+                     "multiples of 4" << std::endl;
+        exit(EXIT_FAILURE);
+    }
     //setup text header that will be prefixed to opencl code
     std::ostringstream clheaderStream;
-    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n';
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n' << defines;
 #ifdef USE_DOUBLE    
-    clheaderStream << "#define DOUBLE\n";
     const double EPS = 0.000000001;
 #else
     const double EPS = 0.00001;
 #endif
-    //enable profiling on queue    
-    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true,
-                               argv[4], argv[5], clheaderStream.str());
+    const std::chrono::steady_clock::time_point setupStart =
+        std::chrono::steady_clock::now();
+    //enable profiling on queue; the program is built in the background
+    //while host data are initialized and device buffers allocated
+    CLEnvFuture clenvFuture = create_clenv_async(argv[1], argv[2],
+                                                 atoi(argv[3]), true,
+                                                 argv[4], argv[5],
+                                                 clheaderStream.str());
+    CLEnv& clenv = clenvFuture.env;
    
     cl_int status;
-    //create input and output matrices
-    std::vector<real_t> A = create_matrix(SIZE, SIZE);
-    std::vector<real_t> B = create_matrix(SIZE, SIZE);
-    std::vector<real_t> C(SIZE * SIZE,real_t(0));
-    std::vector<real_t> refC(SIZE * SIZE,real_t(0));        
+    //create input and output matrices in pinned host memory: transfers
+    //do not require a staging copy
+    CLPinnedArena* arena = create_pinned_arena(clenv);
+    const CLPinnedAllocator< real_t > pinnedAlloc(arena);
+    //C is initialized with a value no product can produce: elements
+    //outside of the M x N output must be left untouched
+    PinnedMatrix A(shape.M * shape.lda, real_t(0), pinnedAlloc);
+    PinnedMatrix B(shape.K * shape.ldb, real_t(0), pinnedAlloc);
+    PinnedMatrix C(shape.M * shape.ldc, real_t(-1), pinnedAlloc);
+    std::vector<real_t> refC(shape.M * shape.ldc, real_t(-1));
+    srand(time(0));
+    init_matrix(A);
+    init_matrix(B);
     
     //allocate output buffer on OpenCL device
     cl_mem devC = clCreateBuffer(clenv.context,
-                                 CL_MEM_WRITE_ONLY,
-                                 BYTE_SIZE,
+                                 CL_MEM_READ_WRITE,
+                                 C_BYTE_SIZE,
                                  0,
                                  &status);
     check_cl_error(status, "clCreateBuffer");
 
     //allocate input buffers on OpenCL devices and copy data
     cl_mem devA = clCreateBuffer(clenv.context,
-                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                 BYTE_SIZE,
-                                 &A[0], //<-- copy data from A
+                                 CL_MEM_READ_ONLY,
+                                 A_BYTE_SIZE,
+                                 0,
                                  &status);
     check_cl_error(status, "clCreateBuffer");                              
     cl_mem devB = clCreateBuffer(clenv.context,
-                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                 BYTE_SIZE,
-                                 &B[0], //<-- copy data from B
+                                 CL_MEM_READ_ONLY,
+                                 B_BYTE_SIZE,
+                                 0,
                                  &status);
     check_cl_error(status, "clCreateBuffer");                              
+    cl_event writeEvents[2];
+    enqueue_write(clenv.commandQueue, devA, 0, A_BYTE_SIZE, &A[0], false,
+                  &writeEvents[0]);
+    enqueue_write(clenv.commandQueue, devB, 0, B_BYTE_SIZE, &B[0], false,
+                  &writeEvents[1]);
+    enqueue_write(clenv.commandQueue, devC, 0, C_BYTE_SIZE, &C[0]);
+
+    //wait for program build to complete
+    wait_clenv(clenvFuture);
+    const double setupTime_ms = std::chrono::duration< double, std::milli >(
+        std::chrono::steady_clock::now() - setupStart).count();
 
     //set kernel parameters
     status = clSetKernelArg(clenv.kernel, //kernel
@@ -130,16 +359,14 @@ int main(int argc, char** argv) {
                             sizeof(cl_mem), //size of parameter
                             &devC); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(C)");
-    status = clSetKernelArg(clenv.kernel, //kernel
-                            3,      //parameter id
-                            sizeof(int), //size of parameter
-                            &SIZE); //pointer to parameter
-    check_cl_error(status, "clSetKernelArg(SIZE)");
+    //matrix size; gemm: M, N, K, lda, ldb, ldc
+    set_size_args(clenv.kernel, shape, GEMM);
 
 
     //setup kernel launch configuration
-    //total number of threads == number of array elements
-    const size_t globalWorkSize[2] = {SIZE, SIZE};
+    //total number of threads == number of array elements / (TM x TN)
+    const CLNDRange globalWorkSize = global_size(shape, tiling, BLOCK_SIZE,
+                                                 GEMM);
     //number of per-workgroup local threads
     const size_t localWorkSize[2] = {BLOCK_SIZE, BLOCK_SIZE}; 
 
@@ -153,7 +380,8 @@ int main(int argc, char** argv) {
                                     clenv.kernel, //kernel                                   
                                     2, //number of dimensions for work-items
                                     0, //global work offset
-                                    globalWorkSize, //total number of threads
+                                    globalWorkSize.size, //total number of
+                                                         //threads
                                     localWorkSize, //threads per workgroup
                                     0, //number of events that need to
                                        //complete before kernel executed
@@ -188,32 +416,67 @@ int main(int argc, char** argv) {
     //event timing is reported in nano seconds: divide by 1e6 to get
     //time in milliseconds
     kernelElapsedTime_ms =  (double)(kernelEndTime - kernelStartTime) / 1E6;
+    //host to device transfer time, the queue is in-order: transfers
+    //are complete
+    const double transferTime_ms = get_cl_time(writeEvents[0])
+                                   + get_cl_time(writeEvents[1]);
+    check_cl_error(clReleaseEvent(writeEvents[0]), "clReleaseEvent");
+    check_cl_error(clReleaseEvent(writeEvents[1]), "clReleaseEvent");
     //read back and check results
-    status = clEnqueueReadBuffer(clenv.commandQueue,
-                                 devC,
-                                 CL_TRUE, //blocking read
-                                 0, //offset
-                                 BYTE_SIZE, //byte size of data
-                                 &C[0], //destination buffer in host memory
-                                 0, //number of events that need to
-                                    //complete before transfer executed
-                                 0, //list of events that need to complete
-                                    //before transfer executed
-                                 0); //event identifying this specific operation
-    check_cl_error(status, "clEnqueueReadBuffer");
+    enqueue_read(clenv.commandQueue, devC, 0, C_BYTE_SIZE, &C[0], true);
     
-    host_matmul(A, B, refC, SIZE, SIZE);
+    //reference result computed by the multi-threaded host GEMM, also
+    //timed as native CPU baseline
+    const std::chrono::steady_clock::time_point hostStart =
+        std::chrono::steady_clock::now();
+    host_gemm(shape.M, shape.N, shape.K, &A[0], shape.lda, &B[0], shape.ldb,
+              &refC[0], shape.ldc);
+    const double hostTime_ms = std::chrono::duration< double, std::milli >(
+        std::chrono::steady_clock::now() - hostStart).count();
 
     if(check_result(refC, C, EPS)) {
     	std::cout << "PASSED" << std::endl;
     	std::cout << "Elapsed time(ms): " << kernelElapsedTime_ms << std::endl;
+    	std::cout << "GFLOP/s: " << gflops(shape, kernelElapsedTime_ms)
+    	          << std::endl;
+    	std::cout << "Setup time(ms): " << setupTime_ms << std::endl;
+    	std::cout << "Host to device transfer time(ms): " << transferTime_ms
+    	          << std::endl;
+    	std::cout << "Host GEMM time(ms): " << hostTime_ms << "  GFLOP/s: "
+    	          << gflops(shape, hostTime_ms) << std::endl;
     } else {
     	std::cout << "FAILED" << std::endl;
     }	
 
+    //compare with block_matmul, built in the same program
+    if(TILED) {
+        const cl_kernel block = get_kernel(clenv, "block_matmul");
+        const cl_mem args[] = {devA, devB, devC};
+        for(int i = 0; i != 3; ++i) {
+            status = clSetKernelArg(block, i, sizeof(cl_mem), &args[i]);
+            check_cl_error(status, "clSetKernelArg");
+        }
+        status = clSetKernelArg(block, 3, sizeof(int), &SIZE);
+        check_cl_error(status, "clSetKernelArg(SIZE)");
+        const size_t blockGlobalWorkSize[2] = {size_t(SIZE), size_t(SIZE)};
+        const double blockTime_ms =
+            timeEnqueueNDRangeKernel(clenv.commandQueue, block, 2, 0,
+                                     blockGlobalWorkSize, localWorkSize,
+                                     0, 0);
+        std::cout << "block_matmul elapsed time(ms): " << blockTime_ms
+                  << "  GFLOP/s: " << gflops(shape, blockTime_ms)
+                  << "\ntiled_matmul speedup: "
+                  << blockTime_ms / kernelElapsedTime_ms << std::endl;
+    }
+
     check_cl_error(clReleaseMemObject(devA), "clReleaseMemObject");
     check_cl_error(clReleaseMemObject(devB), "clReleaseMemObject");
     check_cl_error(clReleaseMemObject(devC), "clReleaseMemObject");
+    //release pinned memory before the arena
+    PinnedMatrix(pinnedAlloc).swap(A);
+    PinnedMatrix(pinnedAlloc).swap(B);
+    PinnedMatrix(pinnedAlloc).swap(C);
+    release_pinned_arena(arena);
     release_clenv(clenv);
    
     return 0;
@@ -6,6 +6,7 @@
 #include <vector>
 #include <cmath>
 #include <sstream>
+#include <algorithm>
 #include "clutil.h"
 
 #ifdef USE_DOUBLE
@@ -17,18 +18,21 @@ typedef float real_t;
 //there is no image data type: only mem objects
 typedef cl_mem cl_image;
 
+//page aligned: buffers share host memory on unified memory devices
+typedef CLAlignedVector< real_t > Grid;
+
 //------------------------------------------------------------------------------
-std::vector< real_t > create_filter() {
+Grid create_filter() {
     real_t f[3][3] = { 1, 1, 1,
                        1, 0, 1,
                        1, 1, 1 }; 
-    return std::vector< real_t >((real_t*)(f), (real_t*)(f) + sizeof(f));
+    return Grid((real_t*)(f), (real_t*)(f) + sizeof(f));
 }
 
 //------------------------------------------------------------------------------
-std::vector< real_t > create_2d_grid(int width, int height,
+Grid create_2d_grid(int width, int height,
                                      int xOffset, int yOffset) {
-	std::vector< real_t > g(width * height);
+	Grid g(width * height);
 	srand(time(0));
     for(int y = 0; y != height; ++y) {
         for(int x = 0; x != width; ++x) {
@@ -40,11 +44,11 @@ std::vector< real_t > create_2d_grid(int width, int height,
 
 
 //------------------------------------------------------------------------------
-void host_apply_stencil(const std::vector< real_t >& in,
+void host_apply_stencil(const Grid& in,
                         int size, 
-	                    const std::vector< real_t >& filter,
+	                    const Grid& filter,
                         int filterSize,
-	                    std::vector< real_t >& out) { 
+	                    Grid& out) { 
     for(int y = filterSize / 2; y < size - filterSize / 2; ++y) {
         for(int x = filterSize / 2; x < size - filterSize / 2; ++x) {
             real_t e = real_t(0);
@@ -61,12 +65,14 @@ void host_apply_stencil(const std::vector< real_t >& in,
 }
 
 //------------------------------------------------------------------------------
-double device_apply_stencil(const std::vector< real_t >& in,
+double device_apply_stencil(const Grid& in,
                             int size, 
-                            const std::vector< real_t >& filter,
+                            const Grid& filter,
                             int filterSize,
-                            std::vector< real_t >& out,
+                            Grid& out,
                             const CLEnv& clenv,
+                            CLMemPool& pool,
+                            cl_kernel kernel,
                             const size_t globalWorkSize[2],
                             const size_t localWorkSize[2]) {
 
@@ -76,61 +82,56 @@ double device_apply_stencil(const std::vector< real_t >& in,
     const size_t BYTE_SIZE = SIZE * SIZE * sizeof(real_t);
 
     cl_int status;
-    //allocate output buffer on OpenCL device
-    cl_mem devOut = clCreateBuffer(clenv.context,
-                                   CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR,
-                                   BYTE_SIZE,
-                                   const_cast< real_t* >(&out[0]),
-                                   &status);
-    check_cl_error(status, "clCreateBuffer");
-
-    //allocate input buffers on OpenCL devices and copy data
-    cl_mem devIn = clCreateBuffer(clenv.context,
-                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                  BYTE_SIZE,
-                                  const_cast< real_t* >(&in[0]),
-                                  &status);
-    check_cl_error(status, "clCreateBuffer");
-    cl_mem devFilter = clCreateBuffer(clenv.context,
-                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                  FILTER_BYTE_SIZE,
-                                  const_cast< real_t* >(&filter[0]),
-                                  &status);
-    check_cl_error(status, "clCreateBuffer");
+    //input and output buffers are created on top of the host grids, no copy
+    //is made on devices sharing memory with the host; the filter buffer is
+    //recycled through the pool: content is undefined and must be initialized
+    //explicitly
+    //border elements are not written by the kernel: output is read-write to
+    //make sure the initial content is copied to the device
+    CLHostBuffer devOut = create_host_buffer(clenv, CL_MEM_READ_WRITE,
+                                             &out[0], BYTE_SIZE);
+    CLHostBuffer devIn = create_host_buffer(clenv, CL_MEM_READ_ONLY,
+                                            const_cast< real_t* >(&in[0]),
+                                            BYTE_SIZE);
+    cl_mem devFilter = pool_alloc_buffer(pool, CL_MEM_READ_ONLY,
+                                         FILTER_BYTE_SIZE);
+    status = clEnqueueWriteBuffer(clenv.commandQueue, devFilter, CL_FALSE, 0,
+                                  FILTER_BYTE_SIZE, &filter[0], 0, 0, 0);
+    check_cl_error(status, "clEnqueueWriteBuffer");
 
 
     //set kernel parameters
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             0,      //parameter id
                             sizeof(cl_mem), //size of parameter
-                            &devIn); //pointer to parameter
+                            &devIn.buffer); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(in)");
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             1,      //parameter id
                             sizeof(int), //size of parameter
                             &SIZE); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(size)");
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             2,      //parameter id
                             sizeof(cl_mem), //size of parameter
                             &devFilter); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(filter)");
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             3,      //parameter id
                             sizeof(int), //size of parameter
                             &FILTER_SIZE); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(SIZE)");
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             4,      //parameter id
                             sizeof(cl_mem), //size of parameter
-                            &devOut); //pointer to parameter
+                            &devOut.buffer); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(out)");
 
 
     //launch and time kernel
     const double timems = timeEnqueueNDRangeKernel(
                                     clenv.commandQueue, //queue
-                                    clenv.kernel, //kernel                                   
+                                    kernel, //kernel
                                     2, //number of dimensions for work-items
                                     0, //global work offset
                                     globalWorkSize, //total number of threads
@@ -142,33 +143,199 @@ double device_apply_stencil(const std::vector< real_t >& in,
 
     check_cl_error(status, "clEnqueueNDRangeKernel");
     
-    //read data from device
-    status = clEnqueueReadBuffer(clenv.commandQueue,
-                                 devOut,
-                                 CL_TRUE, //blocking read
-                                 0, //offset
-                                 BYTE_SIZE, //byte size of data
-                                 &out[0], //destination buffer in host memory
-                                 0, //number of events that need to
-                                    //complete before transfer executed
-                                 0, //list of events that need to complete
-                                    //before transfer executed
-                                 0); //event identifying this specific operation
-    check_cl_error(status, "clEnqueueReadBuffer");
-    check_cl_error(clReleaseMemObject(devIn), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devOut), "clReleaseMemObject");
+    //read data from device (or map when zero-copy)
+    read_host_buffer(clenv.commandQueue, devOut);
+    release_host_buffer(devIn);
+    release_host_buffer(devOut);
+    pool_release(pool, devFilter);
     return timems;
 }
 
+//------------------------------------------------------------------------------
+//one slab of rows per sub-device: each sub-device owns a first-touch
+//allocated copy of its rows plus the halo rows above and below and runs the
+//stencil concurrently with the other sub-devices; returns elapsed time
+double device_apply_stencil_partitioned(const Grid& in,
+                                        int size,
+                                        const Grid& filter,
+                                        int filterSize,
+                                        Grid& out,
+                                        const CLEnv& clenv,
+                                        cl_kernel kernel,
+                                        const size_t globalWorkSize[2],
+                                        const size_t localWorkSize[2]) {
+    const int FILTER_SIZE = filterSize;
+    const int FILTER_BYTE_SIZE = sizeof(real_t) * FILTER_SIZE * FILTER_SIZE;
+    const int SIZE = size;
+    const int HALO = FILTER_SIZE / 2;
+    const size_t ROW_BYTE_SIZE = SIZE * sizeof(real_t);
+    const size_t numPartitions = clenv.subQueues.size();
+    //split core rows evenly in multiples of the workgroup size
+    const std::vector< CLRange > ranges =
+        partition_ndrange(std::vector< double >(numPartitions, 1.0), 2,
+                          globalWorkSize, localWorkSize);
+    std::vector< size_t > sizes;
+    std::vector< const void* > slices;
+    for(size_t p = 0; p != numPartitions; ++p) {
+        sizes.push_back((ranges[p].global[1] + 2 * HALO) * ROW_BYTE_SIZE);
+        slices.push_back(&in[ranges[p].offset[1] * SIZE]);
+    }
+    //first-touch allocation: each slab is initialized by its sub-device
+    const std::vector< cl_mem > devIn =
+        create_partitioned_buffers(clenv, CL_MEM_READ_ONLY, sizes, slices);
+    const std::vector< cl_mem > devOut =
+        create_partitioned_buffers(clenv, CL_MEM_WRITE_ONLY, sizes,
+                                   std::vector< const void* >(numPartitions));
+    cl_int status;
+    //the filter is tiny: a single buffer is shared by all the sub-devices
+    cl_mem devFilter = clCreateBuffer(clenv.context,
+                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  FILTER_BYTE_SIZE,
+                                  const_cast< real_t* >(&filter[0]),
+                                  &status);
+    check_cl_error(status, "clCreateBuffer");
+    status = clSetKernelArg(kernel, 1, sizeof(int), &SIZE);
+    check_cl_error(status, "clSetKernelArg(size)");
+    status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &devFilter);
+    check_cl_error(status, "clSetKernelArg(filter)");
+    status = clSetKernelArg(kernel, 3, sizeof(int), &FILTER_SIZE);
+    check_cl_error(status, "clSetKernelArg(SIZE)");
+    timespec start = {0, 0};
+    timespec end = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for(size_t p = 0; p != numPartitions; ++p) {
+        if(ranges[p].global[1] == 0) continue;
+        //arguments are captured at enqueue time: the same kernel object
+        //can be reused for all the partitions
+        status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &devIn[p]);
+        check_cl_error(status, "clSetKernelArg(in)");
+        status = clSetKernelArg(kernel, 4, sizeof(cl_mem), &devOut[p]);
+        check_cl_error(status, "clSetKernelArg(out)");
+        status = clEnqueueNDRangeKernel(clenv.subQueues[p], kernel, 2, 0,
+                                        ranges[p].global, localWorkSize,
+                                        0, 0, 0);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        check_cl_error(clFlush(clenv.subQueues[p]), "clFlush");
+    }
+    for(size_t p = 0; p != numPartitions; ++p)
+        check_cl_error(clFinish(clenv.subQueues[p]), "clFinish");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    //copy the core rows of each slab, halo rows are not computed
+    for(size_t p = 0; p != numPartitions; ++p) {
+        if(ranges[p].global[1] != 0) {
+            status = clEnqueueReadBuffer(clenv.subQueues[p], devOut[p],
+                                         CL_TRUE,
+                                         HALO * ROW_BYTE_SIZE,
+                                         ranges[p].global[1] * ROW_BYTE_SIZE,
+                                         &out[(ranges[p].offset[1] + HALO)
+                                              * SIZE],
+                                         0, 0, 0);
+            check_cl_error(status, "clEnqueueReadBuffer");
+        }
+        //empty slabs (no halo) have no buffers
+        if(!devIn[p]) continue;
+        check_cl_error(clReleaseMemObject(devIn[p]), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(devOut[p]), "clReleaseMemObject");
+    }
+    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
+    return double(end.tv_sec - start.tv_sec) * 1000.0
+           + double(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
+
+//------------------------------------------------------------------------------
+//grids larger than device memory: chunks of rows plus halo rows are
+//streamed through double buffered device memory, the transfer of the next
+//chunk overlaps the stencil computation on the current one; returns elapsed
+//time including transfers
+double device_apply_stencil_streamed(const Grid& in,
+                                     int size,
+                                     const Grid& filter,
+                                     int filterSize,
+                                     Grid& out,
+                                     const CLEnv& clenv,
+                                     cl_kernel kernel,
+                                     const size_t globalWorkSize[2],
+                                     const size_t localWorkSize[2]) {
+    const int FILTER_SIZE = filterSize;
+    const int SIZE = size;
+    const int HALO = FILTER_SIZE / 2;
+    cl_int status;
+    cl_mem devFilter = clCreateBuffer(clenv.context,
+                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  sizeof(real_t) * FILTER_SIZE * FILTER_SIZE,
+                                  const_cast< real_t* >(&filter[0]),
+                                  &status);
+    check_cl_error(status, "clCreateBuffer");
+    //one item = one row of the core space; chunk buffers hold the halo rows
+    //above and below the chunk, output buffers use the same layout
+    std::vector< CLStreamArray > inputs(1);
+    inputs[0].host = const_cast< real_t* >(&in[HALO * SIZE]);
+    inputs[0].itemBytes = SIZE * sizeof(real_t);
+    inputs[0].halo = HALO;
+    std::vector< CLStreamArray > outputs(1);
+    outputs[0].host = &out[HALO * SIZE];
+    outputs[0].itemBytes = SIZE * sizeof(real_t);
+    outputs[0].halo = HALO;
+    const int DEPTH = 2;
+    CLStream stream =
+        create_stream(clenv, inputs, outputs, globalWorkSize[1],
+                      stream_chunk_items(get_device_id(clenv.context),
+                                         inputs, outputs, DEPTH,
+                                         localWorkSize[1]),
+                      DEPTH);
+    std::cout << "Chunks: " << (globalWorkSize[1] + stream.chunkItems - 1)
+                               / stream.chunkItems << std::endl;
+    //border columns are not computed: preserve the values in 'out'
+    Grid border;
+    for(int y = 0; y != SIZE; ++y) {
+        border.push_back(out[y * SIZE]);
+        border.push_back(out[y * SIZE + SIZE - 1]);
+    }
+    status = clSetKernelArg(kernel, 1, sizeof(int), &SIZE);
+    check_cl_error(status, "clSetKernelArg(size)");
+    status = clSetKernelArg(kernel, 2, sizeof(cl_mem), &devFilter);
+    check_cl_error(status, "clSetKernelArg(filter)");
+    status = clSetKernelArg(kernel, 3, sizeof(int), &FILTER_SIZE);
+    check_cl_error(status, "clSetKernelArg(SIZE)");
+    timespec start = {0, 0};
+    timespec end = {0, 0};
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run_stream(stream, [=](cl_command_queue queue,
+                           const CLStreamChunk& c,
+                           cl_uint numEvents,
+                           const cl_event* events) {
+        check_cl_error(clSetKernelArg(kernel, 0, sizeof(cl_mem),
+                                      &c.inputs[0]), "clSetKernelArg(in)");
+        check_cl_error(clSetKernelArg(kernel, 4, sizeof(cl_mem),
+                                      &c.outputs[0]), "clSetKernelArg(out)");
+        const size_t chunkWorkSize[2] = {globalWorkSize[0], c.count};
+        cl_event ev;
+        cl_int status = clEnqueueNDRangeKernel(queue, kernel, 2, 0,
+                                               chunkWorkSize, localWorkSize,
+                                               numEvents, events, &ev);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        return ev;
+    });
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    for(int y = 0; y != SIZE; ++y) {
+        out[y * SIZE] = border[2 * y];
+        out[y * SIZE + SIZE - 1] = border[2 * y + 1];
+    }
+    release_stream(stream);
+    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
+    return double(end.tv_sec - start.tv_sec) * 1000.0
+           + double(end.tv_nsec - start.tv_nsec) / 1000000.0;
+}
 
 //------------------------------------------------------------------------------
-double device_apply_stencil_image(const std::vector< real_t >& in,
+double device_apply_stencil_image(const Grid& in,
                                   int size, 
-                                  const std::vector< real_t >& filter,
+                                  const Grid& filter,
                                   int filterSize,
-                                  std::vector< real_t >& out,
+                                  Grid& out,
                                   const CLEnv& clenv,
+                                  CLMemPool& pool,
+                                  cl_kernel kernel,
                                   const size_t globalWorkSize[2],
                                   const size_t localWorkSize[2]) {
 
@@ -181,63 +348,50 @@ double device_apply_stencil_image(const std::vector< real_t >& in,
     cl_image_format format;
     format.image_channel_order = CL_INTENSITY;
     format.image_channel_data_type = CL_FLOAT;
-    //allocate output buffer on OpenCL device
+    const size_t origin[3] = {0, 0, 0};
+    const size_t region[3] = {size_t(SIZE), size_t(SIZE), 1};
+    const size_t filterRegion[3] = {size_t(filterSize), size_t(filterSize), 1};
+    //images and buffers are recycled through the pool: content is undefined
+    //and must be initialized explicitly
 #ifdef WRITE_TO_IMAGE
-    cl_image devOut = clCreateImage2D(clenv.context,
-                                    CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR,
-                                    &format,
-                                    size,
-                                    size,
-                                    0, // row stride,
-                                       // if 0 = size * sizeof(element type)
-                                    const_cast< real_t* >(&out[0]),
-                                    &status);
-    check_cl_error(status, "clCreateImage2D");
+    cl_image devOut = pool_alloc_image2d(pool, CL_MEM_WRITE_ONLY, format,
+                                         size, size);
+    //border elements are not written by the kernel: copy output too
+    status = clEnqueueWriteImage(clenv.commandQueue, devOut, CL_FALSE,
+                                 origin, region, 0, 0, &out[0], 0, 0, 0);
+    check_cl_error(status, "clEnqueueWriteImage");
 #else    
-    cl_mem devOut = clCreateBuffer(clenv.context,
-                                   CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR,
-                                   BYTE_SIZE,
-                                   const_cast< real_t* >(&out[0]),
-                                   &status);
-    check_cl_error(status, "clCreateBuffer");
+    cl_mem devOut = pool_alloc_buffer(pool, CL_MEM_WRITE_ONLY, BYTE_SIZE);
+    //border elements are not written by the kernel: copy output too
+    status = clEnqueueWriteBuffer(clenv.commandQueue, devOut, CL_FALSE, 0,
+                                  BYTE_SIZE, &out[0], 0, 0, 0);
+    check_cl_error(status, "clEnqueueWriteBuffer");
 #endif    
-
-    //allocate input buffers on OpenCL devices and copy data
-   
-    cl_image devIn = clCreateImage2D(clenv.context,
-                                     CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                     &format,
-                                     size,
-                                     size,
-                                     0, // row stride,
-                                        // if 0 = size * sizeof(element type)
-                                     const_cast< real_t* >(&in[0]),
-                                     &status);
-    check_cl_error(status, "clCreateImage2D");
-    cl_image devFilter = clCreateImage2D(clenv.context,
-                                    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                    &format,
-                                    filterSize,
-                                    filterSize,
-                                    0, // row stride,
-                                       // if 0 = size * sizeof(element type)
-                                    const_cast< real_t* >(&filter[0]),
-                                    &status);
-    check_cl_error(status, "clCreateImage2D");
+    cl_image devIn = pool_alloc_image2d(pool, CL_MEM_READ_ONLY, format,
+                                        size, size);
+    status = clEnqueueWriteImage(clenv.commandQueue, devIn, CL_FALSE,
+                                 origin, region, 0, 0, &in[0], 0, 0, 0);
+    check_cl_error(status, "clEnqueueWriteImage");
+    cl_image devFilter = pool_alloc_image2d(pool, CL_MEM_READ_ONLY, format,
+                                            filterSize, filterSize);
+    status = clEnqueueWriteImage(clenv.commandQueue, devFilter, CL_FALSE,
+                                 origin, filterRegion, 0, 0, &filter[0],
+                                 0, 0, 0);
+    check_cl_error(status, "clEnqueueWriteImage");
 
 
     //set kernel parameters
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             0,      //parameter id
                             sizeof(cl_mem), //size of parameter
                             &devIn); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(size)");
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             1,      //parameter id
                             sizeof(cl_mem), //size of parameter
                             &devFilter); //pointer to parameter
     check_cl_error(status, "clSetKernelArg(SIZE)");
-    status = clSetKernelArg(clenv.kernel, //kernel
+    status = clSetKernelArg(kernel, //kernel
                             2,      //parameter id
                             sizeof(cl_mem), //size of parameter
                             &devOut); //pointer to parameter
@@ -247,7 +401,7 @@ double device_apply_stencil_image(const std::vector< real_t >& in,
     //launch and time kernel
     const double timems = timeEnqueueNDRangeKernel(
                                     clenv.commandQueue, //queue
-                                    clenv.kernel, //kernel                                   
+                                    kernel, //kernel
                                     2, //number of dimensions for work-items
                                     0, //global work offset
                                     globalWorkSize, //total number of threads
@@ -261,8 +415,6 @@ double device_apply_stencil_image(const std::vector< real_t >& in,
 
 #ifdef WRITE_TO_IMAGE
     //read data from device
-    const size_t origin[3] = {0, 0, 0};
-    const size_t region[3] = {SIZE, SIZE, 1};
     //const size_t rowPitch = SIZE * sizeof(real_t);
 
     //not required for 2d
@@ -296,16 +448,42 @@ double device_apply_stencil_image(const std::vector< real_t >& in,
                                  0); //event identifying this specific operation
     check_cl_error(status, "clEnqueueReadBuffer");
 #endif    
-    check_cl_error(clReleaseMemObject(devOut), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devIn), "clReleaseMemObject");
-    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
+    pool_release(pool, devOut);
+    pool_release(pool, devIn);
+    pool_release(pool, devFilter);
     return timems;
 }
 
 
 //------------------------------------------------------------------------------
-bool check_result(const std::vector< real_t >& v1,
-	              const std::vector< real_t >& v2,
+//runs kernel with the given local size, returns elapsed time
+typedef std::function< double (const size_t*) > StencilRun;
+
+//local size selected by the autotuner: candidates are timed through the
+//same function used for the actual computation; the selected size is stored
+//in the tuning database and later runs only look it up
+void tune_local_size(const CLEnv& clenv,
+                     cl_kernel kernel,
+                     const std::string& kernelName,
+                     const std::string& defines,
+                     const size_t globalWorkSize[2],
+                     const StencilRun& run,
+                     size_t localWorkSize[2]) {
+    const cl_device_id device = get_device_id(clenv.context);
+    const CLLocalSize local =
+        autotune_local_size(device, kernelName, defines, 2, globalWorkSize,
+                            local_size_candidates(device, kernel, 2,
+                                                  globalWorkSize),
+                            [&run](const CLLocalSize& l) {
+                                return run(l.size);
+                            });
+    localWorkSize[0] = local.size[0];
+    localWorkSize[1] = local.size[1];
+}
+
+//------------------------------------------------------------------------------
+bool check_result(const Grid& v1,
+	              const Grid& v2,
 	              double eps) {
     for(int i = 0; i != v1.size(); ++i) {
     	if(double(std::fabs(v1[i] - v2[i])) > eps) return false;
@@ -318,27 +496,41 @@ int main(int argc, char** argv) {
     if(argc < 9) {
         std::cerr << "usage:\n" << argv[0] << '\n'
                   << "  <platform name>\n"
-                     "  <device type = default | cpu | gpu | acc | all>\n"
+                     "  <device type = default | cpu | gpu | acc | all>"
+                     "[/<partition = numa | l3 | l2 | l1 | <n> >]\n"
                      "  <device num>\n"
                      "  <OpenCL source file path>\n"
                      "  <kernel name>\n"
                      "  <size>\n"
-                     "  <workgroup size>\n"
-                     "  <std|image>\n"
+                     "  <workgroup size | auto>\n"
+                     "  <std|image|both|stream>\n"
                      "  [build parameters passed to the OpenCL compiler]\n"
                      "  filter size is 3x3; size - halo region size must be"
-                     " evenly divisible by the workgroup size"
+                     " evenly divisible by the workgroup size;\n"
+                     "  'both' runs the 'filter' and 'filter_image' kernels"
+                     " from the same program, kernel name is ignored;\n"
+                     "  'std' on a partitioned device (e.g. cpu/numa) runs"
+                     " one slab of rows per sub-device concurrently;\n"
+                     "  'stream' runs the buffer kernel on chunks of rows"
+                     " streamed through device memory, chunk size in bytes"
+                     " can be set with CLUTIL_STREAM_CHUNK;\n"
+                     "  'auto' selects the workgroup size through the"
+                     " autotuner, see autotune_local_size in clutil.h"
                   << std::endl;
         exit(EXIT_FAILURE);   
     }
-    bool image = false;
-    if(std::string(argv[8]) == "image") {
+    const std::string mode = argv[8];
+    if(mode != "std" && mode != "image" && mode != "both"
+       && mode != "stream") {
+        std::cerr << "ERROR - unknown mode " << mode << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(mode == "image" || mode == "both") {
 #ifdef USE_DOUBLE
         std::cerr << "Double precision not supported by 1-element float images"
                   << std::endl;
         exit(EXIT_FAILURE);
 #endif                  
-        image = true; 
     }
     std::string options;
     for(int a = 9; a < argc; ++a) {
@@ -349,8 +541,10 @@ int main(int argc, char** argv) {
 #endif
     const int FILTER_SIZE = 3; //3x3
     const int SIZE = atoi(argv[6]);
-    const int BLOCK_SIZE = atoi(argv[7]);
-    if((SIZE - (2 * (FILTER_SIZE / 2))) % BLOCK_SIZE != 0) {
+    const bool autoTune = std::string(argv[7]) == "auto";
+    const int BLOCK_SIZE = autoTune ? 1 : atoi(argv[7]);
+    if(SIZE <= 2 * (FILTER_SIZE / 2) || BLOCK_SIZE < 1
+       || (SIZE - (2 * (FILTER_SIZE / 2))) % BLOCK_SIZE != 0) {
         std::cerr << "size(" << SIZE << ") - " << (2 * (FILTER_SIZE / 2))
                   << " must be evenly divisible by the workgroup size("
                   << BLOCK_SIZE << ")" << std::endl;
@@ -361,8 +555,9 @@ int main(int argc, char** argv) {
     //image - border (= 2 x (filter size DIV 2) != filter size)
     const size_t globalWorkSize[2] = {SIZE - 2 * (FILTER_SIZE / 2), 
                                       SIZE - 2 * (FILTER_SIZE / 2)};
-    //number of per-workgroup local threads
-    const size_t localWorkSize[2]  = {BLOCK_SIZE, BLOCK_SIZE}; 
+    //number of per-workgroup local threads, replaced by the tuned size
+    //for each kernel in case of 'auto'
+    size_t localWorkSize[2]  = {size_t(BLOCK_SIZE), size_t(BLOCK_SIZE)};
     //setup text header that will be prefixed to opencl code
     std::ostringstream clheaderStream;
 #ifdef USE_DOUBLE    
@@ -371,42 +566,98 @@ int main(int argc, char** argv) {
 #else
     const double EPS = 0.00001;
 #endif    
-    CLEnv clenv = create_clenv(argv[1], //platform name
-                               argv[2], //device type
-                               atoi(argv[3]), //device id
-                               true, //profiling
-                               argv[4], //cl source code
-                               argv[5], //kernel name
-                               "", //source code prefix text
-                               options.c_str()); //compiler options
+    //the program is built in the background while the host data and the
+    //reference result are computed
+    CLEnvFuture clenvFuture =
+        create_clenv_async(argv[1], //platform name
+                           argv[2], //device type
+                           atoi(argv[3]), //device id
+                           true, //profiling
+                           argv[4], //cl source code
+                           0, //all kernels created, selected below
+                           "", //source code prefix text
+                           options.c_str()); //compiler options
    
     cl_int status;
     //create input and output matrices
-    std::vector<real_t> in = create_2d_grid(SIZE, SIZE,
+    Grid in = create_2d_grid(SIZE, SIZE,
                                             FILTER_SIZE / 2, FILTER_SIZE / 2);
-    std::vector<real_t> filter = create_filter();
-    std::vector<real_t> out(SIZE * SIZE,real_t(0));
-    std::vector<real_t> refOut(SIZE * SIZE,real_t(0));        
-    
-    //launch kernels and check results
-    double timems = 0;
-    if(image) {
-        timems = device_apply_stencil_image(in, SIZE, filter, FILTER_SIZE,
-                             out, clenv, globalWorkSize, localWorkSize);
-    } else {
-        timems = device_apply_stencil(in, SIZE, filter, FILTER_SIZE,
-                             out, clenv, globalWorkSize, localWorkSize);
-    }
+    Grid filter = create_filter();
+    Grid out(SIZE * SIZE,real_t(0));
+    Grid refOut(SIZE * SIZE,real_t(0));        
     
     host_apply_stencil(in, SIZE, filter, FILTER_SIZE, refOut);
 
-    if(check_result(out, refOut, EPS)) {
-        std::cout << "Elapsed time: " << timems << " ms" << std::endl;
-    	std::cout << "PASSED" << std::endl;
-    } else {
-    	std::cout << "FAILED" << std::endl;
-    }	
+    CLEnv clenv = wait_clenv(clenvFuture);
+    //device memory is recycled across kernel runs
+    CLMemPool pool = create_mem_pool(clenv.context);
+    //tuning database key: build configuration and device partitioning
+    const std::string tuneDefines = clheaderStream.str() + options + ' '
+                                    + argv[2];
+    Grid scratch(out);
+
+    //launch kernels and check results; kernels are looked up by name
+    //from the already built program: no recompilation required
+    if(mode == "std" || mode == "both" || mode == "stream") {
+        const std::string kernelName = mode == "both" ? "filter" : argv[5];
+        const cl_kernel kernel = get_kernel(clenv, kernelName);
+        const StencilRun run = [&](const size_t* local) {
+            if(mode == "stream") {
+                return device_apply_stencil_streamed(in, SIZE, filter,
+                                                     FILTER_SIZE, scratch,
+                                                     clenv, kernel,
+                                                     globalWorkSize, local);
+            }
+            return clenv.subQueues.empty() ?
+                device_apply_stencil(in, SIZE, filter, FILTER_SIZE, scratch,
+                                     clenv, pool, kernel,
+                                     globalWorkSize, local)
+              : device_apply_stencil_partitioned(in, SIZE, filter,
+                                                 FILTER_SIZE, scratch,
+                                                 clenv, kernel,
+                                                 globalWorkSize, local);
+        };
+        if(autoTune) {
+            tune_local_size(clenv, kernel, kernelName, tuneDefines,
+                            globalWorkSize, run, localWorkSize);
+        }
+        const double timems = run(localWorkSize);
+        out = scratch;
+        std::cout << kernelName << ": ";
+        if(check_result(out, refOut, EPS)) {
+            std::cout << "Elapsed time: " << timems << " ms" << std::endl;
+            std::cout << "PASSED" << std::endl;
+        } else {
+            std::cout << "FAILED" << std::endl;
+        }
+    }
+    if(mode == "image" || mode == "both") {
+        const std::string kernelName =
+            mode == "both" ? "filter_image" : argv[5];
+        const cl_kernel kernel = get_kernel(clenv, kernelName);
+        const StencilRun run = [&](const size_t* local) {
+            std::fill(scratch.begin(), scratch.end(), real_t(0));
+            return device_apply_stencil_image(in, SIZE, filter, FILTER_SIZE,
+                                              scratch, clenv, pool, kernel,
+                                              globalWorkSize, local);
+        };
+        if(autoTune) {
+            tune_local_size(clenv, kernel, kernelName, tuneDefines,
+                            globalWorkSize, run, localWorkSize);
+        }
+        const double timems = run(localWorkSize);
+        out = scratch;
+        std::cout << kernelName << ": ";
+        if(check_result(out, refOut, EPS)) {
+            std::cout << "Elapsed time: " << timems << " ms" << std::endl;
+            std::cout << "PASSED" << std::endl;
+        } else {
+            std::cout << "FAILED" << std::endl;
+        }
+    }
 
+    print_mem_pool_stats(pool, std::cout);
+    release_mem_pool(pool);
     release_clenv(clenv);
    
     return 0;
@@ -31,7 +31,7 @@ double profile_time_s(cl_event event) {
 }
 
 //------------------------------------------------------------------------------
-double copy_host_to_device(cl_context context, cl_command_queue commandQueue,
+double copy_host_to_device(CLMemPool &pool, cl_command_queue commandQueue,
                            size_t size, bool mapped, bool pinned) {
     cl_int status = -1;
     uint8_t *hostMem = nullptr;
@@ -41,10 +41,8 @@ double copy_host_to_device(cl_context context, cl_command_queue commandQueue,
     // Allocate host memory
     if (pinned) {
         // Create a host buffer
-        hostPinnedMem =
-            clCreateBuffer(context, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR,
-                           size, 0, &status);
-        check_cl_error(status, to_string(__LINE__).c_str());
+        hostPinnedMem = pool_alloc_buffer(
+            pool, CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, size);
 
         // Get a mapped pointer to page locked memeory
         hostMem = (uint8_t *)clEnqueueMapBuffer(commandQueue, hostPinnedMem,
@@ -74,8 +72,7 @@ double copy_host_to_device(cl_context context, cl_command_queue commandQueue,
     }
 
     // allocate device memory
-    deviceMem = clCreateBuffer(context, CL_MEM_READ_ONLY, size, 0, &status);
-    check_cl_error(status, to_string(__LINE__).c_str());
+    deviceMem = pool_alloc_buffer(pool, CL_MEM_READ_ONLY, size);
 
     // sync queue
     clFinish(commandQueue);
@@ -137,10 +134,17 @@ double copy_host_to_device(cl_context context, cl_command_queue commandQueue,
     const double bandwidthMB =
         ((double)size / (elapsedTimeSec * (double)(1 << 20)));
 
-    // clean up memory
-    if (deviceMem) clReleaseMemObject(deviceMem);
+    // return memory to the pool, reused by the next iteration
+    if (deviceMem) pool_release(pool, deviceMem);
     if (hostPinnedMem) {
-        clReleaseMemObject(hostPinnedMem);
+        // pinned buffer still mapped for reading by both paths: unmap before
+        // returning it to the pool, the next iteration maps it again
+        status = clEnqueueUnmapMemObject(commandQueue, hostPinnedMem,
+                                         (void *)hostMem, 0, nullptr, nullptr);
+        check_cl_error(status, to_string(__LINE__).c_str());
+        status = clFinish(commandQueue);
+        check_cl_error(status, to_string(__LINE__).c_str());
+        pool_release(pool, hostPinnedMem);
     } else {
         free(hostMem);
     }
@@ -148,7 +152,7 @@ double copy_host_to_device(cl_context context, cl_command_queue commandQueue,
 }
 
 //------------------------------------------------------------------------------
-double copy_device_to_host(cl_context context, cl_command_queue commandQueue,
+double copy_device_to_host(CLMemPool &pool, cl_command_queue commandQueue,
                            size_t size, bool mapped, bool pinned) {
     cl_int status = -1;
     uint8_t *hostMem = nullptr;
@@ -159,10 +163,8 @@ double copy_device_to_host(cl_context context, cl_command_queue commandQueue,
     if (pinned) {
         // Create a host buffer, buffer is read/write because we also use it
         // to initialise GPU memory before timing the transfer back
-        hostPinnedMem =
-            clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
-                           size, 0, &status);
-        check_cl_error(status, to_string(__LINE__).c_str());
+        hostPinnedMem = pool_alloc_buffer(
+            pool, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size);
 
         // Map pinned buffer to host pointer
         hostMem = (uint8_t *)clEnqueueMapBuffer(commandQueue, hostPinnedMem,
@@ -192,8 +194,7 @@ double copy_device_to_host(cl_context context, cl_command_queue commandQueue,
     }
 
     // allocate device memory to be written by kernel
-    deviceMem = clCreateBuffer(context, CL_MEM_WRITE_ONLY, size, 0, &status);
-    check_cl_error(status, to_string(__LINE__).c_str());
+    deviceMem = pool_alloc_buffer(pool, CL_MEM_WRITE_ONLY, size);
 
     // initialize device memory: copy data from host to device
     if (pinned) {
@@ -266,10 +267,10 @@ double copy_device_to_host(cl_context context, cl_command_queue commandQueue,
     const double bandwidthMB =
         ((double)size / (elapsedTimeSec * (double)(1 << 20)));
 
-    // clean up memory
-    if (deviceMem) clReleaseMemObject(deviceMem);
+    // return memory to the pool, reused by the next iteration
+    if (deviceMem) pool_release(pool, deviceMem);
     if (hostPinnedMem) {
-        clReleaseMemObject(hostPinnedMem);
+        pool_release(pool, hostPinnedMem);
     } else {
         free(hostMem);
     }
@@ -278,7 +279,7 @@ double copy_device_to_host(cl_context context, cl_command_queue commandQueue,
 }
 
 //------------------------------------------------------------------------------
-double copy_device_to_device(cl_context context, cl_command_queue commandQueue,
+double copy_device_to_device(CLMemPool &pool, cl_command_queue commandQueue,
                              size_t size) {
     cl_int status = -1;
     uint8_t *hostMem = nullptr;
@@ -293,13 +294,8 @@ double copy_device_to_device(cl_context context, cl_command_queue commandQueue,
     }
 
     // allocate source and destination device buffers
-    cl_mem devSrc =
-        clCreateBuffer(context, CL_MEM_READ_ONLY, size, nullptr, &status);
-    check_cl_error(status, to_string(__LINE__).c_str());
-
-    cl_mem devDest =
-        clCreateBuffer(context, CL_MEM_WRITE_ONLY, size, nullptr, &status);
-    check_cl_error(status, to_string(__LINE__).c_str());
+    cl_mem devSrc = pool_alloc_buffer(pool, CL_MEM_READ_ONLY, size);
+    cl_mem devDest = pool_alloc_buffer(pool, CL_MEM_WRITE_ONLY, size);
 
     // initialize device buffer with host data
     status = clEnqueueWriteBuffer(commandQueue, devSrc, CL_TRUE, 0, size,
@@ -322,10 +318,10 @@ double copy_device_to_device(cl_context context, cl_command_queue commandQueue,
     const double bandwidthMB =
         ((double)size / (elapsedTimeSec * (double)(1 << 20)));
 
-    // clean up memory on host and device
+    // clean up memory on host and return device memory to the pool
     free(hostMem);
-    clReleaseMemObject(devSrc);
-    clReleaseMemObject(devDest);
+    pool_release(pool, devSrc);
+    pool_release(pool, devDest);
 
     return bandwidthMB;
 }
@@ -384,25 +380,25 @@ int main(int argc, char **argv) {
 
     CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true);
 
-    cl_int status;
-
-    ByteArray data(SIZE);
+    // device and pinned buffers are recycled across iterations
+    CLMemPool pool = create_mem_pool(clenv.context);
 
     double H2D_BW_MB = 0.0;
     for (int i = 0; i != iterations; ++i) {
-        H2D_BW_MB += copy_host_to_device(clenv.context, clenv.commandQueue,
+        H2D_BW_MB += copy_host_to_device(pool, clenv.commandQueue,
                                          SIZE, MAPPED, PINNED);
     }
+    H2D_BW_MB /= iterations;
     double D2H_BW_MB = 0.0;
     for (int i = 0; i != iterations; ++i) {
-        D2H_BW_MB += copy_device_to_host(clenv.context, clenv.commandQueue,
+        D2H_BW_MB += copy_device_to_host(pool, clenv.commandQueue,
                                          SIZE, MAPPED, PINNED);
     }
     D2H_BW_MB /= iterations;
     double D2D_BW_MB = 0.0;
     for (int i = 0; i != iterations; ++i) {
         D2D_BW_MB +=
-            copy_device_to_device(clenv.context, clenv.commandQueue, SIZE);
+            copy_device_to_device(pool, clenv.commandQueue, SIZE);
     }
     D2D_BW_MB /= iterations;
 
@@ -413,6 +409,9 @@ int main(int argc, char **argv) {
          << "  Host to device:   " << H2D_BW_MB << endl
          << "  Device to host:   " << D2H_BW_MB << endl
          << "  Device to device: " << D2D_BW_MB << endl;
+    print_mem_pool_stats(pool, cout);
+    release_mem_pool(pool);
+    release_clenv(clenv);
 
     return 0;
 }
\ No newline at end of file
@@ -4,8 +4,8 @@
 //Requires GLFW and GLM, to deal with the missing support for matrix stack
 //in OpenGL >= 3.3
 
-//g++ ../src/12_glinterop-compute-loop.cpp \
-// ../src/gl-cl.cpp -I/usr/local/glfw/include \
+//g++ -std=c++11 ../src/12_glinterop-compute-loop.cpp \
+// ../src/gl-cl.cpp ../src/clutil.cpp -I/usr/local/glfw/include \
 // -DGL_GLEXT_PROTOTYPES -L/usr/local/glfw/lib -lglfw \
 // -I/usr/local/cuda/include -lOpenCL \
 // -I/usr/local/glm/include
@@ -28,6 +28,7 @@
 
 //OpenCL C++ wrapper
 #include "cl.hpp"
+#include "clutil.h"
 
 #define gle std::cout << "[GL] - " \
                       << __LINE__ << ' ' << glGetError() << std::endl;
@@ -402,6 +403,16 @@ int main(int argc, char** argv) {
         //impossible to pass a cl::Image2D vector to the methods
         std::vector<cl::Memory> clmembuffers(clbuffers.begin(),
                                              clbuffers.end());
+        //the step is recorded once: only the image arguments swap between
+        //iterations and each replay continues the ping-pong sequence
+        kernel.setArg(2, DIFFUSION_SPEED);
+        CLRecording stepRecording = create_recording(queue());
+        record_kernel(stepRecording, kernel(),
+                      CLNDRange(GLOBAL_WORK_SIZE, GLOBAL_WORK_SIZE),
+                      CLNDRange(LOCAL_WORK_SIZE, LOCAL_WORK_SIZE));
+        record_ping_pong(stepRecording, 0, clbuffers[0](), clbuffers[1]());
+        record_ping_pong(stepRecording, 1, clbuffers[1](), clbuffers[0]());
+        finalize_recording(stepRecording);
         float prevError = 0;
         while (!glfwWindowShouldClose(window) && !converged) {     
 
@@ -415,24 +426,9 @@ int main(int argc, char** argv) {
             //sequence of base types
             queue.enqueueAcquireGLObjects(&clmembuffers);
             
-            if(IS_EVEN(step)) {
-                kernel.setArg(0, clbuffers[0]);
-                kernel.setArg(1, clbuffers[1]);
-                tex = texOdd;
-            } else {//even
-                kernel.setArg(0, clbuffers[1]);
-                kernel.setArg(1, clbuffers[0]);
-                tex = texEven;
-            }
-            
-            kernel.setArg(2, DIFFUSION_SPEED);
-
-            queue.enqueueNDRangeKernel(kernel,
-                                       cl::NDRange(0, 0),
-                                       cl::NDRange(GLOBAL_WORK_SIZE,
-                                                   GLOBAL_WORK_SIZE),
-                                       cl::NDRange(LOCAL_WORK_SIZE,
-                                                   LOCAL_WORK_SIZE));
+            //replay the recorded step: images are swapped by the recording
+            tex = IS_EVEN(step) ? texOdd : texEven;
+            replay_recording(stepRecording);
             //CHECK FOR CONVERGENCE: extract element at grid center
             //and exit if |element value - boundary value| <= EPS    
             float centerOut = -BOUNDARY_VALUE;
@@ -523,6 +519,7 @@ int main(int argc, char** argv) {
                       << "  time: " << totalTime / 1E3 << " s"
                       << std::endl;
 //CLEANUP
+        release_recording(stepRecording);
         glDeleteBuffers(1, &quadvbo);
         glDeleteBuffers(1, &texbo);
         glDeleteTextures(1, &texEven);
@@ -0,0 +1,234 @@
+//Multi-device execution: a single NDRange is split across all the devices in
+//a context, each device running on its own command queue; the split is
+//proportional to the throughput measured in the previous iteration;
+//results are gathered from per-device output buffers.
+//Supports matrix multiply (2D NDRange) and dot product (1D NDRange).
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/14_multi_device.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 14_multi_device
+//
+//run on two GPUs:
+// ./14_multi_device "AMD Accelerated Parallel Processing" gpu 0,1 \
+//   ../src/kernels/04_matrix_multiply.cl block_matmul 1024 16
+//test on a single CPU device partitioned into four sub-devices:
+// ./14_multi_device "Portable Computing Language" cpu 0/4 \
+//   ../src/kernels/05_dot_product.cl dotprod 16777216 256
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <numeric>
+#include "clutil.h"
+
+#ifdef USE_DOUBLE
+typedef double real_t;
+#else
+typedef float real_t;
+#endif
+
+//------------------------------------------------------------------------------
+std::vector< real_t > create_matrix(int cols, int rows) {
+    std::vector< real_t > m(cols * rows);
+    srand(time(0));
+    for(std::vector<real_t>::iterator i = m.begin();
+        i != m.end(); ++i) *i = rand() % 10;
+    return m;
+}
+
+//------------------------------------------------------------------------------
+bool check_result(const std::vector< real_t >& v1,
+                  const std::vector< real_t >& v2,
+                  double eps) {
+    for(size_t i = 0; i != v1.size(); ++i) {
+        if(double(std::fabs(v1[i] - v2[i])) > eps) return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void print_split(const CLMultiEnv& clenv,
+                 const std::vector< CLRange >& ranges) {
+    for(size_t i = 0; i != ranges.size(); ++i) {
+        const CLRange& r = ranges[i];
+        std::cout << "  device " << i << ": offset " << r.offset[r.dim - 1]
+                  << "  size " << r.global[r.dim - 1]
+                  << "  throughput " << clenv.throughput[i]
+                  << " work items/ms" << std::endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+void release_buffers(const std::vector< cl_mem >& buffers) {
+    for(std::vector< cl_mem >::const_iterator b = buffers.begin();
+        b != buffers.end(); ++b) {
+        check_cl_error(clReleaseMemObject(*b), "clReleaseMemObject");
+    }
+}
+
+//------------------------------------------------------------------------------
+bool run_matmul(CLMultiEnv& clenv, cl_kernel kernel, int SIZE,
+                int BLOCK_SIZE, int iterations, double EPS) {
+    const size_t BYTE_SIZE = SIZE * SIZE * sizeof(real_t);
+    cl_int status;
+    std::vector<real_t> A = create_matrix(SIZE, SIZE);
+    std::vector<real_t> B = create_matrix(SIZE, SIZE);
+    std::vector<real_t> C(SIZE * SIZE,real_t(0));
+    std::vector<real_t> refC(SIZE * SIZE,real_t(0));
+    //read-only inputs are shared by all devices
+    cl_mem devA = clCreateBuffer(clenv.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 BYTE_SIZE,
+                                 &A[0], //<-- copy data from A
+                                 &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devB = clCreateBuffer(clenv.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 BYTE_SIZE,
+                                 &B[0], //<-- copy data from B
+                                 &status);
+    check_cl_error(status, "clCreateBuffer");
+    //one output buffer per device
+    const std::vector< cl_mem > devC =
+        create_device_buffers(clenv, CL_MEM_WRITE_ONLY, BYTE_SIZE);
+    status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &devA);
+    check_cl_error(status, "clSetKernelArg(A)");
+    status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &devB);
+    check_cl_error(status, "clSetKernelArg(B)");
+    status = clSetKernelArg(kernel, 3, sizeof(int), &SIZE);
+    check_cl_error(status, "clSetKernelArg(SIZE)");
+    const size_t globalWorkSize[2] = {size_t(SIZE), size_t(SIZE)};
+    const size_t localWorkSize[2] = {size_t(BLOCK_SIZE), size_t(BLOCK_SIZE)};
+    std::vector< CLRange > ranges;
+    for(int i = 0; i != iterations; ++i) {
+        ranges = dispatch_ndrange(clenv, kernel, 2,
+                                  globalWorkSize, localWorkSize,
+                                  [&devC](cl_kernel k, int device) {
+            check_cl_error(clSetKernelArg(k, 2, sizeof(cl_mem),
+                                          &devC[device]),
+                           "clSetKernelArg(C)");
+        });
+        std::cout << "Iteration " << i << std::endl;
+        print_split(clenv, ranges);
+    }
+    //each device computed a slab of rows
+    gather_ndrange(clenv, devC, ranges, SIZE * sizeof(real_t), 1, &C[0]);
+    host_gemm(SIZE, SIZE, SIZE, &A[0], SIZE, &B[0], SIZE, &refC[0], SIZE);
+    check_cl_error(clReleaseMemObject(devA), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devB), "clReleaseMemObject");
+    release_buffers(devC);
+    return check_result(refC, C, EPS);
+}
+
+//------------------------------------------------------------------------------
+bool run_dotprod(CLMultiEnv& clenv, cl_kernel kernel, int SIZE,
+                 int BLOCK_SIZE, int iterations, double EPS) {
+    const size_t BYTE_SIZE = SIZE * sizeof(real_t);
+    const int REDUCED_SIZE = SIZE / BLOCK_SIZE;
+    const size_t REDUCED_BYTE_SIZE = REDUCED_SIZE * sizeof(real_t);
+    cl_int status;
+    std::vector<real_t> V1 = create_matrix(SIZE, 1);
+    std::vector<real_t> V2 = create_matrix(SIZE, 1);
+    std::vector<real_t> partialDot(REDUCED_SIZE);
+    cl_mem devV1 = clCreateBuffer(clenv.context,
+                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  BYTE_SIZE,
+                                  &V1[0], //<-- copy data from V1
+                                  &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devV2 = clCreateBuffer(clenv.context,
+                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  BYTE_SIZE,
+                                  &V2[0], //<-- copy data from V2
+                                  &status);
+    check_cl_error(status, "clCreateBuffer");
+    const std::vector< cl_mem > partialReduction =
+        create_device_buffers(clenv, CL_MEM_WRITE_ONLY, REDUCED_BYTE_SIZE);
+    status = clSetKernelArg(kernel, 0, sizeof(cl_mem), &devV1);
+    check_cl_error(status, "clSetKernelArg(V1)");
+    status = clSetKernelArg(kernel, 1, sizeof(cl_mem), &devV2);
+    check_cl_error(status, "clSetKernelArg(V2)");
+    const size_t globalWorkSize[1] = {size_t(SIZE)};
+    const size_t localWorkSize[1] = {size_t(BLOCK_SIZE)};
+    std::vector< CLRange > ranges;
+    for(int i = 0; i != iterations; ++i) {
+        ranges = dispatch_ndrange(clenv, kernel, 1,
+                                  globalWorkSize, localWorkSize,
+                                  [&partialReduction](cl_kernel k,
+                                                      int device) {
+            check_cl_error(clSetKernelArg(k, 2, sizeof(cl_mem),
+                                          &partialReduction[device]),
+                           "clSetKernelArg(devOut)");
+        });
+        std::cout << "Iteration " << i << std::endl;
+        print_split(clenv, ranges);
+    }
+    //each workgroup produced one partial result
+    gather_ndrange(clenv, partialReduction, ranges,
+                   sizeof(real_t), BLOCK_SIZE, &partialDot[0]);
+    //values are small integers: per-workgroup partial sums are exact in
+    //single precision, final sums are computed in double precision
+    const double deviceDot = std::accumulate(partialDot.begin(),
+                                             partialDot.end(), 0.0);
+    const double hostDot = std::inner_product(V1.begin(), V1.end(),
+                                              V2.begin(), 0.0);
+    std::cout << "Dot product, device: " << deviceDot << "  host: " << hostDot
+              << std::endl;
+    check_cl_error(clReleaseMemObject(devV1), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devV2), "clReleaseMemObject");
+    release_buffers(partialReduction);
+    return std::fabs(deviceDot - hostDot) <= EPS * std::fabs(hostDot);
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 8) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device list = all | 0,1... | "
+                     "<device num>/<number of sub-devices>>"
+                     " <OpenCL source file path>"
+                     " <kernel name = matmul | block_matmul | dotprod>"
+                     " <size> <workgroup size> [iterations, default = 4]"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const std::string kernelName = argv[5];
+    const int SIZE = atoi(argv[6]);
+    const int BLOCK_SIZE = atoi(argv[7]);
+    const int ITERATIONS = argc > 8 ? atoi(argv[8]) : 4;
+    if(SIZE < 1 || BLOCK_SIZE < 1 || (SIZE % BLOCK_SIZE) != 0
+       || ITERATIONS < 1) {
+        std::cerr << "ERROR - size, block size and iterations *must* be "
+                     "greater than zero and size *must* be evenly divisible "
+                     "by block size"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    //setup text header that will be prefixed to opencl code
+    std::ostringstream clheaderStream;
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n';
+#ifdef USE_DOUBLE
+    clheaderStream << "#define DOUBLE\n";
+    const double EPS = 0.000000001;
+#else
+    const double EPS = 0.00001;
+#endif
+    CLMultiEnv clenv = create_multi_clenv(argv[1], argv[2], argv[3],
+                                          argv[4], clheaderStream.str());
+    std::cout << "Number of devices: " << clenv.devices.size() << std::endl;
+    cl_kernel kernel = get_kernel(clenv, kernelName);
+    bool passed = false;
+    if(kernelName == "dotprod") {
+        passed = run_dotprod(clenv, kernel, SIZE, BLOCK_SIZE, ITERATIONS,
+                             EPS);
+    } else {
+        passed = run_matmul(clenv, kernel, SIZE, BLOCK_SIZE, ITERATIONS,
+                            EPS);
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    release_multi_clenv(clenv);
+    return 0;
+}
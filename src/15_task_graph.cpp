@@ -0,0 +1,335 @@
+//Task graph: matrix multiply and stencil pipelines expressed as a graph of
+//write -> kernel -> read nodes; dependencies are cl_event wait lists and
+//independent nodes are submitted to an out-of-order queue or to multiple
+//in-order queues so that transfers and kernels from different batches
+//overlap. The same graph is run first on a single in-order queue
+//(serialized) and then concurrently and the elapsed times are compared.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 ../src/15_task_graph.cpp ../src/clutil.cpp -I../src \
+// -lOpenCL -o 15_task_graph
+//
+//./15_task_graph "AMD Accelerated Parallel Processing" gpu 0 \
+//  ../src/kernels/04_matrix_multiply.cl ../src/kernels/07_stencil.cl \
+//  512 1026 16 4
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include "clutil.h"
+
+#ifdef USE_DOUBLE
+typedef double real_t;
+#else
+typedef float real_t;
+#endif
+
+//------------------------------------------------------------------------------
+std::vector< real_t > create_matrix(int cols, int rows) {
+    std::vector< real_t > m(cols * rows);
+    for(std::vector<real_t>::iterator i = m.begin();
+        i != m.end(); ++i) *i = rand() % 10;
+    return m;
+}
+
+//------------------------------------------------------------------------------
+std::vector< real_t > create_filter() {
+    real_t f[3][3] = { 1, 1, 1,
+                       1, 0, 1,
+                       1, 1, 1 };
+    return std::vector< real_t >((real_t*)(f),
+                                 (real_t*)(f) + sizeof(f) / sizeof(real_t));
+}
+
+//------------------------------------------------------------------------------
+void host_matmul(const std::vector< real_t >& A,
+                 const std::vector< real_t >& B,
+                 std::vector< real_t >& C,
+                 int size) {
+    for(int r = 0; r != size; ++r) {
+        for(int c = 0; c != size; ++c) {
+            real_t e = real_t(0);
+            for(int ic = 0; ic != size; ++ic) {
+                e += A[r * size + ic] * B[ic * size + c];
+            }
+            C[r * size + c] = e;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void host_apply_stencil(const std::vector< real_t >& in,
+                        int size,
+                        const std::vector< real_t >& filter,
+                        int filterSize,
+                        std::vector< real_t >& out) {
+    for(int y = filterSize / 2; y < size - filterSize / 2; ++y) {
+        for(int x = filterSize / 2; x < size - filterSize / 2; ++x) {
+            real_t e = real_t(0);
+            for(int fy = -filterSize / 2; fy <= filterSize / 2; ++fy) {
+                for(int fx = -filterSize / 2; fx <= filterSize / 2; ++fx) {
+                    e += in[(y + fy) * size + x + fx]
+                         * filter[(filterSize / 2 + fy) * filterSize
+                                  + filterSize / 2 + fx];
+                }
+            }
+            out[y * size + x] = e / real_t(filterSize * filterSize);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+bool check_result(const std::vector< real_t >& v1,
+                  const std::vector< real_t >& v2,
+                  double eps) {
+    for(size_t i = 0; i != v1.size(); ++i) {
+        if(double(std::fabs(v1[i] - v2[i])) > eps) return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+cl_mem create_buffer(cl_context ctx, cl_mem_flags flags, size_t size) {
+    cl_int status;
+    cl_mem b = clCreateBuffer(ctx, flags, size, 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    return b;
+}
+
+//------------------------------------------------------------------------------
+//host and device data of one batch: one matrix multiply and one stencil
+struct Batch {
+    std::vector< real_t > A, B, C, refC;
+    std::vector< real_t > in, out, refOut;
+    cl_mem devA, devB, devC;
+    cl_mem devIn, devOut;
+};
+
+//------------------------------------------------------------------------------
+//each batch is made of two independent chains:
+// write A, write B -> matmul -> read C
+// write in -> stencil -> read out
+//the filter is written once and shared by all the stencil nodes
+void add_batches(CLTaskGraph& g,
+                 std::vector< Batch >& batches,
+                 cl_kernel matmul,
+                 cl_kernel stencil,
+                 cl_mem devFilter,
+                 const std::vector< real_t >& filter,
+                 int MATRIX_SIZE,
+                 int GRID_SIZE,
+                 int FILTER_SIZE,
+                 int BLOCK_SIZE) {
+    const size_t MATRIX_BYTE_SIZE = MATRIX_SIZE * MATRIX_SIZE * sizeof(real_t);
+    const size_t GRID_BYTE_SIZE = GRID_SIZE * GRID_SIZE * sizeof(real_t);
+    const size_t matmulGlobal[2] = {size_t(MATRIX_SIZE), size_t(MATRIX_SIZE)};
+    const size_t stencilGlobal[2] = {size_t(GRID_SIZE - 2 * (FILTER_SIZE / 2)),
+                                     size_t(GRID_SIZE - 2 * (FILTER_SIZE / 2))};
+    const size_t local[2] = {size_t(BLOCK_SIZE), size_t(BLOCK_SIZE)};
+    const int wf = add_write_task(g, "write filter", devFilter, 0,
+                                  filter.size() * sizeof(real_t), &filter[0]);
+    for(size_t i = 0; i != batches.size(); ++i) {
+        Batch& b = batches[i];
+        std::ostringstream os;
+        os << '[' << i << ']';
+        const std::string id = os.str();
+        const int wa = add_write_task(g, "write A" + id, b.devA, 0,
+                                      MATRIX_BYTE_SIZE, &b.A[0]);
+        const int wb = add_write_task(g, "write B" + id, b.devB, 0,
+                                      MATRIX_BYTE_SIZE, &b.B[0]);
+        const int mm = add_kernel_task(g, "matmul" + id, matmul, 2,
+                                       matmulGlobal, local, {wa, wb},
+                                       [&b, MATRIX_SIZE](cl_kernel k) {
+            check_cl_error(clSetKernelArg(k, 0, sizeof(cl_mem), &b.devA),
+                           "clSetKernelArg(A)");
+            check_cl_error(clSetKernelArg(k, 1, sizeof(cl_mem), &b.devB),
+                           "clSetKernelArg(B)");
+            check_cl_error(clSetKernelArg(k, 2, sizeof(cl_mem), &b.devC),
+                           "clSetKernelArg(C)");
+            check_cl_error(clSetKernelArg(k, 3, sizeof(int), &MATRIX_SIZE),
+                           "clSetKernelArg(size)");
+        });
+        add_read_task(g, "read C" + id, b.devC, 0, MATRIX_BYTE_SIZE,
+                      &b.C[0], {mm});
+        const int wi = add_write_task(g, "write in" + id, b.devIn, 0,
+                                      GRID_BYTE_SIZE, &b.in[0]);
+        const int st = add_kernel_task(g, "stencil" + id, stencil, 2,
+                                       stencilGlobal, local, {wi, wf},
+                                       [&b, devFilter, GRID_SIZE,
+                                        FILTER_SIZE](cl_kernel k) {
+            check_cl_error(clSetKernelArg(k, 0, sizeof(cl_mem), &b.devIn),
+                           "clSetKernelArg(in)");
+            check_cl_error(clSetKernelArg(k, 1, sizeof(int), &GRID_SIZE),
+                           "clSetKernelArg(size)");
+            check_cl_error(clSetKernelArg(k, 2, sizeof(cl_mem), &devFilter),
+                           "clSetKernelArg(filter)");
+            check_cl_error(clSetKernelArg(k, 3, sizeof(int), &FILTER_SIZE),
+                           "clSetKernelArg(filter size)");
+            check_cl_error(clSetKernelArg(k, 4, sizeof(cl_mem), &b.devOut),
+                           "clSetKernelArg(out)");
+        });
+        add_read_task(g, "read out" + id, b.devOut, 0, GRID_BYTE_SIZE,
+                      &b.out[0], {st});
+    }
+}
+
+//------------------------------------------------------------------------------
+//runs graph and returns elapsed wall-clock time in milliseconds
+double time_task_graph(CLTaskGraph& g) {
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    run_task_graph(g);
+    wait_task_graph(g);
+    const std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now();
+    return std::chrono::duration< double, std::milli >(end - start).count();
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 9) {
+        std::cerr << "usage:\n" << argv[0] << '\n'
+                  << "  <platform name>\n"
+                     "  <device type = default | cpu | gpu | acc | all>\n"
+                     "  <device num>\n"
+                     "  <matrix multiply OpenCL source file path>\n"
+                     "  <stencil OpenCL source file path>\n"
+                     "  <matrix size>\n"
+                     "  <stencil grid size>\n"
+                     "  <workgroup size>\n"
+                     "  [batches, default = 4]\n"
+                     "  [queues, default = 0: out-of-order queue if supported]"
+                     "\n  matrix size and stencil grid size - 2 must be evenly"
+                     " divisible by the workgroup size"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int FILTER_SIZE = 3; //3x3
+    const int MATRIX_SIZE = atoi(argv[6]);
+    const int GRID_SIZE = atoi(argv[7]);
+    const int BLOCK_SIZE = atoi(argv[8]);
+    const int BATCHES = argc > 9 ? atoi(argv[9]) : 4;
+    const int QUEUES = argc > 10 ? atoi(argv[10]) : 0;
+    if(BLOCK_SIZE < 1 || MATRIX_SIZE % BLOCK_SIZE != 0
+       || (GRID_SIZE - 2 * (FILTER_SIZE / 2)) % BLOCK_SIZE != 0
+       || BATCHES < 1 || QUEUES < 0) {
+        std::cerr << "ERROR - invalid size, workgroup size, batches or queues"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    //setup text header that will be prefixed to opencl code
+    std::ostringstream clheaderStream;
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n';
+#ifdef USE_DOUBLE
+    clheaderStream << "#define DOUBLE\n";
+    const double EPS = 0.000000001;
+#else
+    const double EPS = 0.00001;
+#endif
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), false,
+                               argv[4], "block_matmul",
+                               clheaderStream.str());
+    //the stencil program is built for the same context: kernels from both
+    //programs can run concurrently
+    cl_program stencilProgram =
+        build_program(clenv.context, get_device_id(clenv.context),
+                      clheaderStream.str() + load_text(argv[5]));
+    CLKernelMap stencilKernels = create_kernels(stencilProgram);
+    if(stencilKernels.find("filter") == stencilKernels.end()) {
+        std::cerr << "ERROR - 'filter' kernel not found in " << argv[5]
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    cl_kernel stencil = stencilKernels["filter"];
+    //create data
+    srand(time(0));
+    const std::vector< real_t > filter = create_filter();
+    std::vector< Batch > batches(BATCHES);
+    for(std::vector< Batch >::iterator b = batches.begin();
+        b != batches.end(); ++b) {
+        b->A = create_matrix(MATRIX_SIZE, MATRIX_SIZE);
+        b->B = create_matrix(MATRIX_SIZE, MATRIX_SIZE);
+        b->C.resize(MATRIX_SIZE * MATRIX_SIZE, real_t(0));
+        b->refC.resize(MATRIX_SIZE * MATRIX_SIZE, real_t(0));
+        host_matmul(b->A, b->B, b->refC, MATRIX_SIZE);
+        b->in = create_matrix(GRID_SIZE, GRID_SIZE);
+        b->out.resize(GRID_SIZE * GRID_SIZE, real_t(0));
+        b->refOut.resize(GRID_SIZE * GRID_SIZE, real_t(0));
+        host_apply_stencil(b->in, GRID_SIZE, filter, FILTER_SIZE, b->refOut);
+        const size_t MATRIX_BYTE_SIZE =
+            MATRIX_SIZE * MATRIX_SIZE * sizeof(real_t);
+        const size_t GRID_BYTE_SIZE = GRID_SIZE * GRID_SIZE * sizeof(real_t);
+        b->devA = create_buffer(clenv.context, CL_MEM_READ_ONLY,
+                                MATRIX_BYTE_SIZE);
+        b->devB = create_buffer(clenv.context, CL_MEM_READ_ONLY,
+                                MATRIX_BYTE_SIZE);
+        b->devC = create_buffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                MATRIX_BYTE_SIZE);
+        b->devIn = create_buffer(clenv.context, CL_MEM_READ_ONLY,
+                                 GRID_BYTE_SIZE);
+        //border elements are not written by the kernel: initialize to zero
+        cl_int status;
+        b->devOut = clCreateBuffer(clenv.context,
+                                   CL_MEM_WRITE_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   GRID_BYTE_SIZE, &b->out[0], &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+    cl_mem devFilter = create_buffer(clenv.context, CL_MEM_READ_ONLY,
+                                     filter.size() * sizeof(real_t));
+
+    //serialized: one in-order queue
+    CLTaskGraph serial = create_task_graph(clenv, 1);
+    add_batches(serial, batches, clenv.kernel, stencil, devFilter, filter,
+                MATRIX_SIZE, GRID_SIZE, FILTER_SIZE, BLOCK_SIZE);
+    time_task_graph(serial); //warm up
+    const double serialTime = time_task_graph(serial);
+    release_task_graph(serial);
+
+    //concurrent: out-of-order queue or multiple in-order queues
+    CLTaskGraph concurrent = create_task_graph(clenv, QUEUES, true);
+    add_batches(concurrent, batches, clenv.kernel, stencil, devFilter, filter,
+                MATRIX_SIZE, GRID_SIZE, FILTER_SIZE, BLOCK_SIZE);
+    for(std::vector< Batch >::iterator b = batches.begin();
+        b != batches.end(); ++b) {
+        std::fill(b->C.begin(), b->C.end(), real_t(0));
+        std::fill(b->out.begin(), b->out.end(), real_t(0));
+    }
+    const double concurrentTime = time_task_graph(concurrent);
+    std::cout << "Queues: " << concurrent.queues.size()
+              << (concurrent.outOfOrder ? " (out-of-order)" : " (in-order)")
+              << std::endl;
+    std::cout << "Timeline:" << std::endl;
+    print_task_timeline(concurrent, std::cout);
+    release_task_graph(concurrent);
+
+    bool passed = true;
+    for(std::vector< Batch >::const_iterator b = batches.begin();
+        b != batches.end(); ++b) {
+        passed = passed && check_result(b->C, b->refC, EPS)
+                        && check_result(b->out, b->refOut, EPS);
+    }
+    std::cout << "Serialized: " << serialTime << " ms" << std::endl;
+    std::cout << "Concurrent: " << concurrentTime << " ms" << std::endl;
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+    for(std::vector< Batch >::iterator b = batches.begin();
+        b != batches.end(); ++b) {
+        check_cl_error(clReleaseMemObject(b->devA), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(b->devB), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(b->devC), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(b->devIn), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(b->devOut), "clReleaseMemObject");
+    }
+    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
+    for(CLKernelMap::iterator k = stencilKernels.begin();
+        k != stencilKernels.end(); ++k) {
+        check_cl_error(clReleaseKernel(k->second), "clReleaseKernel");
+    }
+    check_cl_error(clReleaseProgram(stencilProgram), "clReleaseProgram");
+    release_clenv(clenv);
+    return 0;
+}
@@ -0,0 +1,145 @@
+//Kernel launch overhead: time-stepping stencil loop (ping-pong between two
+//buffers) launched
+// 1) setting all the arguments with clSetKernelArg at each step
+// 2) through the typed launcher in clutil.h which only sets the arguments
+//    that changed since the previous launch
+//the host time spent enqueueing each step is reported for both methods.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 ../src/16_launch_overhead.cpp ../src/clutil.cpp -I../src \
+// -lOpenCL -o 16_launch_overhead
+//
+//./16_launch_overhead "AMD Accelerated Parallel Processing" gpu 0 \
+//  ../src/kernels/07_stencil.cl 258 16 10000
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include "clutil.h"
+
+typedef float real_t;
+
+//------------------------------------------------------------------------------
+double elapsed_us(const std::chrono::steady_clock::time_point& start,
+                  const std::chrono::steady_clock::time_point& end) {
+    return std::chrono::duration< double, std::micro >(end - start).count();
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 8) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <grid size> <workgroup size> <steps>"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int FILTER_SIZE = 3;
+    const int SIZE = atoi(argv[5]);
+    const int BLOCK_SIZE = atoi(argv[6]);
+    const int STEPS = atoi(argv[7]);
+    if(BLOCK_SIZE < 1 || (SIZE - 2 * (FILTER_SIZE / 2)) % BLOCK_SIZE != 0
+       || STEPS < 1) {
+        std::cerr << "ERROR - size - 2 must be evenly divisible by the "
+                     "workgroup size and steps must be greater than zero"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), false,
+                               argv[4], "filter");
+    const size_t BYTE_SIZE = SIZE * SIZE * sizeof(real_t);
+    std::vector< real_t > grid(SIZE * SIZE, real_t(1));
+    const std::vector< real_t > filter(FILTER_SIZE * FILTER_SIZE, real_t(1));
+    cl_int status;
+    cl_mem devGrid[2];
+    for(int i = 0; i != 2; ++i) {
+        devGrid[i] = clCreateBuffer(clenv.context,
+                                    CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                    BYTE_SIZE, &grid[0], &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+    cl_mem devFilter = clCreateBuffer(clenv.context,
+                                      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      filter.size() * sizeof(real_t),
+                                      const_cast< real_t* >(&filter[0]),
+                                      &status);
+    check_cl_error(status, "clCreateBuffer");
+    const size_t globalWorkSize[2] = {size_t(SIZE - 2 * (FILTER_SIZE / 2)),
+                                      size_t(SIZE - 2 * (FILTER_SIZE / 2))};
+    const size_t localWorkSize[2] = {size_t(BLOCK_SIZE), size_t(BLOCK_SIZE)};
+
+    //1) all the arguments set at each step
+    check_cl_error(clFinish(clenv.commandQueue), "clFinish");
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for(int step = 0; step != STEPS; ++step) {
+        const cl_mem in = devGrid[step % 2];
+        const cl_mem out = devGrid[(step + 1) % 2];
+        status = clSetKernelArg(clenv.kernel, 0, sizeof(cl_mem), &in);
+        check_cl_error(status, "clSetKernelArg(in)");
+        status = clSetKernelArg(clenv.kernel, 1, sizeof(int), &SIZE);
+        check_cl_error(status, "clSetKernelArg(size)");
+        status = clSetKernelArg(clenv.kernel, 2, sizeof(cl_mem), &devFilter);
+        check_cl_error(status, "clSetKernelArg(filter)");
+        status = clSetKernelArg(clenv.kernel, 3, sizeof(int), &FILTER_SIZE);
+        check_cl_error(status, "clSetKernelArg(filter size)");
+        status = clSetKernelArg(clenv.kernel, 4, sizeof(cl_mem), &out);
+        check_cl_error(status, "clSetKernelArg(out)");
+        cl_event event;
+        status = clEnqueueNDRangeKernel(clenv.commandQueue, clenv.kernel, 2,
+                                        0, globalWorkSize, localWorkSize,
+                                        0, 0, &event);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        check_cl_error(clReleaseEvent(event), "clReleaseEvent");
+    }
+    std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now();
+    const double explicitEnqueue_us = elapsed_us(start, end);
+    check_cl_error(clFinish(clenv.commandQueue), "clFinish");
+    const double explicitTotal_us =
+        elapsed_us(start, std::chrono::steady_clock::now());
+
+    //2) launcher: only the arguments that changed are set; the signature
+    //   is checked at compile time
+    const CLTypedKernel< cl_mem, int, cl_mem, int, cl_mem >
+        stencil(clenv.kernel);
+    //arguments were set directly above: discard cached values
+    forget_kernel_args(clenv.kernel);
+    start = std::chrono::steady_clock::now();
+    for(int step = 0; step != STEPS; ++step) {
+        cl_event event = launch(clenv.commandQueue, stencil,
+                                CLNDRange(globalWorkSize[0],
+                                          globalWorkSize[1]),
+                                CLNDRange(localWorkSize[0],
+                                          localWorkSize[1]),
+                                devGrid[step % 2], SIZE, devFilter,
+                                FILTER_SIZE, devGrid[(step + 1) % 2]);
+        check_cl_error(clReleaseEvent(event), "clReleaseEvent");
+    }
+    end = std::chrono::steady_clock::now();
+    const double launcherEnqueue_us = elapsed_us(start, end);
+    check_cl_error(clFinish(clenv.commandQueue), "clFinish");
+    const double launcherTotal_us =
+        elapsed_us(start, std::chrono::steady_clock::now());
+    const CLLaunchStats stats = get_launch_stats();
+
+    std::cout << "Steps: " << STEPS << std::endl;
+    std::cout << "clSetKernelArg at each step:\n"
+              << "  enqueue (host) per step: " << explicitEnqueue_us / STEPS
+              << " us\n"
+              << "  total per step: " << explicitTotal_us / STEPS << " us"
+              << std::endl;
+    std::cout << "Launcher:\n"
+              << "  enqueue (host) per step: " << launcherEnqueue_us / STEPS
+              << " us\n"
+              << "  total per step: " << launcherTotal_us / STEPS << " us\n"
+              << "  arguments set: " << stats.argsSet
+              << "  skipped: " << stats.argsSkipped << std::endl;
+
+    check_cl_error(clReleaseMemObject(devGrid[0]), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devGrid[1]), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
+    release_clenv(clenv);
+    return 0;
+}
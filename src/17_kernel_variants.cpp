@@ -0,0 +1,164 @@
+//Kernel specialization sweep: all the variants of the vectorized dot product
+//(VEC_WIDTH 1, 4, 8, 16 x float, double) are built concurrently on a pool of
+//threads then run one after the other; each variant is compiled once, built
+//binaries are stored in the program cache and later runs do not recompile.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/17_kernel_variants.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 17_kernel_variants
+//
+//./17_kernel_variants "AMD Accelerated Parallel Processing" gpu 0 \
+//  ../src/kernels/05_dot_product_vec.cl 16777216 256
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <cmath>
+#include <numeric>
+#include <chrono>
+#include "clutil.h"
+
+//------------------------------------------------------------------------------
+template < typename T >
+std::vector< T > create_vector(int size) {
+    std::vector< T > v(size);
+    for(typename std::vector< T >::iterator i = v.begin();
+        i != v.end(); ++i) *i = rand() % 10;
+    return v;
+}
+
+//------------------------------------------------------------------------------
+//runs the dot product kernel built for spec; returns kernel time in ms,
+//sets 'passed' to the outcome of the comparison with the host result
+template < typename T >
+double run_variant(const CLEnv& clenv,
+                   CLVariantCache& variants,
+                   const CLSpec& spec,
+                   const std::vector< T >& V1,
+                   const std::vector< T >& V2,
+                   int vecWidth,
+                   int blockSize,
+                   bool& passed) {
+    const size_t BYTE_SIZE = V1.size() * sizeof(T);
+    const size_t globalWorkSize[1] = {V1.size() / vecWidth};
+    const size_t localWorkSize[1] = {size_t(blockSize)};
+    const size_t REDUCED_SIZE = globalWorkSize[0] / blockSize;
+    cl_int status;
+    cl_mem devV1 = clCreateBuffer(clenv.context,
+                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  BYTE_SIZE, const_cast< T* >(&V1[0]),
+                                  &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devV2 = clCreateBuffer(clenv.context,
+                                  CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                  BYTE_SIZE, const_cast< T* >(&V2[0]),
+                                  &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devOut = clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                   REDUCED_SIZE * sizeof(T), 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_kernel kernel = create_variant_kernel(variants, spec, "dotprod");
+    check_cl_error(clSetKernelArg(kernel, 0, sizeof(cl_mem), &devV1),
+                   "clSetKernelArg(V1)");
+    check_cl_error(clSetKernelArg(kernel, 1, sizeof(cl_mem), &devV2),
+                   "clSetKernelArg(V2)");
+    check_cl_error(clSetKernelArg(kernel, 2, sizeof(cl_mem), &devOut),
+                   "clSetKernelArg(devOut)");
+    const double time_ms =
+        timeEnqueueNDRangeKernel(clenv.commandQueue, kernel, 1, 0,
+                                 globalWorkSize, localWorkSize, 0, 0);
+    std::vector< T > partialDot(REDUCED_SIZE);
+    status = clEnqueueReadBuffer(clenv.commandQueue, devOut, CL_TRUE, 0,
+                                 REDUCED_SIZE * sizeof(T), &partialDot[0],
+                                 0, 0, 0);
+    check_cl_error(status, "clEnqueueReadBuffer");
+    //values are small integers: per-workgroup partial sums are exact in
+    //single precision, final sums are computed in double precision
+    const double deviceDot = std::accumulate(partialDot.begin(),
+                                             partialDot.end(), 0.0);
+    const double hostDot = std::inner_product(V1.begin(), V1.end(),
+                                              V2.begin(), 0.0);
+    passed = std::fabs(deviceDot - hostDot) <= 1E-9 * std::fabs(hostDot);
+    check_cl_error(clReleaseKernel(kernel), "clReleaseKernel");
+    check_cl_error(clReleaseMemObject(devV1), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devV2), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devOut), "clReleaseMemObject");
+    return time_ms;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 7) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <size> <workgroup size> [build threads, default = "
+                     "number of hardware threads]"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int SIZE = atoi(argv[5]);
+    const int BLOCK_SIZE = atoi(argv[6]);
+    const int THREADS = argc > 7 ? atoi(argv[7]) : 0;
+    const int VEC_WIDTHS[] = {1, 4, 8, 16};
+    const int NUM_WIDTHS = sizeof(VEC_WIDTHS) / sizeof(int);
+    if(SIZE < 1 || BLOCK_SIZE < 1 || SIZE % (16 * BLOCK_SIZE) != 0) {
+        std::cerr << "ERROR - size *must* be evenly divisible by 16 x "
+                     "workgroup size" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    //no program built at creation time
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true, 0, 0);
+    const bool fp64 = get_device_info_string(get_device_id(clenv.context),
+                                             CL_DEVICE_EXTENSIONS)
+                      .find("cl_khr_fp64") != std::string::npos;
+    std::vector< CLSpec > specs;
+    for(int d = 0; d != (fp64 ? 2 : 1); ++d) {
+        for(int w = 0; w != NUM_WIDTHS; ++w) {
+            CLSpec spec;
+            spec_set(spec, "BLOCK_SIZE", BLOCK_SIZE);
+            spec_set(spec, "VEC_WIDTH", VEC_WIDTHS[w]);
+            spec_flag(spec, "DOUBLE", d == 1);
+            specs.push_back(spec);
+        }
+    }
+    //build all variants concurrently
+    CLVariantCache* variants = create_variant_cache(clenv, argv[4], "",
+                                                    THREADS);
+    const std::chrono::steady_clock::time_point buildStart =
+        std::chrono::steady_clock::now();
+    build_variants(*variants, specs);
+    for(std::vector< CLSpec >::const_iterator s = specs.begin();
+        s != specs.end(); ++s) get_variant(*variants, *s);
+    const double buildWall_ms = std::chrono::duration< double, std::milli >(
+        std::chrono::steady_clock::now() - buildStart).count();
+    const CLProgramCacheStats cacheStats = get_program_cache_stats();
+    std::cout << "Variants: " << specs.size()
+              << (fp64 ? "" : " (no double precision support)") << '\n'
+              << "Build wall time(ms): " << buildWall_ms << '\n'
+              << "Sum of build times(ms): " << cacheStats.buildTime_ms
+              << "  cache hits: " << cacheStats.hits
+              << "  misses: " << cacheStats.misses << std::endl;
+
+    srand(time(0));
+    const std::vector< float > V1f = create_vector< float >(SIZE);
+    const std::vector< float > V2f = create_vector< float >(SIZE);
+    const std::vector< double > V1d(V1f.begin(), V1f.end());
+    const std::vector< double > V2d(V2f.begin(), V2f.end());
+    for(std::vector< CLSpec >::const_iterator s = specs.begin();
+        s != specs.end(); ++s) {
+        const int vecWidth = atoi(s->defines.find("VEC_WIDTH")
+                                      ->second.c_str());
+        bool passed = false;
+        const double time_ms = s->defines.count("DOUBLE") ?
+            run_variant(clenv, *variants, *s, V1d, V2d, vecWidth, BLOCK_SIZE,
+                        passed)
+          : run_variant(clenv, *variants, *s, V1f, V2f, vecWidth, BLOCK_SIZE,
+                        passed);
+        std::cout << spec_label(*s) << ": " << time_ms << " ms  "
+                  << (passed ? "PASSED" : "FAILED") << std::endl;
+    }
+    release_variant_cache(variants);
+    release_clenv(clenv);
+    return 0;
+}
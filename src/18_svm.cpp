@@ -0,0 +1,286 @@
+//Shared virtual memory (OpenCL 2.x): matrix multiply and dot product with
+//host and device sharing the same pointers; data are passed to kernels
+//through clSetKernelArgSVMPointer and made visible to the device/host by
+//unmapping/mapping (coarse-grain) or without any command (fine-grain)
+//instead of creating buffers and copying data.
+//The 'compare' mode runs the same computation through both the buffer path
+//and the SVM path and reports the time spent in transfers + kernel for each.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 ../src/18_svm.cpp ../src/clutil.cpp ../src/clutil_svm.cpp \
+// -I../src -lOpenCL -pthread -o 18_svm
+//
+//./18_svm "Portable Computing Language" default 0 \
+//  ../src/kernels/04_matrix_multiply.cl block_matmul 512 16 compare
+//./18_svm "Portable Computing Language" default 0 \
+//  ../src/kernels/05_dot_product.cl dotprod 16777216 256 compare fine
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <chrono>
+#include "clutil.h"
+
+#ifdef USE_DOUBLE
+typedef double real_t;
+#else
+typedef float real_t;
+#endif
+
+//matmul: C = A x B, square matrices;
+//dotprod: one partial dot product of V1 and V2 per workgroup
+struct Problem {
+    bool matmul;
+    int size;
+    int blockSize;
+    size_t inputElements;
+    size_t outputElements;
+};
+
+struct Timing {
+    double kernel_ms;
+    double total_ms; //transfers or map/unmap + kernel
+};
+
+//------------------------------------------------------------------------------
+Problem make_problem(const std::string& kernelName, int size, int blockSize) {
+    Problem p;
+    p.matmul = kernelName != "dotprod";
+    p.size = size;
+    p.blockSize = blockSize;
+    p.inputElements = p.matmul ? size_t(size) * size : size_t(size);
+    p.outputElements = p.matmul ? size_t(size) * size
+                                : size_t(size / blockSize);
+    return p;
+}
+
+//------------------------------------------------------------------------------
+//same seed: identical data in the buffer and SVM paths
+void fill_inputs(real_t* in1, real_t* in2, size_t n) {
+    srand(1);
+    for(size_t i = 0; i != n; ++i) in1[i] = rand() % 10;
+    for(size_t i = 0; i != n; ++i) in2[i] = rand() % 10;
+}
+
+//------------------------------------------------------------------------------
+bool check_result(const Problem& p,
+                  const real_t* in1,
+                  const real_t* in2,
+                  const real_t* out,
+                  double eps) {
+    if(p.matmul) {
+        const int n = p.size;
+        for(int r = 0; r != n; ++r) {
+            for(int c = 0; c != n; ++c) {
+                real_t v = 0;
+                for(int i = 0; i != n; ++i) v += in1[r*n + i] * in2[i*n + c];
+                if(double(std::fabs(v - out[r*n + c])) > eps) return false;
+            }
+        }
+        return true;
+    }
+    double hostDot = 0;
+    for(size_t i = 0; i != p.inputElements; ++i)
+        hostDot += double(in1[i]) * in2[i];
+    double deviceDot = 0;
+    for(size_t i = 0; i != p.outputElements; ++i) deviceDot += out[i];
+    //partial sums are accumulated in real_t on the device
+    return std::fabs(deviceDot - hostDot) <= eps * std::fabs(hostDot);
+}
+
+//------------------------------------------------------------------------------
+double launch(cl_command_queue queue, cl_kernel kernel, const Problem& p) {
+    if(p.matmul) {
+        check_cl_error(clSetKernelArg(kernel, 3, sizeof(int), &p.size),
+                       "clSetKernelArg(SIZE)");
+        const size_t globalWorkSize[2] = {size_t(p.size), size_t(p.size)};
+        const size_t localWorkSize[2] = {size_t(p.blockSize),
+                                         size_t(p.blockSize)};
+        return timeEnqueueNDRangeKernel(queue, kernel, 2, 0, globalWorkSize,
+                                        localWorkSize, 0, 0);
+    }
+    const size_t globalWorkSize[1] = {size_t(p.size)};
+    const size_t localWorkSize[1] = {size_t(p.blockSize)};
+    return timeEnqueueNDRangeKernel(queue, kernel, 1, 0, globalWorkSize,
+                                    localWorkSize, 0, 0);
+}
+
+//------------------------------------------------------------------------------
+double elapsed_ms(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration< double, std::milli >(
+               std::chrono::steady_clock::now() - start).count();
+}
+
+//------------------------------------------------------------------------------
+//host data copied into buffers at creation time, output read back
+bool run_buffers(const CLEnv& clenv, cl_kernel kernel, const Problem& p,
+                 double eps, Timing& t) {
+    const size_t IN_BYTE_SIZE = p.inputElements * sizeof(real_t);
+    const size_t OUT_BYTE_SIZE = p.outputElements * sizeof(real_t);
+    std::vector< real_t > in1(p.inputElements);
+    std::vector< real_t > in2(p.inputElements);
+    std::vector< real_t > out(p.outputElements);
+    fill_inputs(&in1[0], &in2[0], p.inputElements);
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    cl_int status;
+    cl_mem devIn1 = clCreateBuffer(clenv.context,
+                                   CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   IN_BYTE_SIZE, &in1[0], &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devIn2 = clCreateBuffer(clenv.context,
+                                   CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                   IN_BYTE_SIZE, &in2[0], &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devOut = clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                   OUT_BYTE_SIZE, 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    check_cl_error(clSetKernelArg(kernel, 0, sizeof(cl_mem), &devIn1),
+                   "clSetKernelArg(in1)");
+    check_cl_error(clSetKernelArg(kernel, 1, sizeof(cl_mem), &devIn2),
+                   "clSetKernelArg(in2)");
+    check_cl_error(clSetKernelArg(kernel, 2, sizeof(cl_mem), &devOut),
+                   "clSetKernelArg(out)");
+    t.kernel_ms = launch(clenv.commandQueue, kernel, p);
+    enqueue_read(clenv.commandQueue, devOut, 0, OUT_BYTE_SIZE, &out[0], true);
+    t.total_ms = elapsed_ms(start);
+    check_cl_error(clReleaseMemObject(devIn1), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devIn2), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devOut), "clReleaseMemObject");
+    return check_result(p, &in1[0], &in2[0], &out[0], eps);
+}
+
+//------------------------------------------------------------------------------
+//host writes inputs directly into shared memory, kernel receives the same
+//pointers: no buffers and no copies
+bool run_svm(const CLEnv& clenv, cl_kernel kernel, const Problem& p,
+             bool fineGrain, double eps, Timing& t) {
+    const size_t IN_BYTE_SIZE = p.inputElements * sizeof(real_t);
+    const size_t OUT_BYTE_SIZE = p.outputElements * sizeof(real_t);
+    const cl_command_queue queue = clenv.commandQueue;
+    real_t* in1 = static_cast< real_t* >(
+        svm_alloc(clenv.context, IN_BYTE_SIZE, fineGrain, CL_MEM_READ_ONLY));
+    real_t* in2 = static_cast< real_t* >(
+        svm_alloc(clenv.context, IN_BYTE_SIZE, fineGrain, CL_MEM_READ_ONLY));
+    real_t* out = static_cast< real_t* >(
+        svm_alloc(clenv.context, OUT_BYTE_SIZE, fineGrain,
+                  CL_MEM_WRITE_ONLY));
+    //coarse-grain: host access only between map and unmap
+    svm_map(queue, in1, IN_BYTE_SIZE, CL_MAP_WRITE_INVALIDATE_REGION);
+    svm_map(queue, in2, IN_BYTE_SIZE, CL_MAP_WRITE_INVALIDATE_REGION);
+    fill_inputs(in1, in2, p.inputElements);
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    svm_unmap(queue, in1);
+    svm_unmap(queue, in2);
+    set_kernel_arg_svm(kernel, 0, in1);
+    set_kernel_arg_svm(kernel, 1, in2);
+    set_kernel_arg_svm(kernel, 2, out);
+    t.kernel_ms = launch(queue, kernel, p);
+    svm_map(queue, out, OUT_BYTE_SIZE, CL_MAP_READ);
+    t.total_ms = elapsed_ms(start);
+    //reference computed on the host from the same shared memory
+    svm_map(queue, in1, IN_BYTE_SIZE, CL_MAP_READ);
+    svm_map(queue, in2, IN_BYTE_SIZE, CL_MAP_READ);
+    const bool passed = check_result(p, in1, in2, out, eps);
+    svm_unmap(queue, in1);
+    svm_unmap(queue, in2);
+    svm_unmap(queue, out);
+    //memory must not be in use when freed
+    check_cl_error(clFinish(queue), "clFinish");
+    svm_free(clenv.context, in1);
+    svm_free(clenv.context, in2);
+    svm_free(clenv.context, out);
+    return passed;
+}
+
+//------------------------------------------------------------------------------
+void print_timing(const std::string& label, const Timing& t) {
+    std::cout << label << ":\n"
+              << "  kernel: " << t.kernel_ms << " ms\n"
+              << "  transfers + kernel: " << t.total_ms << " ms" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 9) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <kernel name = matmul | block_matmul | dotprod>"
+                     " <size> <workgroup size>"
+                     " <mode = svm | buffer | compare>"
+                     " [SVM granularity = auto | coarse | fine,"
+                     " default = auto]"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const std::string kernelName = argv[5];
+    const int SIZE = atoi(argv[6]);
+    const int BLOCK_SIZE = atoi(argv[7]);
+    const std::string mode = argv[8];
+    const std::string grain = argc > 9 ? argv[9] : "auto";
+    if(SIZE < 1 || BLOCK_SIZE < 1 || (SIZE % BLOCK_SIZE) != 0) {
+        std::cerr << "ERROR - size and block size *must* be greater than "
+                     "zero and size *must* be evenly divisible by block size"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(mode != "svm" && mode != "buffer" && mode != "compare") {
+        std::cerr << "ERROR - invalid mode " << mode << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::ostringstream clheaderStream;
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n';
+#ifdef USE_DOUBLE
+    clheaderStream << "#define DOUBLE\n";
+    const double EPS = 0.000000001;
+#else
+    const double EPS = 0.00001;
+#endif
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true,
+                               argv[4], argv[5], clheaderStream.str());
+    const cl_device_svm_capabilities caps =
+        svm_capabilities(get_device_id(clenv.context));
+    const bool useSVM = mode != "buffer";
+    bool fineGrain = false;
+    if(useSVM) {
+        if(!(caps & CL_DEVICE_SVM_COARSE_GRAIN_BUFFER)) {
+            std::cerr << "ERROR - device does not support shared virtual "
+                         "memory" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        const bool fineSupported = caps & CL_DEVICE_SVM_FINE_GRAIN_BUFFER;
+        if(grain == "fine" && !fineSupported) {
+            std::cerr << "ERROR - device does not support fine-grain shared "
+                         "virtual memory" << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        fineGrain = grain == "fine" || (grain == "auto" && fineSupported);
+        std::cout << "SVM granularity: " << (fineGrain ? "fine" : "coarse")
+                  << std::endl;
+    }
+    const Problem problem = make_problem(kernelName, SIZE, BLOCK_SIZE);
+    bool passed = true;
+    Timing bufferTiming;
+    Timing svmTiming;
+    if(mode != "svm") {
+        passed = run_buffers(clenv, clenv.kernel, problem, EPS, bufferTiming)
+                 && passed;
+        print_timing("Buffers", bufferTiming);
+    }
+    if(useSVM) {
+        passed = run_svm(clenv, clenv.kernel, problem, fineGrain, EPS,
+                         svmTiming) && passed;
+        print_timing("SVM", svmTiming);
+    }
+    if(mode == "compare") {
+        std::cout << "SVM speedup (transfers + kernel): "
+                  << bufferTiming.total_ms / svmTiming.total_ms << std::endl;
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    release_clenv(clenv);
+    return 0;
+}
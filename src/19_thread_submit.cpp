@@ -0,0 +1,190 @@
+//Multi-threaded submission stress test: N host threads launch 'arrayset'
+//concurrently, each on its own output array,
+// 1) through a single command queue and kernel shared by all the threads
+//    and protected by a mutex
+// 2) through per-thread command queues and kernels (see CLThreadEnv in
+//    clutil.h)
+//At the end each thread publishes a marker event; the main thread makes its
+//own queue wait for all the markers before reading back the results.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/19_thread_submit.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 19_thread_submit
+//
+//./19_thread_submit "Portable Computing Language" default 0 \
+//  ../src/kernels/08_arrayset.cl 1048576 8 1000
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include "clutil.h"
+
+typedef float real_t;
+
+//------------------------------------------------------------------------------
+double elapsed_ms(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration< double, std::milli >(
+               std::chrono::steady_clock::now() - start).count();
+}
+
+//------------------------------------------------------------------------------
+//value written by the last launch of each thread
+real_t expected_value(int thread, int launches) {
+    return real_t(thread * launches + launches - 1);
+}
+
+//------------------------------------------------------------------------------
+void launch_arrayset(cl_command_queue queue, cl_kernel kernel, cl_mem out,
+                     size_t size, real_t value) {
+    check_cl_error(clSetKernelArg(kernel, 0, sizeof(cl_mem), &out),
+                   "clSetKernelArg(out)");
+    check_cl_error(clSetKernelArg(kernel, 1, sizeof(real_t), &value),
+                   "clSetKernelArg(value)");
+    const size_t globalWorkSize[1] = {size};
+    check_cl_error(clEnqueueNDRangeKernel(queue, kernel, 1, 0,
+                                          globalWorkSize, 0, 0, 0, 0),
+                   "clEnqueueNDRangeKernel");
+}
+
+//------------------------------------------------------------------------------
+bool check_results(cl_command_queue queue,
+                   const std::vector< cl_mem >& buffers,
+                   size_t size, int launches) {
+    std::vector< real_t > host(size);
+    bool passed = true;
+    for(size_t t = 0; t != buffers.size(); ++t) {
+        enqueue_read(queue, buffers[t], 0, size * sizeof(real_t), &host[0],
+                     true);
+        const real_t v = expected_value(int(t), launches);
+        for(size_t i = 0; i != size && passed; ++i) passed = host[i] == v;
+    }
+    return passed;
+}
+
+//------------------------------------------------------------------------------
+//all the threads serialize on the same queue and kernel
+double run_shared_queue(const CLEnv& clenv,
+                        const std::vector< cl_mem >& buffers,
+                        size_t size, int launches) {
+    std::mutex mutex;
+    std::vector< std::thread > threads;
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for(int t = 0; t != int(buffers.size()); ++t) {
+        threads.push_back(std::thread([&, t]() {
+            for(int l = 0; l != launches; ++l) {
+                std::lock_guard< std::mutex > lock(mutex);
+                launch_arrayset(clenv.commandQueue, clenv.kernel, buffers[t],
+                                size, real_t(t * launches + l));
+            }
+        }));
+    }
+    for(std::vector< std::thread >::iterator t = threads.begin();
+        t != threads.end(); ++t) t->join();
+    check_cl_error(clFinish(clenv.commandQueue), "clFinish");
+    return elapsed_ms(start);
+}
+
+//------------------------------------------------------------------------------
+//each thread submits through its own queue and kernel, no locking
+double run_thread_queues(CLThreadEnv& te,
+                         const std::vector< cl_mem >& buffers,
+                         size_t size, int launches,
+                         std::vector< cl_event >& markers) {
+    std::vector< std::thread > threads;
+    markers.resize(buffers.size());
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for(int t = 0; t != int(buffers.size()); ++t) {
+        threads.push_back(std::thread([&, t]() {
+            const cl_command_queue queue = thread_queue(te);
+            const cl_kernel kernel = thread_kernel(te, "arrayset");
+            for(int l = 0; l != launches; ++l) {
+                launch_arrayset(queue, kernel, buffers[t], size,
+                                real_t(t * launches + l));
+            }
+            markers[t] = thread_marker(te);
+            check_cl_error(clFlush(queue), "clFlush");
+        }));
+    }
+    for(std::vector< std::thread >::iterator t = threads.begin();
+        t != threads.end(); ++t) t->join();
+    check_cl_error(clWaitForEvents(cl_uint(markers.size()), &markers[0]),
+                   "clWaitForEvents");
+    return elapsed_ms(start);
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 8) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <array size> <number of threads>"
+                     " <launches per thread>"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const size_t SIZE = size_t(atol(argv[5]));
+    const int THREADS = atoi(argv[6]);
+    const int LAUNCHES = atoi(argv[7]);
+    if(SIZE < 1 || THREADS < 1 || LAUNCHES < 1) {
+        std::cerr << "ERROR - array size, number of threads and launches "
+                     "*must* be greater than zero" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), false,
+                               argv[4], "arrayset");
+    std::vector< cl_mem > buffers;
+    for(int t = 0; t != THREADS; ++t) {
+        cl_int status;
+        buffers.push_back(clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                         SIZE * sizeof(real_t), 0, &status));
+        check_cl_error(status, "clCreateBuffer");
+    }
+
+    //1) single queue
+    const double sharedTime = run_shared_queue(clenv, buffers, SIZE,
+                                               LAUNCHES);
+    const bool sharedPassed = check_results(clenv.commandQueue, buffers,
+                                            SIZE, LAUNCHES);
+
+    //2) per-thread queues
+    CLThreadEnv* te = create_thread_env(clenv);
+    std::vector< cl_event > markers;
+    const double threadTime = run_thread_queues(*te, buffers, SIZE, LAUNCHES,
+                                                markers);
+    //the main thread's queue waits for the commands of all the other
+    //threads before reading
+    thread_wait(*te, markers);
+    const bool threadPassed = check_results(thread_queue(*te), buffers,
+                                            SIZE, LAUNCHES);
+    std::cout << "Threads: " << THREADS << "  launches per thread: "
+              << LAUNCHES << std::endl;
+    std::cout << "Shared queue:\n"
+              << "  total: " << sharedTime << " ms\n"
+              << "  per launch: "
+              << 1000 * sharedTime / (THREADS * LAUNCHES) << " us"
+              << std::endl;
+    std::cout << "Per-thread queues (" << thread_queue_count(*te) << "):\n"
+              << "  total: " << threadTime << " ms\n"
+              << "  per launch: "
+              << 1000 * threadTime / (THREADS * LAUNCHES) << " us"
+              << std::endl;
+    std::cout << (sharedPassed && threadPassed ? "PASSED" : "FAILED")
+              << std::endl;
+
+    for(std::vector< cl_event >::iterator e = markers.begin();
+        e != markers.end(); ++e) {
+        check_cl_error(clReleaseEvent(*e), "clReleaseEvent");
+    }
+    release_thread_env(te);
+    for(std::vector< cl_mem >::iterator b = buffers.begin();
+        b != buffers.end(); ++b) {
+        check_cl_error(clReleaseMemObject(*b), "clReleaseMemObject");
+    }
+    release_clenv(clenv);
+    return 0;
+}
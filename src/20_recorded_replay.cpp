@@ -0,0 +1,180 @@
+//Recorded command sequences: headless time-stepping stencil loop
+//(ping-pong between two buffers)
+// 1) issuing clSetKernelArg and clEnqueueNDRangeKernel at each step
+// 2) replaying a recorded sequence through the pre-bound enqueue loop
+// 3) replaying a recorded sequence through cl_khr_command_buffer, if
+//    supported by the device
+//the host time spent enqueueing each step and the total time per step are
+//reported; results of all methods must match.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/20_recorded_replay.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 20_recorded_replay
+//
+//./20_recorded_replay "Portable Computing Language" default 0 \
+//  ../src/kernels/07_stencil.cl 258 16 10000
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <chrono>
+#include "clutil.h"
+
+typedef float real_t;
+
+struct StepTiming {
+    double enqueue_us;
+    double total_us;
+};
+
+//------------------------------------------------------------------------------
+double elapsed_us(const std::chrono::steady_clock::time_point& start,
+                  const std::chrono::steady_clock::time_point& end) {
+    return std::chrono::duration< double, std::micro >(end - start).count();
+}
+
+//------------------------------------------------------------------------------
+void reset_grids(cl_command_queue queue, cl_mem devGrid[2],
+                 const std::vector< real_t >& grid) {
+    for(int i = 0; i != 2; ++i) {
+        enqueue_write(queue, devGrid[i], 0, grid.size() * sizeof(real_t),
+                      &grid[0], true);
+    }
+}
+
+//------------------------------------------------------------------------------
+void print_timing(const std::string& label, const StepTiming& t, int steps) {
+    std::cout << label << ":\n"
+              << "  enqueue (host) per step: " << t.enqueue_us / steps
+              << " us\n"
+              << "  total per step: " << t.total_us / steps << " us"
+              << std::endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 8) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <grid size> <workgroup size> <steps>"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int FILTER_SIZE = 3;
+    const int SIZE = atoi(argv[5]);
+    const int BLOCK_SIZE = atoi(argv[6]);
+    const int STEPS = atoi(argv[7]);
+    if(BLOCK_SIZE < 1 || (SIZE - 2 * (FILTER_SIZE / 2)) % BLOCK_SIZE != 0
+       || STEPS < 1) {
+        std::cerr << "ERROR - size - 2 must be evenly divisible by the "
+                     "workgroup size and steps must be greater than zero"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), false,
+                               argv[4], "filter");
+    const size_t BYTE_SIZE = SIZE * SIZE * sizeof(real_t);
+    //values in [0, 1] and normalized filter: no overflow for long runs
+    std::vector< real_t > grid(SIZE * SIZE);
+    srand(1);
+    for(std::vector< real_t >::iterator i = grid.begin(); i != grid.end();
+        ++i) *i = real_t(rand() % 10) / 10;
+    const std::vector< real_t > filter(FILTER_SIZE * FILTER_SIZE,
+                                       real_t(1) / (FILTER_SIZE
+                                                    * FILTER_SIZE));
+    cl_int status;
+    cl_mem devGrid[2];
+    for(int i = 0; i != 2; ++i) {
+        devGrid[i] = clCreateBuffer(clenv.context, CL_MEM_READ_WRITE,
+                                    BYTE_SIZE, 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+    cl_mem devFilter = clCreateBuffer(clenv.context,
+                                      CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      filter.size() * sizeof(real_t),
+                                      const_cast< real_t* >(&filter[0]),
+                                      &status);
+    check_cl_error(status, "clCreateBuffer");
+    const CLNDRange global(SIZE - 2 * (FILTER_SIZE / 2),
+                           SIZE - 2 * (FILTER_SIZE / 2));
+    const CLNDRange local(BLOCK_SIZE, BLOCK_SIZE);
+    //result after STEPS steps is in devGrid[STEPS % 2]
+    std::vector< real_t > reference(SIZE * SIZE);
+    std::vector< real_t > result(SIZE * SIZE);
+    bool passed = true;
+
+    //1) per-iteration enqueue
+    reset_grids(clenv.commandQueue, devGrid, grid);
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for(int step = 0; step != STEPS; ++step) {
+        const cl_mem in = devGrid[step % 2];
+        const cl_mem out = devGrid[(step + 1) % 2];
+        status = clSetKernelArg(clenv.kernel, 0, sizeof(cl_mem), &in);
+        check_cl_error(status, "clSetKernelArg(in)");
+        status = clSetKernelArg(clenv.kernel, 1, sizeof(int), &SIZE);
+        check_cl_error(status, "clSetKernelArg(size)");
+        status = clSetKernelArg(clenv.kernel, 2, sizeof(cl_mem), &devFilter);
+        check_cl_error(status, "clSetKernelArg(filter)");
+        status = clSetKernelArg(clenv.kernel, 3, sizeof(int), &FILTER_SIZE);
+        check_cl_error(status, "clSetKernelArg(filter size)");
+        status = clSetKernelArg(clenv.kernel, 4, sizeof(cl_mem), &out);
+        check_cl_error(status, "clSetKernelArg(out)");
+        status = clEnqueueNDRangeKernel(clenv.commandQueue, clenv.kernel, 2,
+                                        0, global.size, local.size,
+                                        0, 0, 0);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+    }
+    StepTiming perIteration;
+    perIteration.enqueue_us = elapsed_us(start,
+                                         std::chrono::steady_clock::now());
+    check_cl_error(clFinish(clenv.commandQueue), "clFinish");
+    perIteration.total_us = elapsed_us(start,
+                                       std::chrono::steady_clock::now());
+    enqueue_read(clenv.commandQueue, devGrid[STEPS % 2], 0, BYTE_SIZE,
+                 &reference[0], true);
+    print_timing("Per-iteration enqueue", perIteration, STEPS);
+
+    //2) and 3) recorded once, replayed with a single call; constant
+    //arguments are set before finalizing the recording
+    status = clSetKernelArg(clenv.kernel, 1, sizeof(int), &SIZE);
+    check_cl_error(status, "clSetKernelArg(size)");
+    status = clSetKernelArg(clenv.kernel, 2, sizeof(cl_mem), &devFilter);
+    check_cl_error(status, "clSetKernelArg(filter)");
+    status = clSetKernelArg(clenv.kernel, 3, sizeof(int), &FILTER_SIZE);
+    check_cl_error(status, "clSetKernelArg(filter size)");
+    const bool commandBuffer = command_buffer_supported(clenv.commandQueue);
+    for(int m = 0; m != (commandBuffer ? 2 : 1); ++m) {
+        CLRecording rec = create_recording(clenv.commandQueue);
+        record_kernel(rec, clenv.kernel, global, local);
+        record_ping_pong(rec, 0, devGrid[0], devGrid[1]);
+        record_ping_pong(rec, 4, devGrid[1], devGrid[0]);
+        finalize_recording(rec, m == 1);
+        reset_grids(clenv.commandQueue, devGrid, grid);
+        start = std::chrono::steady_clock::now();
+        replay_recording(rec, STEPS);
+        StepTiming replay;
+        replay.enqueue_us = elapsed_us(start,
+                                       std::chrono::steady_clock::now());
+        check_cl_error(clFinish(clenv.commandQueue), "clFinish");
+        replay.total_us = elapsed_us(start, std::chrono::steady_clock::now());
+        enqueue_read(clenv.commandQueue, devGrid[STEPS % 2], 0, BYTE_SIZE,
+                     &result[0], true);
+        passed = passed && result == reference;
+        print_timing(rec.commandBuffers.empty() ?
+                     "Recorded, enqueue loop replay"
+                     : "Recorded, cl_khr_command_buffer replay",
+                     replay, STEPS);
+        release_recording(rec);
+    }
+    if(!commandBuffer) {
+        std::cout << "cl_khr_command_buffer not supported" << std::endl;
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+    check_cl_error(clReleaseMemObject(devGrid[0]), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devGrid[1]), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devFilter), "clReleaseMemObject");
+    release_clenv(clenv);
+    return 0;
+}
@@ -0,0 +1,298 @@
+//Batched multiply of small matrices: sweep over matrix sizes x batch sizes,
+//all the products of a batch are computed by a single kernel launch of
+// 1) batched_gemm: matrices stored at fixed strides
+// 2) batched_gemm_indexed: matrix offsets read from an array, equivalent of
+//    a batch of pointers; A and C are stored in reverse order and B is
+//    shared by pairs of products
+//one or more matrices are assigned to each workgroup and kept in local
+//memory, matrices too large for local memory are read from global memory;
+//one program variant per matrix size is built (see CLVariantCache in
+//clutil.h). Kernel time, GFLOP/s and matrices per second are reported.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/21_batched_gemm.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 21_batched_gemm
+//
+//./21_batched_gemm "Portable Computing Language" default 0 \
+//  ../src/kernels/21_batched_gemm.cl 8,16,32,64 100,1000,10000
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <climits>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include "clutil.h"
+
+#ifdef USE_DOUBLE
+typedef double real_t;
+#else
+typedef float real_t;
+#endif
+
+typedef std::vector< real_t > Matrices;
+
+//------------------------------------------------------------------------------
+std::vector< int > parse_list(const char* text) {
+    std::vector< int > values;
+    std::istringstream is(text);
+    std::string v;
+    while(std::getline(is, v, ',')) values.push_back(atoi(v.c_str()));
+    return values;
+}
+
+//------------------------------------------------------------------------------
+Matrices create_matrices(int count, int size) {
+    Matrices m(size_t(count) * size * size);
+    for(Matrices::iterator i = m.begin(); i != m.end(); ++i) *i = rand() % 10;
+    return m;
+}
+
+//------------------------------------------------------------------------------
+//'requested' or, if zero, enough matrices for each work item to compute at
+//least one element; bounded by the available local memory, zero if a single
+//matrix does not fit: operands are then read from global memory, see kernel
+//source
+int matrices_per_group(int size, int groupSize, size_t localMemSize,
+                       int requested) {
+    const size_t matrixBytes = 2 * size * size * sizeof(real_t)
+                               + 3 * sizeof(int);
+    const int fit = int(localMemSize / matrixBytes);
+    return std::min(requested > 0 ? requested
+                    : (groupSize + size * size - 1) / (size * size), fit);
+}
+
+//------------------------------------------------------------------------------
+//offsets of A, B and C of each product, see batched_gemm_indexed
+std::vector< int > strided_offsets(int count, int size) {
+    std::vector< int > offsets(3 * count);
+    for(int i = 0; i != count; ++i) {
+        offsets[3 * i] = offsets[3 * i + 1] = offsets[3 * i + 2] =
+            i * size * size;
+    }
+    return offsets;
+}
+
+//------------------------------------------------------------------------------
+std::vector< int > indexed_offsets(int count, int size) {
+    std::vector< int > offsets(3 * count);
+    for(int i = 0; i != count; ++i) {
+        offsets[3 * i] = (count - 1 - i) * size * size;
+        offsets[3 * i + 1] = (i / 2) * size * size;
+        offsets[3 * i + 2] = (count - 1 - i) * size * size;
+    }
+    return offsets;
+}
+
+//------------------------------------------------------------------------------
+void host_batched_matmul(const Matrices& A,
+                         const Matrices& B,
+                         Matrices& C,
+                         int size,
+                         const std::vector< int >& offsets) {
+    for(size_t i = 0; i != offsets.size(); i += 3) {
+        const real_t* a = &A[offsets[i]];
+        const real_t* b = &B[offsets[i + 1]];
+        real_t* c = &C[offsets[i + 2]];
+        for(int r = 0; r != size; ++r) {
+            for(int col = 0; col != size; ++col) {
+                real_t s = 0;
+                for(int k = 0; k != size; ++k) {
+                    s += a[r * size + k] * b[k * size + col];
+                }
+                c[r * size + col] = s;
+            }
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+bool check_result(const Matrices& v1, const Matrices& v2, double eps) {
+    for(size_t i = 0; i != v1.size(); ++i) {
+        if(double(std::fabs(v1[i] - v2[i])) > eps) return false;
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+//runs one batch through 'kernel'; returns kernel time in ms, sets 'passed'
+//to the outcome of the comparison with the host result
+double run_batch(const CLEnv& clenv,
+                 cl_kernel kernel,
+                 bool indexed,
+                 const Matrices& A,
+                 const Matrices& B,
+                 int count,
+                 int size,
+                 int matricesPerGroup,
+                 int groupSize,
+                 double eps,
+                 bool& passed) {
+    const cl_device_id device = get_device_id(clenv.context);
+    const size_t BYTE_SIZE = A.size() * sizeof(real_t);
+    const std::vector< int > offsets = indexed ?
+                                       indexed_offsets(count, size)
+                                       : strided_offsets(count, size);
+    cl_int status;
+    cl_mem devA = clCreateBuffer(clenv.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 BYTE_SIZE, const_cast< real_t* >(&A[0]),
+                                 &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devB = clCreateBuffer(clenv.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 BYTE_SIZE, const_cast< real_t* >(&B[0]),
+                                 &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devC = clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                 BYTE_SIZE, 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devOffsets = clCreateBuffer(clenv.context,
+                                       CL_MEM_READ_ONLY
+                                       | CL_MEM_COPY_HOST_PTR,
+                                       offsets.size() * sizeof(int),
+                                       const_cast< int* >(&offsets[0]),
+                                       &status);
+    check_cl_error(status, "clCreateBuffer");
+    const cl_mem args[] = {devA, devB, devC};
+    for(int i = 0; i != 3; ++i) {
+        status = clSetKernelArg(kernel, i, sizeof(cl_mem), &args[i]);
+        check_cl_error(status, "clSetKernelArg");
+    }
+    status = clSetKernelArg(kernel, 3, sizeof(int), &count);
+    check_cl_error(status, "clSetKernelArg(count)");
+    if(indexed) {
+        status = clSetKernelArg(kernel, 4, sizeof(cl_mem), &devOffsets);
+        check_cl_error(status, "clSetKernelArg(offsets)");
+    } else {
+        const int stride = size * size;
+        for(int i = 4; i != 7; ++i) {
+            status = clSetKernelArg(kernel, i, sizeof(int), &stride);
+            check_cl_error(status, "clSetKernelArg(stride)");
+        }
+    }
+    //the kernel supports any workgroup size: clamp to the kernel limit
+    size_t maxGroupSize = 0;
+    status = clGetKernelWorkGroupInfo(kernel, device,
+                                      CL_KERNEL_WORK_GROUP_SIZE,
+                                      sizeof(size_t), &maxGroupSize, 0);
+    check_cl_error(status, "clGetKernelWorkGroupInfo");
+    const size_t localWorkSize[1] = {std::min(size_t(groupSize),
+                                              maxGroupSize)};
+    const int groupMatrices = std::max(matricesPerGroup, 1);
+    const size_t groups = (count + groupMatrices - 1) / groupMatrices;
+    const size_t globalWorkSize[1] = {groups * localWorkSize[0]};
+    const double time_ms =
+        timeEnqueueNDRangeKernel(clenv.commandQueue, kernel, 1, 0,
+                                 globalWorkSize, localWorkSize, 0, 0);
+    Matrices C(A.size());
+    enqueue_read(clenv.commandQueue, devC, 0, BYTE_SIZE, &C[0], true);
+    Matrices refC(A.size());
+    host_batched_matmul(A, B, refC, size, offsets);
+    passed = check_result(refC, C, eps);
+    check_cl_error(clReleaseMemObject(devA), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devB), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devC), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devOffsets), "clReleaseMemObject");
+    return time_ms;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 7) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <matrix sizes e.g. 8,16,32,64>"
+                     " <batch sizes e.g. 100,1000,10000>"
+                     " [workgroup size, default = 256]"
+                     " [matrices per workgroup, default = auto]"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const std::vector< int > SIZES = parse_list(argv[5]);
+    const std::vector< int > COUNTS = parse_list(argv[6]);
+    const int GROUP_SIZE = argc > 7 ? atoi(argv[7]) : 256;
+    const int MATRICES_PER_GROUP = argc > 8 ? atoi(argv[8]) : 0;
+    const int maxSize = SIZES.empty() ? 0 :
+                        *std::max_element(SIZES.begin(), SIZES.end());
+    const int maxCount = COUNTS.empty() ? 0 :
+                         *std::max_element(COUNTS.begin(), COUNTS.end());
+    if(SIZES.empty() || COUNTS.empty()
+       || *std::min_element(SIZES.begin(), SIZES.end()) < 1
+       || *std::min_element(COUNTS.begin(), COUNTS.end()) < 1
+       || double(maxCount) * maxSize * maxSize > INT_MAX
+       || GROUP_SIZE < 1 || MATRICES_PER_GROUP < 0) {
+        std::cerr << "ERROR - matrix sizes, batch sizes and workgroup size "
+                     "*must* be greater than zero and offsets *must* fit "
+                     "into an int" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+#ifdef USE_DOUBLE
+    const double EPS = 0.000000001;
+#else
+    const double EPS = 0.00001;
+#endif
+    //no program built at creation time
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true, 0, 0);
+    const cl_device_id device = get_device_id(clenv.context);
+    cl_ulong localMemSize = 0;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_LOCAL_MEM_SIZE,
+                                   sizeof(cl_ulong), &localMemSize, 0),
+                   "clGetDeviceInfo(CL_DEVICE_LOCAL_MEM_SIZE)");
+    //one variant per matrix size, all built concurrently
+    std::vector< CLSpec > specs(SIZES.size());
+    std::vector< int > matricesPerGroup(SIZES.size());
+    for(size_t s = 0; s != SIZES.size(); ++s) {
+        matricesPerGroup[s] = matrices_per_group(SIZES[s], GROUP_SIZE,
+                                                 size_t(localMemSize),
+                                                 MATRICES_PER_GROUP);
+        spec_set(specs[s], "MAT_M", SIZES[s]);
+        spec_set(specs[s], "MAT_N", SIZES[s]);
+        spec_set(specs[s], "MAT_K", SIZES[s]);
+        spec_set(specs[s], "MATS_PER_GROUP", matricesPerGroup[s]);
+#ifdef USE_DOUBLE
+        spec_flag(specs[s], "DOUBLE");
+#endif
+    }
+    CLVariantCache* variants = create_variant_cache(clenv, argv[4]);
+    build_variants(*variants, specs);
+
+    srand(time(0));
+    std::cout << "size  batch  layout  matrices/group  time(ms)  GFLOP/s"
+                 "  matrices/s" << std::endl;
+    bool passed = true;
+    for(size_t s = 0; s != SIZES.size(); ++s) {
+        const int n = SIZES[s];
+        const char* names[] = {"batched_gemm", "batched_gemm_indexed"};
+        for(int k = 0; k != 2; ++k) {
+            cl_kernel kernel = create_variant_kernel(*variants, specs[s],
+                                                     names[k]);
+            for(std::vector< int >::const_iterator c = COUNTS.begin();
+                c != COUNTS.end(); ++c) {
+                const Matrices A = create_matrices(*c, n);
+                const Matrices B = create_matrices(*c, n);
+                bool batchPassed = false;
+                const double time_ms = run_batch(clenv, kernel, k == 1, A, B,
+                                                 *c, n, matricesPerGroup[s],
+                                                 GROUP_SIZE, EPS,
+                                                 batchPassed);
+                passed = passed && batchPassed;
+                std::cout << n << "  " << *c << "  "
+                          << (k == 1 ? "indexed" : "strided") << "  "
+                          << std::max(matricesPerGroup[s], 1)
+                          << (matricesPerGroup[s] > 0 ? "" : " (global)")
+                          << "  " << time_ms << "  "
+                          << 2 * double(n) * n * n * *c / (time_ms * 1E6)
+                          << "  " << *c / (time_ms / 1000)
+                          << (batchPassed ? "" : "  FAILED") << std::endl;
+            }
+            check_cl_error(clReleaseKernel(kernel), "clReleaseKernel");
+        }
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+    release_variant_cache(variants);
+    release_clenv(clenv);
+    return 0;
+}
@@ -0,0 +1,373 @@
+//Out-of-core matrix multiply: C = A x B with matrices larger than device
+//memory. C is partitioned into tiles of panel x panel elements; for each
+//tile the matching row-panel of A and column-panel of B are streamed
+//through rotating sets of device buffers (two by default: double buffering)
+//and multiplied by the gemm kernel in 04_matrix_multiply.cl.
+//Transfers are enqueued on a transfer queue and kernels on a separate
+//compute queue: the upload of the panels of tile t + 1 and the download of
+//tile t - 1 overlap the multiplication of tile t. A row-panels are uploaded
+//once and reused by all the tiles of a row, B column-panels and C tiles are
+//transferred as rectangular regions of the host matrices.
+//Reported: total GFLOP/s, kernel and transfer busy times and the fraction
+//of the shorter of the two hidden by the overlap; one buffer set gives the
+//serialized baseline. Results are validated on a sample of rows.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/22_out_of_core_gemm.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 22_out_of_core_gemm
+//
+//./22_out_of_core_gemm "Portable Computing Language" default 0 \
+//  ../src/kernels/04_matrix_multiply.cl 32768 auto 2
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <climits>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include "clutil.h"
+
+#ifdef USE_DOUBLE
+typedef double real_t;
+#else
+typedef float real_t;
+#endif
+
+//host matrices do not fit into pinned regions (see CLPinnedArena): page
+//aligned pageable memory
+typedef CLAlignedVector< real_t > Matrix;
+
+//gemm compile time parameters, see kernel source
+const int BLOCK_SIZE = 16;
+const int TM = 4;
+const int TN = 4;
+const int TK = 16;
+
+//------------------------------------------------------------------------------
+void init_matrix(Matrix& m) {
+    for(Matrix::iterator i = m.begin(); i != m.end(); ++i) *i = rand() % 10;
+}
+
+//------------------------------------------------------------------------------
+//time between start and end of command execution
+double busy_ms(cl_event ev) {
+    cl_ulong start = 0;
+    cl_ulong end = 0;
+    check_cl_error(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START,
+                                           sizeof(cl_ulong), &start, 0),
+                   "clGetEventProfilingInfo");
+    check_cl_error(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END,
+                                           sizeof(cl_ulong), &end, 0),
+                   "clGetEventProfilingInfo");
+    return double(end - start) / 1E6;
+}
+
+//------------------------------------------------------------------------------
+//largest panel size p, multiple of 'multiple', such that 'depth' sets of
+//p x K (A), K x p (B) and p x p (C) buffers fit into a quarter of the
+//device memory and no buffer is larger than CL_DEVICE_MAX_MEM_ALLOC_SIZE
+size_t auto_panel_size(cl_device_id device, size_t K, int depth,
+                       size_t multiple) {
+    cl_ulong globalMem = 0;
+    cl_ulong maxAlloc = 0;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE,
+                                   sizeof(cl_ulong), &globalMem, 0),
+                   "clGetDeviceInfo");
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                                   sizeof(cl_ulong), &maxAlloc, 0),
+                   "clGetDeviceInfo");
+    //p^2 + 2 K p <= budget
+    const double budget = double(globalMem) / 4 / depth / sizeof(real_t);
+    const double k = double(K);
+    size_t p = size_t(std::sqrt(k * k + budget) - k);
+    p = std::min(p, size_t(maxAlloc / sizeof(real_t) / K));
+    p = std::min(p, size_t(std::sqrt(double(maxAlloc / sizeof(real_t)))));
+    return p - p % multiple;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 6) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <matrix size | MxNxK> [panel size | auto, default ="
+                     " auto] [buffer sets, default = 2]"
+                     " [validated rows, default = 16]\n"
+                     "'auto' selects the largest panel size for which the "
+                     "buffers fit into a quarter of the device memory"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    size_t M = 0;
+    size_t N = 0;
+    size_t K = 0;
+    if(sscanf(argv[5], "%zux%zux%zu", &M, &N, &K) != 3) {
+        M = N = K = size_t(atol(argv[5]));
+    }
+    const int DEPTH = argc > 7 ? atoi(argv[7]) : 2;
+    const int CHECK_ROWS = argc > 8 ? atoi(argv[8]) : 16;
+    const size_t MULTIPLE = BLOCK_SIZE * std::max(TM, TN);
+    if(M < 1 || N < 1 || K < 1 || DEPTH < 1 || CHECK_ROWS < 0) {
+        std::cerr << "ERROR - sizes and number of buffer sets *must* be "
+                     "greater than zero" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::ostringstream clheaderStream;
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n'
+                   << "#define TM " << TM << '\n'
+                   << "#define TN " << TN << '\n'
+                   << "#define TK " << TK << '\n';
+#ifdef USE_DOUBLE
+    clheaderStream << "#define DOUBLE\n";
+    const double EPS = 0.000000001;
+#else
+    const double EPS = 0.00001;
+#endif
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true,
+                               argv[4], "gemm", clheaderStream.str());
+    const cl_device_id device = get_device_id(clenv.context);
+    const size_t PANEL = argc < 7 || std::string(argv[6]) == "auto" ?
+                         auto_panel_size(device, K, DEPTH, MULTIPLE)
+                         : size_t(atol(argv[6]));
+    if(PANEL < 1 || PANEL * K > INT_MAX || PANEL * PANEL > INT_MAX) {
+        std::cerr << "ERROR - panel size *must* be greater than zero and "
+                     "panel size x K *must* fit into an int" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    //tiles of C: ROW_PANELS x COLUMN_PANELS, edge tiles are smaller
+    const size_t MB = std::min(PANEL, M);
+    const size_t NB = std::min(PANEL, N);
+    const size_t ROW_PANELS = (M + MB - 1) / MB;
+    const size_t COLUMN_PANELS = (N + NB - 1) / NB;
+    const size_t TILES = ROW_PANELS * COLUMN_PANELS;
+
+    cl_ulong globalMem = 0;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE,
+                                   sizeof(cl_ulong), &globalMem, 0),
+                   "clGetDeviceInfo");
+    const double matrixBytes = double(M * K + K * N + M * N)
+                               * sizeof(real_t);
+    std::cout << "Matrix size: " << M << " x " << N << " x " << K
+              << "  panel size: " << PANEL << "  buffer sets: " << DEPTH
+              << "\nMatrices: " << matrixBytes / (1 << 20) << " MiB  "
+              << "device memory: " << double(globalMem) / (1 << 20)
+              << " MiB (" << matrixBytes / globalMem << " x)\n"
+              << "Tiles: " << ROW_PANELS << " x " << COLUMN_PANELS
+              << std::endl;
+
+    Matrix A(M * K);
+    Matrix B(K * N);
+    Matrix C(M * N);
+    srand(time(0));
+    init_matrix(A);
+    init_matrix(B);
+
+    cl_int status;
+    const cl_command_queue computeQueue = clenv.commandQueue;
+    const cl_command_queue transferQueue =
+        clCreateCommandQueue(clenv.context, device,
+                             CL_QUEUE_PROFILING_ENABLE, &status);
+    check_cl_error(status, "clCreateCommandQueue");
+    //buffers[slot]: A row-panel MB x K, B column-panel K x NB, C tile
+    //MB x NB
+    std::vector< cl_mem > devA(DEPTH);
+    std::vector< cl_mem > devB(DEPTH);
+    std::vector< cl_mem > devC(DEPTH);
+    for(int slot = 0; slot != DEPTH; ++slot) {
+        devA[slot] = clCreateBuffer(clenv.context, CL_MEM_READ_ONLY,
+                                    MB * K * sizeof(real_t), 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+        devB[slot] = clCreateBuffer(clenv.context, CL_MEM_READ_ONLY,
+                                    K * NB * sizeof(real_t), 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+        devC[slot] = clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                    MB * NB * sizeof(real_t), 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+
+    //all events are kept for profiling and released at the end; per-slot
+    //events are not owned:
+    // write A(i) waits for the last kernel which read A slot i % DEPTH
+    // write B(t) waits for kernel(t - DEPTH)
+    // kernel(t) waits for write A(i), write B(t) and read(t - DEPTH)
+    // read(t) waits for kernel(t)
+    std::vector< cl_event > transferEvents;
+    std::vector< cl_event > kernelEvents;
+    std::vector< cl_event > writtenA(DEPTH, cl_event(0));
+    std::vector< cl_event > writtenB(DEPTH, cl_event(0));
+    std::vector< cl_event > computed(DEPTH, cl_event(0));
+    std::vector< cl_event > lastReadA(DEPTH, cl_event(0));
+    std::vector< cl_event > read(DEPTH, cl_event(0));
+    const int KI = int(K);
+    const int LDB = int(NB);
+    const int LDC = int(NB);
+    //enqueues the upload of the panels of tile t
+    const auto write = [&](size_t t) {
+        const size_t i = t / COLUMN_PANELS;
+        const size_t j = t % COLUMN_PANELS;
+        const int slot = int(t % DEPTH);
+        if(j == 0) {
+            const int aSlot = int(i % DEPTH);
+            const size_t rows = std::min(MB, M - i * MB);
+            cl_event ev;
+            cl_event prev = lastReadA[aSlot];
+            status = clEnqueueWriteBuffer(transferQueue, devA[aSlot],
+                                          CL_FALSE, 0,
+                                          rows * K * sizeof(real_t),
+                                          &A[i * MB * K], prev ? 1 : 0,
+                                          prev ? &prev : 0, &ev);
+            check_cl_error(status, "clEnqueueWriteBuffer(A)");
+            transferEvents.push_back(ev);
+            writtenA[aSlot] = ev;
+        }
+        const size_t columns = std::min(NB, N - j * NB);
+        const size_t bufferOrigin[3] = {0, 0, 0};
+        const size_t hostOrigin[3] = {j * NB * sizeof(real_t), 0, 0};
+        const size_t region[3] = {columns * sizeof(real_t), K, 1};
+        cl_event ev;
+        cl_event prev = computed[slot];
+        status = clEnqueueWriteBufferRect(transferQueue, devB[slot],
+                                          CL_FALSE, bufferOrigin,
+                                          hostOrigin, region,
+                                          NB * sizeof(real_t), 0,
+                                          N * sizeof(real_t), 0, &B[0],
+                                          prev ? 1 : 0, prev ? &prev : 0,
+                                          &ev);
+        check_cl_error(status, "clEnqueueWriteBufferRect(B)");
+        transferEvents.push_back(ev);
+        writtenB[slot] = ev;
+    };
+
+    check_cl_error(clFinish(computeQueue), "clFinish");
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    for(size_t t = 0; t + 1 < size_t(DEPTH) && t < TILES; ++t) write(t);
+    for(size_t t = 0; t != TILES; ++t) {
+        const size_t i = t / COLUMN_PANELS;
+        const size_t j = t % COLUMN_PANELS;
+        const int slot = int(t % DEPTH);
+        const int aSlot = int(i % DEPTH);
+        //panels of tile t + DEPTH - 1 are uploaded while tile t is
+        //computed
+        if(t + DEPTH - 1 < TILES) write(t + DEPTH - 1);
+        const int rows = int(std::min(MB, M - i * MB));
+        const int columns = int(std::min(NB, N - j * NB));
+        const cl_mem args[] = {devA[aSlot], devB[slot], devC[slot]};
+        for(int a = 0; a != 3; ++a) {
+            status = clSetKernelArg(clenv.kernel, a, sizeof(cl_mem),
+                                    &args[a]);
+            check_cl_error(status, "clSetKernelArg");
+        }
+        const int sizes[] = {rows, columns, KI, KI, LDB, LDC};
+        for(int a = 0; a != 6; ++a) {
+            status = clSetKernelArg(clenv.kernel, 3 + a, sizeof(int),
+                                    &sizes[a]);
+            check_cl_error(status, "clSetKernelArg(size)");
+        }
+        const size_t globalWorkSize[2] = {
+            size_t((columns + TN - 1) / TN + BLOCK_SIZE - 1)
+                / BLOCK_SIZE * BLOCK_SIZE,
+            size_t((rows + TM - 1) / TM + BLOCK_SIZE - 1)
+                / BLOCK_SIZE * BLOCK_SIZE};
+        const size_t localWorkSize[2] = {BLOCK_SIZE, BLOCK_SIZE};
+        std::vector< cl_event > waitList;
+        waitList.push_back(writtenA[aSlot]);
+        waitList.push_back(writtenB[slot]);
+        if(read[slot]) waitList.push_back(read[slot]);
+        cl_event ev;
+        status = clEnqueueNDRangeKernel(computeQueue, clenv.kernel, 2, 0,
+                                        globalWorkSize, localWorkSize,
+                                        cl_uint(waitList.size()),
+                                        &waitList[0], &ev);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        kernelEvents.push_back(ev);
+        computed[slot] = ev;
+        lastReadA[aSlot] = ev;
+        check_cl_error(clFlush(computeQueue), "clFlush");
+        //download of tile t
+        const size_t bufferOrigin[3] = {0, 0, 0};
+        const size_t hostOrigin[3] = {j * NB * sizeof(real_t), i * MB, 0};
+        const size_t region[3] = {columns * sizeof(real_t), size_t(rows), 1};
+        cl_event rev;
+        status = clEnqueueReadBufferRect(transferQueue, devC[slot], CL_FALSE,
+                                         bufferOrigin, hostOrigin, region,
+                                         NB * sizeof(real_t), 0,
+                                         N * sizeof(real_t), 0, &C[0],
+                                         1, &ev, &rev);
+        check_cl_error(status, "clEnqueueReadBufferRect(C)");
+        transferEvents.push_back(rev);
+        read[slot] = rev;
+        check_cl_error(clFlush(transferQueue), "clFlush");
+    }
+    check_cl_error(clFinish(computeQueue), "clFinish");
+    check_cl_error(clFinish(transferQueue), "clFinish");
+    const double elapsed_ms = std::chrono::duration< double, std::milli >(
+        std::chrono::steady_clock::now() - start).count();
+
+    double kernel_ms = 0;
+    double transfer_ms = 0;
+    for(std::vector< cl_event >::iterator e = kernelEvents.begin();
+        e != kernelEvents.end(); ++e) {
+        kernel_ms += busy_ms(*e);
+        check_cl_error(clReleaseEvent(*e), "clReleaseEvent");
+    }
+    for(std::vector< cl_event >::iterator e = transferEvents.begin();
+        e != transferEvents.end(); ++e) {
+        transfer_ms += busy_ms(*e);
+        check_cl_error(clReleaseEvent(*e), "clReleaseEvent");
+    }
+    //A uploaded once, B once per row-panel, C downloaded once
+    const double transferredBytes =
+        double(M * K + ROW_PANELS * K * N + M * N) * sizeof(real_t);
+    //fraction of the shorter activity hidden behind the longer one
+    const double shorter_ms = std::min(kernel_ms, transfer_ms);
+    const double overlap = shorter_ms > 0 ?
+        std::max(0.0, kernel_ms + transfer_ms - elapsed_ms) / shorter_ms : 0;
+    const double flops = 2 * double(M) * N * K;
+    std::cout << "Elapsed time(ms): " << elapsed_ms << "  GFLOP/s: "
+              << flops / (elapsed_ms * 1E6) << '\n'
+              << "Kernel time(ms): " << kernel_ms << "  GFLOP/s: "
+              << flops / (kernel_ms * 1E6) << '\n'
+              << "Transfer time(ms): " << transfer_ms << "  GB/s: "
+              << transferredBytes / (transfer_ms * 1E6) << '\n'
+              << "Transfer/compute overlap: "
+              << 100 * std::min(overlap, 1.0) << '%' << std::endl;
+
+    //validation: evenly spaced rows of C
+    const size_t checkRows = std::min(size_t(CHECK_ROWS), M);
+    bool passed = true;
+    if(checkRows > 0) {
+        Matrix rowsA(checkRows * K);
+        Matrix refC(checkRows * N);
+        for(size_t r = 0; r != checkRows; ++r) {
+            std::copy(A.begin() + (r * M / checkRows) * K,
+                      A.begin() + (r * M / checkRows + 1) * K,
+                      rowsA.begin() + r * K);
+        }
+        host_gemm(int(checkRows), int(N), int(K), &rowsA[0], int(K), &B[0],
+                  int(N), &refC[0], int(N));
+        for(size_t r = 0; r != checkRows && passed; ++r) {
+            const real_t* c = &C[(r * M / checkRows) * N];
+            for(size_t col = 0; col != N && passed; ++col) {
+                passed = double(std::fabs(c[col] - refC[r * N + col])) <= EPS;
+            }
+        }
+    }
+    std::cout << (passed ? "PASSED" : "FAILED") << " (" << checkRows
+              << " rows checked)" << std::endl;
+
+    for(int slot = 0; slot != DEPTH; ++slot) {
+        check_cl_error(clReleaseMemObject(devA[slot]), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(devB[slot]), "clReleaseMemObject");
+        check_cl_error(clReleaseMemObject(devC[slot]), "clReleaseMemObject");
+    }
+    untrace_queue(transferQueue);
+    check_cl_error(clReleaseCommandQueue(transferQueue),
+                   "clReleaseCommandQueue");
+    release_clenv(clenv);
+    return 0;
+}
@@ -0,0 +1,331 @@
+//Half precision storage: operands stored as half (16 bit) and converted to
+//float on load, products accumulated in float; compared with float storage:
+// - gemm_half vs gemm in 04_matrix_multiply.cl
+// - dotprod_half vs dotprod in 05_dot_product_vec.cl
+//Kernel time, bandwidth, GFLOP/s and device memory of both variants are
+//reported. Results are validated against first order error bounds computed
+//from the exact (double precision) results:
+// - float accumulation: |error| <= n x 2^-24 x sum |a x b| where n is the
+//   number of rounding steps on the path of each result, computed from the
+//   inputs actually stored (i.e. after conversion to half)
+// - half storage: an additional 2 x 2^-11 x sum |a x b| with respect to the
+//   float inputs
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/23_half_precision.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 23_half_precision
+//
+//./23_half_precision "Portable Computing Language" default 0 \
+//  ../src/kernels/04_matrix_multiply.cl gemm_half 1024 16
+//./23_half_precision "Portable Computing Language" default 0 \
+//  ../src/kernels/05_dot_product_vec.cl dotprod_half 16777216 256
+#include <iostream>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include "clutil.h"
+
+//gemm register tiling, see kernel source; vector width of dotprod
+const int TM = 4;
+const int TN = 4;
+const int TK = 16;
+const int VEC_WIDTH = 4;
+
+struct Result {
+    double time_ms;
+    //largest ratio between error and error bound, must be <= 1
+    double errorRatio;
+};
+
+//------------------------------------------------------------------------------
+//values in [-1, 1): not exactly representable as half in general
+std::vector< float > create_vector(size_t size) {
+    std::vector< float > v(size);
+    for(std::vector< float >::iterator i = v.begin(); i != v.end(); ++i)
+        *i = float(rand()) / (double(RAND_MAX) + 1) * 2 - 1;
+    return v;
+}
+
+//------------------------------------------------------------------------------
+std::vector< double > to_double(const std::vector< float >& v) {
+    return std::vector< double >(v.begin(), v.end());
+}
+
+//------------------------------------------------------------------------------
+std::vector< double > absolute(const std::vector< double >& v) {
+    std::vector< double > a(v.size());
+    for(size_t i = 0; i != v.size(); ++i) a[i] = std::fabs(v[i]);
+    return a;
+}
+
+//------------------------------------------------------------------------------
+template < typename T >
+cl_mem create_input(cl_context ctx, const std::vector< T >& v) {
+    cl_int status;
+    cl_mem b = clCreateBuffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                              v.size() * sizeof(T), const_cast< T* >(&v[0]),
+                              &status);
+    check_cl_error(status, "clCreateBuffer");
+    return b;
+}
+
+//------------------------------------------------------------------------------
+//max over all the elements of |result - exact| / (relative bound x sum)
+double error_ratio(const std::vector< float >& result,
+                   const std::vector< double >& exact,
+                   const std::vector< double >& absSum,
+                   double relativeBound) {
+    double ratio = 0;
+    for(size_t i = 0; i != result.size(); ++i) {
+        const double error = std::fabs(result[i] - exact[i]);
+        //zero bound: exact result required
+        const double bound = relativeBound * absSum[i];
+        ratio = std::max(ratio, bound > 0 ? error / bound
+                                : (error > 0 ? HUGE_VAL : 0));
+    }
+    return ratio;
+}
+
+//------------------------------------------------------------------------------
+//runs gemm or gemm_half on square matrices, inputs already on the device
+std::vector< float > run_gemm(const CLEnv& clenv,
+                              const std::string& kernelName,
+                              cl_mem devA,
+                              cl_mem devB,
+                              int SIZE,
+                              int BLOCK_SIZE,
+                              double& time_ms) {
+    cl_int status;
+    cl_mem devC = clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                 size_t(SIZE) * SIZE * sizeof(float), 0,
+                                 &status);
+    check_cl_error(status, "clCreateBuffer");
+    const cl_kernel kernel = get_kernel(clenv, kernelName);
+    const cl_mem args[] = {devA, devB, devC};
+    for(int i = 0; i != 3; ++i) {
+        status = clSetKernelArg(kernel, i, sizeof(cl_mem), &args[i]);
+        check_cl_error(status, "clSetKernelArg");
+    }
+    //M, N, K, lda, ldb, ldc
+    for(int i = 3; i != 9; ++i) {
+        status = clSetKernelArg(kernel, i, sizeof(int), &SIZE);
+        check_cl_error(status, "clSetKernelArg(size)");
+    }
+    const size_t globalWorkSize[2] = {
+        size_t(((SIZE + TN - 1) / TN + BLOCK_SIZE - 1) / BLOCK_SIZE
+               * BLOCK_SIZE),
+        size_t(((SIZE + TM - 1) / TM + BLOCK_SIZE - 1) / BLOCK_SIZE
+               * BLOCK_SIZE)};
+    const size_t localWorkSize[2] = {size_t(BLOCK_SIZE), size_t(BLOCK_SIZE)};
+    time_ms = timeEnqueueNDRangeKernel(clenv.commandQueue, kernel, 2, 0,
+                                       globalWorkSize, localWorkSize, 0, 0);
+    std::vector< float > C(size_t(SIZE) * SIZE);
+    enqueue_read(clenv.commandQueue, devC, 0, C.size() * sizeof(float),
+                 &C[0], true);
+    check_cl_error(clReleaseMemObject(devC), "clReleaseMemObject");
+    return C;
+}
+
+//------------------------------------------------------------------------------
+//runs dotprod or dotprod_half, returns the per-workgroup partial sums
+std::vector< float > run_dot(const CLEnv& clenv,
+                             const std::string& kernelName,
+                             cl_mem devV1,
+                             cl_mem devV2,
+                             size_t SIZE,
+                             int BLOCK_SIZE,
+                             double& time_ms) {
+    const size_t globalWorkSize[1] = {SIZE / VEC_WIDTH};
+    const size_t localWorkSize[1] = {size_t(BLOCK_SIZE)};
+    cl_int status;
+    cl_mem devReduced = clCreateBuffer(clenv.context, CL_MEM_WRITE_ONLY,
+                                       globalWorkSize[0] / BLOCK_SIZE
+                                       * sizeof(float), 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    const cl_kernel kernel = get_kernel(clenv, kernelName);
+    const cl_mem args[] = {devV1, devV2, devReduced};
+    for(int i = 0; i != 3; ++i) {
+        status = clSetKernelArg(kernel, i, sizeof(cl_mem), &args[i]);
+        check_cl_error(status, "clSetKernelArg");
+    }
+    time_ms = timeEnqueueNDRangeKernel(clenv.commandQueue, kernel, 1, 0,
+                                       globalWorkSize, localWorkSize, 0, 0);
+    std::vector< float > reduced(globalWorkSize[0] / BLOCK_SIZE);
+    enqueue_read(clenv.commandQueue, devReduced, 0,
+                 reduced.size() * sizeof(float), &reduced[0], true);
+    check_cl_error(clReleaseMemObject(devReduced), "clReleaseMemObject");
+    return reduced;
+}
+
+//------------------------------------------------------------------------------
+//exact result and sum of absolute products of each block of 'block'
+//elements, in double precision
+void host_block_dot(const std::vector< double >& v1,
+                    const std::vector< double >& v2,
+                    size_t block,
+                    std::vector< double >& dot,
+                    std::vector< double >& absDot) {
+    dot.assign(v1.size() / block, 0);
+    absDot.assign(v1.size() / block, 0);
+    for(size_t i = 0; i != v1.size(); ++i) {
+        dot[i / block] += v1[i] * v2[i];
+        absDot[i / block] += std::fabs(v1[i] * v2[i]);
+    }
+}
+
+//------------------------------------------------------------------------------
+void print_result(const std::string& label,
+                  const Result& r,
+                  double inputBytes,
+                  double flops) {
+    std::cout << label << ":\n"
+              << "  kernel time(ms): " << r.time_ms << '\n'
+              << "  input bandwidth(GB/s): "
+              << inputBytes / (r.time_ms * 1E6) << '\n'
+              << "  GFLOP/s: " << flops / (r.time_ms * 1E6) << '\n'
+              << "  device memory, inputs(MiB): " << inputBytes / (1 << 20)
+              << '\n'
+              << "  error / bound: " << r.errorRatio << std::endl;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 8) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <kernel name = gemm_half | dotprod_half>"
+                     " <matrix size | vector size> <workgroup size>\n"
+                     "gemm_half is compared with gemm in "
+                     "04_matrix_multiply.cl, dotprod_half with dotprod in "
+                     "05_dot_product_vec.cl"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const std::string KERNEL = argv[5];
+    const bool GEMM = KERNEL == "gemm_half";
+    const long SIZE = atol(argv[6]);
+    const int BLOCK_SIZE = atoi(argv[7]);
+    if(!GEMM && KERNEL != "dotprod_half") {
+        std::cerr << "ERROR - kernel *must* be gemm_half or dotprod_half"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    if(SIZE < 1 || BLOCK_SIZE < 1
+       || (GEMM && (TK % 4 != 0 || BLOCK_SIZE * TN % 4 != 0))
+       || (!GEMM && SIZE % (VEC_WIDTH * BLOCK_SIZE) != 0)) {
+        std::cerr << "ERROR - size and workgroup size *must* be greater than "
+                     "zero; dotprod_half: size *must* be evenly divisible "
+                     "by " << VEC_WIDTH << " x workgroup size" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    //float and half kernels built in the same program; DOUBLE is not
+    //defined: float storage is the reference variant
+    std::ostringstream clheaderStream;
+    clheaderStream << "#define BLOCK_SIZE " << BLOCK_SIZE << '\n'
+                   << "#define TM " << TM << '\n'
+                   << "#define TN " << TN << '\n'
+                   << "#define TK " << TK << '\n'
+                   << "#define VEC_WIDTH " << VEC_WIDTH << '\n';
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true,
+                               argv[4], 0, clheaderStream.str());
+    srand(time(0));
+    //inputs: SIZE x SIZE matrices or SIZE element vectors
+    const size_t ELEMENTS = GEMM ? size_t(SIZE) * SIZE : size_t(SIZE);
+    const std::vector< float > X = create_vector(ELEMENTS);
+    const std::vector< float > Y = create_vector(ELEMENTS);
+    std::vector< cl_half > Xh(ELEMENTS);
+    std::vector< cl_half > Yh(ELEMENTS);
+    float_to_half(&X[0], ELEMENTS, &Xh[0]);
+    float_to_half(&Y[0], ELEMENTS, &Yh[0]);
+    //values actually stored on the device in the half variant
+    std::vector< float > Xr(ELEMENTS);
+    std::vector< float > Yr(ELEMENTS);
+    half_to_float(&Xh[0], ELEMENTS, &Xr[0]);
+    half_to_float(&Yh[0], ELEMENTS, &Yr[0]);
+
+    const cl_mem devX = create_input(clenv.context, X);
+    const cl_mem devY = create_input(clenv.context, Y);
+    const cl_mem devXh = create_input(clenv.context, Xh);
+    const cl_mem devYh = create_input(clenv.context, Yh);
+    Result single;
+    Result half;
+    double halfStorageRatio = 0;
+    //rounding steps of float accumulation, see header
+    double steps = 0;
+    double flops = 0;
+    if(GEMM) {
+        const int n = int(SIZE);
+        steps = n + 1;
+        flops = 2 * double(n) * n * n;
+        const std::vector< float > C =
+            run_gemm(clenv, "gemm", devX, devY, n, BLOCK_SIZE,
+                     single.time_ms);
+        const std::vector< float > Ch =
+            run_gemm(clenv, "gemm_half", devXh, devYh, n, BLOCK_SIZE,
+                     half.time_ms);
+        //exact results and sums of absolute products, host_gemm in double
+        const std::vector< double > A = to_double(X);
+        const std::vector< double > B = to_double(Y);
+        const std::vector< double > Ar = to_double(Xr);
+        const std::vector< double > Br = to_double(Yr);
+        std::vector< double > exact(ELEMENTS);
+        std::vector< double > absSum(ELEMENTS);
+        host_gemm(n, n, n, &A[0], n, &B[0], n, &exact[0], n);
+        host_gemm(n, n, n, &absolute(A)[0], n, &absolute(B)[0], n,
+                  &absSum[0], n);
+        single.errorRatio = error_ratio(C, exact, absSum,
+                                        steps * FLOAT_UNIT_ROUNDOFF);
+        halfStorageRatio = error_ratio(Ch, exact, absSum,
+                                       2 * HALF_UNIT_ROUNDOFF
+                                       + steps * FLOAT_UNIT_ROUNDOFF);
+        host_gemm(n, n, n, &Ar[0], n, &Br[0], n, &exact[0], n);
+        host_gemm(n, n, n, &absolute(Ar)[0], n, &absolute(Br)[0], n,
+                  &absSum[0], n);
+        half.errorRatio = error_ratio(Ch, exact, absSum,
+                                      steps * FLOAT_UNIT_ROUNDOFF);
+    } else {
+        //products, sequential sum of VEC_WIDTH products, reduction tree
+        steps = VEC_WIDTH + std::ceil(std::log2(double(BLOCK_SIZE))) + 1;
+        flops = 2 * double(SIZE);
+        const std::vector< float > dot =
+            run_dot(clenv, "dotprod", devX, devY, SIZE, BLOCK_SIZE,
+                    single.time_ms);
+        const std::vector< float > doth =
+            run_dot(clenv, "dotprod_half", devXh, devYh, SIZE, BLOCK_SIZE,
+                    half.time_ms);
+        //partial sums are validated one by one
+        const size_t block = size_t(VEC_WIDTH) * BLOCK_SIZE;
+        std::vector< double > exact;
+        std::vector< double > absSum;
+        host_block_dot(to_double(X), to_double(Y), block, exact, absSum);
+        single.errorRatio = error_ratio(dot, exact, absSum,
+                                        steps * FLOAT_UNIT_ROUNDOFF);
+        halfStorageRatio = error_ratio(doth, exact, absSum,
+                                       2 * HALF_UNIT_ROUNDOFF
+                                       + steps * FLOAT_UNIT_ROUNDOFF);
+        host_block_dot(to_double(Xr), to_double(Yr), block, exact, absSum);
+        half.errorRatio = error_ratio(doth, exact, absSum,
+                                      steps * FLOAT_UNIT_ROUNDOFF);
+    }
+    print_result("float storage", single, 2 * double(ELEMENTS)
+                 * sizeof(float), flops);
+    print_result("half storage", half, 2 * double(ELEMENTS)
+                 * sizeof(cl_half), flops);
+    std::cout << "  error / bound w.r.t. float inputs: " << halfStorageRatio
+              << "\nhalf storage speedup: " << single.time_ms / half.time_ms
+              << std::endl;
+    const bool passed = single.errorRatio <= 1 && half.errorRatio <= 1
+                        && halfStorageRatio <= 1;
+    std::cout << (passed ? "PASSED" : "FAILED") << std::endl;
+
+    check_cl_error(clReleaseMemObject(devX), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devY), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devXh), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devYh), "clReleaseMemObject");
+    release_clenv(clenv);
+    return 0;
+}
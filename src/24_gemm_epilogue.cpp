@@ -0,0 +1,353 @@
+//Fused GEMM epilogue: C = act(alpha x A x B + beta x C + bias) computed by
+//gemm_epilogue in 04_matrix_multiply.cl in a single pass, compared with the
+//unfused chain gemm -> epilogue_axpby -> epilogue_bias -> epilogue_activation
+//which reads and writes the whole of C once per term.
+//The epilogue terms are selected at compile time through specialization
+//defines (EPILOGUE_ALPHA, EPILOGUE_BETA, EPILOGUE_BIAS, EPILOGUE_ACTIVATION):
+//disabled terms generate no code; gemm_epilogue built without any term is
+//also timed against gemm to show that the epilogue support is free when
+//unused.
+//Reported: kernel times of plain, fused and unfused runs and the C-side
+//memory traffic (bytes read and written other than A and B) of the fused
+//and unfused epilogues. Both results are validated against host_gemm
+//followed by the epilogue computed on the host.
+//Author: Ugo Varetto
+//
+//g++ -std=c++11 -pthread ../src/24_gemm_epilogue.cpp ../src/clutil.cpp \
+// -I../src -lOpenCL -o 24_gemm_epilogue
+//
+//./24_gemm_epilogue "Portable Computing Language" default 0 \
+//  ../src/kernels/04_matrix_multiply.cl 1024 alpha,beta,bias,relu
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+#include "clutil.h"
+
+#ifdef USE_DOUBLE
+typedef double real_t;
+const double EPS = 0.000000001;
+#else
+typedef float real_t;
+const double EPS = 0.00001;
+#endif
+
+typedef std::vector< real_t > Matrix;
+
+//gemm register tiling, see kernel source
+const int TM = 4;
+const int TN = 4;
+const int TK = 16;
+
+//EPILOGUE_ACTIVATION values
+const char* ACTIVATIONS[] = {"none", "relu", "sigmoid", "tanh"};
+const int NUM_ACTIVATIONS = sizeof(ACTIVATIONS) / sizeof(const char*);
+
+//epilogue terms, alpha and beta are always passed to the kernels but used
+//only if the corresponding term is enabled
+struct Epilogue {
+    bool alpha;
+    bool beta;
+    bool bias;
+    int activation;
+};
+
+//------------------------------------------------------------------------------
+//comma separated list of alpha, beta, bias and one activation name
+bool parse_epilogue(const std::string& s, Epilogue& e) {
+    e.alpha = e.beta = e.bias = false;
+    e.activation = 0;
+    std::istringstream terms(s);
+    std::string t;
+    while(std::getline(terms, t, ',')) {
+        if(t == "alpha") e.alpha = true;
+        else if(t == "beta") e.beta = true;
+        else if(t == "bias") e.bias = true;
+        else {
+            const char** a = std::find(ACTIVATIONS,
+                                       ACTIVATIONS + NUM_ACTIVATIONS, t);
+            if(a == ACTIVATIONS + NUM_ACTIVATIONS) return false;
+            e.activation = int(a - ACTIVATIONS);
+        }
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+CLSpec epilogue_spec(const Epilogue& e, int blockSize) {
+    CLSpec spec;
+    spec_set(spec, "BLOCK_SIZE", blockSize);
+    spec_set(spec, "TM", TM);
+    spec_set(spec, "TN", TN);
+    spec_set(spec, "TK", TK);
+#ifdef USE_DOUBLE
+    spec_flag(spec, "DOUBLE");
+#endif
+    spec_flag(spec, "EPILOGUE_ALPHA", e.alpha);
+    spec_flag(spec, "EPILOGUE_BETA", e.beta);
+    spec_flag(spec, "EPILOGUE_BIAS", e.bias);
+    if(e.activation) spec_set(spec, "EPILOGUE_ACTIVATION", e.activation);
+    return spec;
+}
+
+//------------------------------------------------------------------------------
+real_t activation(real_t x, int a) {
+    switch(a) {
+    case 1: return std::max(x, real_t(0));
+    case 2: return 1 / (1 + std::exp(-x));
+    case 3: return std::tanh(x);
+    default: return x;
+    }
+}
+
+//------------------------------------------------------------------------------
+//reference result: AB = A x B, C = act(alpha x AB + beta x C + bias)
+void host_epilogue(const Epilogue& e, int M, int N, const Matrix& AB,
+                   real_t alpha, real_t beta, const Matrix& bias, Matrix& C) {
+    for(int r = 0; r != M; ++r) {
+        for(int c = 0; c != N; ++c) {
+            const size_t i = size_t(r) * N + c;
+            real_t v = AB[i];
+            if(e.alpha) v *= alpha;
+            if(e.beta) v += beta * C[i];
+            if(e.bias) v += bias[c];
+            C[i] = activation(v, e.activation);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//C-side bytes read and written by the epilogue i.e. all the traffic not
+//related to A and B, including the store of the product
+double fused_bytes(const Epilogue& e, int M, int N) {
+    const double MN = double(M) * N;
+    return sizeof(real_t) * (MN + (e.beta ? MN : 0) + (e.bias ? N : 0));
+}
+
+double unfused_bytes(const Epilogue& e, int M, int N) {
+    const double MN = double(M) * N;
+    double elements = MN; //gemm store
+    if(e.alpha || e.beta) elements += 2 * MN + (e.beta ? MN : 0);
+    if(e.bias) elements += 2 * MN + N;
+    if(e.activation) elements += 2 * MN;
+    return sizeof(real_t) * elements;
+}
+
+//------------------------------------------------------------------------------
+//max |result - reference| / max(1, |reference|)
+double max_error(const Matrix& result, const Matrix& reference) {
+    double err = 0;
+    for(size_t i = 0; i != result.size(); ++i) {
+        err = std::max(err, std::fabs(double(result[i]) - reference[i])
+                            / std::max(1.0, std::fabs(double(reference[i]))));
+    }
+    return err;
+}
+
+//------------------------------------------------------------------------------
+int main(int argc, char** argv) {
+    if(argc < 6) {
+        std::cerr << "usage: " << argv[0]
+                  << " <platform name> <device type = default | cpu | gpu "
+                     "| acc | all> <device num> <OpenCL source file path>"
+                     " <matrix size | MxNxK> [epilogue terms, default ="
+                     " alpha,beta,bias,relu] [workgroup size, default = 16]\n"
+                     "epilogue terms: comma separated list of alpha, beta, "
+                     "bias and one of none, relu, sigmoid, tanh"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    int M = 0;
+    int N = 0;
+    int K = 0;
+    if(sscanf(argv[5], "%dx%dx%d", &M, &N, &K) != 3) {
+        M = N = K = atoi(argv[5]);
+    }
+    const std::string TERMS = argc > 6 ? argv[6] : "alpha,beta,bias,relu";
+    Epilogue epilogue;
+    if(!parse_epilogue(TERMS, epilogue)) {
+        std::cerr << "ERROR - invalid epilogue term" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const int BLOCK_SIZE = argc > 7 ? atoi(argv[7]) : 16;
+    if(M < 1 || N < 1 || K < 1 || BLOCK_SIZE < 1) {
+        std::cerr << "ERROR - sizes and workgroup size *must* be greater "
+                     "than zero" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const real_t ALPHA = 0.5;
+    const real_t BETA = -1;
+
+    //no program built at creation time: the selected epilogue and the empty
+    //epilogue are built as two variants of the same source
+    CLEnv clenv = create_clenv(argv[1], argv[2], atoi(argv[3]), true, 0, 0);
+    const Epilogue none = {false, false, false, 0};
+    const CLSpec spec = epilogue_spec(epilogue, BLOCK_SIZE);
+    const CLSpec plainSpec = epilogue_spec(none, BLOCK_SIZE);
+    CLVariantCache* variants = create_variant_cache(clenv, argv[4]);
+    std::vector< CLSpec > specs;
+    specs.push_back(spec);
+    specs.push_back(plainSpec);
+    build_variants(*variants, specs);
+    const cl_kernel gemm = create_variant_kernel(*variants, spec, "gemm");
+    const cl_kernel fused = create_variant_kernel(*variants, spec,
+                                                  "gemm_epilogue");
+    const cl_kernel plainFused = create_variant_kernel(*variants, plainSpec,
+                                                       "gemm_epilogue");
+    const cl_kernel axpby = create_variant_kernel(*variants, spec,
+                                                  "epilogue_axpby");
+    const cl_kernel addBias = create_variant_kernel(*variants, spec,
+                                                    "epilogue_bias");
+    const cl_kernel act = create_variant_kernel(*variants, spec,
+                                                "epilogue_activation");
+
+    //small integers: products and sums exact, errors only introduced by
+    //the sigmoid and tanh activations
+    srand(time(0));
+    Matrix A(size_t(M) * K);
+    Matrix B(size_t(K) * N);
+    Matrix C0(size_t(M) * N);
+    Matrix bias(N);
+    for(Matrix::iterator i = A.begin(); i != A.end(); ++i) *i = rand() % 10;
+    for(Matrix::iterator i = B.begin(); i != B.end(); ++i) *i = rand() % 10;
+    for(Matrix::iterator i = C0.begin(); i != C0.end(); ++i) *i = rand() % 10;
+    for(Matrix::iterator i = bias.begin(); i != bias.end(); ++i)
+        *i = rand() % 10 - 5;
+    Matrix AB(C0.size());
+    host_gemm(M, N, K, &A[0], K, &B[0], N, &AB[0], N);
+    Matrix reference = C0;
+    host_epilogue(epilogue, M, N, AB, ALPHA, BETA, bias, reference);
+
+    cl_int status;
+    const size_t C_BYTES = C0.size() * sizeof(real_t);
+    cl_mem devA = clCreateBuffer(clenv.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 A.size() * sizeof(real_t), &A[0], &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devB = clCreateBuffer(clenv.context,
+                                 CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                 B.size() * sizeof(real_t), &B[0], &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devBias = clCreateBuffer(clenv.context,
+                                    CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                    N * sizeof(real_t), &bias[0], &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem devC = clCreateBuffer(clenv.context, CL_MEM_READ_WRITE, C_BYTES, 0,
+                                 &status);
+    check_cl_error(status, "clCreateBuffer");
+    //unfused chain with beta: the product cannot overwrite C before C is
+    //read, one additional M x N temporary is required
+    cl_mem devT = 0;
+    if(epilogue.beta) {
+        devT = clCreateBuffer(clenv.context, CL_MEM_READ_WRITE, C_BYTES, 0,
+                              &status);
+        check_cl_error(status, "clCreateBuffer");
+    }
+
+    const size_t gemmGlobal[2] = {
+        size_t(((N + TN - 1) / TN + BLOCK_SIZE - 1) / BLOCK_SIZE
+               * BLOCK_SIZE),
+        size_t(((M + TM - 1) / TM + BLOCK_SIZE - 1) / BLOCK_SIZE
+               * BLOCK_SIZE)};
+    const size_t passGlobal[2] = {
+        size_t((N + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE),
+        size_t((M + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE)};
+    const size_t local[2] = {size_t(BLOCK_SIZE), size_t(BLOCK_SIZE)};
+    const cl_mem product = epilogue.beta ? devT : devC;
+
+    //plain gemm and gemm_epilogue without epilogue
+    set_kernel_args(gemm, 0, devA, devB, devC, M, N, K, K, N, N);
+    const double gemm_ms =
+        timeEnqueueNDRangeKernel(clenv.commandQueue, gemm, 2, 0, gemmGlobal,
+                                 local, 0, 0);
+    set_kernel_args(plainFused, 0, devA, devB, devC, M, N, K, K, N, N,
+                    ALPHA, BETA, devBias);
+    const double plain_ms =
+        timeEnqueueNDRangeKernel(clenv.commandQueue, plainFused, 2, 0,
+                                 gemmGlobal, local, 0, 0);
+
+    //fused
+    enqueue_write(clenv.commandQueue, devC, 0, C_BYTES, &C0[0], true);
+    set_kernel_args(fused, 0, devA, devB, devC, M, N, K, K, N, N,
+                    ALPHA, BETA, devBias);
+    const double fused_ms =
+        timeEnqueueNDRangeKernel(clenv.commandQueue, fused, 2, 0, gemmGlobal,
+                                 local, 0, 0);
+    Matrix fusedC(C0.size());
+    enqueue_read(clenv.commandQueue, devC, 0, C_BYTES, &fusedC[0], true);
+
+    //unfused: one pass per enabled term
+    enqueue_write(clenv.commandQueue, devC, 0, C_BYTES, &C0[0], true);
+    set_kernel_args(gemm, 0, devA, devB, product, M, N, K, K, N, N);
+    double unfused_ms =
+        timeEnqueueNDRangeKernel(clenv.commandQueue, gemm, 2, 0, gemmGlobal,
+                                 local, 0, 0);
+    const double product_ms = unfused_ms;
+    if(epilogue.alpha || epilogue.beta) {
+        set_kernel_args(axpby, 0, product, devC, M, N, N, N, ALPHA, BETA);
+        unfused_ms +=
+            timeEnqueueNDRangeKernel(clenv.commandQueue, axpby, 2, 0,
+                                     passGlobal, local, 0, 0);
+    }
+    if(epilogue.bias) {
+        set_kernel_args(addBias, 0, devC, M, N, N, devBias);
+        unfused_ms +=
+            timeEnqueueNDRangeKernel(clenv.commandQueue, addBias, 2, 0,
+                                     passGlobal, local, 0, 0);
+    }
+    if(epilogue.activation) {
+        set_kernel_args(act, 0, devC, M, N, N);
+        unfused_ms +=
+            timeEnqueueNDRangeKernel(clenv.commandQueue, act, 2, 0,
+                                     passGlobal, local, 0, 0);
+    }
+    Matrix unfusedC(C0.size());
+    enqueue_read(clenv.commandQueue, devC, 0, C_BYTES, &unfusedC[0], true);
+
+    const double fusedError = max_error(fusedC, reference);
+    const double unfusedError = max_error(unfusedC, reference);
+    const double fusedBytes = fused_bytes(epilogue, M, N);
+    const double unfusedBytes = unfused_bytes(epilogue, M, N);
+    const double MiB = 1 << 20;
+    const double flops = 2 * double(M) * N * K;
+    std::cout << "M x N x K: " << M << " x " << N << " x " << K << '\n'
+              << "Epilogue: " << TERMS << '\n'
+              << "gemm time(ms): " << gemm_ms << "  GFLOP/s: "
+              << flops / (gemm_ms * 1E6) << '\n'
+              << "gemm_epilogue, no epilogue time(ms): " << plain_ms << '\n'
+              << "Fused time(ms): " << fused_ms << '\n'
+              << "Unfused time(ms): " << unfused_ms << " (gemm: "
+              << product_ms << ", epilogue passes: "
+              << unfused_ms - product_ms << ")\n"
+              << "Fused speedup: " << unfused_ms / fused_ms << '\n'
+              << "C-side traffic, fused(MiB): " << fusedBytes / MiB << '\n'
+              << "C-side traffic, unfused(MiB): " << unfusedBytes / MiB
+              << '\n'
+              << "Traffic saved(MiB): " << (unfusedBytes - fusedBytes) / MiB
+              << " (" << 100 * (1 - fusedBytes / unfusedBytes) << "%)\n"
+              << "Unfused temporary(MiB): "
+              << (epilogue.beta ? C_BYTES / MiB : 0) << '\n'
+              << "Max relative error, fused: " << fusedError
+              << "  unfused: " << unfusedError << std::endl;
+    std::cout << (fusedError <= EPS && unfusedError <= EPS ? "PASSED"
+                                                           : "FAILED")
+              << std::endl;
+
+    const cl_kernel kernels[] = {gemm, fused, plainFused, axpby, addBias, act};
+    for(int k = 0; k != 6; ++k) {
+        forget_kernel_args(kernels[k]);
+        check_cl_error(clReleaseKernel(kernels[k]), "clReleaseKernel");
+    }
+    check_cl_error(clReleaseMemObject(devA), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devB), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devBias), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(devC), "clReleaseMemObject");
+    if(devT) check_cl_error(clReleaseMemObject(devT), "clReleaseMemObject");
+    release_variant_cache(variants);
+    release_clenv(clenv);
+    return 0;
+}
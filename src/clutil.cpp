@@ -6,7 +6,28 @@
 #include <iterator>
 #include <vector>
 #include <algorithm>
+#include <numeric>
+#include <cmath>
 #include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <chrono>
+#include <future>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <cerrno>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace {
+std::string kernel_name(cl_kernel kernel);
+}
 
 //------------------------------------------------------------------------------
 void check_cl_error(cl_int status, const char* msg) {
@@ -26,14 +47,9 @@ void CL_CALLBACK context_callback(const char * errInfo,
 }
 
 //------------------------------------------------------------------------------
-// returns context associated with single device only,
-// to make it support multiple devices, a list of
-// <device type, device num> pairs is required
-cl_context create_cl_context(const std::string& platformName,
-                             const std::string& deviceTypeName,
-                             int deviceNum) {
+cl_platform_id find_platform(const std::string& platformName) {
     cl_int status = 0;
-    //1) get platfors and search for platform matching platformName
+    //get platfors and search for platform matching platformName
     cl_uint numPlatforms = 0;
     status = clGetPlatformIDs(0, 0, &numPlatforms);
     check_cl_error(status, "clGetPlatformIDs");
@@ -46,24 +62,22 @@ cl_context create_cl_context(const std::string& platformName,
     status = clGetPlatformIDs(numPlatforms, &platformIDs[0], 0);
     check_cl_error(status, "clGetPlatformIDs");
     std::vector< char > buf(0x10000, char(0));
-    cl_platform_id platformID;
     PlatformIDs::const_iterator pi = platformIDs.begin();
     for(; pi != platformIDs.end(); ++pi) {
         status = clGetPlatformInfo(*pi, CL_PLATFORM_NAME,
                                  buf.size(), &buf[0], 0);
         check_cl_error(status, "clGetPlatformInfo");
-        if(platformName == &buf[0]) {
-            platformID = *pi;
-            break; 
-        }
+        if(platformName == &buf[0]) return *pi;
     } 
-    if(pi == platformIDs.end()) {
-        std::cerr << "ERROR - Couldn't find platform " 
-                  << platformName << std::endl;
-        exit(EXIT_FAILURE);
-    }
-    //2) get devices of deviceTypeName type and store their ids into
-    //   an array then select device id at position deviceNum
+    std::cerr << "ERROR - Couldn't find platform " 
+              << platformName << std::endl;
+    exit(EXIT_FAILURE);
+    return 0;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+cl_device_type device_type(const std::string& deviceTypeName) {
     cl_device_type deviceType;
     if(deviceTypeName == "default") 
         deviceType = CL_DEVICE_TYPE_DEFAULT;
@@ -80,6 +94,15 @@ cl_context create_cl_context(const std::string& platformName,
                   << std::endl;
         exit(EXIT_FAILURE);          
     }                      
+    return deviceType;
+}
+}
+
+//------------------------------------------------------------------------------
+std::vector< cl_device_id > get_device_ids(cl_platform_id platformID,
+                                           const std::string& deviceTypeName) {
+    cl_int status = 0;
+    const cl_device_type deviceType = device_type(deviceTypeName);
     cl_uint numDevices = 0; 
     status = clGetDeviceIDs(platformID, deviceType, 0, 0, &numDevices);
     check_cl_error(status, "clGetDeviceIDs");
@@ -88,17 +111,43 @@ cl_context create_cl_context(const std::string& platformName,
                   << deviceTypeName << std::endl;
         exit(EXIT_FAILURE);          
     }
-    typedef std::vector< cl_device_id > DeviceIDs;
-    DeviceIDs deviceIDs(numDevices);
+    std::vector< cl_device_id > deviceIDs(numDevices);
     status = clGetDeviceIDs(platformID, deviceType, numDevices,
                             &deviceIDs[0], 0);
     check_cl_error(status, "clGetDeviceIDs");
-    if(deviceNum < 0 || deviceNum >= numDevices) {
-        std::cerr << "ERROR - device number out of range: [0," 
-                  << (numDevices - 1) << ']' << std::endl;
-        exit(EXIT_FAILURE);
+    return deviceIDs;
+}
+
+//------------------------------------------------------------------------------
+// returns context associated with single device only,
+// use create_multi_clenv for multiple devices
+cl_context create_cl_context(const std::string& platformName,
+                             const std::string& deviceTypeName,
+                             int deviceNum) {
+    cl_int status = 0;
+    cl_platform_id platformID;
+    cl_device_id deviceID;
+    if(auto_platform(platformName)) {
+        //1) and 2) fastest device of deviceTypeName type on any platform
+        const CLDeviceScore best = auto_select_device(platformName,
+                                                      deviceTypeName);
+        platformID = best.platform;
+        deviceID = best.device;
+    } else {
+        //1) search for platform matching platformName
+        platformID = find_platform(platformName);
+        //2) get devices of deviceTypeName type and store their ids into
+        //   an array then select device id at position deviceNum
+        typedef std::vector< cl_device_id > DeviceIDs;
+        const DeviceIDs deviceIDs = get_device_ids(platformID,
+                                                   deviceTypeName);
+        if(deviceNum < 0 || deviceNum >= int(deviceIDs.size())) {
+            std::cerr << "ERROR - device number out of range: [0," 
+                      << (deviceIDs.size() - 1) << ']' << std::endl;
+            exit(EXIT_FAILURE);
+        }
+        deviceID = deviceIDs[deviceNum]; 
     }
-    cl_device_id deviceID = deviceIDs[deviceNum]; 
     //3) create and return context
     cl_context_properties ctxProps[] = {
         CL_CONTEXT_PLATFORM,
@@ -126,14 +175,30 @@ std::string load_text(const char* filepath) {
 
 //------------------------------------------------------------------------------
 cl_device_id get_device_id(cl_context ctx) {
-    cl_device_id deviceID; 
-    // retrieve actual device id from context
-    cl_int status = clGetContextInfo(ctx,
-                                     CL_CONTEXT_DEVICES,
-                                     sizeof(cl_device_id),
-                                     &deviceID, 0);
+    // retrieve actual device id from context; in case of multiple devices
+    // the first one is returned
+    size_t size = 0;
+    cl_int status = clGetContextInfo(ctx, CL_CONTEXT_DEVICES, 0, 0, &size);
     check_cl_error(status, "clGetContextInfo");
-    return deviceID;
+    std::vector< cl_device_id > deviceIDs(size / sizeof(cl_device_id));
+    status = clGetContextInfo(ctx,
+                              CL_CONTEXT_DEVICES,
+                              size,
+                              &deviceIDs[0], 0);
+    check_cl_error(status, "clGetContextInfo");
+    return deviceIDs[0];
+}
+
+//------------------------------------------------------------------------------
+std::string get_device_info_string(cl_device_id deviceID,
+                                   cl_device_info info) {
+    size_t size = 0;
+    cl_int status = clGetDeviceInfo(deviceID, info, 0, 0, &size);
+    check_cl_error(status, "clGetDeviceInfo");
+    std::vector< char > buf(size + 1, char(0));
+    status = clGetDeviceInfo(deviceID, info, size, &buf[0], 0);
+    check_cl_error(status, "clGetDeviceInfo");
+    return std::string(&buf[0]);
 }
 
 //------------------------------------------------------------------------------
@@ -354,85 +419,449 @@ void print_platforms() {
 }
 
 //------------------------------------------------------------------------------
-CLEnv create_clenv(const std::string& platformName,
-                   const std::string& deviceType,
-                   int deviceNum,
-                   bool enableProfiling,
-                   const char* clSourcePath,
-                   const char* kernelName, 
-                   const std::string& clSourcePrefix, 
-                   const std::string& buildOptions) {
+namespace {
+CLProgramCacheStats programCacheStats = {0, 0, 0, 0.0};
+//programs can be built concurrently, see build_variants
+std::mutex programCacheStatsMutex;
+
+//64 bit FNV-1a hash
+unsigned long long hash_text(const std::string& text,
+                             unsigned long long h = 14695981039346656037ULL) {
+    for(std::string::const_iterator i = text.begin(); i != text.end(); ++i) {
+        h ^= (unsigned char)(*i);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+//returns empty string if caching disabled
+std::string program_cache_dir() {
+    const char* dir = getenv("CLUTIL_CACHE_DIR");
+    const std::string d = dir ? dir : ".clcache";
+    if(d.empty()) return d;
+    if(mkdir(d.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "WARNING - cannot create program cache directory "
+                  << d << "; caching disabled" << std::endl;
+        return std::string();
+    }
+    return d;
+}
+
+//print build log, if any, and exit on failure
+void check_build(cl_program program,
+                 const std::vector< cl_device_id >& devices,
+                 cl_int buildStatus) {
+    for(std::vector< cl_device_id >::const_iterator d = devices.begin();
+        d != devices.end(); ++d) {
+        size_t len = 0;
+        cl_int status = clGetProgramBuildInfo(program,
+                                              *d,
+                                              CL_PROGRAM_BUILD_LOG,
+                                              0,
+                                              0,
+                                              &len);
+        check_cl_error(status, "clGetProgramBuildInfo");
+        if(len < 2) continue;
+        std::vector< char > buffer(len + 1, char(0));
+        status = clGetProgramBuildInfo(program,
+                                       *d,
+                                       CL_PROGRAM_BUILD_LOG,
+                                       len,
+                                       &buffer[0],
+                                       0);
+        check_cl_error(status, "clGetProgramBuildInfo");
+        //some implementations return a log made of whitespace only
+        const std::string log(&buffer[0]);
+        if(log.find_first_not_of(" \t\r\n") != std::string::npos)
+            std::cout << "Build output: " << log << std::endl;
+    }
+    check_cl_error(buildStatus, "clBuildProgram");
+}
+
+cl_program build_program_from_source(cl_context ctx,
+                                     const std::vector< cl_device_id >& devices,
+                                     const std::string& source,
+                                     const std::string& buildOptions) {
+    cl_int status;
+    const char* src = source.c_str();
+    const size_t sourceLength = source.length();
+    cl_program program = clCreateProgramWithSource(ctx, //context
+                                                   1,   //number of strings
+                                                   &src, //lines
+                                                   &sourceLength, // size
+                                                   &status);  // status
+    check_cl_error(status, "clCreateProgramWithSource");
+    const cl_int buildStatus = clBuildProgram(program,
+                                  cl_uint(devices.size()), &devices[0],
+                                  buildOptions.size() ?
+                                  buildOptions.c_str() : 0, 0, 0);
+    check_build(program, devices, buildStatus);
+    return program;
+}
+
+//cache file layout: key line, line with binary sizes, binaries;
+//returns null program if binaries not found or rejected
+cl_program load_cached_program(cl_context ctx,
+                               const std::vector< cl_device_id >& devices,
+                               const std::string& path,
+                               const std::string& key,
+                               const std::string& buildOptions,
+                               bool& rejected) {
+    rejected = false;
+    std::ifstream in(path.c_str(), std::ios::in | std::ios::binary);
+    if(!in) return 0;
+    std::string storedKey;
+    if(!std::getline(in, storedKey) || storedKey != key) return 0;
+    std::string sizeLine;
+    if(!std::getline(in, sizeLine)) return 0;
+    std::istringstream sizeStream(sizeLine);
+    std::vector< size_t > sizes;
+    size_t sz = 0;
+    while(sizeStream >> sz) sizes.push_back(sz);
+    if(sizes.size() != devices.size()) return 0;
+    std::vector< std::vector< unsigned char > > binaries(sizes.size());
+    std::vector< const unsigned char* > bins(sizes.size());
+    for(size_t i = 0; i != sizes.size(); ++i) {
+        if(sizes[i] == 0) return 0;
+        binaries[i].resize(sizes[i]);
+        if(!in.read((char*)(&binaries[i][0]), sizes[i])) return 0;
+        bins[i] = &binaries[i][0];
+    }
+    std::vector< cl_int > binaryStatus(devices.size(), CL_SUCCESS);
+    cl_int status = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(ctx,
+                                                   cl_uint(devices.size()),
+                                                   &devices[0],
+                                                   &sizes[0], &bins[0],
+                                                   &binaryStatus[0], &status);
+    if(status != CL_SUCCESS
+       || std::count(binaryStatus.begin(), binaryStatus.end(), CL_SUCCESS)
+          != int(binaryStatus.size())) {
+        if(program) clReleaseProgram(program);
+        rejected = true;
+        return 0;
+    }
+    //building is still required for programs created from binaries
+    status = clBuildProgram(program, cl_uint(devices.size()), &devices[0],
+                            buildOptions.size() ? buildOptions.c_str() : 0,
+                            0, 0);
+    if(status != CL_SUCCESS) {
+        clReleaseProgram(program);
+        rejected = true;
+        return 0;
+    }
+    return program;
+}
+
+void store_program(cl_program program,
+                   size_t numDevices,
+                   const std::string& path,
+                   const std::string& key) {
+    std::vector< size_t > sizes(numDevices, 0);
+    cl_int status = clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES,
+                                     sizeof(size_t) * numDevices,
+                                     &sizes[0], 0);
+    if(status != CL_SUCCESS
+       || std::count(sizes.begin(), sizes.end(), size_t(0))) return;
+    std::vector< std::vector< unsigned char > > binaries(numDevices);
+    std::vector< unsigned char* > bins(numDevices);
+    for(size_t i = 0; i != numDevices; ++i) {
+        binaries[i].resize(sizes[i]);
+        bins[i] = &binaries[i][0];
+    }
+    status = clGetProgramInfo(program, CL_PROGRAM_BINARIES,
+                              sizeof(unsigned char*) * numDevices,
+                              &bins[0], 0);
+    if(status != CL_SUCCESS) return;
+    //write to temporary file first then rename to avoid having
+    //concurrent runs read partially written binaries
+    const std::string tmp = path + ".tmp";
+    std::ofstream out(tmp.c_str(), std::ios::out | std::ios::binary);
+    if(!out) return;
+    out << key << '\n';
+    for(size_t i = 0; i != numDevices; ++i) out << sizes[i] << ' ';
+    out << '\n';
+    for(size_t i = 0; i != numDevices; ++i)
+        out.write((const char*)(&binaries[i][0]), sizes[i]);
+    out.close();
+    if(!out || rename(tmp.c_str(), path.c_str()) != 0) remove(tmp.c_str());
+}
+}
+
+//------------------------------------------------------------------------------
+cl_program build_program(cl_context ctx,
+                         cl_device_id deviceID,
+                         const std::string& source,
+                         const std::string& buildOptions) {
+    return build_program(ctx, std::vector< cl_device_id >(1, deviceID),
+                         source, buildOptions);
+}
+
+//------------------------------------------------------------------------------
+cl_program build_program(cl_context ctx,
+                         const std::vector< cl_device_id >& devices,
+                         const std::string& source,
+                         const std::string& buildOptions) {
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    const std::string dir = program_cache_dir();
+    cl_program program = 0;
+    const char* outcome = "disabled";
+    if(!dir.empty()) {
+        std::ostringstream keyStream;
+        keyStream << std::hex << hash_text(source) << ' '
+                  << hash_text(buildOptions);
+        for(std::vector< cl_device_id >::const_iterator d = devices.begin();
+            d != devices.end(); ++d) {
+            keyStream << ' '
+                      << hash_text(get_device_info_string(*d, CL_DEVICE_NAME))
+                      << ' '
+                      << hash_text(get_device_info_string(*d,
+                                                          CL_DRIVER_VERSION));
+        }
+        const std::string key = keyStream.str();
+        std::ostringstream pathStream;
+        pathStream << dir << '/' << std::hex << hash_text(key) << ".clbin";
+        const std::string path = pathStream.str();
+        bool rejected = false;
+        program = load_cached_program(ctx, devices, path, key,
+                                      buildOptions, rejected);
+        if(program) {
+            outcome = "hit";
+        } else {
+            outcome = rejected ? "rejected" : "miss";
+            program = build_program_from_source(ctx, devices,
+                                                source, buildOptions);
+            store_program(program, devices.size(), path, key);
+        }
+    } else {
+        program = build_program_from_source(ctx, devices,
+                                            source, buildOptions);
+    }
+    const std::chrono::steady_clock::time_point end =
+        std::chrono::steady_clock::now();
+    trace_host("build_program", start, end);
+    const double elapsed_ms =
+        std::chrono::duration< double, std::milli >(end - start).count();
+    std::lock_guard< std::mutex > lock(programCacheStatsMutex);
+    const std::string o = outcome;
+    if(o == "hit") ++programCacheStats.hits;
+    else if(o == "rejected") ++programCacheStats.rejected;
+    else if(o == "miss") ++programCacheStats.misses;
+    programCacheStats.buildTime_ms += elapsed_ms;
+    std::cout << "Program cache: " << outcome
+              << "  build time: " << elapsed_ms << " ms" << std::endl;
+    return program;
+}
+
+//------------------------------------------------------------------------------
+CLProgramCacheStats get_program_cache_stats() {
+    std::lock_guard< std::mutex > lock(programCacheStatsMutex);
+    return programCacheStats;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+CLEnvFuture create_clenv_impl(std::launch policy,
+                              const std::string& platformName,
+                              const std::string& deviceType,
+                              int deviceNum,
+                              bool enableProfiling,
+                              const char* clSourcePath,
+                              const char* kernelName,
+                              const std::string& clSourcePrefix,
+                              const std::string& buildOptions) {
 
-    CLEnv rt;
+    CLEnvFuture f;
+    CLEnv& rt = f.env;
+    rt.program = 0;
+    rt.kernel = 0;
+    if(kernelName != 0) f.kernelName = kernelName;
     cl_int status;
     cl_device_id deviceID;
 
     //1)create context
-    rt.context = create_cl_context(platformName, deviceType, deviceNum);
+    const std::string::size_type slash = deviceType.find('/');
+    rt.context = create_cl_context(platformName, deviceType.substr(0, slash),
+                                   deviceNum);
     //only a single device was selected
     //retrieve actual device id from context
-    status = clGetContextInfo(rt.context,
-                              CL_CONTEXT_DEVICES,
-                              sizeof(cl_device_id),
-                              &deviceID, 0);
-    check_cl_error(status, "clGetContextInfo");
+    deviceID = get_device_id(rt.context);
+    std::vector< cl_device_id > devices(1, deviceID);
+    //1.1)optional device fission: replace context with a context containing
+    //    both the parent device and its sub-devices
+    if(slash != std::string::npos) {
+        rt.subDevices = create_sub_devices(deviceID,
+                                           deviceType.substr(slash + 1));
+        devices.insert(devices.end(),
+                       rt.subDevices.begin(), rt.subDevices.end());
+        cl_platform_id platformID;
+        status = clGetDeviceInfo(deviceID, CL_DEVICE_PLATFORM,
+                                 sizeof(cl_platform_id), &platformID, 0);
+        check_cl_error(status, "clGetDeviceInfo");
+        check_cl_error(clReleaseContext(rt.context), "clReleaseContext");
+        cl_context_properties ctxProps[] = {
+            CL_CONTEXT_PLATFORM,
+            cl_context_properties(platformID),
+            0
+        };
+        rt.context = clCreateContext(ctxProps, cl_uint(devices.size()),
+                                     &devices[0], &context_callback, 0,
+                                     &status);
+        check_cl_error(status, "clCreateContext");
+    }
     
     //2)load kernel source
     if(clSourcePath != 0) {
         const std::string programSource = clSourcePrefix 
                                           + "\n" 
                                           + load_text(clSourcePath);
-        const char* src = programSource.c_str();
-        const size_t sourceLength = programSource.length();
 
-        //3)build program and create kernel
-        
-        rt.program = clCreateProgramWithSource(rt.context, //context
-                                               1,   //number of strings
-                                               &src, //lines
-                                               &sourceLength, // size 
-                                               &status);  // status 
-        check_cl_error(status, "clCreateProgramWithSource");
-        
-        cl_int buildStatus = buildOptions.size() ?
-                             clBuildProgram(rt.program, 1, &deviceID,
-                                buildOptions.c_str(), 0, 0)
-                             : clBuildProgram(rt.program, 1, &deviceID,
-                                0, 0, 0);
-        //log output if any
-        char buffer[0x10000] = "";
-        size_t len = 0;
-        status = clGetProgramBuildInfo(rt.program,
-                                       deviceID,
-                                       CL_PROGRAM_BUILD_LOG,
-                                       sizeof(buffer),
-                                       buffer,
-                                       &len);
-        check_cl_error(status, "clBuildProgramInfo");
-        if(len > 1) std::cout << "Build output: " << buffer << std::endl;
-        check_cl_error(buildStatus, "clBuildProgram");
-        if(kernelName != 0) {
-            rt.kernel = clCreateKernel(rt.program, kernelName, &status);
-            check_cl_error(status, "clCreateKernel"); 
-        }
+        //3)build program; kernels are created in wait_clenv
+        const cl_context ctx = rt.context;
+        f.program = std::async(policy, [ctx, devices, programSource,
+                                        buildOptions]() {
+            return build_program(ctx, devices, programSource, buildOptions);
+        });
     }
 
+    //profiling is required to trace commands
+    if(tracing_enabled()) enableProfiling = true;
     rt.commandQueue = enableProfiling ?
                       clCreateCommandQueue(rt.context, deviceID,
                                            CL_QUEUE_PROFILING_ENABLE, &status)
                       : clCreateCommandQueue(rt.context, deviceID, 0, &status);
     check_cl_error(status, "clCreateCommandQueue");
+    for(std::vector< cl_device_id >::const_iterator d = rt.subDevices.begin();
+        d != rt.subDevices.end(); ++d) {
+        rt.subQueues.push_back(clCreateCommandQueue(rt.context, *d,
+                                   enableProfiling ?
+                                   CL_QUEUE_PROFILING_ENABLE : 0, &status));
+        check_cl_error(status, "clCreateCommandQueue");
+    }
 
-    return rt;
+    return f;
+}
+}
+
+//------------------------------------------------------------------------------
+CLEnv create_clenv(const std::string& platformName,
+                   const std::string& deviceType,
+                   int deviceNum,
+                   bool enableProfiling,
+                   const char* clSourcePath,
+                   const char* kernelName,
+                   const std::string& clSourcePrefix,
+                   const std::string& buildOptions) {
+    //deferred: program is built in the calling thread by wait_clenv
+    CLEnvFuture f = create_clenv_impl(std::launch::deferred,
+                                      platformName, deviceType, deviceNum,
+                                      enableProfiling, clSourcePath,
+                                      kernelName, clSourcePrefix,
+                                      buildOptions);
+    return wait_clenv(f);
+}
+
+//------------------------------------------------------------------------------
+CLEnvFuture create_clenv_async(const std::string& platformName,
+                               const std::string& deviceType,
+                               int deviceNum,
+                               bool enableProfiling,
+                               const char* clSourcePath,
+                               const char* kernelName,
+                               const std::string& clSourcePrefix,
+                               const std::string& buildOptions) {
+    return create_clenv_impl(std::launch::async,
+                             platformName, deviceType, deviceNum,
+                             enableProfiling, clSourcePath,
+                             kernelName, clSourcePrefix, buildOptions);
+}
+
+//------------------------------------------------------------------------------
+bool clenv_ready(const CLEnvFuture& f) {
+    return !f.program.valid()
+           || f.program.wait_for(std::chrono::seconds(0))
+              == std::future_status::ready;
+}
+
+//------------------------------------------------------------------------------
+CLEnv wait_clenv(CLEnvFuture& f) {
+    if(f.program.valid()) {
+        const std::chrono::steady_clock::time_point start =
+            std::chrono::steady_clock::now();
+        f.env.program = f.program.get();
+        trace_host("wait_clenv", start, std::chrono::steady_clock::now());
+        f.env.kernels = create_kernels(f.env.program);
+        if(!f.kernelName.empty())
+            f.env.kernel = get_kernel(f.env, f.kernelName);
+    }
+    return f.env;
 }
 
 //------------------------------------------------------------------------------
 void release_clenv(CLEnv& e) {
+    collect_trace();
+    untrace_queue(e.commandQueue);
     check_cl_error(clReleaseCommandQueue(e.commandQueue),
                                          "clReleaseCommandQueue");
-    check_cl_error(clReleaseKernel(e.kernel), "clReleaseKernel");
-    check_cl_error(clReleaseProgram(e.program), "clReleaseProgram");
+    for(std::vector< cl_command_queue >::iterator q = e.subQueues.begin();
+        q != e.subQueues.end(); ++q) {
+        untrace_queue(*q);
+        check_cl_error(clReleaseCommandQueue(*q), "clReleaseCommandQueue");
+    }
+    e.subQueues.clear();
+    //e.kernel is one of e.kernels
+    for(CLKernelMap::iterator k = e.kernels.begin();
+        k != e.kernels.end(); ++k) {
+        forget_kernel_args(k->second);
+        check_cl_error(clReleaseKernel(k->second), "clReleaseKernel");
+    }
+    e.kernels.clear();
+    e.kernel = 0;
+    if(e.program)
+        check_cl_error(clReleaseProgram(e.program), "clReleaseProgram");
     check_cl_error(clReleaseContext(e.context), "clReleaseContext");
+    for(std::vector< cl_device_id >::iterator d = e.subDevices.begin();
+        d != e.subDevices.end(); ++d) {
+        check_cl_error(clReleaseDevice(*d), "clReleaseDevice");
+    }
+    e.subDevices.clear();
+}
+
+//------------------------------------------------------------------------------
+CLKernelMap create_kernels(cl_program program) {
+    cl_uint numKernels = 0;
+    cl_int status = clCreateKernelsInProgram(program, 0, 0, &numKernels);
+    check_cl_error(status, "clCreateKernelsInProgram");
+    CLKernelMap kernels;
+    if(numKernels == 0) return kernels;
+    std::vector< cl_kernel > k(numKernels);
+    status = clCreateKernelsInProgram(program, numKernels, &k[0], 0);
+    check_cl_error(status, "clCreateKernelsInProgram");
+    std::vector< char > name(0x100, char(0));
+    for(std::vector< cl_kernel >::const_iterator i = k.begin();
+        i != k.end(); ++i) {
+        size_t len = 0;
+        status = clGetKernelInfo(*i, CL_KERNEL_FUNCTION_NAME, 0, 0, &len);
+        check_cl_error(status, "clGetKernelInfo");
+        if(len > name.size()) name.resize(len);
+        status = clGetKernelInfo(*i, CL_KERNEL_FUNCTION_NAME,
+                                 name.size(), &name[0], 0);
+        check_cl_error(status, "clGetKernelInfo");
+        kernels[&name[0]] = *i;
+    }
+    return kernels;
+}
+
+//------------------------------------------------------------------------------
+cl_kernel get_kernel(const CLEnv& e, const std::string& kernelName) {
+    CLKernelMap::const_iterator k = e.kernels.find(kernelName);
+    if(k == e.kernels.end()) {
+        std::cerr << "ERROR - kernel " << kernelName << " not found"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return k->second;
 }
 
 //------------------------------------------------------------------------------
@@ -481,6 +910,10 @@ double timeEnqueueNDRangeKernel(cl_command_queue command_queue,
     //event timing is reported in nano seconds: divide by 1e6 to get
     //time in milliseconds
     kernelElapsedTime_ms =  (double)(kernelEndTime - kernelStartTime) / 1E6;
+    if(tracing_enabled())
+        trace_command(command_queue, profilingEvent, "kernel",
+                      kernel_name(kernel));
+    check_cl_error(clReleaseEvent(profilingEvent), "clReleaseEvent");
     return kernelElapsedTime_ms;
 }
 
@@ -502,4 +935,2903 @@ double get_cl_time(cl_event ev) {
     //event timing is reported in nanoseconds: divide by 1e6 to get
     //time in milliseconds
     return double((endTime - startTime) / 1E6);    
-}
\ No newline at end of file
+}
+
+//------------------------------------------------------------------------------
+std::vector< cl_device_id > create_sub_devices(cl_device_id deviceID,
+                                               int numSubDevices) {
+    cl_uint computeUnits = 0;
+    cl_int status = clGetDeviceInfo(deviceID, CL_DEVICE_MAX_COMPUTE_UNITS,
+                                    sizeof(cl_uint), &computeUnits, 0);
+    check_cl_error(status, "clGetDeviceInfo");
+    if(numSubDevices < 1) {
+        std::cerr << "ERROR - invalid number of sub-devices: "
+                  << numSubDevices << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const cl_uint unitsPerSubDevice =
+        std::max(cl_uint(1), computeUnits / cl_uint(numSubDevices));
+    const cl_device_partition_property props[] = {
+        CL_DEVICE_PARTITION_EQUALLY,
+        cl_device_partition_property(unitsPerSubDevice),
+        0
+    };
+    cl_uint n = 0;
+    status = clCreateSubDevices(deviceID, props, 0, 0, &n);
+    check_cl_error(status, "clCreateSubDevices");
+    std::vector< cl_device_id > subDevices(n);
+    status = clCreateSubDevices(deviceID, props, n, &subDevices[0], 0);
+    check_cl_error(status, "clCreateSubDevices");
+    //compute units not evenly divisible: discard extra sub-devices
+    while(int(subDevices.size()) > numSubDevices) {
+        check_cl_error(clReleaseDevice(subDevices.back()), "clReleaseDevice");
+        subDevices.pop_back();
+    }
+    return subDevices;
+}
+
+//------------------------------------------------------------------------------
+std::vector< cl_device_id > create_sub_devices(cl_device_id deviceID,
+                                               const std::string& partition) {
+    cl_device_affinity_domain domain = 0;
+    if(partition == "numa") domain = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+    else if(partition == "l4") domain = CL_DEVICE_AFFINITY_DOMAIN_L4_CACHE;
+    else if(partition == "l3") domain = CL_DEVICE_AFFINITY_DOMAIN_L3_CACHE;
+    else if(partition == "l2") domain = CL_DEVICE_AFFINITY_DOMAIN_L2_CACHE;
+    else if(partition == "l1") domain = CL_DEVICE_AFFINITY_DOMAIN_L1_CACHE;
+    else if(partition == "next")
+        domain = CL_DEVICE_AFFINITY_DOMAIN_NEXT_PARTITIONABLE;
+    else return create_sub_devices(deviceID, atoi(partition.c_str()));
+    const cl_device_partition_property props[] = {
+        CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN,
+        cl_device_partition_property(domain),
+        0
+    };
+    cl_uint n = 0;
+    cl_int status = clCreateSubDevices(deviceID, props, 0, 0, &n);
+    check_cl_error(status, "clCreateSubDevices - affinity domain not "
+                           "supported by device?");
+    std::vector< cl_device_id > subDevices(n);
+    status = clCreateSubDevices(deviceID, props, n, &subDevices[0], 0);
+    check_cl_error(status, "clCreateSubDevices");
+    return subDevices;
+}
+
+//------------------------------------------------------------------------------
+std::vector< cl_mem > create_partitioned_buffers(const CLEnv& e,
+                                     cl_mem_flags flags,
+                                     const std::vector< size_t >& sizes,
+                                     const std::vector< const void* >& host) {
+    if(sizes.size() != e.subQueues.size()
+       || host.size() != e.subQueues.size()) {
+        std::cerr << "ERROR - number of slices does not match number of "
+                     "sub-devices" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::vector< cl_mem > buffers;
+    for(size_t i = 0; i != sizes.size(); ++i) {
+        //zero-sized buffers are not allowed
+        if(sizes[i] == 0) {
+            buffers.push_back(0);
+            continue;
+        }
+        cl_int status;
+        const size_t size = sizes[i];
+        cl_mem b = clCreateBuffer(e.context, flags | CL_MEM_ALLOC_HOST_PTR,
+                                  size, 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+        //make sub-device the owner of the buffer, then have the sub-device
+        //write the data: on CPU devices pages are first touched by the
+        //threads bound to the affinity domain of the sub-device
+        cl_event ev;
+        status = clEnqueueMigrateMemObjects(e.subQueues[i], 1, &b,
+                             CL_MIGRATE_MEM_OBJECT_CONTENT_UNDEFINED,
+                             0, 0, trace_event_ptr(e.subQueues[i], &ev));
+        check_cl_error(status, "clEnqueueMigrateMemObjects");
+        trace_command_and_release(e.subQueues[i], ev, "migrate",
+                                  "partitioned buffer");
+        if(host[i]) {
+            status = clEnqueueWriteBuffer(e.subQueues[i], b, CL_FALSE, 0,
+                                          sizes[i], host[i], 0, 0,
+                                          trace_event_ptr(e.subQueues[i],
+                                                          &ev));
+            check_cl_error(status, "clEnqueueWriteBuffer");
+            trace_command_and_release(e.subQueues[i], ev, "write",
+                                      "partitioned buffer");
+        } else {
+            const cl_uchar zero = 0;
+            status = clEnqueueFillBuffer(e.subQueues[i], b, &zero,
+                                         sizeof(zero), 0, size, 0, 0,
+                                         trace_event_ptr(e.subQueues[i],
+                                                         &ev));
+            check_cl_error(status, "clEnqueueFillBuffer");
+            trace_command_and_release(e.subQueues[i], ev, "fill",
+                                      "partitioned buffer");
+        }
+        buffers.push_back(b);
+    }
+    for(size_t i = 0; i != sizes.size(); ++i)
+        check_cl_error(clFinish(e.subQueues[i]), "clFinish");
+    return buffers;
+}
+
+//------------------------------------------------------------------------------
+CLMultiEnv create_multi_clenv(const std::string& platformName,
+                              const std::string& deviceTypeName,
+                              const std::string& deviceList,
+                              const char* clSourcePath,
+                              const std::string& clSourcePrefix,
+                              const std::string& buildOptions) {
+    CLMultiEnv rt;
+    rt.program = 0;
+    cl_int status;
+    //1)select devices; "auto": devices of the platform of the fastest device
+    cl_platform_id platformID = auto_platform(platformName) ?
+        auto_select_device(platformName, deviceTypeName).platform
+        : find_platform(platformName);
+    const std::vector< cl_device_id > deviceIDs =
+        get_device_ids(platformID, deviceTypeName);
+    if(deviceList == "all") {
+        rt.devices = deviceIDs;
+    } else {
+        std::istringstream is(deviceList);
+        std::string d;
+        while(std::getline(is, d, ',')) {
+            const int deviceNum = atoi(d.c_str());
+            if(deviceNum < 0 || deviceNum >= int(deviceIDs.size())) {
+                std::cerr << "ERROR - device number out of range: [0,"
+                          << (deviceIDs.size() - 1) << ']' << std::endl;
+                exit(EXIT_FAILURE);
+            }
+            const std::string::size_type slash = d.find('/');
+            if(slash == std::string::npos) {
+                rt.devices.push_back(deviceIDs[deviceNum]);
+            } else {
+                const std::vector< cl_device_id > sub =
+                    create_sub_devices(deviceIDs[deviceNum],
+                                       d.substr(slash + 1));
+                rt.subDevices.insert(rt.subDevices.end(),
+                                     sub.begin(), sub.end());
+                rt.devices.insert(rt.devices.end(), sub.begin(), sub.end());
+            }
+        }
+    }
+    if(rt.devices.empty()) {
+        std::cerr << "ERROR - no devices selected" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    //2)create context
+    cl_context_properties ctxProps[] = {
+        CL_CONTEXT_PLATFORM,
+        cl_context_properties(platformID),
+        0
+    };
+    rt.context = clCreateContext(ctxProps, cl_uint(rt.devices.size()),
+                                 &rt.devices[0], &context_callback, 0,
+                                 &status);
+    check_cl_error(status, "clCreateContext");
+    //3)build program for all devices and create kernels
+    if(clSourcePath != 0) {
+        const std::string programSource = clSourcePrefix
+                                          + "\n"
+                                          + load_text(clSourcePath);
+        rt.program = build_program(rt.context, rt.devices,
+                                   programSource, buildOptions);
+        rt.kernels = create_kernels(rt.program);
+    }
+    //4)one queue per device, profiling is required to measure throughput
+    for(std::vector< cl_device_id >::const_iterator d = rt.devices.begin();
+        d != rt.devices.end(); ++d) {
+        rt.queues.push_back(clCreateCommandQueue(rt.context, *d,
+                                                 CL_QUEUE_PROFILING_ENABLE,
+                                                 &status));
+        check_cl_error(status, "clCreateCommandQueue");
+    }
+    rt.throughput.resize(rt.devices.size(), 0.0);
+    return rt;
+}
+
+//------------------------------------------------------------------------------
+void release_multi_clenv(CLMultiEnv& e) {
+    collect_trace();
+    for(std::vector< cl_command_queue >::iterator q = e.queues.begin();
+        q != e.queues.end(); ++q) {
+        untrace_queue(*q);
+        check_cl_error(clReleaseCommandQueue(*q), "clReleaseCommandQueue");
+    }
+    e.queues.clear();
+    for(CLKernelMap::iterator k = e.kernels.begin();
+        k != e.kernels.end(); ++k) {
+        forget_kernel_args(k->second);
+        check_cl_error(clReleaseKernel(k->second), "clReleaseKernel");
+    }
+    e.kernels.clear();
+    if(e.program)
+        check_cl_error(clReleaseProgram(e.program), "clReleaseProgram");
+    check_cl_error(clReleaseContext(e.context), "clReleaseContext");
+    for(std::vector< cl_device_id >::iterator d = e.subDevices.begin();
+        d != e.subDevices.end(); ++d) {
+        check_cl_error(clReleaseDevice(*d), "clReleaseDevice");
+    }
+    e.subDevices.clear();
+    e.devices.clear();
+}
+
+//------------------------------------------------------------------------------
+cl_kernel get_kernel(const CLMultiEnv& e, const std::string& kernelName) {
+    CLKernelMap::const_iterator k = e.kernels.find(kernelName);
+    if(k == e.kernels.end()) {
+        std::cerr << "ERROR - kernel " << kernelName << " not found"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return k->second;
+}
+
+//------------------------------------------------------------------------------
+std::vector< CLRange > partition_ndrange(const std::vector< double >& weights,
+                                         cl_uint dim,
+                                         const size_t* global,
+                                         const size_t* local) {
+    if(dim < 1 || dim > 3 || weights.empty()) {
+        std::cerr << "ERROR - invalid NDRange partition" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const cl_uint split = dim - 1;
+    const size_t block = local ? local[split] : 1;
+    const size_t numBlocks = global[split] / block;
+    const double totalWeight = std::accumulate(weights.begin(),
+                                               weights.end(), 0.0);
+    std::vector< CLRange > ranges(weights.size());
+    size_t assigned = 0;
+    for(size_t i = 0; i != weights.size(); ++i) {
+        CLRange& r = ranges[i];
+        r.dim = dim;
+        for(cl_uint d = 0; d != 3; ++d) {
+            r.offset[d] = 0;
+            r.global[d] = d < dim ? global[d] : 1;
+        }
+        //last device receives the remainder
+        size_t blocks = i == weights.size() - 1 ? numBlocks - assigned
+                        : size_t(numBlocks * weights[i] / totalWeight + 0.5);
+        blocks = std::min(blocks, numBlocks - assigned);
+        r.offset[split] = assigned * block;
+        r.global[split] = blocks * block;
+        assigned += blocks;
+    }
+    return ranges;
+}
+
+//------------------------------------------------------------------------------
+std::vector< CLRange > dispatch_ndrange(CLMultiEnv& e,
+                      cl_kernel kernel,
+                      cl_uint dim,
+                      const size_t* global,
+                      const size_t* local,
+                      const CLDeviceArgsSetter& setDeviceArgs) {
+    const bool measured = std::count(e.throughput.begin(),
+                                     e.throughput.end(), 0.0) == 0;
+    const std::vector< double > weights =
+        measured ? e.throughput : std::vector< double >(e.devices.size(), 1.0);
+    const std::vector< CLRange > ranges =
+        partition_ndrange(weights, dim, global, local);
+    std::vector< cl_event > events(ranges.size(), cl_event(0));
+    for(size_t i = 0; i != ranges.size(); ++i) trace_queue(e.queues[i]);
+    for(size_t i = 0; i != ranges.size(); ++i) {
+        const CLRange& r = ranges[i];
+        if(r.global[dim - 1] == 0) continue;
+        if(setDeviceArgs) setDeviceArgs(kernel, int(i));
+        cl_int status = clEnqueueNDRangeKernel(e.queues[i], kernel, dim,
+                                               r.offset, r.global, local,
+                                               0, 0, &events[i]);
+        check_cl_error(status, "clEnqueueNDRangeKernel");
+        if(tracing_enabled())
+            trace_command(e.queues[i], events[i], "kernel",
+                          kernel_name(kernel));
+        //start execution right away on this device
+        check_cl_error(clFlush(e.queues[i]), "clFlush");
+    }
+    for(size_t i = 0; i != ranges.size(); ++i) {
+        if(!events[i]) continue;
+        check_cl_error(clWaitForEvents(1, &events[i]), "clWaitForEvents");
+        cl_ulong start = 0;
+        cl_ulong end = 0;
+        check_cl_error(clGetEventProfilingInfo(events[i],
+                                               CL_PROFILING_COMMAND_START,
+                                               sizeof(cl_ulong), &start, 0),
+                       "clGetEventProfilingInfo");
+        check_cl_error(clGetEventProfilingInfo(events[i],
+                                               CL_PROFILING_COMMAND_END,
+                                               sizeof(cl_ulong), &end, 0),
+                       "clGetEventProfilingInfo");
+        check_cl_error(clReleaseEvent(events[i]), "clReleaseEvent");
+        const double ms = std::max(double(end - start) / 1E6, 1E-6);
+        size_t items = 1;
+        for(cl_uint d = 0; d != dim; ++d) items *= ranges[i].global[d];
+        const double t = items / ms;
+        //smooth measurements to reduce the effect of outliers
+        e.throughput[i] = e.throughput[i] > 0.0 ?
+                          0.5 * (e.throughput[i] + t) : t;
+    }
+    return ranges;
+}
+
+//------------------------------------------------------------------------------
+std::vector< cl_mem > create_device_buffers(const CLMultiEnv& e,
+                                            cl_mem_flags flags,
+                                            size_t size) {
+    std::vector< cl_mem > buffers;
+    for(size_t i = 0; i != e.devices.size(); ++i) {
+        cl_int status;
+        buffers.push_back(clCreateBuffer(e.context, flags, size, 0, &status));
+        check_cl_error(status, "clCreateBuffer");
+    }
+    return buffers;
+}
+
+//------------------------------------------------------------------------------
+void gather_ndrange(const CLMultiEnv& e,
+                    const std::vector< cl_mem >& deviceBuffers,
+                    const std::vector< CLRange >& ranges,
+                    size_t bytesPerBlock,
+                    size_t itemsPerBlock,
+                    void* host) {
+    for(size_t i = 0; i != ranges.size(); ++i) {
+        const CLRange& r = ranges[i];
+        const cl_uint split = r.dim - 1;
+        if(r.global[split] == 0) continue;
+        const size_t offset = r.offset[split] / itemsPerBlock * bytesPerBlock;
+        const size_t size = r.global[split] / itemsPerBlock * bytesPerBlock;
+        cl_event ev;
+        cl_int status = clEnqueueReadBuffer(e.queues[i], deviceBuffers[i],
+                                            CL_FALSE, offset, size,
+                                            (char*)(host) + offset,
+                                            0, 0,
+                                            trace_event_ptr(e.queues[i], &ev));
+        check_cl_error(status, "clEnqueueReadBuffer");
+        trace_command_and_release(e.queues[i], ev, "read", "gather_ndrange");
+    }
+    for(size_t i = 0; i != ranges.size(); ++i)
+        check_cl_error(clFinish(e.queues[i]), "clFinish");
+}
+
+//------------------------------------------------------------------------------
+CLTaskGraph create_task_graph(const CLEnv& e,
+                              int numQueues,
+                              bool enableProfiling) {
+    CLTaskGraph g;
+    g.context = e.context;
+    g.profiling = enableProfiling;
+    const cl_device_id deviceID = get_device_id(e.context);
+    cl_command_queue_properties supported = 0;
+    cl_int status = clGetDeviceInfo(deviceID, CL_DEVICE_QUEUE_PROPERTIES,
+                                    sizeof(supported), &supported, 0);
+    check_cl_error(status, "clGetDeviceInfo");
+    g.outOfOrder = numQueues == 0
+                   && (supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+    cl_command_queue_properties props =
+        enableProfiling || tracing_enabled() ? CL_QUEUE_PROFILING_ENABLE : 0;
+    if(g.outOfOrder) props |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+    const int n = g.outOfOrder ? 1 : (numQueues > 0 ? numQueues : 2);
+    for(int q = 0; q != n; ++q) {
+        g.queues.push_back(clCreateCommandQueue(e.context, deviceID,
+                                                props, &status));
+        check_cl_error(status, "clCreateCommandQueue");
+    }
+    return g;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+void release_task_events(CLTaskGraph& g) {
+    for(std::vector< CLTask >::iterator t = g.tasks.begin();
+        t != g.tasks.end(); ++t) {
+        if(!t->event) continue;
+        check_cl_error(clReleaseEvent(t->event), "clReleaseEvent");
+        t->event = 0;
+    }
+}
+
+CLTask make_task(const CLTaskGraph& g,
+                 CLTaskType type,
+                 const std::string& name,
+                 const std::vector< int >& deps) {
+    const int id = int(g.tasks.size());
+    for(std::vector< int >::const_iterator d = deps.begin();
+        d != deps.end(); ++d) {
+        if(*d < 0 || *d >= id) {
+            std::cerr << "ERROR - task '" << name
+                      << "' depends on invalid task " << *d << std::endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    CLTask t;
+    t.type = type;
+    t.name = name;
+    t.deps = deps;
+    t.queue = 0;
+    t.kernel = 0;
+    t.dim = 0;
+    t.hasLocal = false;
+    for(int i = 0; i != 3; ++i) t.global[i] = t.local[i] = 1;
+    t.buffer = 0;
+    t.offset = 0;
+    t.size = 0;
+    t.host = 0;
+    t.mapFlags = 0;
+    t.mapTask = -1;
+    t.event = 0;
+    return t;
+}
+
+//with multiple in-order queues a node is appended to the queue of one of
+//its dependencies if that dependency is the last node in the queue: the
+//in-order queue already enforces the dependency and chains of dependent
+//nodes stay on the same queue; all other nodes are distributed round-robin
+//so that independent chains end up on different queues
+int select_queue(const CLTaskGraph& g,
+                 const CLTask& t,
+                 std::vector< int >& tail,
+                 int& next) {
+    if(g.outOfOrder) return 0;
+    for(std::vector< int >::const_iterator d = t.deps.begin();
+        d != t.deps.end(); ++d) {
+        const int q = g.tasks[*d].queue;
+        if(tail[q] == *d) return q;
+    }
+    const int q = next;
+    next = (next + 1) % int(g.queues.size());
+    return q;
+}
+}
+
+//------------------------------------------------------------------------------
+void release_task_graph(CLTaskGraph& g) {
+    collect_trace();
+    release_task_events(g);
+    for(std::vector< cl_command_queue >::iterator q = g.queues.begin();
+        q != g.queues.end(); ++q) {
+        untrace_queue(*q);
+        check_cl_error(clReleaseCommandQueue(*q), "clReleaseCommandQueue");
+    }
+    g.queues.clear();
+    g.tasks.clear();
+}
+
+//------------------------------------------------------------------------------
+int add_kernel_task(CLTaskGraph& g,
+                    const std::string& name,
+                    cl_kernel kernel,
+                    cl_uint dim,
+                    const size_t* global,
+                    const size_t* local,
+                    const std::vector< int >& deps,
+                    const CLKernelArgsSetter& setArgs) {
+    CLTask t = make_task(g, CLTASK_KERNEL, name, deps);
+    t.kernel = kernel;
+    t.setArgs = setArgs;
+    t.dim = dim;
+    t.hasLocal = local != 0;
+    for(cl_uint d = 0; d != dim; ++d) {
+        t.global[d] = global[d];
+        if(local) t.local[d] = local[d];
+    }
+    g.tasks.push_back(t);
+    return int(g.tasks.size()) - 1;
+}
+
+//------------------------------------------------------------------------------
+int add_write_task(CLTaskGraph& g,
+                   const std::string& name,
+                   cl_mem buffer,
+                   size_t offset,
+                   size_t size,
+                   const void* host,
+                   const std::vector< int >& deps) {
+    CLTask t = make_task(g, CLTASK_WRITE, name, deps);
+    t.buffer = buffer;
+    t.offset = offset;
+    t.size = size;
+    t.host = const_cast< void* >(host);
+    g.tasks.push_back(t);
+    return int(g.tasks.size()) - 1;
+}
+
+//------------------------------------------------------------------------------
+int add_read_task(CLTaskGraph& g,
+                  const std::string& name,
+                  cl_mem buffer,
+                  size_t offset,
+                  size_t size,
+                  void* host,
+                  const std::vector< int >& deps) {
+    CLTask t = make_task(g, CLTASK_READ, name, deps);
+    t.buffer = buffer;
+    t.offset = offset;
+    t.size = size;
+    t.host = host;
+    g.tasks.push_back(t);
+    return int(g.tasks.size()) - 1;
+}
+
+//------------------------------------------------------------------------------
+int add_map_task(CLTaskGraph& g,
+                 const std::string& name,
+                 cl_mem buffer,
+                 cl_map_flags flags,
+                 size_t offset,
+                 size_t size,
+                 const std::vector< int >& deps) {
+    CLTask t = make_task(g, CLTASK_MAP, name, deps);
+    t.buffer = buffer;
+    t.mapFlags = flags;
+    t.offset = offset;
+    t.size = size;
+    g.tasks.push_back(t);
+    return int(g.tasks.size()) - 1;
+}
+
+//------------------------------------------------------------------------------
+int add_unmap_task(CLTaskGraph& g,
+                   const std::string& name,
+                   int mapTask,
+                   const std::vector< int >& deps) {
+    //the unmap node always depends on the map node
+    std::vector< int > d(deps);
+    if(std::find(d.begin(), d.end(), mapTask) == d.end()) d.push_back(mapTask);
+    CLTask t = make_task(g, CLTASK_UNMAP, name, d);
+    if(g.tasks[mapTask].type != CLTASK_MAP) {
+        std::cerr << "ERROR - task '" << name << "': task " << mapTask
+                  << " is not a map task" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    t.buffer = g.tasks[mapTask].buffer;
+    t.mapTask = mapTask;
+    g.tasks.push_back(t);
+    return int(g.tasks.size()) - 1;
+}
+
+//------------------------------------------------------------------------------
+void run_task_graph(CLTaskGraph& g) {
+    release_task_events(g);
+    for(std::vector< cl_command_queue >::const_iterator q = g.queues.begin();
+        q != g.queues.end(); ++q) trace_queue(*q);
+    const char* category[] = {"kernel", "write", "read", "map", "unmap"};
+    std::vector< int > tail(g.queues.size(), -1);
+    int next = 0;
+    for(size_t i = 0; i != g.tasks.size(); ++i) {
+        CLTask& t = g.tasks[i];
+        t.queue = select_queue(g, t, tail, next);
+        tail[t.queue] = int(i);
+        cl_command_queue queue = g.queues[t.queue];
+        std::vector< cl_event > waitList;
+        for(std::vector< int >::const_iterator d = t.deps.begin();
+            d != t.deps.end(); ++d) waitList.push_back(g.tasks[*d].event);
+        const cl_uint numEvents = cl_uint(waitList.size());
+        const cl_event* events = waitList.empty() ? 0 : &waitList[0];
+        cl_int status = CL_SUCCESS;
+        switch(t.type) {
+        case CLTASK_KERNEL:
+            if(t.setArgs) t.setArgs(t.kernel);
+            status = clEnqueueNDRangeKernel(queue, t.kernel, t.dim, 0,
+                                            t.global,
+                                            t.hasLocal ? t.local : 0,
+                                            numEvents, events, &t.event);
+            check_cl_error(status, "clEnqueueNDRangeKernel");
+            break;
+        case CLTASK_WRITE:
+            status = clEnqueueWriteBuffer(queue, t.buffer, CL_FALSE,
+                                          t.offset, t.size, t.host,
+                                          numEvents, events, &t.event);
+            check_cl_error(status, "clEnqueueWriteBuffer");
+            break;
+        case CLTASK_READ:
+            status = clEnqueueReadBuffer(queue, t.buffer, CL_FALSE,
+                                         t.offset, t.size, t.host,
+                                         numEvents, events, &t.event);
+            check_cl_error(status, "clEnqueueReadBuffer");
+            break;
+        case CLTASK_MAP:
+            t.host = clEnqueueMapBuffer(queue, t.buffer, CL_FALSE,
+                                        t.mapFlags, t.offset, t.size,
+                                        numEvents, events, &t.event,
+                                        &status);
+            check_cl_error(status, "clEnqueueMapBuffer");
+            break;
+        case CLTASK_UNMAP:
+            status = clEnqueueUnmapMemObject(queue, t.buffer,
+                                             g.tasks[t.mapTask].host,
+                                             numEvents, events, &t.event);
+            check_cl_error(status, "clEnqueueUnmapMemObject");
+            break;
+        }
+        trace_command(queue, t.event, category[t.type], t.name);
+    }
+    //start execution on all the queues
+    for(std::vector< cl_command_queue >::const_iterator q = g.queues.begin();
+        q != g.queues.end(); ++q) check_cl_error(clFlush(*q), "clFlush");
+}
+
+//------------------------------------------------------------------------------
+void wait_task_graph(const CLTaskGraph& g) {
+    std::vector< cl_event > events;
+    for(std::vector< CLTask >::const_iterator t = g.tasks.begin();
+        t != g.tasks.end(); ++t) if(t->event) events.push_back(t->event);
+    if(events.empty()) return;
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    check_cl_error(clWaitForEvents(cl_uint(events.size()), &events[0]),
+                   "clWaitForEvents");
+    trace_host("wait_task_graph", start, std::chrono::steady_clock::now());
+}
+
+//------------------------------------------------------------------------------
+void* get_mapped_ptr(const CLTaskGraph& g, int mapTask) {
+    return g.tasks[mapTask].host;
+}
+
+//------------------------------------------------------------------------------
+void print_task_timeline(const CLTaskGraph& g, std::ostream& os) {
+    if(!g.profiling) {
+        os << "Task timeline requires profiling" << std::endl;
+        return;
+    }
+    std::vector< cl_ulong > start(g.tasks.size(), 0);
+    std::vector< cl_ulong > end(g.tasks.size(), 0);
+    cl_ulong first = ~cl_ulong(0);
+    for(size_t i = 0; i != g.tasks.size(); ++i) {
+        if(!g.tasks[i].event) continue;
+        check_cl_error(clGetEventProfilingInfo(g.tasks[i].event,
+                                               CL_PROFILING_COMMAND_START,
+                                               sizeof(cl_ulong), &start[i], 0),
+                       "clGetEventProfilingInfo");
+        check_cl_error(clGetEventProfilingInfo(g.tasks[i].event,
+                                               CL_PROFILING_COMMAND_END,
+                                               sizeof(cl_ulong), &end[i], 0),
+                       "clGetEventProfilingInfo");
+        first = std::min(first, start[i]);
+    }
+    for(size_t i = 0; i != g.tasks.size(); ++i) {
+        if(!g.tasks[i].event) continue;
+        os << "  " << g.tasks[i].name << "  queue " << g.tasks[i].queue
+           << "  start " << double(start[i] - first) / 1E6 << " ms"
+           << "  end " << double(end[i] - first) / 1E6 << " ms" << std::endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+bool CLMemPoolKey::operator<(const CLMemPoolKey& k) const {
+    if(flags != k.flags) return flags < k.flags;
+    if(image != k.image) return image < k.image;
+    if(order != k.order) return order < k.order;
+    if(type != k.type) return type < k.type;
+    if(width != k.width) return width < k.width;
+    return height < k.height;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+size_t size_class(size_t size) {
+    const size_t MIN_SIZE = 256;
+    if(size <= MIN_SIZE) return MIN_SIZE;
+    size_t p = MIN_SIZE;
+    while(p <= size / 2) p *= 2;
+    //four classes per power of two: at most 25% overhead
+    const size_t step = p / 4;
+    return (size + step - 1) / step * step;
+}
+
+//returns cached object matching key, or 0
+cl_mem pool_find(CLMemPool& pool, const CLMemPoolKey& key, size_t bytes) {
+    std::multimap< CLMemPoolKey, cl_mem >::iterator i = pool.free.find(key);
+    if(i == pool.free.end()) return 0;
+    cl_mem mem = i->second;
+    pool.free.erase(i);
+    pool.stats.bytesCached -= bytes;
+    return mem;
+}
+
+void pool_insert(CLMemPool& pool, const CLMemPoolKey& key,
+                 cl_mem mem, size_t bytes) {
+    pool.inUse[mem] = std::make_pair(key, bytes);
+    pool.stats.bytesInUse += bytes;
+    pool.stats.highWaterBytes = std::max(pool.stats.highWaterBytes,
+                                         pool.stats.bytesInUse
+                                         + pool.stats.bytesCached);
+}
+
+void check_pool_flags(cl_mem_flags flags) {
+    if(flags & (CL_MEM_USE_HOST_PTR | CL_MEM_COPY_HOST_PTR)) {
+        std::cerr << "ERROR - pooled memory objects cannot be created from "
+                     "host pointers" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+}
+
+//------------------------------------------------------------------------------
+CLMemPool create_mem_pool(cl_context ctx) {
+    CLMemPool pool;
+    pool.context = ctx;
+    pool.stats.allocations = 0;
+    pool.stats.hits = 0;
+    pool.stats.bytesInUse = 0;
+    pool.stats.bytesCached = 0;
+    pool.stats.highWaterBytes = 0;
+    return pool;
+}
+
+//------------------------------------------------------------------------------
+void release_mem_pool(CLMemPool& pool) {
+    trim_mem_pool(pool, 0);
+    if(!pool.inUse.empty()) {
+        std::cerr << "WARNING - " << pool.inUse.size()
+                  << " pooled memory objects still in use" << std::endl;
+    }
+}
+
+//------------------------------------------------------------------------------
+cl_mem pool_alloc_buffer(CLMemPool& pool, cl_mem_flags flags, size_t size) {
+    check_pool_flags(flags);
+    CLMemPoolKey key;
+    key.flags = flags;
+    key.image = false;
+    key.order = 0;
+    key.type = 0;
+    key.width = size_class(size);
+    key.height = 1;
+    cl_mem mem = pool_find(pool, key, key.width);
+    if(mem) {
+        ++pool.stats.hits;
+    } else {
+        cl_int status;
+        mem = clCreateBuffer(pool.context, flags, key.width, 0, &status);
+        check_cl_error(status, "clCreateBuffer");
+        ++pool.stats.allocations;
+    }
+    pool_insert(pool, key, mem, key.width);
+    return mem;
+}
+
+//------------------------------------------------------------------------------
+cl_mem pool_alloc_image2d(CLMemPool& pool,
+                          cl_mem_flags flags,
+                          const cl_image_format& format,
+                          size_t width,
+                          size_t height) {
+    check_pool_flags(flags);
+    CLMemPoolKey key;
+    key.flags = flags;
+    key.image = true;
+    key.order = format.image_channel_order;
+    key.type = format.image_channel_data_type;
+    key.width = width;
+    key.height = height;
+    cl_mem mem = 0;
+    size_t bytes = 0;
+    std::multimap< CLMemPoolKey, cl_mem >::iterator i = pool.free.find(key);
+    if(i != pool.free.end()) {
+        check_cl_error(clGetMemObjectInfo(i->second, CL_MEM_SIZE,
+                                          sizeof(size_t), &bytes, 0),
+                       "clGetMemObjectInfo");
+        mem = pool_find(pool, key, bytes);
+        ++pool.stats.hits;
+    } else {
+        cl_int status;
+        mem = clCreateImage2D(pool.context, flags, &format, width, height,
+                              0, 0, &status);
+        check_cl_error(status, "clCreateImage2D");
+        check_cl_error(clGetMemObjectInfo(mem, CL_MEM_SIZE,
+                                          sizeof(size_t), &bytes, 0),
+                       "clGetMemObjectInfo");
+        ++pool.stats.allocations;
+    }
+    pool_insert(pool, key, mem, bytes);
+    return mem;
+}
+
+//------------------------------------------------------------------------------
+void pool_release(CLMemPool& pool, cl_mem mem) {
+    std::map< cl_mem, std::pair< CLMemPoolKey, size_t > >::iterator i =
+        pool.inUse.find(mem);
+    if(i == pool.inUse.end()) {
+        std::cerr << "ERROR - memory object not allocated from pool"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    pool.free.insert(std::make_pair(i->second.first, mem));
+    pool.stats.bytesInUse -= i->second.second;
+    pool.stats.bytesCached += i->second.second;
+    pool.inUse.erase(i);
+}
+
+//------------------------------------------------------------------------------
+void trim_mem_pool(CLMemPool& pool, size_t maxCachedBytes) {
+    typedef std::multimap< CLMemPoolKey, cl_mem >::iterator FreeIterator;
+    typedef std::pair< size_t, FreeIterator > CachedObject;
+    //sort cached objects by size, largest first
+    std::vector< CachedObject > cached;
+    for(FreeIterator i = pool.free.begin(); i != pool.free.end(); ++i) {
+        size_t bytes = 0;
+        check_cl_error(clGetMemObjectInfo(i->second, CL_MEM_SIZE,
+                                          sizeof(size_t), &bytes, 0),
+                       "clGetMemObjectInfo");
+        cached.push_back(CachedObject(bytes, i));
+    }
+    std::sort(cached.begin(), cached.end(),
+              [](const CachedObject& a, const CachedObject& b) {
+                  return a.first > b.first;
+              });
+    for(std::vector< CachedObject >::iterator c = cached.begin();
+        c != cached.end() && pool.stats.bytesCached > maxCachedBytes; ++c) {
+        check_cl_error(clReleaseMemObject(c->second->second),
+                       "clReleaseMemObject");
+        pool.free.erase(c->second);
+        pool.stats.bytesCached -= c->first;
+    }
+}
+
+//------------------------------------------------------------------------------
+void print_mem_pool_stats(const CLMemPool& pool, std::ostream& os) {
+    os << "Memory pool:\n"
+       << "  allocations: " << pool.stats.allocations << '\n'
+       << "  hits: " << pool.stats.hits << '\n'
+       << "  in use (bytes): " << pool.stats.bytesInUse << '\n'
+       << "  cached (bytes): " << pool.stats.bytesCached << '\n'
+       << "  high-water mark (bytes): " << pool.stats.highWaterBytes
+       << std::endl;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+//all live arenas, searched by find_pinned
+std::vector< CLPinnedArena* > pinnedArenas;
+std::mutex pinnedArenasMutex;
+std::atomic< size_t > pinnedTransfers(0);
+std::atomic< size_t > pageableTransfers(0);
+
+CLPinnedRegion create_pinned_region(const CLPinnedArena& arena, size_t size) {
+    CLPinnedRegion r;
+    cl_int status;
+    r.buffer = clCreateBuffer(arena.context,
+                              CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR,
+                              size, 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    //region stays mapped until the arena is released
+    cl_event ev;
+    r.base = static_cast< char* >(
+                clEnqueueMapBuffer(arena.queue, r.buffer, CL_TRUE,
+                                   CL_MAP_READ | CL_MAP_WRITE, 0, size,
+                                   0, 0, trace_event_ptr(arena.queue, &ev),
+                                   &status));
+    check_cl_error(status, "clEnqueueMapBuffer");
+    trace_command_and_release(arena.queue, ev, "map", "pinned region");
+    r.size = size;
+    r.offset = 0;
+    r.live = 0;
+    return r;
+}
+
+void release_pinned_region(const CLPinnedArena& arena,
+                           const CLPinnedRegion& r) {
+    cl_event unmapped;
+    check_cl_error(clEnqueueUnmapMemObject(arena.queue, r.buffer, r.base,
+                                           0, 0, &unmapped),
+                   "clEnqueueUnmapMemObject");
+    check_cl_error(clWaitForEvents(1, &unmapped), "clWaitForEvents");
+    check_cl_error(clReleaseEvent(unmapped), "clReleaseEvent");
+    check_cl_error(clReleaseMemObject(r.buffer), "clReleaseMemObject");
+}
+}
+
+//------------------------------------------------------------------------------
+CLPinnedArena* create_pinned_arena(const CLEnv& e, size_t regionSize) {
+    CLPinnedArena* arena = new CLPinnedArena;
+    arena->context = e.context;
+    arena->queue = e.commandQueue;
+    arena->regionSize = regionSize;
+    cl_uint alignBits = 0;
+    check_cl_error(clGetDeviceInfo(get_device_id(e.context),
+                                   CL_DEVICE_MEM_BASE_ADDR_ALIGN,
+                                   sizeof(cl_uint), &alignBits, 0),
+                   "clGetDeviceInfo");
+    arena->alignment = std::max(size_t(alignBits / 8), size_t(64));
+    arena->bytesInUse = 0;
+    arena->peakBytes = 0;
+    std::lock_guard< std::mutex > lock(pinnedArenasMutex);
+    pinnedArenas.push_back(arena);
+    return arena;
+}
+
+//------------------------------------------------------------------------------
+void release_pinned_arena(CLPinnedArena* arena) {
+    {
+        std::lock_guard< std::mutex > lock(pinnedArenasMutex);
+        pinnedArenas.erase(std::find(pinnedArenas.begin(),
+                                     pinnedArenas.end(), arena));
+    }
+    for(std::vector< CLPinnedRegion >::const_iterator r =
+            arena->regions.begin(); r != arena->regions.end(); ++r) {
+        if(r->live != 0) {
+            std::cerr << "WARNING - pinned region released with "
+                      << r->live << " live allocations" << std::endl;
+        }
+        release_pinned_region(*arena, *r);
+    }
+    delete arena;
+}
+
+//------------------------------------------------------------------------------
+void* pinned_alloc(CLPinnedArena& arena, size_t size) {
+    const size_t bytes = std::max((size + arena.alignment - 1)
+                                  / arena.alignment * arena.alignment,
+                                  arena.alignment);
+    std::lock_guard< std::mutex > lock(arena.mutex);
+    std::vector< CLPinnedRegion >::iterator r = arena.regions.begin();
+    for(; r != arena.regions.end(); ++r) {
+        if(r->size - r->offset >= bytes) break;
+    }
+    if(r == arena.regions.end()) {
+        arena.regions.push_back(
+            create_pinned_region(arena, std::max(bytes, arena.regionSize)));
+        r = arena.regions.end() - 1;
+    }
+    void* p = r->base + r->offset;
+    r->offset += bytes;
+    ++r->live;
+    arena.bytesInUse += bytes;
+    arena.peakBytes = std::max(arena.peakBytes, arena.bytesInUse);
+    return p;
+}
+
+//------------------------------------------------------------------------------
+void pinned_free(CLPinnedArena& arena, void* p) {
+    if(!p) return;
+    std::lock_guard< std::mutex > lock(arena.mutex);
+    for(std::vector< CLPinnedRegion >::iterator r = arena.regions.begin();
+        r != arena.regions.end(); ++r) {
+        const char* c = static_cast< const char* >(p);
+        if(c < r->base || c >= r->base + r->size) continue;
+        //the bump pointer is reset when the last allocation is released:
+        //bytesInUse is updated per region
+        if(--r->live == 0) {
+            arena.bytesInUse -= r->offset;
+            r->offset = 0;
+        }
+        return;
+    }
+    std::cerr << "ERROR - pointer not allocated from pinned arena"
+              << std::endl;
+    exit(EXIT_FAILURE);
+}
+
+//------------------------------------------------------------------------------
+bool find_pinned(const void* p, cl_mem& buffer, size_t& offset) {
+    const char* c = static_cast< const char* >(p);
+    std::lock_guard< std::mutex > lock(pinnedArenasMutex);
+    for(std::vector< CLPinnedArena* >::const_iterator a =
+            pinnedArenas.begin(); a != pinnedArenas.end(); ++a) {
+        std::lock_guard< std::mutex > arenaLock((*a)->mutex);
+        for(std::vector< CLPinnedRegion >::const_iterator r =
+                (*a)->regions.begin(); r != (*a)->regions.end(); ++r) {
+            if(c >= r->base && c < r->base + r->size) {
+                buffer = r->buffer;
+                offset = size_t(c - r->base);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+//------------------------------------------------------------------------------
+CLTransferStats get_transfer_stats() {
+    CLTransferStats s;
+    s.pinned = pinnedTransfers;
+    s.pageable = pageableTransfers;
+    return s;
+}
+
+//------------------------------------------------------------------------------
+void enqueue_write(cl_command_queue queue,
+                   cl_mem buffer,
+                   size_t offset,
+                   size_t size,
+                   const void* host,
+                   bool blocking,
+                   cl_event* event) {
+    cl_mem pinned = 0;
+    size_t pinnedOffset = 0;
+    if(find_pinned(host, pinned, pinnedOffset)) ++pinnedTransfers;
+    else ++pageableTransfers;
+    //the mapped pointer of a CL_MEM_ALLOC_HOST_PTR buffer is recognized by
+    //the runtime as page-locked memory and transferred directly
+    cl_event ev;
+    cl_int status = clEnqueueWriteBuffer(queue, buffer,
+                                         blocking ? CL_TRUE : CL_FALSE,
+                                         offset, size, host, 0, 0,
+                                         event ? event
+                                               : trace_event_ptr(queue, &ev));
+    check_cl_error(status, "clEnqueueWriteBuffer");
+    if(event) trace_command(queue, *event, "write", "enqueue_write");
+    else trace_command_and_release(queue, ev, "write", "enqueue_write");
+}
+
+//------------------------------------------------------------------------------
+void enqueue_read(cl_command_queue queue,
+                  cl_mem buffer,
+                  size_t offset,
+                  size_t size,
+                  void* host,
+                  bool blocking,
+                  cl_event* event) {
+    cl_mem pinned = 0;
+    size_t pinnedOffset = 0;
+    if(find_pinned(host, pinned, pinnedOffset)) ++pinnedTransfers;
+    else ++pageableTransfers;
+    cl_event ev;
+    cl_int status = clEnqueueReadBuffer(queue, buffer,
+                                        blocking ? CL_TRUE : CL_FALSE,
+                                        offset, size, host, 0, 0,
+                                        event ? event
+                                              : trace_event_ptr(queue, &ev));
+    check_cl_error(status, "clEnqueueReadBuffer");
+    if(event) trace_command(queue, *event, "read", "enqueue_read");
+    else trace_command_and_release(queue, ev, "read", "enqueue_read");
+}
+
+//------------------------------------------------------------------------------
+namespace {
+//last value bound to each argument slot of each kernel launched through
+//the launcher; __local arguments are recorded as their size
+struct CLArgValue {
+    bool local;
+    std::string bytes;
+};
+std::map< cl_kernel, std::vector< CLArgValue > > kernelArgs;
+std::mutex kernelArgsMutex;
+CLLaunchStats launchStats = {0, 0, 0};
+}
+
+//------------------------------------------------------------------------------
+CLLaunchStats get_launch_stats() {
+    std::lock_guard< std::mutex > lock(kernelArgsMutex);
+    return launchStats;
+}
+
+//------------------------------------------------------------------------------
+bool kernel_arg_changed(cl_kernel kernel, cl_uint index,
+                        const void* value, size_t size) {
+    CLArgValue v;
+    v.local = value == 0;
+    v.bytes = v.local ? std::string((const char*)(&size), sizeof(size))
+                      : std::string((const char*)(value), size);
+    std::lock_guard< std::mutex > lock(kernelArgsMutex);
+    std::vector< CLArgValue >& args = kernelArgs[kernel];
+    if(args.size() <= index) args.resize(index + 1);
+    CLArgValue& prev = args[index];
+    //a default constructed slot has an empty value and never matches
+    if(!prev.bytes.empty() && prev.local == v.local && prev.bytes == v.bytes) {
+        ++launchStats.argsSkipped;
+        return false;
+    }
+    prev = v;
+    ++launchStats.argsSet;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+void forget_kernel_args(cl_kernel kernel) {
+    std::lock_guard< std::mutex > lock(kernelArgsMutex);
+    kernelArgs.erase(kernel);
+}
+
+//------------------------------------------------------------------------------
+cl_event enqueue_launch(cl_command_queue queue,
+                        cl_kernel kernel,
+                        const CLNDRange& global,
+                        const CLNDRange& local) {
+    cl_event event = 0;
+    //calibrate before the first traced launch
+    if(tracing_enabled()) trace_queue(queue);
+    cl_int status = clEnqueueNDRangeKernel(queue, kernel, global.dim, 0,
+                                           global.size,
+                                           local.dim ? local.size : 0,
+                                           0, 0, &event);
+    check_cl_error(status, "clEnqueueNDRangeKernel");
+    if(tracing_enabled())
+        trace_command(queue, event, "kernel", kernel_name(kernel));
+    std::lock_guard< std::mutex > lock(kernelArgsMutex);
+    ++launchStats.launches;
+    return event;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+struct CLTraceRecord {
+    std::string category;
+    std::string name;
+    int queue; //index into CLTracer::queues, -1 for host spans
+    cl_event event; //NULL once collected
+    bool valid; //timing information available
+    double t[4]; //queued, submit, start, end: microseconds from trace origin
+};
+struct CLTraceQueue {
+    cl_command_queue queue;
+    std::string label;
+    bool calibrated;
+    long long offset_ns; //host time - device time
+};
+struct CLTracer {
+    bool enabled;
+    std::chrono::steady_clock::time_point origin;
+    std::vector< CLTraceRecord > records;
+    std::vector< CLTraceQueue > queues;
+    std::string exitPath;
+    std::mutex mutex;
+    CLTracer() : enabled(false) {}
+};
+CLTracer& tracer() {
+    static CLTracer t;
+    return t;
+}
+
+long long host_ns(const CLTracer& t, std::chrono::steady_clock::time_point p) {
+    return std::chrono::duration_cast< std::chrono::nanoseconds >(
+               p - t.origin).count();
+}
+
+std::string kernel_name(cl_kernel kernel) {
+    size_t size = 0;
+    check_cl_error(clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME,
+                                   0, 0, &size), "clGetKernelInfo");
+    std::vector< char > name(size + 1, '\0');
+    check_cl_error(clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME,
+                                   size, &name[0], 0), "clGetKernelInfo");
+    return &name[0];
+}
+
+//returns index of queue, registering and calibrating it if not yet traced;
+//calibration: a marker is enqueued and its end time compared with the
+//midpoint of the host time interval spanning enqueue and completion;
+//requires lock on tracer mutex
+int register_queue(CLTracer& t, cl_command_queue queue) {
+    for(size_t i = 0; i != t.queues.size(); ++i)
+        if(t.queues[i].queue == queue) return int(i);
+    CLTraceQueue q;
+    q.queue = queue;
+    q.calibrated = false;
+    q.offset_ns = 0;
+    cl_device_id device = 0;
+    check_cl_error(clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE,
+                                         sizeof(device), &device, 0),
+                   "clGetCommandQueueInfo");
+    std::ostringstream os;
+    os << "queue " << t.queues.size() << " ("
+       << get_device_info_string(device, CL_DEVICE_NAME) << ')';
+    q.label = os.str();
+    const std::chrono::steady_clock::time_point before =
+        std::chrono::steady_clock::now();
+    cl_event marker = 0;
+    if(clEnqueueMarker(queue, &marker) == CL_SUCCESS) {
+        check_cl_error(clWaitForEvents(1, &marker), "clWaitForEvents");
+        const std::chrono::steady_clock::time_point after =
+            std::chrono::steady_clock::now();
+        cl_ulong end = 0;
+        if(clGetEventProfilingInfo(marker, CL_PROFILING_COMMAND_END,
+                                   sizeof(cl_ulong), &end, 0) == CL_SUCCESS
+           && end != 0) {
+            q.offset_ns = (host_ns(t, before) + host_ns(t, after)) / 2
+                          - (long long)(end);
+            q.calibrated = true;
+        }
+        check_cl_error(clReleaseEvent(marker), "clReleaseEvent");
+    }
+    t.queues.push_back(q);
+    return int(t.queues.size()) - 1;
+}
+
+//requires lock on tracer mutex
+void collect_records(CLTracer& t) {
+    for(std::vector< CLTraceRecord >::iterator r = t.records.begin();
+        r != t.records.end(); ++r) {
+        if(!r->event) continue;
+        const CLTraceQueue& q = t.queues[r->queue];
+        cl_int status = clWaitForEvents(1, &r->event);
+        const cl_profiling_info info[4] = {CL_PROFILING_COMMAND_QUEUED,
+                                           CL_PROFILING_COMMAND_SUBMIT,
+                                           CL_PROFILING_COMMAND_START,
+                                           CL_PROFILING_COMMAND_END};
+        r->valid = status == CL_SUCCESS && q.calibrated;
+        for(int i = 0; i != 4 && r->valid; ++i) {
+            cl_ulong v = 0;
+            r->valid = clGetEventProfilingInfo(r->event, info[i],
+                                               sizeof(cl_ulong), &v, 0)
+                       == CL_SUCCESS;
+            r->t[i] = double((long long)(v) + q.offset_ns) / 1E3;
+        }
+        check_cl_error(clReleaseEvent(r->event), "clReleaseEvent");
+        r->event = 0;
+    }
+}
+
+std::string json_escape(const std::string& s) {
+    std::string e;
+    for(std::string::const_iterator c = s.begin(); c != s.end(); ++c) {
+        if(*c == '"' || *c == '\\') e += '\\';
+        e += *c;
+    }
+    return e;
+}
+
+void write_trace_at_exit() {
+    write_chrome_trace(tracer().exitPath);
+}
+
+//tracing enabled at startup through CLUTIL_TRACE
+struct CLTraceInit {
+    CLTraceInit() {
+        const char* path = getenv("CLUTIL_TRACE");
+        if(!path || !*path) return;
+        tracer().exitPath = path;
+        start_tracing();
+        atexit(write_trace_at_exit);
+    }
+} traceInit;
+}
+
+//------------------------------------------------------------------------------
+CLEventTimes get_event_times(cl_event ev) {
+    CLEventTimes t;
+    check_cl_error(clWaitForEvents(1, &ev), "clWaitForEvents");
+    check_cl_error(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_QUEUED,
+                                           sizeof(cl_ulong), &t.queued, 0),
+                   "clGetEventProfilingInfo");
+    check_cl_error(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_SUBMIT,
+                                           sizeof(cl_ulong), &t.submit, 0),
+                   "clGetEventProfilingInfo");
+    check_cl_error(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_START,
+                                           sizeof(cl_ulong), &t.start, 0),
+                   "clGetEventProfilingInfo");
+    check_cl_error(clGetEventProfilingInfo(ev, CL_PROFILING_COMMAND_END,
+                                           sizeof(cl_ulong), &t.end, 0),
+                   "clGetEventProfilingInfo");
+    return t;
+}
+
+//------------------------------------------------------------------------------
+void start_tracing() {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    if(t.enabled) return;
+    if(t.records.empty()) t.origin = std::chrono::steady_clock::now();
+    t.enabled = true;
+}
+
+//------------------------------------------------------------------------------
+void stop_tracing() {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    t.enabled = false;
+}
+
+//------------------------------------------------------------------------------
+bool tracing_enabled() {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    return t.enabled;
+}
+
+//------------------------------------------------------------------------------
+void trace_queue(cl_command_queue queue) {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    if(t.enabled) register_queue(t, queue);
+}
+
+//------------------------------------------------------------------------------
+void untrace_queue(cl_command_queue queue) {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    //the entry is kept for the recorded commands, only the handle is cleared
+    for(size_t i = 0; i != t.queues.size(); ++i)
+        if(t.queues[i].queue == queue) t.queues[i].queue = 0;
+}
+
+//------------------------------------------------------------------------------
+cl_event* trace_event_ptr(cl_command_queue queue, cl_event* ev) {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    *ev = 0;
+    if(!t.enabled) return 0;
+    register_queue(t, queue);
+    return ev;
+}
+
+//------------------------------------------------------------------------------
+void trace_command(cl_command_queue queue,
+                   cl_event ev,
+                   const std::string& category,
+                   const std::string& name) {
+    if(!ev) return;
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    if(!t.enabled) return;
+    CLTraceRecord r;
+    r.category = category;
+    r.name = name;
+    r.queue = register_queue(t, queue);
+    r.event = ev;
+    r.valid = false;
+    check_cl_error(clRetainEvent(ev), "clRetainEvent");
+    t.records.push_back(r);
+}
+
+//------------------------------------------------------------------------------
+void trace_command_and_release(cl_command_queue queue,
+                               cl_event ev,
+                               const std::string& category,
+                               const std::string& name) {
+    if(!ev) return;
+    trace_command(queue, ev, category, name);
+    check_cl_error(clReleaseEvent(ev), "clReleaseEvent");
+}
+
+//------------------------------------------------------------------------------
+void trace_host(const std::string& name,
+                std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end) {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    if(!t.enabled) return;
+    CLTraceRecord r;
+    r.category = "host";
+    r.name = name;
+    r.queue = -1;
+    r.event = 0;
+    r.valid = true;
+    r.t[0] = r.t[1] = r.t[2] = double(host_ns(t, start)) / 1E3;
+    r.t[3] = double(host_ns(t, end)) / 1E3;
+    t.records.push_back(r);
+}
+
+//------------------------------------------------------------------------------
+void collect_trace() {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    collect_records(t);
+}
+
+//------------------------------------------------------------------------------
+void write_chrome_trace(const std::string& path) {
+    CLTracer& t = tracer();
+    std::lock_guard< std::mutex > lock(t.mutex);
+    collect_records(t);
+    std::ofstream os(path.c_str());
+    if(!os) {
+        std::cerr << "ERROR - cannot write trace file " << path << std::endl;
+        return;
+    }
+    //one row for host spans, two rows per queue: execution (START-END)
+    //and wait (QUEUED-START)
+    os << "{\"traceEvents\":[\n"
+       << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,"
+          "\"args\":{\"name\":\"host\"}}";
+    for(size_t i = 0; i != t.queues.size(); ++i) {
+        const std::string label = json_escape(t.queues[i].label);
+        os << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+           << "\"tid\":" << 2 * i + 1
+           << ",\"args\":{\"name\":\"" << label << "\"}}"
+           << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+           << "\"tid\":" << 2 * i + 2
+           << ",\"args\":{\"name\":\"" << label << " queued\"}}";
+    }
+    os.precision(3);
+    os << std::fixed;
+    for(std::vector< CLTraceRecord >::const_iterator r = t.records.begin();
+        r != t.records.end(); ++r) {
+        if(!r->valid) continue;
+        const std::string name = json_escape(r->name);
+        const std::string cat = json_escape(r->category);
+        const int tid = r->queue < 0 ? 0 : 2 * r->queue + 1;
+        os << ",\n{\"name\":\"" << name << "\",\"cat\":\"" << cat
+           << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+           << ",\"ts\":" << r->t[2] << ",\"dur\":" << (r->t[3] - r->t[2]);
+        if(r->queue >= 0) {
+            os << ",\"args\":{\"queued\":" << r->t[0]
+               << ",\"submit\":" << r->t[1]
+               << ",\"start\":" << r->t[2]
+               << ",\"end\":" << r->t[3] << '}';
+        }
+        os << '}';
+        if(r->queue >= 0 && r->t[2] > r->t[0]) {
+            os << ",\n{\"name\":\"" << name << "\",\"cat\":\"queued\""
+               << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid + 1
+               << ",\"ts\":" << r->t[0] << ",\"dur\":" << (r->t[2] - r->t[0])
+               << '}';
+        }
+    }
+    os << "\n]}\n";
+}
+
+//------------------------------------------------------------------------------
+namespace {
+//returns empty string if persistence disabled
+std::string tune_db_path() {
+    const char* path = getenv("CLUTIL_TUNE_DB");
+    return path ? path : ".cltune";
+}
+
+std::mutex tuneDBMutex;
+
+//one entry per line: key, tab, dim, local sizes, time in milliseconds;
+//later entries override earlier ones with the same key
+bool find_tuned(const std::string& key, CLLocalSize& local, double& ms) {
+    const std::string path = tune_db_path();
+    if(path.empty()) return false;
+    std::lock_guard< std::mutex > lock(tuneDBMutex);
+    std::ifstream in(path.c_str());
+    std::string line;
+    bool found = false;
+    while(std::getline(in, line)) {
+        const std::string::size_type tab = line.find('\t');
+        if(tab == std::string::npos || line.substr(0, tab) != key) continue;
+        std::istringstream is(line.substr(tab + 1));
+        CLLocalSize l = {0, {1, 1, 1}};
+        double t = 0;
+        if(!(is >> l.dim >> l.size[0] >> l.size[1] >> l.size[2] >> t)
+           || l.dim < 1 || l.dim > 3) continue;
+        local = l;
+        ms = t;
+        found = true;
+    }
+    return found;
+}
+
+void store_tuned(const std::string& key, const CLLocalSize& local, double ms) {
+    const std::string path = tune_db_path();
+    if(path.empty()) return;
+    std::lock_guard< std::mutex > lock(tuneDBMutex);
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::app);
+    out << key << '\t' << local.dim << ' ' << local.size[0] << ' '
+        << local.size[1] << ' ' << local.size[2] << ' ' << ms << '\n';
+    if(!out) {
+        std::cerr << "WARNING - cannot write tuning database " << path
+                  << std::endl;
+    }
+}
+
+std::string format_local_size(const CLLocalSize& local) {
+    std::ostringstream os;
+    for(cl_uint d = 0; d != local.dim; ++d)
+        os << (d ? "x" : "") << local.size[d];
+    return os.str();
+}
+}
+
+//------------------------------------------------------------------------------
+std::vector< CLLocalSize > local_size_candidates(cl_device_id device,
+                                                 cl_kernel kernel,
+                                                 cl_uint dim,
+                                                 const size_t* global,
+                                                 bool square) {
+    size_t maxGroupSize = 0;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                   sizeof(size_t), &maxGroupSize, 0),
+                   "clGetDeviceInfo");
+    if(kernel) {
+        size_t kernelGroupSize = 0;
+        check_cl_error(clGetKernelWorkGroupInfo(kernel, device,
+                                                CL_KERNEL_WORK_GROUP_SIZE,
+                                                sizeof(size_t),
+                                                &kernelGroupSize, 0),
+                       "clGetKernelWorkGroupInfo");
+        maxGroupSize = std::min(maxGroupSize, kernelGroupSize);
+    }
+    cl_uint maxDim = 0;
+    check_cl_error(clGetDeviceInfo(device,
+                                   CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS,
+                                   sizeof(cl_uint), &maxDim, 0),
+                   "clGetDeviceInfo");
+    std::vector< size_t > maxItems(std::max(maxDim, cl_uint(3)), 1);
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+                                   sizeof(size_t) * maxDim, &maxItems[0], 0),
+                   "clGetDeviceInfo");
+    //power of two sizes per dimension
+    std::vector< std::vector< size_t > > sizes(dim);
+    for(cl_uint d = 0; d != dim; ++d) {
+        for(size_t s = 1; s <= std::min(global[d], maxItems[d]); s *= 2)
+            if(global[d] % s == 0) sizes[d].push_back(s);
+    }
+    std::vector< CLLocalSize > candidates;
+    std::vector< size_t > idx(dim, 0);
+    while(true) {
+        CLLocalSize c = {dim, {1, 1, 1}};
+        size_t items = 1;
+        bool equal = true;
+        for(cl_uint d = 0; d != dim; ++d) {
+            c.size[d] = sizes[d][idx[d]];
+            items *= c.size[d];
+            equal = equal && c.size[d] == c.size[0];
+        }
+        if(items <= maxGroupSize && (!square || equal))
+            candidates.push_back(c);
+        //next combination
+        cl_uint d = 0;
+        while(d != dim && ++idx[d] == sizes[d].size()) idx[d++] = 0;
+        if(d == dim) break;
+    }
+    return candidates;
+}
+
+//------------------------------------------------------------------------------
+CLLocalSize autotune_local_size(cl_device_id device,
+                                const std::string& kernelName,
+                                const std::string& defines,
+                                cl_uint dim,
+                                const size_t* global,
+                                const std::vector< CLLocalSize >& candidates,
+                                const CLTuneRun& run,
+                                int warmup,
+                                int repeats) {
+    std::ostringstream keyStream;
+    keyStream << get_device_info_string(device, CL_DEVICE_NAME) << ';'
+              << get_device_info_string(device, CL_DRIVER_VERSION) << ';'
+              << kernelName << ';' << std::hex << hash_text(defines)
+              << std::dec << ';';
+    for(cl_uint d = 0; d != dim; ++d) keyStream << (d ? "x" : "") << global[d];
+    const std::string key = keyStream.str();
+    CLLocalSize best = {0, {1, 1, 1}};
+    double bestTime = -1;
+    if(find_tuned(key, best, bestTime) && best.dim == dim) {
+        std::cout << "Autotuner: " << kernelName << " local size "
+                  << format_local_size(best) << " from database ("
+                  << bestTime << " ms)" << std::endl;
+        return best;
+    }
+    bestTime = -1;
+    for(std::vector< CLLocalSize >::const_iterator c = candidates.begin();
+        c != candidates.end(); ++c) {
+        bool usable = true;
+        for(int i = 0; i < warmup && usable; ++i) usable = run(*c) >= 0;
+        std::vector< double > times;
+        for(int i = 0; i < repeats && usable; ++i) {
+            const double t = run(*c);
+            usable = t >= 0;
+            times.push_back(t);
+        }
+        if(!usable || times.empty()) continue;
+        std::nth_element(times.begin(), times.begin() + times.size() / 2,
+                         times.end());
+        const double t = times[times.size() / 2];
+        std::cout << "  " << format_local_size(*c) << ": " << t << " ms"
+                  << std::endl;
+        if(bestTime < 0 || t < bestTime) {
+            best = *c;
+            bestTime = t;
+        }
+    }
+    if(bestTime < 0) {
+        std::cerr << "ERROR - no usable local size for kernel " << kernelName
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    store_tuned(key, best, bestTime);
+    std::cout << "Autotuner: " << kernelName << " local size "
+              << format_local_size(best) << " tuned (" << bestTime << " ms)"
+              << std::endl;
+    return best;
+}
+
+//------------------------------------------------------------------------------
+CLSpec& spec_set(CLSpec& s, const std::string& name, const std::string& value) {
+    s.defines[name] = value;
+    return s;
+}
+
+//------------------------------------------------------------------------------
+CLSpec& spec_set(CLSpec& s, const std::string& name, const char* value) {
+    return spec_set(s, name, std::string(value));
+}
+
+//------------------------------------------------------------------------------
+CLSpec& spec_flag(CLSpec& s, const std::string& name, bool on) {
+    if(on) s.defines[name] = std::string();
+    else s.defines.erase(name);
+    return s;
+}
+
+//------------------------------------------------------------------------------
+std::string spec_prefix(const CLSpec& s) {
+    std::string prefix;
+    for(std::map< std::string, std::string >::const_iterator d =
+            s.defines.begin(); d != s.defines.end(); ++d) {
+        prefix += "#define " + d->first;
+        if(!d->second.empty()) prefix += ' ' + d->second;
+        prefix += '\n';
+    }
+    return prefix;
+}
+
+//------------------------------------------------------------------------------
+std::string spec_label(const CLSpec& s) {
+    std::string label;
+    for(std::map< std::string, std::string >::const_iterator d =
+            s.defines.begin(); d != s.defines.end(); ++d) {
+        if(!label.empty()) label += ' ';
+        label += d->first;
+        if(!d->second.empty()) label += '=' + d->second;
+    }
+    return label;
+}
+
+//------------------------------------------------------------------------------
+//fixed size pool of worker threads consuming a FIFO queue of tasks
+struct CLThreadPool {
+    std::vector< std::thread > threads;
+    std::deque< std::function< void () > > tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop;
+};
+
+namespace {
+void worker_loop(CLThreadPool* pool) {
+    while(true) {
+        std::function< void () > task;
+        {
+            std::unique_lock< std::mutex > lock(pool->mutex);
+            pool->cv.wait(lock, [pool]() {
+                return pool->stop || !pool->tasks.empty();
+            });
+            //pending tasks are executed before exiting
+            if(pool->tasks.empty()) return;
+            task = pool->tasks.front();
+            pool->tasks.pop_front();
+        }
+        task();
+    }
+}
+
+//requires lock on cache mutex
+std::shared_future< cl_program > schedule_variant(CLVariantCache& cache,
+                                                  const std::string& prefix) {
+    std::map< std::string, std::shared_future< cl_program > >::iterator i =
+        cache.programs.find(prefix);
+    if(i != cache.programs.end()) return i->second;
+    const cl_context ctx = cache.context;
+    const std::vector< cl_device_id > devices = cache.devices;
+    const std::string source = prefix + "\n" + cache.source;
+    const std::string options = cache.buildOptions;
+    std::shared_ptr< std::packaged_task< cl_program () > > task =
+        std::make_shared< std::packaged_task< cl_program () > >(
+            [ctx, devices, source, options]() {
+                return build_program(ctx, devices, source, options);
+            });
+    std::shared_future< cl_program > program = task->get_future().share();
+    cache.programs[prefix] = program;
+    {
+        std::lock_guard< std::mutex > lock(cache.pool->mutex);
+        cache.pool->tasks.push_back([task]() { (*task)(); });
+    }
+    cache.pool->cv.notify_one();
+    return program;
+}
+}
+
+//------------------------------------------------------------------------------
+CLVariantCache* create_variant_cache(const CLEnv& e,
+                                     const char* clSourcePath,
+                                     const std::string& buildOptions,
+                                     int numThreads) {
+    CLVariantCache* cache = new CLVariantCache;
+    cache->context = e.context;
+    size_t size = 0;
+    check_cl_error(clGetContextInfo(e.context, CL_CONTEXT_DEVICES, 0, 0,
+                                    &size), "clGetContextInfo");
+    cache->devices.resize(size / sizeof(cl_device_id));
+    check_cl_error(clGetContextInfo(e.context, CL_CONTEXT_DEVICES, size,
+                                    &cache->devices[0], 0),
+                   "clGetContextInfo");
+    cache->source = load_text(clSourcePath);
+    cache->buildOptions = buildOptions;
+    if(numThreads < 1)
+        numThreads = std::max(int(std::thread::hardware_concurrency()), 1);
+    cache->pool = new CLThreadPool;
+    cache->pool->stop = false;
+    for(int t = 0; t != numThreads; ++t)
+        cache->pool->threads.push_back(std::thread(worker_loop, cache->pool));
+    return cache;
+}
+
+//------------------------------------------------------------------------------
+void release_variant_cache(CLVariantCache* cache) {
+    {
+        std::lock_guard< std::mutex > lock(cache->pool->mutex);
+        cache->pool->stop = true;
+    }
+    cache->pool->cv.notify_all();
+    for(std::vector< std::thread >::iterator t =
+            cache->pool->threads.begin();
+        t != cache->pool->threads.end(); ++t) t->join();
+    delete cache->pool;
+    for(std::map< std::string, std::shared_future< cl_program > >::iterator
+            p = cache->programs.begin(); p != cache->programs.end(); ++p) {
+        check_cl_error(clReleaseProgram(p->second.get()), "clReleaseProgram");
+    }
+    delete cache;
+}
+
+//------------------------------------------------------------------------------
+void build_variants(CLVariantCache& cache, const std::vector< CLSpec >& specs) {
+    std::lock_guard< std::mutex > lock(cache.mutex);
+    for(std::vector< CLSpec >::const_iterator s = specs.begin();
+        s != specs.end(); ++s) schedule_variant(cache, spec_prefix(*s));
+}
+
+//------------------------------------------------------------------------------
+cl_program get_variant(CLVariantCache& cache, const CLSpec& spec) {
+    std::shared_future< cl_program > program;
+    {
+        std::lock_guard< std::mutex > lock(cache.mutex);
+        program = schedule_variant(cache, spec_prefix(spec));
+    }
+    return program.get();
+}
+
+//------------------------------------------------------------------------------
+cl_kernel create_variant_kernel(CLVariantCache& cache,
+                                const CLSpec& spec,
+                                const std::string& kernelName) {
+    cl_int status;
+    cl_kernel kernel = clCreateKernel(get_variant(cache, spec),
+                                      kernelName.c_str(), &status);
+    check_cl_error(status, "clCreateKernel");
+    return kernel;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+size_t array_chunk_bytes(const CLStreamArray& a, size_t chunkItems) {
+    return (chunkItems + 2 * a.halo) * a.itemBytes;
+}
+
+void release_event(cl_event& ev) {
+    if(ev) check_cl_error(clReleaseEvent(ev), "clReleaseEvent");
+    ev = 0;
+}
+}
+
+//------------------------------------------------------------------------------
+size_t stream_chunk_items(cl_device_id device,
+                          const std::vector< CLStreamArray >& inputs,
+                          const std::vector< CLStreamArray >& outputs,
+                          int depth,
+                          size_t multiple) {
+    size_t itemBytes = 0;
+    size_t haloBytes = 0;
+    size_t maxItemBytes = 0;
+    for(std::vector< CLStreamArray >::const_iterator a = inputs.begin();
+        a != inputs.end(); ++a) {
+        itemBytes += a->itemBytes;
+        haloBytes += 2 * a->halo * a->itemBytes;
+        maxItemBytes = std::max(maxItemBytes, a->itemBytes);
+    }
+    for(std::vector< CLStreamArray >::const_iterator a = outputs.begin();
+        a != outputs.end(); ++a) {
+        itemBytes += a->itemBytes;
+        haloBytes += 2 * a->halo * a->itemBytes;
+        maxItemBytes = std::max(maxItemBytes, a->itemBytes);
+    }
+    size_t items = 0;
+    const char* chunk = getenv("CLUTIL_STREAM_CHUNK");
+    if(chunk && *chunk) {
+        //requested size refers to the largest per-chunk buffer
+        items = size_t(strtoull(chunk, 0, 10)) / maxItemBytes;
+    } else {
+        cl_ulong globalMem = 0;
+        cl_ulong maxAlloc = 0;
+        check_cl_error(clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE,
+                                       sizeof(cl_ulong), &globalMem, 0),
+                       "clGetDeviceInfo");
+        check_cl_error(clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                                       sizeof(cl_ulong), &maxAlloc, 0),
+                       "clGetDeviceInfo");
+        const size_t budget = size_t(globalMem / 4) / depth;
+        items = budget > haloBytes ? (budget - haloBytes) / itemBytes : 0;
+        std::vector< CLStreamArray > arrays(inputs);
+        arrays.insert(arrays.end(), outputs.begin(), outputs.end());
+        for(std::vector< CLStreamArray >::const_iterator a = arrays.begin();
+            a != arrays.end(); ++a) {
+            const size_t maxItems = size_t(maxAlloc) / a->itemBytes;
+            items = std::min(items, maxItems > 2 * a->halo ?
+                                    maxItems - 2 * a->halo : 0);
+        }
+    }
+    items -= items % multiple;
+    if(items == 0) {
+        std::cerr << "ERROR - stream chunk smaller than " << multiple
+                  << " items" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return items;
+}
+
+//------------------------------------------------------------------------------
+bool stream_required(cl_device_id device, size_t bytes) {
+    const char* chunk = getenv("CLUTIL_STREAM_CHUNK");
+    if(chunk && *chunk) return true;
+    cl_ulong maxAlloc = 0;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                                   sizeof(cl_ulong), &maxAlloc, 0),
+                   "clGetDeviceInfo");
+    return bytes > maxAlloc;
+}
+
+//------------------------------------------------------------------------------
+CLStream create_stream(const CLEnv& e,
+                       const std::vector< CLStreamArray >& inputs,
+                       const std::vector< CLStreamArray >& outputs,
+                       size_t totalItems,
+                       size_t chunkItems,
+                       int depth) {
+    if(depth < 2 || chunkItems == 0) {
+        std::cerr << "ERROR - stream requires at least two buffer sets and "
+                     "non empty chunks" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    CLStream s;
+    s.totalItems = totalItems;
+    s.chunkItems = std::min(chunkItems, std::max(totalItems, size_t(1)));
+    s.inputs = inputs;
+    s.outputs = outputs;
+    const cl_device_id deviceID = get_device_id(e.context);
+    cl_int status;
+    s.transferQueue = clCreateCommandQueue(e.context, deviceID,
+                                           CL_QUEUE_PROFILING_ENABLE,
+                                           &status);
+    check_cl_error(status, "clCreateCommandQueue");
+    s.computeQueue = clCreateCommandQueue(e.context, deviceID,
+                                          CL_QUEUE_PROFILING_ENABLE,
+                                          &status);
+    check_cl_error(status, "clCreateCommandQueue");
+    s.inBuffers.resize(depth);
+    s.outBuffers.resize(depth);
+    for(int slot = 0; slot != depth; ++slot) {
+        for(size_t i = 0; i != inputs.size(); ++i) {
+            s.inBuffers[slot].push_back(
+                clCreateBuffer(e.context, CL_MEM_READ_ONLY,
+                               array_chunk_bytes(inputs[i], s.chunkItems),
+                               0, &status));
+            check_cl_error(status, "clCreateBuffer");
+        }
+        for(size_t i = 0; i != outputs.size(); ++i) {
+            s.outBuffers[slot].push_back(
+                clCreateBuffer(e.context, CL_MEM_READ_WRITE,
+                               array_chunk_bytes(outputs[i], s.chunkItems),
+                               0, &status));
+            check_cl_error(status, "clCreateBuffer");
+        }
+    }
+    return s;
+}
+
+//------------------------------------------------------------------------------
+void release_stream(CLStream& s) {
+    collect_trace();
+    for(size_t slot = 0; slot != s.inBuffers.size(); ++slot) {
+        for(size_t i = 0; i != s.inBuffers[slot].size(); ++i)
+            check_cl_error(clReleaseMemObject(s.inBuffers[slot][i]),
+                           "clReleaseMemObject");
+        for(size_t i = 0; i != s.outBuffers[slot].size(); ++i)
+            check_cl_error(clReleaseMemObject(s.outBuffers[slot][i]),
+                           "clReleaseMemObject");
+    }
+    s.inBuffers.clear();
+    s.outBuffers.clear();
+    untrace_queue(s.transferQueue);
+    untrace_queue(s.computeQueue);
+    check_cl_error(clReleaseCommandQueue(s.transferQueue),
+                   "clReleaseCommandQueue");
+    check_cl_error(clReleaseCommandQueue(s.computeQueue),
+                   "clReleaseCommandQueue");
+}
+
+//------------------------------------------------------------------------------
+//schedule: the writes of the first depth - 1 chunks are enqueued upfront,
+//then for each chunk k: kernel(k), write(k + depth - 1), read(k); on the
+//in-order transfer queue the write of the next chunk precedes the read of
+//the current one and can therefore overlap the kernel; buffer set reuse is
+//enforced through events:
+// write(k) waits for kernel(k - depth) (inputs no longer in use)
+// kernel(k) waits for write(k) and read(k - depth) (outputs copied)
+// read(k) waits for kernel(k)
+void run_stream(CLStream& s, const CLStreamKernel& kernel) {
+    const int depth = int(s.inBuffers.size());
+    const size_t numChunks = (s.totalItems + s.chunkItems - 1) / s.chunkItems;
+    std::vector< cl_event > written(depth, cl_event(0));
+    std::vector< cl_event > computed(depth, cl_event(0));
+    std::vector< cl_event > read(depth, cl_event(0));
+    trace_queue(s.transferQueue);
+    trace_queue(s.computeQueue);
+    const auto chunk = [&s](size_t k) {
+        CLStreamChunk c;
+        c.index = k;
+        c.first = k * s.chunkItems;
+        c.count = std::min(s.chunkItems, s.totalItems - c.first);
+        const size_t slot = k % s.inBuffers.size();
+        c.inputs = s.inBuffers[slot].empty() ? 0 : &s.inBuffers[slot][0];
+        c.outputs = s.outBuffers[slot].empty() ? 0 : &s.outBuffers[slot][0];
+        return c;
+    };
+    const auto write = [&](size_t k) {
+        const CLStreamChunk c = chunk(k);
+        const int slot = int(k % depth);
+        cl_event prev = computed[slot];
+        release_event(written[slot]);
+        for(size_t i = 0; i != s.inputs.size(); ++i) {
+            const CLStreamArray& a = s.inputs[i];
+            const char* src = (const char*)(a.host)
+                              + (c.first - a.halo) * a.itemBytes;
+            cl_event ev = 0;
+            cl_int status = clEnqueueWriteBuffer(s.transferQueue,
+                                c.inputs[i], CL_FALSE, 0,
+                                (c.count + 2 * a.halo) * a.itemBytes, src,
+                                prev ? 1 : 0, prev ? &prev : 0, &ev);
+            check_cl_error(status, "clEnqueueWriteBuffer");
+            trace_command(s.transferQueue, ev, "write", "stream chunk");
+            //in-order queue: the last write completes after the others
+            release_event(written[slot]);
+            written[slot] = ev;
+        }
+    };
+    for(size_t k = 0; k < size_t(depth - 1) && k < numChunks; ++k) write(k);
+    for(size_t k = 0; k != numChunks; ++k) {
+        const int slot = int(k % depth);
+        const CLStreamChunk c = chunk(k);
+        std::vector< cl_event > waitList;
+        if(written[slot]) waitList.push_back(written[slot]);
+        if(read[slot]) waitList.push_back(read[slot]);
+        cl_event ev = kernel(s.computeQueue, c, cl_uint(waitList.size()),
+                             waitList.empty() ? 0 : &waitList[0]);
+        if(tracing_enabled())
+            trace_command(s.computeQueue, ev, "kernel", "stream chunk");
+        release_event(computed[slot]);
+        computed[slot] = ev;
+        check_cl_error(clFlush(s.computeQueue), "clFlush");
+        if(k + depth - 1 < numChunks) write(k + depth - 1);
+        release_event(read[slot]);
+        for(size_t i = 0; i != s.outputs.size(); ++i) {
+            const CLStreamArray& a = s.outputs[i];
+            cl_event rev = 0;
+            cl_int status = clEnqueueReadBuffer(s.transferQueue,
+                                c.outputs[i], CL_FALSE,
+                                a.halo * a.itemBytes, c.count * a.itemBytes,
+                                (char*)(a.host) + c.first * a.itemBytes,
+                                1, &computed[slot], &rev);
+            check_cl_error(status, "clEnqueueReadBuffer");
+            trace_command(s.transferQueue, rev, "read", "stream chunk");
+            release_event(read[slot]);
+            read[slot] = rev;
+        }
+        check_cl_error(clFlush(s.transferQueue), "clFlush");
+    }
+    check_cl_error(clFinish(s.computeQueue), "clFinish");
+    check_cl_error(clFinish(s.transferQueue), "clFinish");
+    for(int slot = 0; slot != depth; ++slot) {
+        release_event(written[slot]);
+        release_event(computed[slot]);
+        release_event(read[slot]);
+    }
+}
+
+//------------------------------------------------------------------------------
+void* aligned_host_alloc(size_t size) {
+    void* p = 0;
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    if(posix_memalign(&p, page, std::max(size, size_t(1))) != 0) {
+        std::cerr << "ERROR - cannot allocate " << size
+                  << " bytes of page aligned memory" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+//------------------------------------------------------------------------------
+void aligned_host_free(void* p) {
+    free(p);
+}
+
+//------------------------------------------------------------------------------
+bool host_unified_memory(cl_device_id device) {
+    cl_bool unified = CL_FALSE;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_HOST_UNIFIED_MEMORY,
+                                   sizeof(cl_bool), &unified, 0),
+                   "clGetDeviceInfo");
+    return unified == CL_TRUE;
+}
+
+//------------------------------------------------------------------------------
+CLHostBuffer create_host_buffer(const CLEnv& e,
+                                cl_mem_flags flags,
+                                void* host,
+                                size_t size) {
+    CLHostBuffer b;
+    b.host = host;
+    b.size = size;
+    const size_t page = size_t(sysconf(_SC_PAGESIZE));
+    b.zeroCopy = host && size_t(host) % page == 0
+                 && host_unified_memory(get_device_id(e.context));
+    if(b.zeroCopy) flags |= CL_MEM_USE_HOST_PTR;
+    else if(host && !(flags & CL_MEM_WRITE_ONLY)) flags |= CL_MEM_COPY_HOST_PTR;
+    cl_int status;
+    b.buffer = clCreateBuffer(e.context, flags, size,
+                              flags & (CL_MEM_USE_HOST_PTR
+                                       | CL_MEM_COPY_HOST_PTR) ? host : 0,
+                              &status);
+    check_cl_error(status, "clCreateBuffer");
+    return b;
+}
+
+//------------------------------------------------------------------------------
+void release_host_buffer(CLHostBuffer& b) {
+    check_cl_error(clReleaseMemObject(b.buffer), "clReleaseMemObject");
+    b.buffer = 0;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+//map and unmap: synchronizes the host memory of a CL_MEM_USE_HOST_PTR
+//buffer, no data transfer on unified memory devices
+void map_unmap(cl_command_queue queue, const CLHostBuffer& b,
+               cl_map_flags flags) {
+    cl_int status;
+    cl_event ev;
+    void* p = clEnqueueMapBuffer(queue, b.buffer, CL_TRUE, flags, 0, b.size,
+                                 0, 0, trace_event_ptr(queue, &ev), &status);
+    check_cl_error(status, "clEnqueueMapBuffer");
+    trace_command_and_release(queue, ev, "map", "host buffer");
+    cl_event unmapped;
+    status = clEnqueueUnmapMemObject(queue, b.buffer, p, 0, 0, &unmapped);
+    check_cl_error(status, "clEnqueueUnmapMemObject");
+    check_cl_error(clWaitForEvents(1, &unmapped), "clWaitForEvents");
+    check_cl_error(clReleaseEvent(unmapped), "clReleaseEvent");
+}
+}
+
+//------------------------------------------------------------------------------
+void read_host_buffer(cl_command_queue queue, const CLHostBuffer& b) {
+    if(b.zeroCopy) map_unmap(queue, b, CL_MAP_READ);
+    else enqueue_read(queue, b.buffer, 0, b.size, b.host, true);
+}
+
+//------------------------------------------------------------------------------
+void write_host_buffer(cl_command_queue queue, const CLHostBuffer& b) {
+    //host content is the new content: no copy from the device at map time
+    if(b.zeroCopy) map_unmap(queue, b, CL_MAP_WRITE_INVALIDATE_REGION);
+    else enqueue_write(queue, b.buffer, 0, b.size, b.host, true);
+}
+
+//------------------------------------------------------------------------------
+namespace {
+std::atomic< unsigned > threadEnvId(0);
+//environment id -> state of the current thread; entries of released
+//environments are never looked up again since ids are not reused
+thread_local std::map< unsigned, CLThreadState* > threadStates;
+
+CLThreadState& thread_state(CLThreadEnv& te) {
+    std::map< unsigned, CLThreadState* >::const_iterator i =
+        threadStates.find(te.id);
+    if(i != threadStates.end()) return *i->second;
+    std::lock_guard< std::mutex > lock(te.mutex);
+    //a new thread might reuse the id of a thread which has exited: state is
+    //reused as well
+    CLThreadState*& s = te.threads[std::this_thread::get_id()];
+    if(!s) {
+        s = new CLThreadState;
+        cl_int status;
+        s->queue = clCreateCommandQueue(te.context, te.device, te.properties,
+                                        &status);
+        check_cl_error(status, "clCreateCommandQueue");
+        if(te.program) s->kernels = create_kernels(te.program);
+    }
+    threadStates[te.id] = s;
+    return *s;
+}
+}
+
+//------------------------------------------------------------------------------
+CLThreadEnv* create_thread_env(const CLEnv& e, bool enableProfiling) {
+    CLThreadEnv* te = new CLThreadEnv;
+    te->context = e.context;
+    te->device = get_device_id(e.context);
+    te->program = e.program;
+    //profiling is required to trace commands
+    te->properties = enableProfiling || tracing_enabled() ?
+                     CL_QUEUE_PROFILING_ENABLE : 0;
+    te->id = ++threadEnvId;
+    return te;
+}
+
+//------------------------------------------------------------------------------
+void release_thread_env(CLThreadEnv* te) {
+    finish_thread_queues(*te);
+    collect_trace();
+    for(std::map< std::thread::id, CLThreadState* >::iterator s =
+            te->threads.begin(); s != te->threads.end(); ++s) {
+        for(CLKernelMap::iterator k = s->second->kernels.begin();
+            k != s->second->kernels.end(); ++k) {
+            forget_kernel_args(k->second);
+            check_cl_error(clReleaseKernel(k->second), "clReleaseKernel");
+        }
+        untrace_queue(s->second->queue);
+        check_cl_error(clReleaseCommandQueue(s->second->queue),
+                       "clReleaseCommandQueue");
+        delete s->second;
+    }
+    threadStates.erase(te->id);
+    delete te;
+}
+
+//------------------------------------------------------------------------------
+cl_command_queue thread_queue(CLThreadEnv& te) {
+    return thread_state(te).queue;
+}
+
+//------------------------------------------------------------------------------
+cl_kernel thread_kernel(CLThreadEnv& te, const std::string& kernelName) {
+    const CLKernelMap& kernels = thread_state(te).kernels;
+    CLKernelMap::const_iterator k = kernels.find(kernelName);
+    if(k == kernels.end()) {
+        std::cerr << "ERROR - kernel " << kernelName << " not found"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return k->second;
+}
+
+//------------------------------------------------------------------------------
+cl_event thread_marker(CLThreadEnv& te) {
+    cl_event ev;
+    check_cl_error(clEnqueueMarkerWithWaitList(thread_queue(te), 0, 0, &ev),
+                   "clEnqueueMarkerWithWaitList");
+    return ev;
+}
+
+//------------------------------------------------------------------------------
+void thread_wait(CLThreadEnv& te, const std::vector< cl_event >& events) {
+    if(events.empty()) return;
+    check_cl_error(clEnqueueBarrierWithWaitList(thread_queue(te),
+                                                cl_uint(events.size()),
+                                                &events[0], 0),
+                   "clEnqueueBarrierWithWaitList");
+}
+
+//------------------------------------------------------------------------------
+size_t thread_queue_count(CLThreadEnv& te) {
+    std::lock_guard< std::mutex > lock(te.mutex);
+    return te.threads.size();
+}
+
+//------------------------------------------------------------------------------
+void finish_thread_queues(CLThreadEnv& te) {
+    std::lock_guard< std::mutex > lock(te.mutex);
+    for(std::map< std::thread::id, CLThreadState* >::iterator s =
+            te.threads.begin(); s != te.threads.end(); ++s) {
+        check_cl_error(clFinish(s->second->queue), "clFinish");
+    }
+}
+
+//------------------------------------------------------------------------------
+namespace {
+//cl_khr_command_buffer entry points; declared here since the extension
+//header is not available with all the SDKs, handles are opaque pointers
+typedef void* CLCommandBufferKHR;
+typedef CLCommandBufferKHR (*CreateCommandBufferKHR)(cl_uint,
+                                                     const cl_command_queue*,
+                                                     const cl_ulong*,
+                                                     cl_int*);
+typedef cl_int (*CommandNDRangeKernelKHR)(CLCommandBufferKHR,
+                                          cl_command_queue,
+                                          const cl_ulong*,
+                                          cl_kernel,
+                                          cl_uint,
+                                          const size_t*,
+                                          const size_t*,
+                                          const size_t*,
+                                          cl_uint,
+                                          const cl_uint*,
+                                          cl_uint*,
+                                          void**);
+typedef cl_int (*FinalizeCommandBufferKHR)(CLCommandBufferKHR);
+typedef cl_int (*EnqueueCommandBufferKHR)(cl_uint,
+                                          cl_command_queue*,
+                                          CLCommandBufferKHR,
+                                          cl_uint,
+                                          const cl_event*,
+                                          cl_event*);
+typedef cl_int (*ReleaseCommandBufferKHR)(CLCommandBufferKHR);
+struct CLCommandBufferAPI {
+    CreateCommandBufferKHR create;
+    CommandNDRangeKernelKHR ndrange;
+    FinalizeCommandBufferKHR finalize;
+    EnqueueCommandBufferKHR enqueue;
+    ReleaseCommandBufferKHR release;
+};
+
+cl_device_id queue_device(cl_command_queue queue) {
+    cl_device_id device;
+    check_cl_error(clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE,
+                                         sizeof(cl_device_id), &device, 0),
+                   "clGetCommandQueueInfo");
+    return device;
+}
+
+std::map< cl_device_id, CLCommandBufferAPI > commandBufferAPIs;
+std::mutex commandBufferAPIsMutex;
+
+//all entry points are NULL if the extension is not supported; entry points
+//are looked up once per device
+CLCommandBufferAPI command_buffer_api(cl_command_queue queue) {
+    const cl_device_id device = queue_device(queue);
+    std::lock_guard< std::mutex > lock(commandBufferAPIsMutex);
+    std::map< cl_device_id, CLCommandBufferAPI >::const_iterator i =
+        commandBufferAPIs.find(device);
+    if(i != commandBufferAPIs.end()) return i->second;
+    CLCommandBufferAPI& api = commandBufferAPIs[device];
+    api.create = 0;
+    api.ndrange = 0;
+    api.finalize = 0;
+    api.enqueue = 0;
+    api.release = 0;
+    if(!command_buffer_supported(queue)) return api;
+    cl_platform_id platform;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_PLATFORM,
+                                   sizeof(cl_platform_id), &platform, 0),
+                   "clGetDeviceInfo");
+    api.create = (CreateCommandBufferKHR)
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clCreateCommandBufferKHR");
+    api.ndrange = (CommandNDRangeKernelKHR)
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clCommandNDRangeKernelKHR");
+    api.finalize = (FinalizeCommandBufferKHR)
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clFinalizeCommandBufferKHR");
+    api.enqueue = (EnqueueCommandBufferKHR)
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clEnqueueCommandBufferKHR");
+    api.release = (ReleaseCommandBufferKHR)
+        clGetExtensionFunctionAddressForPlatform(platform,
+                                                 "clReleaseCommandBufferKHR");
+    if(!api.create || !api.ndrange || !api.finalize || !api.enqueue
+       || !api.release) api.create = 0;
+    return api;
+}
+
+void set_swap_args(const CLRecordedKernel& c, int phase) {
+    for(std::vector< CLRecordedSwap >::const_iterator s = c.swaps.begin();
+        s != c.swaps.end(); ++s) {
+        check_cl_error(clSetKernelArg(c.kernel, s->index, sizeof(cl_mem),
+                                      &s->buffers[phase]),
+                       "clSetKernelArg");
+    }
+}
+
+void release_command_buffers(CLRecording& r) {
+    if(r.commandBuffers.empty()) return;
+    const CLCommandBufferAPI api = command_buffer_api(r.queue);
+    for(std::vector< void* >::iterator b = r.commandBuffers.begin();
+        b != r.commandBuffers.end(); ++b) {
+        if(*b) check_cl_error(api.release(*b), "clReleaseCommandBufferKHR");
+    }
+    r.commandBuffers.clear();
+}
+}
+
+//------------------------------------------------------------------------------
+CLRecording create_recording(cl_command_queue queue) {
+    CLRecording r;
+    r.queue = queue;
+    r.phases = 1;
+    r.phase = 0;
+    return r;
+}
+
+//------------------------------------------------------------------------------
+void record_kernel(CLRecording& r,
+                   cl_kernel kernel,
+                   const CLNDRange& global,
+                   const CLNDRange& local) {
+    CLRecordedKernel c;
+    c.kernel = kernel;
+    c.global = global;
+    c.local = local;
+    r.commands.push_back(c);
+}
+
+//------------------------------------------------------------------------------
+void record_ping_pong(CLRecording& r, cl_uint index, cl_mem even, cl_mem odd) {
+    if(r.commands.empty()) {
+        std::cerr << "ERROR - record_ping_pong: no kernel recorded"
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    CLRecordedSwap s;
+    s.index = index;
+    s.buffers[0] = even;
+    s.buffers[1] = odd;
+    r.commands.back().swaps.push_back(s);
+    r.phases = 2;
+}
+
+//------------------------------------------------------------------------------
+bool command_buffer_supported(cl_command_queue queue) {
+    const std::string extensions =
+        get_device_info_string(queue_device(queue), CL_DEVICE_EXTENSIONS);
+    std::istringstream is(extensions);
+    std::string e;
+    while(is >> e) if(e == "cl_khr_command_buffer") return true;
+    return false;
+}
+
+//------------------------------------------------------------------------------
+void finalize_recording(CLRecording& r, bool useCommandBuffer) {
+    release_command_buffers(r);
+    //arguments set directly: discard values cached by the launcher
+    for(std::vector< CLRecordedKernel >::const_iterator c =
+            r.commands.begin(); c != r.commands.end(); ++c) {
+        forget_kernel_args(c->kernel);
+    }
+    if(!useCommandBuffer) return;
+    const CLCommandBufferAPI api = command_buffer_api(r.queue);
+    if(!api.create) return;
+    //arguments are captured when a command is recorded: one command buffer
+    //per ping-pong phase
+    for(int p = 0; p != r.phases; ++p) {
+        cl_int status;
+        CLCommandBufferKHR b = api.create(1, &r.queue, 0, &status);
+        if(status != CL_SUCCESS) break;
+        r.commandBuffers.push_back(b);
+        for(std::vector< CLRecordedKernel >::const_iterator c =
+                r.commands.begin();
+            c != r.commands.end() && status == CL_SUCCESS; ++c) {
+            set_swap_args(*c, p);
+            status = api.ndrange(b, 0, 0, c->kernel, c->global.dim, 0,
+                                 c->global.size,
+                                 c->local.dim ? c->local.size : 0,
+                                 0, 0, 0, 0);
+        }
+        if(status == CL_SUCCESS) status = api.finalize(b);
+        if(status != CL_SUCCESS) {
+            //e.g. queue properties not supported by command buffers
+            std::cerr << "WARNING - cl_khr_command_buffer recording failed ("
+                      << status << "), replaying through enqueue loop"
+                      << std::endl;
+            release_command_buffers(r);
+            return;
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+void replay_recording(CLRecording& r, int iterations) {
+    const bool traced = tracing_enabled();
+    cl_event ev = 0;
+    if(!r.commandBuffers.empty()) {
+        const CLCommandBufferAPI api = command_buffer_api(r.queue);
+        for(int i = 0; i != iterations; ++i) {
+            check_cl_error(api.enqueue(0, 0, r.commandBuffers[r.phase], 0, 0,
+                                       traced ? trace_event_ptr(r.queue, &ev)
+                                              : 0),
+                           "clEnqueueCommandBufferKHR");
+            if(ev) trace_command_and_release(r.queue, ev, "replay",
+                                             "command buffer");
+            r.phase = (r.phase + 1) % r.phases;
+        }
+        return;
+    }
+    for(int i = 0; i != iterations; ++i) {
+        for(std::vector< CLRecordedKernel >::const_iterator c =
+                r.commands.begin(); c != r.commands.end(); ++c) {
+            set_swap_args(*c, r.phase);
+            check_cl_error(clEnqueueNDRangeKernel(r.queue, c->kernel,
+                                                  c->global.dim, 0,
+                                                  c->global.size,
+                                                  c->local.dim ?
+                                                  c->local.size : 0,
+                                                  0, 0,
+                                                  traced ?
+                                                  trace_event_ptr(r.queue,
+                                                                  &ev)
+                                                  : 0),
+                           "clEnqueueNDRangeKernel");
+            if(ev) trace_command_and_release(r.queue, ev, "replay",
+                                             kernel_name(c->kernel));
+        }
+        r.phase = (r.phase + 1) % r.phases;
+    }
+}
+
+//------------------------------------------------------------------------------
+void release_recording(CLRecording& r) {
+    release_command_buffers(r);
+    r.commands.clear();
+}
+
+//------------------------------------------------------------------------------
+namespace {
+const int PROBE_ITERATIONS = 256;
+const char* PROBE_SOURCE =
+    "__kernel void copy(__global const float4* in, __global float4* out) {\n"
+    "    const size_t i = get_global_id(0);\n"
+    "    out[i] = in[i];\n"
+    "}\n"
+    "__kernel void flops(__global float* out, float a, float b) {\n"
+    "    float4 x = (float4)(get_global_id(0));\n"
+    "    float4 y = x + 1.0f;\n"
+    "    float4 z = x + 2.0f;\n"
+    "    float4 w = x + 3.0f;\n"
+    "    for(int i = 0; i != PROBE_ITERATIONS; ++i) {\n"
+    "        x = mad(x, a, b);\n"
+    "        y = mad(y, a, b);\n"
+    "        z = mad(z, a, b);\n"
+    "        w = mad(w, a, b);\n"
+    "    }\n"
+    "    const float4 s = x + y + z + w;\n"
+    "    out[get_global_id(0)] = s.x + s.y + s.z + s.w;\n"
+    "}\n";
+
+//returns empty string if persistence disabled
+std::string device_db_path() {
+    const char* path = getenv("CLUTIL_DEVICE_DB");
+    return path ? path : ".cldevices";
+}
+
+std::mutex deviceDBMutex;
+
+std::string platform_name(cl_platform_id platform) {
+    std::vector< char > buf(0x10000, char(0));
+    check_cl_error(clGetPlatformInfo(platform, CL_PLATFORM_NAME,
+                                     buf.size(), &buf[0], 0),
+                   "clGetPlatformInfo");
+    return &buf[0];
+}
+
+std::string device_key(cl_platform_id platform, cl_device_id device) {
+    return platform_name(platform) + ';'
+           + get_device_info_string(device, CL_DEVICE_NAME) + ';'
+           + get_device_info_string(device, CL_DRIVER_VERSION);
+}
+
+//one entry per line: key, tab, bandwidth in GB/s, GFLOP/s;
+//later entries override earlier ones with the same key
+bool find_device_score(const std::string& key, CLDeviceScore& score) {
+    const std::string path = device_db_path();
+    if(path.empty()) return false;
+    std::lock_guard< std::mutex > lock(deviceDBMutex);
+    std::ifstream in(path.c_str());
+    std::string line;
+    bool found = false;
+    while(std::getline(in, line)) {
+        const std::string::size_type tab = line.find('\t');
+        if(tab == std::string::npos || line.substr(0, tab) != key) continue;
+        std::istringstream is(line.substr(tab + 1));
+        double bandwidth = 0;
+        double gflops = 0;
+        if(!(is >> bandwidth >> gflops)) continue;
+        score.bandwidth = bandwidth;
+        score.gflops = gflops;
+        found = true;
+    }
+    return found;
+}
+
+void store_device_score(const std::string& key, const CLDeviceScore& score) {
+    const std::string path = device_db_path();
+    if(path.empty()) return;
+    std::lock_guard< std::mutex > lock(deviceDBMutex);
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::app);
+    out << key << '\t' << score.bandwidth << ' ' << score.gflops << '\n';
+    if(!out) {
+        std::cerr << "WARNING - cannot write device database " << path
+                  << std::endl;
+    }
+}
+
+//best of three runs, kernel arguments already set
+double probe_ms(cl_command_queue queue, cl_kernel kernel, size_t global) {
+    double best = -1;
+    for(int r = 0; r != 3; ++r) {
+        const double ms = timeEnqueueNDRangeKernel(queue, kernel, 1, 0,
+                                                   &global, 0, 0, 0);
+        if(best < 0 || ms < best) best = ms;
+    }
+    return std::max(best, 1E-6);
+}
+}
+
+//------------------------------------------------------------------------------
+bool auto_platform(const std::string& platformName) {
+    return platformName.compare(0, 4, "auto") == 0;
+}
+
+//------------------------------------------------------------------------------
+CLDeviceScore probe_device(cl_platform_id platform, cl_device_id device) {
+    CLDeviceScore score;
+    score.platform = platform;
+    score.device = device;
+    const std::string key = device_key(platform, device);
+    if(find_device_score(key, score)) return score;
+    cl_int status;
+    cl_context_properties ctxProps[] = {
+        CL_CONTEXT_PLATFORM,
+        cl_context_properties(platform),
+        0
+    };
+    cl_context ctx = clCreateContext(ctxProps, 1, &device,
+                                     &context_callback, 0, &status);
+    check_cl_error(status, "clCreateContext");
+    cl_command_queue queue = clCreateCommandQueue(ctx, device,
+                                                  CL_QUEUE_PROFILING_ENABLE,
+                                                  &status);
+    check_cl_error(status, "clCreateCommandQueue");
+    std::ostringstream opts;
+    opts << "-DPROBE_ITERATIONS=" << PROBE_ITERATIONS;
+    cl_program program = build_program(ctx, device, PROBE_SOURCE, opts.str());
+    //bandwidth: copy of 64 MiB or half the maximum allocation size
+    cl_ulong maxAlloc = 0;
+    check_cl_error(clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                                   sizeof(cl_ulong), &maxAlloc, 0),
+                   "clGetDeviceInfo");
+    const size_t bytes = size_t(std::min(cl_ulong(64) << 20, maxAlloc / 2))
+                         / 16 * 16;
+    cl_mem in = clCreateBuffer(ctx, CL_MEM_READ_ONLY, bytes, 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_mem out = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY, bytes, 0, &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_kernel copy = clCreateKernel(program, "copy", &status);
+    check_cl_error(status, "clCreateKernel");
+    check_cl_error(clSetKernelArg(copy, 0, sizeof(cl_mem), &in),
+                   "clSetKernelArg");
+    check_cl_error(clSetKernelArg(copy, 1, sizeof(cl_mem), &out),
+                   "clSetKernelArg");
+    //bytes read + bytes written
+    score.bandwidth = 2 * double(bytes) / (probe_ms(queue, copy, bytes / 16)
+                                           * 1E6);
+    //FLOP rate: 4 independent chains of float4 multiply-adds per work item
+    const size_t FLOPS_GLOBAL = size_t(1) << 20;
+    cl_mem flopsOut = clCreateBuffer(ctx, CL_MEM_WRITE_ONLY,
+                                     FLOPS_GLOBAL * sizeof(float), 0,
+                                     &status);
+    check_cl_error(status, "clCreateBuffer");
+    cl_kernel flops = clCreateKernel(program, "flops", &status);
+    check_cl_error(status, "clCreateKernel");
+    const float a = 0.999f;
+    const float b = 0.001f;
+    check_cl_error(clSetKernelArg(flops, 0, sizeof(cl_mem), &flopsOut),
+                   "clSetKernelArg");
+    check_cl_error(clSetKernelArg(flops, 1, sizeof(float), &a),
+                   "clSetKernelArg");
+    check_cl_error(clSetKernelArg(flops, 2, sizeof(float), &b),
+                   "clSetKernelArg");
+    score.gflops = double(FLOPS_GLOBAL) * PROBE_ITERATIONS * 4 * 4 * 2
+                   / (probe_ms(queue, flops, FLOPS_GLOBAL) * 1E6);
+    check_cl_error(clReleaseKernel(copy), "clReleaseKernel");
+    check_cl_error(clReleaseKernel(flops), "clReleaseKernel");
+    check_cl_error(clReleaseMemObject(in), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(out), "clReleaseMemObject");
+    check_cl_error(clReleaseMemObject(flopsOut), "clReleaseMemObject");
+    check_cl_error(clReleaseProgram(program), "clReleaseProgram");
+    untrace_queue(queue);
+    check_cl_error(clReleaseCommandQueue(queue), "clReleaseCommandQueue");
+    check_cl_error(clReleaseContext(ctx), "clReleaseContext");
+    store_device_score(key, score);
+    return score;
+}
+
+//------------------------------------------------------------------------------
+CLDeviceScore auto_select_device(const std::string& selector,
+                                 const std::string& deviceTypeName) {
+    if(selector != "auto" && selector != "auto:bandwidth"
+       && selector != "auto:compute") {
+        std::cerr << "ERROR - invalid device selector " << selector
+                  << ": auto | auto:bandwidth | auto:compute" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    const cl_device_type deviceType = device_type(deviceTypeName);
+    cl_uint numPlatforms = 0;
+    check_cl_error(clGetPlatformIDs(0, 0, &numPlatforms), "clGetPlatformIDs");
+    std::vector< cl_platform_id > platforms(numPlatforms);
+    if(numPlatforms > 0) {
+        check_cl_error(clGetPlatformIDs(numPlatforms, &platforms[0], 0),
+                       "clGetPlatformIDs");
+    }
+    CLDeviceScore best = {0, 0, 0, 0};
+    double bestValue = -1;
+    for(std::vector< cl_platform_id >::const_iterator p = platforms.begin();
+        p != platforms.end(); ++p) {
+        //platforms without devices of the requested type are skipped
+        cl_uint numDevices = 0;
+        if(clGetDeviceIDs(*p, deviceType, 0, 0, &numDevices) != CL_SUCCESS
+           || numDevices < 1) continue;
+        std::vector< cl_device_id > devices(numDevices);
+        check_cl_error(clGetDeviceIDs(*p, deviceType, numDevices,
+                                      &devices[0], 0), "clGetDeviceIDs");
+        for(std::vector< cl_device_id >::const_iterator d = devices.begin();
+            d != devices.end(); ++d) {
+            const CLDeviceScore s = probe_device(*p, *d);
+            const double value =
+                selector == "auto:bandwidth" ? s.bandwidth
+                : selector == "auto:compute" ? s.gflops
+                : std::sqrt(s.bandwidth * s.gflops);
+            if(value > bestValue) {
+                bestValue = value;
+                best = s;
+            }
+        }
+    }
+    if(!best.device) {
+        std::cerr << "ERROR - Cannot find device of type " << deviceTypeName
+                  << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    std::cout << "Device selection (" << selector << "): "
+              << get_device_info_string(best.device, CL_DEVICE_NAME)
+              << " - " << platform_name(best.platform) << "  "
+              << best.bandwidth << " GB/s  " << best.gflops << " GFLOP/s"
+              << std::endl;
+    return best;
+}
+
+//------------------------------------------------------------------------------
+namespace {
+//register tile of the micro-kernel: GEMM_MR rows x two SIMD vectors, of
+//the widest size the target supports natively: wider vectors are split by
+//the compiler into slow sequences; cache blocking: GEMM_MC x GEMM_KC block
+//of A (L2), GEMM_KC x GEMM_NC panel of B (L3), GEMM_KC x NR micro-panel of
+//B (L1)
+#if defined(__AVX__)
+const int GEMM_VEC_BYTES = 32;
+#else
+const int GEMM_VEC_BYTES = 16;
+#endif
+const int GEMM_MR = 4;
+const int GEMM_MC = 128;
+const int GEMM_KC = 256;
+const int GEMM_NC = 4096;
+
+template < typename T >
+struct GemmTile {
+    static const int NR = 2 * GEMM_VEC_BYTES / sizeof(T);
+};
+
+#if defined(__GNUC__)
+typedef float GemmFloatVec __attribute__((vector_size(GEMM_VEC_BYTES)));
+typedef double GemmDoubleVec __attribute__((vector_size(GEMM_VEC_BYTES)));
+template < typename T > struct GemmVec;
+template <> struct GemmVec< float > { typedef GemmFloatVec type; };
+template <> struct GemmVec< double > { typedef GemmDoubleVec type; };
+#endif
+
+//rows [0, mc) x columns [0, kc) of A into panels of GEMM_MR rows stored
+//column after column, last panel zero padded
+template < typename T >
+void gemm_pack_a(int mc, int kc, const T* A, int lda, T* packed) {
+    for(int ip = 0; ip < mc; ip += GEMM_MR) {
+        const int mr = std::min(GEMM_MR, mc - ip);
+        for(int k = 0; k != kc; ++k) {
+            for(int i = 0; i != GEMM_MR; ++i) {
+                *packed++ = i < mr ? A[size_t(ip + i) * lda + k] : T(0);
+            }
+        }
+    }
+}
+
+//rows [0, kc) x columns [0, nc) of B into panels of NR columns stored row
+//after row, last panel zero padded
+template < typename T >
+void gemm_pack_b(int kc, int nc, const T* B, int ldb, T* packed) {
+    const int NR = GemmTile< T >::NR;
+    for(int jp = 0; jp < nc; jp += NR) {
+        const int nr = std::min(NR, nc - jp);
+        for(int k = 0; k != kc; ++k) {
+            const T* row = B + size_t(k) * ldb + jp;
+            for(int j = 0; j != NR; ++j) *packed++ = j < nr ? row[j] : T(0);
+        }
+    }
+}
+
+//mr x nr elements of C, mr <= GEMM_MR, nr <= NR: set to (accumulate ==
+//false) or incremented by the product of a packed panel of A and a packed
+//micro-panel of B; packed B must be GEMM_VEC_BYTES aligned
+template < typename T >
+void gemm_micro_kernel(int kc, const T* a, const T* b, T* c, int ldc,
+                       int mr, int nr, bool accumulate) {
+    const int NR = GemmTile< T >::NR;
+    T tile[GEMM_MR][NR];
+#if defined(__GNUC__)
+    typedef typename GemmVec< T >::type V;
+    const int W = NR / 2;
+    V acc[GEMM_MR][2];
+    std::memset(acc, 0, sizeof(acc));
+    for(int k = 0; k != kc; ++k) {
+        const V b0 = *reinterpret_cast< const V* >(b);
+        const V b1 = *reinterpret_cast< const V* >(b + W);
+        for(int i = 0; i != GEMM_MR; ++i) {
+            acc[i][0] += a[i] * b0;
+            acc[i][1] += a[i] * b1;
+        }
+        a += GEMM_MR;
+        b += NR;
+    }
+    std::memcpy(tile, acc, sizeof(tile));
+#else
+    for(int i = 0; i != GEMM_MR; ++i) {
+        for(int j = 0; j != NR; ++j) tile[i][j] = T(0);
+    }
+    for(int k = 0; k != kc; ++k) {
+        for(int i = 0; i != GEMM_MR; ++i) {
+            for(int j = 0; j != NR; ++j) tile[i][j] += a[i] * b[j];
+        }
+        a += GEMM_MR;
+        b += NR;
+    }
+#endif
+    for(int i = 0; i != mr; ++i) {
+        T* row = c + size_t(i) * ldc;
+        for(int j = 0; j != nr; ++j) {
+            row[j] = accumulate ? row[j] + tile[i][j] : tile[i][j];
+        }
+    }
+}
+
+template < typename T >
+void gemm(int M, int N, int K,
+          const T* A, int lda,
+          const T* B, int ldb,
+          T* C, int ldc,
+          int threads) {
+    if(M < 1 || N < 1) return;
+    if(K < 1) {
+        for(int r = 0; r != M; ++r) {
+            std::fill(C + size_t(r) * ldc, C + size_t(r) * ldc + N, T(0));
+        }
+        return;
+    }
+    const int NR = GemmTile< T >::NR;
+    if(threads < 1) {
+        threads = std::max(1, int(std::thread::hardware_concurrency()));
+    }
+    threads = std::min(threads, (M + GEMM_MC - 1) / GEMM_MC);
+    const int kcMax = std::min(K, GEMM_KC);
+    const int ncMax = (std::min(N, GEMM_NC) + NR - 1) / NR * NR;
+    const int mcMax = (std::min(M, GEMM_MC) + GEMM_MR - 1) / GEMM_MR
+                      * GEMM_MR;
+    //page aligned, see aligned_host_alloc
+    T* packedB = static_cast< T* >(aligned_host_alloc(sizeof(T) * kcMax
+                                                      * ncMax));
+    std::vector< T* > packedA(threads);
+    for(int t = 0; t != threads; ++t) {
+        packedA[t] = static_cast< T* >(aligned_host_alloc(sizeof(T) * kcMax
+                                                          * mcMax));
+    }
+    for(int jc = 0; jc < N; jc += GEMM_NC) {
+        const int nc = std::min(GEMM_NC, N - jc);
+        for(int pc = 0; pc < K; pc += GEMM_KC) {
+            const int kc = std::min(GEMM_KC, K - pc);
+            gemm_pack_b(kc, nc, B + size_t(pc) * ldb + jc, ldb, packedB);
+            //blocks of rows of C assigned round robin to threads
+            const std::function< void (int) > rowBlocks = [&](int t) {
+                for(int ic = t * GEMM_MC; ic < M; ic += threads * GEMM_MC) {
+                    const int mc = std::min(GEMM_MC, M - ic);
+                    gemm_pack_a(mc, kc, A + size_t(ic) * lda + pc, lda,
+                                packedA[t]);
+                    for(int jr = 0; jr < nc; jr += NR) {
+                        for(int ir = 0; ir < mc; ir += GEMM_MR) {
+                            gemm_micro_kernel(kc, packedA[t] + ir * kc,
+                                              packedB + jr * kc,
+                                              C + size_t(ic + ir) * ldc
+                                              + jc + jr, ldc,
+                                              std::min(GEMM_MR, mc - ir),
+                                              std::min(NR, nc - jr),
+                                              pc > 0);
+                        }
+                    }
+                }
+            };
+            std::vector< std::thread > workers;
+            for(int t = 1; t < threads; ++t) {
+                workers.push_back(std::thread(rowBlocks, t));
+            }
+            rowBlocks(0);
+            for(std::vector< std::thread >::iterator w = workers.begin();
+                w != workers.end(); ++w) w->join();
+        }
+    }
+    for(int t = 0; t != threads; ++t) aligned_host_free(packedA[t]);
+    aligned_host_free(packedB);
+}
+}
+
+//------------------------------------------------------------------------------
+void host_gemm(int M, int N, int K,
+               const float* A, int lda,
+               const float* B, int ldb,
+               float* C, int ldc,
+               int threads) {
+    gemm(M, N, K, A, lda, B, ldb, C, ldc, threads);
+}
+
+//------------------------------------------------------------------------------
+void host_gemm(int M, int N, int K,
+               const double* A, int lda,
+               const double* B, int ldb,
+               double* C, int ldc,
+               int threads) {
+    gemm(M, N, K, A, lda, B, ldb, C, ldc, threads);
+}
+
+//------------------------------------------------------------------------------
+cl_half float_to_half(float f) {
+    cl_uint x;
+    std::memcpy(&x, &f, sizeof(x));
+    const cl_uint sign = (x >> 16) & 0x8000;
+    const cl_uint bits = x & 0x7fffffff;
+    //infinity, NaN (quiet)
+    if(bits >= 0x7f800000) {
+        return cl_half(sign | 0x7c00 | (bits > 0x7f800000 ? 0x200 : 0));
+    }
+    //65520 and above round to infinity
+    if(bits >= 0x477ff000) return cl_half(sign | 0x7c00);
+    const cl_uint exponent = bits >> 23;
+    cl_uint h = 0;
+    cl_uint remainder = 0;
+    cl_uint halfway = 0;
+    if(exponent < 113) {
+        //below 2^-14: half subnormal, unit 2^-24
+        const cl_uint shift = 126 - exponent;
+        if(shift > 24) return cl_half(sign);
+        const cl_uint mantissa = (bits & 0x7fffff) | 0x800000;
+        h = mantissa >> shift;
+        remainder = mantissa & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+    } else {
+        h = ((exponent - 112) << 10) | ((bits & 0x7fffff) >> 13);
+        remainder = bits & 0x1fff;
+        halfway = 0x1000;
+    }
+    //a carry out of the mantissa correctly increments the exponent
+    if(remainder > halfway || (remainder == halfway && (h & 1))) ++h;
+    return cl_half(sign | h);
+}
+
+//------------------------------------------------------------------------------
+float half_to_float(cl_half h) {
+    const cl_uint sign = cl_uint(h & 0x8000) << 16;
+    const cl_uint exponent = (h >> 10) & 0x1f;
+    const cl_uint mantissa = h & 0x3ff;
+    cl_uint x = 0;
+    if(exponent == 0x1f) {
+        x = sign | 0x7f800000 | (mantissa << 13);
+    } else if(exponent == 0) {
+        //zero or subnormal: mantissa x 2^-24, exact in float
+        const float f = std::ldexp(float(mantissa), -24);
+        return sign ? -f : f;
+    } else {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    float f;
+    std::memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+//------------------------------------------------------------------------------
+void float_to_half(const float* in, size_t n, cl_half* out) {
+    for(size_t i = 0; i != n; ++i) out[i] = float_to_half(in[i]);
+}
+
+//------------------------------------------------------------------------------
+void half_to_float(const cl_half* in, size_t n, float* out) {
+    for(size_t i = 0; i != n; ++i) out[i] = half_to_float(in[i]);
+}
@@ -2,6 +2,15 @@
 //OpenCL utility functions
 //Author: Ugo Varetto
 #include <string>
+#include <map>
+#include <vector>
+#include <functional>
+#include <iosfwd>
+#include <future>
+#include <mutex>
+#include <type_traits>
+#include <chrono>
+#include <thread>
 
 #ifdef __APPLE__
 #include <OpenCL/cl.h>
@@ -12,24 +21,89 @@
 
 
 
+//kernels indexed by function name
+typedef std::map< std::string, cl_kernel > CLKernelMap;
+
 struct CLEnv {
     cl_context context;
     cl_program program;
-    cl_kernel kernel;
+    cl_kernel kernel; //kernel selected at creation time, also in 'kernels'
     cl_command_queue commandQueue;
+    CLKernelMap kernels; //all the kernels in program
+    //device fission: sub-devices of the selected device and one queue per
+    //sub-device; empty unless a partition is requested in create_clenv;
+    //the context contains both the parent device and the sub-devices,
+    //commandQueue always refers to the parent device
+    std::vector< cl_device_id > subDevices;
+    std::vector< cl_command_queue > subQueues;
 };
 
 void check_cl_error(cl_int status, const char* msg);
+cl_platform_id find_platform(const std::string& platformName);
+//device type = default | cpu | gpu | acc | all
+std::vector< cl_device_id > get_device_ids(cl_platform_id platformID,
+                                           const std::string& deviceTypeName);
+//platformName = "auto": see auto_select_device
 cl_context create_cl_context(const std::string& platformName,
                              const std::string& deviceTypeName,
                              int deviceNum);
+//automatic device selection: platformName = "auto" | "auto:bandwidth" |
+//"auto:compute" selects, among the devices of the requested type on all the
+//platforms, the one with the highest score measured by short probes:
+//global memory bandwidth for bandwidth-bound kernels, single precision
+//FLOP rate for compute-bound kernels, the geometric mean of the two for
+//plain "auto". With "auto" the device number is ignored.
+//Scores are cached on disk keyed on platform name, device name and driver
+//version: devices are probed only once; the cache file is read from the
+//CLUTIL_DEVICE_DB environment variable, default: '.cldevices'; set to empty
+//to disable persistence.
+struct CLDeviceScore {
+    cl_platform_id platform;
+    cl_device_id device;
+    double bandwidth; //GB/s
+    double gflops;
+};
+bool auto_platform(const std::string& platformName);
+//runs the probes unless scores are found in the cache
+CLDeviceScore probe_device(cl_platform_id platform, cl_device_id device);
+CLDeviceScore auto_select_device(const std::string& selector,
+                                 const std::string& deviceTypeName);
 std::string load_text(const char* filepath);
 cl_device_id get_device_id(cl_context ctx);
+std::string get_device_info_string(cl_device_id deviceID,
+                                   cl_device_info info);
 void print_platforms();
+//builds program from source for a single device; program binaries are
+//cached on disk and reloaded through clCreateProgramWithBinary on subsequent
+//runs, falling back to a source build if the binary is rejected.
+//Cache entries are keyed on a hash of source text, build options, device name
+//and driver version; the cache directory is read from the CLUTIL_CACHE_DIR
+//environment variable (default: ./.clcache); set CLUTIL_CACHE_DIR to an empty
+//string to disable caching
+cl_program build_program(cl_context ctx,
+                         cl_device_id deviceID,
+                         const std::string& source,
+                         const std::string& buildOptions = std::string());
+//builds program for all the devices in the list
+cl_program build_program(cl_context ctx,
+                         const std::vector< cl_device_id >& devices,
+                         const std::string& source,
+                         const std::string& buildOptions = std::string());
+//cumulative program cache statistics
+struct CLProgramCacheStats {
+    int hits;
+    int misses;
+    int rejected; //cached binary found but rejected by the runtime
+    double buildTime_ms; //total time spent in build_program
+};
+CLProgramCacheStats get_program_cache_stats();
 //the following function only fills the requested CLEnv fields:
 //context and command queue are always reaturned; program and
-//kernel are returned only if the source path and kernel name are
-//not NULL
+//kernels are returned only if the source path is not NULL, kernel is
+//set only if kernel name is not NULL;
+//the device type can be followed by a '/<partition>' suffix to split the
+//device into sub-devices through clCreateSubDevices, see create_sub_devices;
+//e.g. "cpu/numa" creates one sub-device and one queue per NUMA node
 CLEnv create_clenv(const std::string& platformName,
                    const std::string& deviceType,
                    int deviceNum,
@@ -38,7 +112,37 @@ CLEnv create_clenv(const std::string& platformName,
                    const char* kernelName = 0, 
                    const std::string& clSourcePrefix = std::string(),
                    const std::string& buildOptions = std::string());
+//asynchronous version of create_clenv: context and command queues are
+//created synchronously and can be used right away e.g. to allocate buffers,
+//the program is built in a background thread; program, kernels and kernel
+//in 'env' are set by wait_clenv; program cache statistics are updated by
+//the build thread and are valid after wait_clenv returns
+struct CLEnvFuture {
+    CLEnv env;
+    std::string kernelName;
+    std::future< cl_program > program; //invalid if no source was specified
+};
+CLEnvFuture create_clenv_async(const std::string& platformName,
+                               const std::string& deviceType,
+                               int deviceNum,
+                               bool enableProfiling = false,
+                               const char* clSourcePath = 0,
+                               const char* kernelName = 0,
+                               const std::string& clSourcePrefix =
+                                   std::string(),
+                               const std::string& buildOptions =
+                                   std::string());
+//true if the program build has completed; does not block
+bool clenv_ready(const CLEnvFuture& f);
+//waits for the build to complete and creates the kernels
+CLEnv wait_clenv(CLEnvFuture& f);
 void release_clenv(CLEnv& e);
+//creates all the kernels in a built program through clCreateKernelsInProgram
+CLKernelMap create_kernels(cl_program program);
+//returns kernel from the set of kernels created from the CLEnv program; no
+//recompilation is performed when switching kernels; all the kernels share
+//the CLEnv context and command queue
+cl_kernel get_kernel(const CLEnv& e, const std::string& kernelName);
 //executes kernel synchronously and returns elapsed time in milliseconds
 double timeEnqueueNDRangeKernel(cl_command_queue command_queue,
                                 cl_kernel kernel,
@@ -49,3 +153,866 @@ double timeEnqueueNDRangeKernel(cl_command_queue command_queue,
                                 cl_uint num_events_in_wait_list,
                                 const cl_event *event_wait_list);
 double get_cl_time(cl_event ev);
+
+//multi-device support: one context, one program built for all the devices
+//and one profiling-enabled command queue per device
+struct CLMultiEnv {
+    cl_context context;
+    cl_program program;
+    CLKernelMap kernels;
+    std::vector< cl_device_id > devices;
+    std::vector< cl_command_queue > queues; //one per device
+    std::vector< cl_device_id > subDevices; //sub-devices created by clutil
+    std::vector< double > throughput; //measured work items per ms per device,
+                                      //zero if not yet measured
+};
+//partitions device into numSubDevices sub-devices with
+//CL_DEVICE_PARTITION_EQUALLY; requires OpenCL >= 1.2
+std::vector< cl_device_id > create_sub_devices(cl_device_id deviceID,
+                                               int numSubDevices);
+//partition = numa | l4 | l3 | l2 | l1 | next: one sub-device per affinity
+//            domain (CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN)
+//          | <n>: n sub-devices (CL_DEVICE_PARTITION_EQUALLY)
+std::vector< cl_device_id > create_sub_devices(cl_device_id deviceID,
+                                               const std::string& partition);
+//creates one buffer per sub-device in a partitioned CLEnv; the memory of each
+//buffer is first touched by the owning sub-device: buffers are allocated with
+//CL_MEM_ALLOC_HOST_PTR, migrated to the sub-device and initialised through
+//the sub-device queue with the content of the corresponding host slice
+//(zero-filled if the host slice is NULL); no buffer is created for empty
+//slices, the returned handle is NULL
+std::vector< cl_mem > create_partitioned_buffers(const CLEnv& e,
+                                     cl_mem_flags flags,
+                                     const std::vector< size_t >& sizes,
+                                     const std::vector< const void* >& host);
+//device list:
+//  "all": all the devices of type deviceTypeName
+//  "0,1...": comma separated list of device indices
+//  "<device index>/<partition>": device partitioned into sub-devices,
+//                        see create_sub_devices; useful to test on a
+//                        single CPU device e.g. "0/4"
+CLMultiEnv create_multi_clenv(const std::string& platformName,
+                              const std::string& deviceTypeName,
+                              const std::string& deviceList,
+                              const char* clSourcePath = 0,
+                              const std::string& clSourcePrefix = std::string(),
+                              const std::string& buildOptions = std::string());
+void release_multi_clenv(CLMultiEnv& e);
+cl_kernel get_kernel(const CLMultiEnv& e, const std::string& kernelName);
+//per-device slab of an NDRange: kernels must use get_global_id (which
+//includes the global offset) and not get_group_id to compute global indices
+struct CLRange {
+    cl_uint dim;
+    size_t offset[3];
+    size_t global[3];
+};
+//splits NDRange along the slowest moving dimension (dim - 1) in multiples
+//of the local size proportionally to weights; devices with zero weight
+//receive an empty range
+std::vector< CLRange > partition_ndrange(const std::vector< double >& weights,
+                                         cl_uint dim,
+                                         const size_t* global,
+                                         const size_t* local);
+//launches kernel on all devices with a split proportional to the measured
+//throughput (equal split until first measurement), waits for completion and
+//updates throughput; setDeviceArgs, if set, is invoked before each
+//per-device launch to set device specific arguments (e.g. output buffers)
+typedef std::function< void (cl_kernel, int) > CLDeviceArgsSetter;
+std::vector< CLRange > dispatch_ndrange(CLMultiEnv& e,
+                      cl_kernel kernel,
+                      cl_uint dim,
+                      const size_t* global,
+                      const size_t* local,
+                      const CLDeviceArgsSetter& setDeviceArgs =
+                          CLDeviceArgsSetter());
+//one buffer per device; used for outputs which must not be written
+//concurrently by more than one device
+std::vector< cl_mem > create_device_buffers(const CLMultiEnv& e,
+                                            cl_mem_flags flags,
+                                            size_t size);
+//reads the output region of each range from the buffer of the corresponding
+//device into host memory; output size per range is
+//(range size along split dimension / itemsPerBlock) * bytesPerBlock
+//e.g. one row of floats per work item along y: itemsPerBlock = 1,
+//bytesPerBlock = columns * sizeof(float)
+void gather_ndrange(const CLMultiEnv& e,
+                    const std::vector< cl_mem >& deviceBuffers,
+                    const std::vector< CLRange >& ranges,
+                    size_t bytesPerBlock,
+                    size_t itemsPerBlock,
+                    void* host);
+
+//task graph: nodes are kernel launches, buffer writes, reads, maps and
+//unmaps; dependencies between nodes are turned into cl_event wait lists, the
+//submission order is the insertion order, which is always a valid
+//topological order since a node can only depend on nodes added before it.
+//Nodes are submitted to a single out-of-order queue or distributed across
+//multiple in-order queues: independent transfers and kernels can overlap
+enum CLTaskType {
+    CLTASK_KERNEL,
+    CLTASK_WRITE,
+    CLTASK_READ,
+    CLTASK_MAP,
+    CLTASK_UNMAP
+};
+//invoked right before the kernel is enqueued: kernel arguments are
+//captured at enqueue time, the same kernel can therefore be shared by
+//multiple nodes with different arguments
+typedef std::function< void (cl_kernel) > CLKernelArgsSetter;
+struct CLTask {
+    CLTaskType type;
+    std::string name;
+    std::vector< int > deps; //indices of nodes this node depends on
+    int queue; //index of the queue the node was submitted to
+    //kernel
+    cl_kernel kernel;
+    CLKernelArgsSetter setArgs;
+    cl_uint dim;
+    size_t global[3];
+    size_t local[3];
+    bool hasLocal;
+    //write, read, map, unmap
+    cl_mem buffer;
+    size_t offset;
+    size_t size;
+    void* host; //source/destination for write/read, mapped pointer for map
+    cl_map_flags mapFlags;
+    int mapTask; //unmap: index of the map node
+    cl_event event; //valid after run_task_graph until the next run/release
+};
+struct CLTaskGraph {
+    cl_context context;
+    std::vector< cl_command_queue > queues;
+    bool outOfOrder;
+    bool profiling;
+    std::vector< CLTask > tasks;
+};
+//numQueues == 0: one out-of-order queue if supported by the device, two
+//                in-order queues otherwise
+//numQueues > 0: numQueues in-order queues; 1 = fully serialized execution
+CLTaskGraph create_task_graph(const CLEnv& e,
+                              int numQueues = 0,
+                              bool enableProfiling = false);
+void release_task_graph(CLTaskGraph& g);
+//the following functions add a node and return its index
+int add_kernel_task(CLTaskGraph& g,
+                    const std::string& name,
+                    cl_kernel kernel,
+                    cl_uint dim,
+                    const size_t* global,
+                    const size_t* local,
+                    const std::vector< int >& deps = std::vector< int >(),
+                    const CLKernelArgsSetter& setArgs = CLKernelArgsSetter());
+int add_write_task(CLTaskGraph& g,
+                   const std::string& name,
+                   cl_mem buffer,
+                   size_t offset,
+                   size_t size,
+                   const void* host,
+                   const std::vector< int >& deps = std::vector< int >());
+int add_read_task(CLTaskGraph& g,
+                  const std::string& name,
+                  cl_mem buffer,
+                  size_t offset,
+                  size_t size,
+                  void* host,
+                  const std::vector< int >& deps = std::vector< int >());
+int add_map_task(CLTaskGraph& g,
+                 const std::string& name,
+                 cl_mem buffer,
+                 cl_map_flags flags,
+                 size_t offset,
+                 size_t size,
+                 const std::vector< int >& deps = std::vector< int >());
+int add_unmap_task(CLTaskGraph& g,
+                   const std::string& name,
+                   int mapTask,
+                   const std::vector< int >& deps = std::vector< int >());
+//submits all the nodes without blocking; events from a previous run are
+//released first
+void run_task_graph(CLTaskGraph& g);
+//waits for all the nodes to complete
+void wait_task_graph(const CLTaskGraph& g);
+//pointer returned by a map node, valid after the node has completed
+void* get_mapped_ptr(const CLTaskGraph& g, int mapTask);
+//prints queue, start and end time of each node relative to the first
+//start time; requires profiling
+void print_task_timeline(const CLTaskGraph& g, std::ostream& os);
+
+//device memory pool: released buffers and images are not destroyed but kept
+//in free lists and returned by subsequent requests with the same flags and
+//size class (buffers) or the same flags, format and extent (images);
+//buffer sizes are rounded up to size classes of 2^k * {1, 1.25, 1.5, 1.75}
+//with a minimum of 256 bytes. Pooled objects are created without host
+//pointers: CL_MEM_USE_HOST_PTR and CL_MEM_COPY_HOST_PTR are not accepted,
+//data must be transferred explicitly; the content of a recycled object is
+//undefined
+struct CLMemPoolKey {
+    cl_mem_flags flags;
+    bool image;
+    cl_channel_order order;
+    cl_channel_type type;
+    size_t width; //size class for buffers
+    size_t height;
+    bool operator<(const CLMemPoolKey& k) const;
+};
+struct CLMemPoolStats {
+    size_t allocations; //objects created through the OpenCL API
+    size_t hits; //requests served from the free lists
+    size_t bytesInUse; //allocated and not yet released to the pool
+    size_t bytesCached; //in the free lists
+    size_t highWaterBytes; //peak of bytesInUse + bytesCached
+};
+struct CLMemPool {
+    cl_context context;
+    std::multimap< CLMemPoolKey, cl_mem > free;
+    std::map< cl_mem, std::pair< CLMemPoolKey, size_t > > inUse; //key, bytes
+    CLMemPoolStats stats;
+};
+CLMemPool create_mem_pool(cl_context ctx);
+//destroys all the cached objects; objects still in use are not released
+void release_mem_pool(CLMemPool& pool);
+cl_mem pool_alloc_buffer(CLMemPool& pool, cl_mem_flags flags, size_t size);
+cl_mem pool_alloc_image2d(CLMemPool& pool,
+                          cl_mem_flags flags,
+                          const cl_image_format& format,
+                          size_t width,
+                          size_t height);
+//returns object to the pool
+void pool_release(CLMemPool& pool, cl_mem mem);
+//destroys cached objects, largest first, until at most maxCachedBytes are
+//left in the free lists
+void trim_mem_pool(CLMemPool& pool, size_t maxCachedBytes = 0);
+void print_mem_pool_stats(const CLMemPool& pool, std::ostream& os);
+
+//pinned host memory arena: host memory is carved out of regions allocated
+//with CL_MEM_ALLOC_HOST_PTR which stay mapped for the lifetime of the arena;
+//transfers from/to such memory do not require a staging copy in pageable
+//memory and are performed through DMA by the OpenCL runtime. Allocations are
+//bump-allocated from the current region and aligned to the device base
+//address alignment; a region is reused once all its allocations have been
+//released; requests larger than the region size get a dedicated region
+struct CLPinnedRegion {
+    cl_mem buffer;
+    char* base;
+    size_t size;
+    size_t offset; //first free byte
+    int live; //number of allocations not yet released
+};
+struct CLPinnedArena {
+    cl_context context;
+    cl_command_queue queue; //used for map/unmap only
+    size_t regionSize;
+    size_t alignment;
+    std::vector< CLPinnedRegion > regions;
+    size_t bytesInUse;
+    size_t peakBytes;
+    std::mutex mutex;
+};
+//arenas are referenced by allocators and are therefore heap allocated and
+//not copyable
+CLPinnedArena* create_pinned_arena(const CLEnv& e,
+                                   size_t regionSize = 64 * (1 << 20));
+//unmaps and releases all the regions: all the memory allocated from the
+//arena must have been released
+void release_pinned_arena(CLPinnedArena* arena);
+void* pinned_alloc(CLPinnedArena& arena, size_t size);
+void pinned_free(CLPinnedArena& arena, void* p);
+//if p is inside a pinned region of any arena returns the region buffer and
+//the offset of p into it
+bool find_pinned(const void* p, cl_mem& buffer, size_t& offset);
+
+//STL allocator: std::vector storage allocated from a pinned arena
+template < typename T >
+struct CLPinnedAllocator {
+    typedef T value_type;
+    CLPinnedArena* arena;
+    CLPinnedAllocator(CLPinnedArena* a) : arena(a) {}
+    template < typename U >
+    CLPinnedAllocator(const CLPinnedAllocator< U >& other)
+        : arena(other.arena) {}
+    T* allocate(size_t n) {
+        return static_cast< T* >(pinned_alloc(*arena, n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t) { pinned_free(*arena, p); }
+};
+template < typename T, typename U >
+bool operator==(const CLPinnedAllocator< T >& a,
+                const CLPinnedAllocator< U >& b) {
+    return a.arena == b.arena;
+}
+template < typename T, typename U >
+bool operator!=(const CLPinnedAllocator< T >& a,
+                const CLPinnedAllocator< U >& b) {
+    return !(a == b);
+}
+template < typename T >
+using CLPinnedVector = std::vector< T, CLPinnedAllocator< T > >;
+
+//buffer transfers: host memory allocated from a pinned arena is
+//transferred directly (DMA), pageable memory is staged by the runtime;
+//the number of transfers of each kind is recorded in CLTransferStats
+struct CLTransferStats {
+    size_t pinned;
+    size_t pageable;
+};
+CLTransferStats get_transfer_stats();
+void enqueue_write(cl_command_queue queue,
+                   cl_mem buffer,
+                   size_t offset,
+                   size_t size,
+                   const void* host,
+                   bool blocking = false,
+                   cl_event* event = 0);
+void enqueue_read(cl_command_queue queue,
+                  cl_mem buffer,
+                  size_t offset,
+                  size_t size,
+                  void* host,
+                  bool blocking = false,
+                  cl_event* event = 0);
+
+//typed kernel launcher:
+//  launch(queue, kernel, CLNDRange(x, y), CLNDRange(lx, ly), args...)
+//sets the kernel arguments in order and enqueues the kernel; an argument is
+//set through clSetKernelArg only if its value differs from the value bound
+//to the same slot by the previous launch of the same kernel: kernels
+//launched through this function must not have their arguments set directly
+//unless forget_kernel_args is called first. Argument types are checked at
+//compile time: arguments must be trivially copyable and must not be host
+//pointers; use CLLocalMem for __local arguments and CLTypedKernel to also
+//check the number and type of arguments against the kernel signature.
+//Returns the event associated with the kernel execution, to be released
+//by the caller
+struct CLNDRange {
+    cl_uint dim; //zero: NULL local size, selected by the runtime
+    size_t size[3];
+    CLNDRange() : dim(0) { size[0] = size[1] = size[2] = 1; }
+    CLNDRange(size_t x) : dim(1) { size[0] = x; size[1] = size[2] = 1; }
+    CLNDRange(size_t x, size_t y) : dim(2) {
+        size[0] = x; size[1] = y; size[2] = 1;
+    }
+    CLNDRange(size_t x, size_t y, size_t z) : dim(3) {
+        size[0] = x; size[1] = y; size[2] = z;
+    }
+};
+//__local memory argument of the specified size in bytes
+struct CLLocalMem {
+    size_t size;
+    explicit CLLocalMem(size_t s) : size(s) {}
+};
+//kernel signature: launch through CLTypedKernel<cl_mem, int...> converts
+//each argument to the corresponding parameter type and does not compile if
+//the number of arguments does not match
+template < typename... ParamsT >
+struct CLTypedKernel {
+    cl_kernel kernel;
+    explicit CLTypedKernel(cl_kernel k) : kernel(k) {}
+};
+struct CLLaunchStats {
+    size_t launches;
+    size_t argsSet; //clSetKernelArg calls
+    size_t argsSkipped; //unchanged arguments
+};
+CLLaunchStats get_launch_stats();
+//returns true if the value differs from the value bound to the same slot
+//in the previous call and records the new value; value == NULL: __local
+//memory argument of the specified size
+bool kernel_arg_changed(cl_kernel kernel, cl_uint index,
+                        const void* value, size_t size);
+//discards recorded argument values; must be called after setting arguments
+//directly with clSetKernelArg or before releasing a kernel
+void forget_kernel_args(cl_kernel kernel);
+cl_event enqueue_launch(cl_command_queue queue,
+                        cl_kernel kernel,
+                        const CLNDRange& global,
+                        const CLNDRange& local);
+
+//OpenCL objects which can be passed by value to kernels; all the other
+//pointer types are host pointers
+template < typename T > struct CLKernelArgHandle : std::false_type {};
+template <> struct CLKernelArgHandle< cl_mem > : std::true_type {};
+template <> struct CLKernelArgHandle< cl_sampler > : std::true_type {};
+template < typename T >
+void set_kernel_arg(cl_kernel kernel, cl_uint index, const T& value) {
+    static_assert(!std::is_pointer< T >::value
+                  || CLKernelArgHandle< T >::value,
+                  "host pointers cannot be passed as kernel arguments");
+    static_assert(std::is_trivially_copyable< T >::value,
+                  "kernel arguments must be trivially copyable");
+    if(kernel_arg_changed(kernel, index, &value, sizeof(T))) {
+        check_cl_error(clSetKernelArg(kernel, index, sizeof(T), &value),
+                       "clSetKernelArg");
+    }
+}
+inline void set_kernel_arg(cl_kernel kernel, cl_uint index,
+                           const CLLocalMem& local) {
+    if(kernel_arg_changed(kernel, index, 0, local.size)) {
+        check_cl_error(clSetKernelArg(kernel, index, local.size, 0),
+                       "clSetKernelArg");
+    }
+}
+inline void set_kernel_args(cl_kernel, cl_uint) {}
+template < typename HeadT, typename... TailT >
+void set_kernel_args(cl_kernel kernel, cl_uint index,
+                     const HeadT& head, const TailT&... tail) {
+    set_kernel_arg(kernel, index, head);
+    set_kernel_args(kernel, index + 1, tail...);
+}
+template < typename... ArgsT >
+cl_event launch(cl_command_queue queue,
+                cl_kernel kernel,
+                const CLNDRange& global,
+                const CLNDRange& local,
+                const ArgsT&... args) {
+    set_kernel_args(kernel, 0, args...);
+    return enqueue_launch(queue, kernel, global, local);
+}
+template < typename T >
+struct CLIdentity {
+    typedef T type;
+};
+template < typename... ParamsT >
+cl_event launch(cl_command_queue queue,
+                const CLTypedKernel< ParamsT... >& kernel,
+                const CLNDRange& global,
+                const CLNDRange& local,
+                const typename CLIdentity< ParamsT >::type&... args) {
+    return launch(queue, kernel.kernel, global, local, args...);
+}
+
+//event timeline tracer: when tracing is enabled every command enqueued
+//through clutil (kernels, reads, writes, maps, migrations) is recorded with
+//its QUEUED, SUBMIT, START and END times together with host-side spans
+//(program builds, waits); the trace is written in Chrome trace_event JSON
+//format (load in chrome://tracing or https://ui.perfetto.dev).
+//Device timestamps are converted to the host clock through a per-queue
+//offset computed by enqueueing a marker the first time a queue is traced.
+//Queues must be created with profiling enabled, commands enqueued on queues
+//without profiling are recorded without timing information and skipped.
+//Tracing is enabled at startup by setting the CLUTIL_TRACE environment
+//variable to the output file path, the trace is written at exit.
+struct CLEventTimes { //nanoseconds, device clock
+    cl_ulong queued;
+    cl_ulong submit;
+    cl_ulong start;
+    cl_ulong end;
+};
+//all four profiling times of a completed event
+CLEventTimes get_event_times(cl_event ev);
+void start_tracing();
+void stop_tracing();
+bool tracing_enabled();
+//registers the queue and calibrates its clock offset; called before
+//enqueueing commands whose events are recorded, so that the calibration
+//marker does not stall the queue in the middle of a dispatch
+void trace_queue(cl_command_queue queue);
+//to be called before releasing a traced queue: records already collected
+//keep their lane, a queue later created with the same handle value is
+//registered and calibrated again
+void untrace_queue(cl_command_queue queue);
+//returns ev if tracing is enabled, NULL otherwise; to be passed as the
+//event argument of clEnqueue* functions whose event is not otherwise needed;
+//the queue clock offset is calibrated on the first call for each queue
+cl_event* trace_event_ptr(cl_command_queue queue, cl_event* ev);
+//records a command; the event is retained by the tracer, NULL events are
+//ignored
+void trace_command(cl_command_queue queue,
+                   cl_event ev,
+                   const std::string& category,
+                   const std::string& name);
+//records and releases event returned by trace_event_ptr
+void trace_command_and_release(cl_command_queue queue,
+                               cl_event ev,
+                               const std::string& category,
+                               const std::string& name);
+//host side span, e.g. time spent waiting for a queue
+void trace_host(const std::string& name,
+                std::chrono::steady_clock::time_point start,
+                std::chrono::steady_clock::time_point end);
+//reads the timing information of all the recorded events and releases
+//them: must be called before releasing the command queues and contexts,
+//invoked by release_clenv, release_multi_clenv and release_task_graph
+void collect_trace();
+void write_chrome_trace(const std::string& path);
+
+//local work size autotuner: candidate local sizes are timed on the device
+//and the fastest one is stored in a tuning database keyed on device name,
+//driver version, kernel name, build defines and global size; later runs
+//with the same key read the configuration from the database without
+//running the kernel. The database is a text file, path taken from the
+//CLUTIL_TUNE_DB environment variable, default: '.cltune'; set to empty to
+//disable persistence.
+struct CLLocalSize {
+    cl_uint dim;
+    size_t size[3];
+};
+//runs the kernel once with the given local size and returns the elapsed
+//time in milliseconds or a negative value if the candidate cannot be used
+//e.g. because the kernel built for it exceeds CL_KERNEL_WORK_GROUP_SIZE
+typedef std::function< double (const CLLocalSize&) > CLTuneRun;
+//power of two local sizes evenly dividing the global size, bounded by
+//CL_DEVICE_MAX_WORK_GROUP_SIZE, CL_DEVICE_MAX_WORK_ITEM_SIZES and, if
+//kernel is not NULL, CL_KERNEL_WORK_GROUP_SIZE; 'square' restricts the
+//candidates to equal sizes in all dimensions as required by tiled kernels
+std::vector< CLLocalSize > local_size_candidates(cl_device_id device,
+                                                 cl_kernel kernel,
+                                                 cl_uint dim,
+                                                 const size_t* global,
+                                                 bool square = false);
+//returns the tuned local size; each candidate is run 'warmup' times then
+//timed 'repeats' times, the median time is compared
+CLLocalSize autotune_local_size(cl_device_id device,
+                                const std::string& kernelName,
+                                const std::string& defines,
+                                cl_uint dim,
+                                const size_t* global,
+                                const std::vector< CLLocalSize >& candidates,
+                                const CLTuneRun& run,
+                                int warmup = 1,
+                                int repeats = 5);
+
+//kernel specialization: compile time parameters are collected into a
+//specification which generates the '#define' prefix of the program source;
+//parameters are sorted by name, equal parameter sets generate the same
+//prefix
+struct CLSpec {
+    std::map< std::string, std::string > defines; //empty value: flag only
+};
+//#define name value
+template < typename T >
+CLSpec& spec_set(CLSpec& s, const std::string& name, const T& value) {
+    static_assert(std::is_arithmetic< T >::value,
+                  "spec_set: numeric value required");
+    s.defines[name] = std::to_string(value);
+    return s;
+}
+CLSpec& spec_set(CLSpec& s, const std::string& name, const std::string& value);
+CLSpec& spec_set(CLSpec& s, const std::string& name, const char* value);
+//#define name if on is true, removed otherwise
+CLSpec& spec_flag(CLSpec& s, const std::string& name, bool on = true);
+//source prefix: one '#define' per line
+std::string spec_prefix(const CLSpec& s);
+//short description e.g. "DOUBLE VEC_WIDTH=4"
+std::string spec_label(const CLSpec& s);
+
+//program variants built concurrently on a pool of threads from the same
+//source with different specializations; each variant is built once and
+//cached in memory for the lifetime of the cache, built binaries are also
+//stored in the program cache (see build_program) and later runs do not
+//recompile
+struct CLThreadPool;
+struct CLVariantCache {
+    cl_context context;
+    std::vector< cl_device_id > devices;
+    std::string source;
+    std::string buildOptions;
+    //indexed by specialization prefix
+    std::map< std::string, std::shared_future< cl_program > > programs;
+    std::mutex mutex;
+    CLThreadPool* pool;
+};
+//numThreads = 0: one thread per hardware thread
+CLVariantCache* create_variant_cache(const CLEnv& e,
+                                     const char* clSourcePath,
+                                     const std::string& buildOptions =
+                                         std::string(),
+                                     int numThreads = 0);
+//waits for pending builds, releases programs
+void release_variant_cache(CLVariantCache* cache);
+//schedules the build of all the variants not yet built; does not block
+void build_variants(CLVariantCache& cache, const std::vector< CLSpec >& specs);
+//returns program for specialization, building it if not already scheduled;
+//waits for the build to complete; the program is owned by the cache
+cl_program get_variant(CLVariantCache& cache, const CLSpec& spec);
+//creates kernel from variant; kernel is owned by the caller
+cl_kernel create_variant_kernel(CLVariantCache& cache,
+                                const CLSpec& spec,
+                                const std::string& kernelName);
+
+//streaming pipeline for inputs larger than device memory: host arrays are
+//split into chunks of items processed by rotating two (double buffering)
+//or three (triple buffering) sets of device buffers; writes and reads are
+//enqueued on a transfer queue, kernels on a separate compute queue, so that
+//the transfer of chunk k + 1 overlaps the kernel running on chunk k.
+//Host arrays should be allocated from pinned memory (see CLPinnedArena)
+//for transfers to be asynchronous.
+struct CLStreamArray {
+    void* host; //address of first item
+    size_t itemBytes;
+    //items before and after each chunk also stored in the device buffer
+    //e.g. stencil halo; host memory must be valid for 'halo' items before
+    //the first and after the last item; inputs are transferred with halo,
+    //outputs are read back without halo
+    size_t halo;
+};
+struct CLStreamChunk {
+    size_t index;
+    size_t first; //first item
+    size_t count; //number of items
+    //one per array, item 'first' at offset 'halo' items
+    const cl_mem* inputs;
+    const cl_mem* outputs;
+};
+//enqueues the kernel(s) processing a chunk on the given queue after the
+//events in the wait list; returns the event of the last command enqueued
+typedef std::function< cl_event (cl_command_queue,
+                                 const CLStreamChunk&,
+                                 cl_uint,
+                                 const cl_event*) > CLStreamKernel;
+struct CLStream {
+    cl_command_queue transferQueue;
+    cl_command_queue computeQueue;
+    size_t totalItems;
+    size_t chunkItems;
+    std::vector< CLStreamArray > inputs;
+    std::vector< CLStreamArray > outputs;
+    //buffers[slot][array]
+    std::vector< std::vector< cl_mem > > inBuffers;
+    std::vector< std::vector< cl_mem > > outBuffers;
+};
+//chunk size in items: CLUTIL_STREAM_CHUNK environment variable (bytes) if
+//set, otherwise the largest size for which all the buffer sets fit into a
+//quarter of the device memory, with no buffer larger than
+//CL_DEVICE_MAX_MEM_ALLOC_SIZE; rounded down to a multiple of 'multiple'
+size_t stream_chunk_items(cl_device_id device,
+                          const std::vector< CLStreamArray >& inputs,
+                          const std::vector< CLStreamArray >& outputs,
+                          int depth = 2,
+                          size_t multiple = 1);
+//true if CLUTIL_STREAM_CHUNK is set or 'bytes' does not fit into a single
+//buffer on the device
+bool stream_required(cl_device_id device, size_t bytes);
+//depth = number of buffer sets
+CLStream create_stream(const CLEnv& e,
+                       const std::vector< CLStreamArray >& inputs,
+                       const std::vector< CLStreamArray >& outputs,
+                       size_t totalItems,
+                       size_t chunkItems,
+                       int depth = 2);
+void release_stream(CLStream& s);
+//processes all the chunks and waits for completion
+void run_stream(CLStream& s, const CLStreamKernel& kernel);
+
+//zero-copy buffers: on devices sharing memory with the host
+//(CL_DEVICE_HOST_UNIFIED_MEMORY, e.g. CPUs and integrated GPUs) buffers are
+//created on top of page-aligned host memory with CL_MEM_USE_HOST_PTR and
+//synchronized through map/unmap, no copy of the data is made; on other
+//devices, or if the host memory is not page-aligned, the data are copied
+//with CL_MEM_COPY_HOST_PTR and synchronized through read/write commands.
+//Allocate host arrays with CLAlignedAllocator to enable zero-copy.
+void* aligned_host_alloc(size_t size); //page aligned, exits on failure
+void aligned_host_free(void* p);
+template < typename T >
+struct CLAlignedAllocator {
+    typedef T value_type;
+    CLAlignedAllocator() {}
+    template < typename U >
+    CLAlignedAllocator(const CLAlignedAllocator< U >&) {}
+    T* allocate(size_t n) {
+        return static_cast< T* >(aligned_host_alloc(n * sizeof(T)));
+    }
+    void deallocate(T* p, size_t) { aligned_host_free(p); }
+};
+template < typename T, typename U >
+bool operator==(const CLAlignedAllocator< T >&,
+                const CLAlignedAllocator< U >&) {
+    return true;
+}
+template < typename T, typename U >
+bool operator!=(const CLAlignedAllocator< T >&,
+                const CLAlignedAllocator< U >&) {
+    return false;
+}
+template < typename T >
+using CLAlignedVector = std::vector< T, CLAlignedAllocator< T > >;
+bool host_unified_memory(cl_device_id device);
+struct CLHostBuffer {
+    cl_mem buffer;
+    void* host;
+    size_t size;
+    bool zeroCopy;
+};
+//flags: access flags only (CL_MEM_READ_ONLY...); host memory must remain
+//valid until the buffer is released; the content of write-only buffers is
+//not copied to the device
+CLHostBuffer create_host_buffer(const CLEnv& e,
+                                cl_mem_flags flags,
+                                void* host,
+                                size_t size);
+void release_host_buffer(CLHostBuffer& b);
+//makes the data written by the device visible in host memory; blocking
+void read_host_buffer(cl_command_queue queue, const CLHostBuffer& b);
+//makes the data written by the host visible to the device; blocking
+void write_host_buffer(cl_command_queue queue, const CLHostBuffer& b);
+
+#ifdef CL_VERSION_2_0
+//shared virtual memory (OpenCL 2.x): host and device share the same
+//virtual address space, pointers are passed to kernels directly through
+//clSetKernelArgSVMPointer instead of creating and copying buffers.
+//Coarse-grain SVM memory must be mapped before the host accesses it and
+//unmapped before the device does; fine-grain SVM memory, when supported,
+//can be accessed concurrently without mapping (map and unmap are still
+//valid but have no effect).
+//Available only with OpenCL 2.0 headers, defined in clutil_svm.cpp which
+//must be compiled together with clutil.cpp by the programs using SVM.
+//returns zero if SVM is not supported by the device
+cl_device_svm_capabilities svm_capabilities(cl_device_id device);
+//fine-grain buffers require CL_DEVICE_SVM_FINE_GRAIN_BUFFER support;
+//exits on failure
+void* svm_alloc(cl_context context,
+                size_t size,
+                bool fineGrain = false,
+                cl_svm_mem_flags flags = CL_MEM_READ_WRITE);
+void svm_free(cl_context context, void* p);
+//blocking map; flags = CL_MAP_READ | CL_MAP_WRITE
+//| CL_MAP_WRITE_INVALIDATE_REGION
+void svm_map(cl_command_queue queue, void* p, size_t size,
+             cl_map_flags flags);
+void svm_unmap(cl_command_queue queue, void* p);
+void set_kernel_arg_svm(cl_kernel kernel, cl_uint index, const void* p);
+template < typename T >
+struct CLSVMAllocator {
+    typedef T value_type;
+    cl_context context;
+    bool fineGrain;
+    CLSVMAllocator(cl_context c, bool fine = false)
+        : context(c), fineGrain(fine) {}
+    template < typename U >
+    CLSVMAllocator(const CLSVMAllocator< U >& a)
+        : context(a.context), fineGrain(a.fineGrain) {}
+    T* allocate(size_t n) {
+        return static_cast< T* >(svm_alloc(context, n * sizeof(T),
+                                           fineGrain));
+    }
+    void deallocate(T* p, size_t) { svm_free(context, p); }
+};
+template < typename T, typename U >
+bool operator==(const CLSVMAllocator< T >& a, const CLSVMAllocator< U >& b) {
+    return a.context == b.context && a.fineGrain == b.fineGrain;
+}
+template < typename T, typename U >
+bool operator!=(const CLSVMAllocator< T >& a, const CLSVMAllocator< U >& b) {
+    return !(a == b);
+}
+//coarse-grain vectors must be mapped before being constructed or accessed
+//on the host: construct them with reserve() and fill them inside a map/unmap
+//pair, or use fine-grain memory
+template < typename T >
+using CLSVMVector = std::vector< T, CLSVMAllocator< T > >;
+#endif
+
+//thread-safe submission: each submitting thread gets its own command queue
+//and its own kernels, created lazily on first use from the context and
+//program of an existing CLEnv and afterwards returned through a thread
+//local lookup with no locking. Kernels are per-thread because
+//clSetKernelArg is not thread safe; separate queues let threads submit
+//concurrently instead of serializing on a single queue.
+//Threads synchronize through events: thread_marker returns an event which
+//completes when all the commands submitted so far by the calling thread
+//have completed, thread_wait makes the commands subsequently submitted by
+//the calling thread wait for a list of events.
+struct CLThreadState {
+    cl_command_queue queue;
+    CLKernelMap kernels;
+};
+struct CLThreadEnv {
+    cl_context context;
+    cl_device_id device;
+    cl_program program; //owned by the CLEnv, may be NULL
+    cl_command_queue_properties properties;
+    unsigned id; //key of the thread local lookup, never reused
+    std::mutex mutex;
+    std::map< std::thread::id, CLThreadState* > threads;
+};
+//the CLEnv must outlive the returned environment
+CLThreadEnv* create_thread_env(const CLEnv& e, bool enableProfiling = false);
+//finishes and releases all the per-thread queues and kernels: no thread
+//may be submitting when invoked
+void release_thread_env(CLThreadEnv* te);
+cl_command_queue thread_queue(CLThreadEnv& te);
+cl_kernel thread_kernel(CLThreadEnv& te, const std::string& kernelName);
+//event owned by the caller
+cl_event thread_marker(CLThreadEnv& te);
+void thread_wait(CLThreadEnv& te, const std::vector< cl_event >& events);
+//number of queues created so far
+size_t thread_queue_count(CLThreadEnv& te);
+//waits for the commands submitted from all threads
+void finish_thread_queues(CLThreadEnv& te);
+
+//recorded command sequences: a sequence of kernel launches is recorded once
+//and replayed with a single call. With cl_khr_command_buffer the sequence
+//is recorded into command buffers, finalized by the driver and replayed
+//with one clEnqueueCommandBufferKHR per iteration; otherwise replay is a
+//tight loop of clEnqueueNDRangeKernel calls on pre-bound kernels.
+//Ping-pong arguments alternate between two buffers at each iteration,
+//arguments are otherwise captured at finalization time and must not be
+//changed before the recording is released. Host transfers cannot be
+//recorded: enqueue them on the same queue between replays.
+struct CLRecordedSwap {
+    cl_uint index;
+    cl_mem buffers[2]; //even, odd iterations
+};
+struct CLRecordedKernel {
+    cl_kernel kernel;
+    CLNDRange global;
+    CLNDRange local;
+    std::vector< CLRecordedSwap > swaps;
+};
+struct CLRecording {
+    cl_command_queue queue;
+    std::vector< CLRecordedKernel > commands;
+    //cl_command_buffer_khr, one per phase; empty when replaying through the
+    //fallback loop
+    std::vector< void* > commandBuffers;
+    int phases; //2 if any ping-pong argument was recorded, 1 otherwise
+    int phase; //phase of the next replayed iteration
+};
+CLRecording create_recording(cl_command_queue queue);
+void record_kernel(CLRecording& r,
+                   cl_kernel kernel,
+                   const CLNDRange& global,
+                   const CLNDRange& local = CLNDRange());
+//argument 'index' of the last recorded kernel is set to 'even' on even
+//iterations and to 'odd' on odd iterations
+void record_ping_pong(CLRecording& r, cl_uint index, cl_mem even, cl_mem odd);
+//true if the device supports cl_khr_command_buffer
+bool command_buffer_supported(cl_command_queue queue);
+//completes the recording; command buffers are used if supported and
+//requested, the fallback loop is used if their creation fails
+void finalize_recording(CLRecording& r, bool useCommandBuffer = true);
+//enqueues 'iterations' iterations of the recorded sequence, continuing the
+//ping-pong sequence from the previous replay; does not block
+void replay_recording(CLRecording& r, int iterations = 1);
+void release_recording(CLRecording& r);
+
+//host matrix multiply C = A x B, A: M x K, B: K x N, C: M x N, row major;
+//lda, ldb, ldc: distance in elements between consecutive rows, only the
+//M x N elements of C are written. Cache-blocked: panels of A and B are
+//packed into contiguous buffers and multiplied by SIMD micro-kernels
+//(GCC/Clang vector extensions, scalar code with other compilers); blocks of
+//rows of C are computed in parallel on 'threads' threads, 0 = one per
+//hardware thread. Used to validate device results and as native CPU
+//baseline
+void host_gemm(int M, int N, int K,
+               const float* A, int lda,
+               const float* B, int ldb,
+               float* C, int ldc,
+               int threads = 0);
+void host_gemm(int M, int N, int K,
+               const double* A, int lda,
+               const double* B, int ldb,
+               double* C, int ldc,
+               int threads = 0);
+
+//half precision storage: conversion between float and IEEE 754 binary16
+//(cl_half) with round to nearest even, as vstore_half_rte; finite values
+//above the half range become infinity. Kernels load half data with
+//vload_half / vload_halfn and compute in float. Conversion loses at most
+//HALF_UNIT_ROUNDOFF relative precision per value for normal numbers.
+const double HALF_UNIT_ROUNDOFF = 1.0 / 2048; //unit roundoff 2^-11
+const double FLOAT_UNIT_ROUNDOFF = 1.0 / 16777216; //unit roundoff 2^-24
+cl_half float_to_half(float f);
+float half_to_float(cl_half h);
+void float_to_half(const float* in, size_t n, cl_half* out);
+void half_to_float(const cl_half* in, size_t n, float* out);
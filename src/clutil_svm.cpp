@@ -0,0 +1,62 @@
+//OpenCL utility functions: shared virtual memory (OpenCL 2.x), in a separate
+//translation unit so that programs not using SVM do not require an OpenCL
+//2.0 library to link; see clutil.h
+//Author: Ugo Varetto
+#include <iostream>
+#include <cstdlib>
+#include "clutil.h"
+
+//------------------------------------------------------------------------------
+cl_device_svm_capabilities svm_capabilities(cl_device_id device) {
+    cl_device_svm_capabilities caps = 0;
+    //OpenCL 1.x devices report an invalid value error
+    if(clGetDeviceInfo(device, CL_DEVICE_SVM_CAPABILITIES,
+                       sizeof(caps), &caps, 0) != CL_SUCCESS) return 0;
+    return caps;
+}
+
+//------------------------------------------------------------------------------
+void* svm_alloc(cl_context context,
+                size_t size,
+                bool fineGrain,
+                cl_svm_mem_flags flags) {
+    if(fineGrain) flags |= CL_MEM_SVM_FINE_GRAIN_BUFFER;
+    void* p = clSVMAlloc(context, flags, size, 0);
+    if(!p) {
+        std::cerr << "ERROR - clSVMAlloc: cannot allocate " << size
+                  << (fineGrain ? " bytes of fine-grain" : " bytes of")
+                  << " shared virtual memory" << std::endl;
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+//------------------------------------------------------------------------------
+void svm_free(cl_context context, void* p) {
+    clSVMFree(context, p);
+}
+
+//------------------------------------------------------------------------------
+void svm_map(cl_command_queue queue, void* p, size_t size,
+             cl_map_flags flags) {
+    cl_event ev;
+    check_cl_error(clEnqueueSVMMap(queue, CL_TRUE, flags, p, size, 0, 0,
+                                   trace_event_ptr(queue, &ev)),
+                   "clEnqueueSVMMap");
+    trace_command_and_release(queue, ev, "map", "svm");
+}
+
+//------------------------------------------------------------------------------
+void svm_unmap(cl_command_queue queue, void* p) {
+    cl_event ev;
+    check_cl_error(clEnqueueSVMUnmap(queue, p, 0, 0,
+                                     trace_event_ptr(queue, &ev)),
+                   "clEnqueueSVMUnmap");
+    trace_command_and_release(queue, ev, "unmap", "svm");
+}
+
+//------------------------------------------------------------------------------
+void set_kernel_arg_svm(cl_kernel kernel, cl_uint index, const void* p) {
+    check_cl_error(clSetKernelArgSVMPointer(kernel, index, p),
+                   "clSetKernelArgSVMPointer");
+}
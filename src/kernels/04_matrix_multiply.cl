@@ -1,6 +1,7 @@
-//Matrix - matrix multiply: trivial and block version; #defines
+//Matrix - matrix multiply: trivial, block and register tiled version; #defines
 //have to be set from the driver program for this code to compile;
-//only square matrices supported
+//only square matrices supported except for gemm which supports any shape and
+//leading dimensions; gemm_epilogue adds fused scaling, bias and activation
 //Author: Ugo Varetto
 
 //BLOCK_SIZE and DOUBLE are defined from outside the kernel
@@ -15,8 +16,22 @@
 #ifdef DOUBLE
 #pragma OPENCL EXTENSION cl_khr_fp64: enable
 typedef double real_t;
+typedef double4 real4_t;
 #else
 typedef float real_t;
+typedef float4 real4_t;
+#endif
+
+//register tiling parameters, see tiled_matmul; can be overridden from the
+//driver program
+#ifndef TM
+#define TM 4
+#endif
+#ifndef TN
+#define TN 4
+#endif
+#ifndef TK
+#define TK 16
 #endif
 
 
@@ -63,8 +78,10 @@ __kernel void block_matmul(__global const real_t* A,
 
     const int row = get_local_id(1);
     const int col = get_local_id(0);
-    const int blockRow = get_group_id(1);
-    const int blockCol = get_group_id(0);
+    //block coordinates computed from global ids and not through get_group_id
+    //to support launches with a global offset
+    const int blockRow = get_global_id(1) / BLOCK_SIZE;
+    const int blockCol = get_global_id(0) / BLOCK_SIZE;
 	__local real_t a[BLOCK_SIZE][BLOCK_SIZE];
 	__local real_t b[BLOCK_SIZE][BLOCK_SIZE]; 
     real_t out = 0;
@@ -93,3 +110,363 @@ __kernel void block_matmul(__global const real_t* A,
        + blockCol * BLOCK_SIZE + col ] = out;     
 }
 
+//------------------------------------------------------------------------------
+//register tiled matrix multiply: each work item computes a TM x TN tile of
+//the output held in registers, each workgroup of BLOCK_SIZE x BLOCK_SIZE
+//work items computes a (BLOCK_SIZE * TM) x (BLOCK_SIZE * TN) tile; tiles of
+//A and B TK deep are loaded into local memory with 4-wide vector loads and
+//the loop over the tile depth is unrolled.
+//Launch with 2d grid = [size / TN, size / TM], workgroup size must be
+//exactly BLOCK_SIZE x BLOCK_SIZE; size must be evenly divisible by
+//BLOCK_SIZE * TM, BLOCK_SIZE * TN and TK; TK, BLOCK_SIZE * TM and
+//BLOCK_SIZE * TN must be multiples of 4
+#define TILE_ROWS (BLOCK_SIZE * TM)
+#define TILE_COLUMNS (BLOCK_SIZE * TN)
+__kernel void tiled_matmul(__global const real_t* A,
+                           __global const real_t* B,
+                           __global real_t* C,
+                           int columns) {
+    const int tx = get_local_id(0);
+    const int ty = get_local_id(1);
+    const int tid = ty * BLOCK_SIZE + tx;
+    //output tile coordinates computed from global ids and not through
+    //get_group_id to support launches with a global offset
+    const int rowBase = (get_global_id(1) / BLOCK_SIZE) * TILE_ROWS;
+    const int colBase = (get_global_id(0) / BLOCK_SIZE) * TILE_COLUMNS;
+    //A tile is stored transposed: both tiles are read along rows in the
+    //inner loop
+    __local real_t a[TK][TILE_ROWS];
+    __local real_t b[TK][TILE_COLUMNS];
+    real_t acc[TM][TN];
+    for(int m = 0; m != TM; ++m) {
+        for(int n = 0; n != TN; ++n) acc[m][n] = 0;
+    }
+    for(int k0 = 0; k0 < columns; k0 += TK) {
+        //TILE_ROWS x TK elements of A, four consecutive columns per load
+        for(int i = tid; i < TILE_ROWS * TK / 4;
+            i += BLOCK_SIZE * BLOCK_SIZE) {
+            const int m = i / (TK / 4);
+            const int k = (i % (TK / 4)) * 4;
+            const real4_t v = vload4(0, A + (rowBase + m) * columns + k0 + k);
+            a[k][m] = v.x;
+            a[k + 1][m] = v.y;
+            a[k + 2][m] = v.z;
+            a[k + 3][m] = v.w;
+        }
+        //TK x TILE_COLUMNS elements of B
+        for(int i = tid; i < TK * TILE_COLUMNS / 4;
+            i += BLOCK_SIZE * BLOCK_SIZE) {
+            const int k = i / (TILE_COLUMNS / 4);
+            const int n = (i % (TILE_COLUMNS / 4)) * 4;
+            vstore4(vload4(0, B + (k0 + k) * columns + colBase + n),
+                    0, &b[k][n]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        //work item elements are strided by BLOCK_SIZE: adjacent work items
+        //access adjacent local memory locations
+#pragma unroll
+        for(int k = 0; k != TK; ++k) {
+            real_t ra[TM];
+            real_t rb[TN];
+            for(int m = 0; m != TM; ++m) ra[m] = a[k][ty + m * BLOCK_SIZE];
+            for(int n = 0; n != TN; ++n) rb[n] = b[k][tx + n * BLOCK_SIZE];
+            for(int m = 0; m != TM; ++m) {
+                for(int n = 0; n != TN; ++n) acc[m][n] += ra[m] * rb[n];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    for(int m = 0; m != TM; ++m) {
+        for(int n = 0; n != TN; ++n) {
+            C[(rowBase + ty + m * BLOCK_SIZE) * columns
+              + colBase + tx + n * BLOCK_SIZE] = acc[m][n];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//general matrix multiply: C = A x B, A: M x K, B: K x N, C: M x N, row
+//major; lda, ldb and ldc are the distances in elements between consecutive
+//rows (>= number of columns) and allow operating in place on submatrices of
+//larger matrices. No restriction on sizes: elements of edge tiles out of
+//range are read as zero and not written, no padding is required.
+//Register tiled as tiled_matmul, with scalar loads since rows are not
+//necessarily aligned.
+//Launch with 2d grid = [ceil(N / TN), ceil(M / TM)] rounded up to a multiple
+//of BLOCK_SIZE, workgroup size must be exactly BLOCK_SIZE x BLOCK_SIZE
+
+//accumulates into acc the TM x TN output elements of the work item,
+//a and b: local memory tiles of the workgroup
+void gemm_accumulate(__global const real_t* A,
+                     __global const real_t* B,
+                     int M,
+                     int N,
+                     int K,
+                     int lda,
+                     int ldb,
+                     __local real_t (*a)[TILE_ROWS],
+                     __local real_t (*b)[TILE_COLUMNS],
+                     real_t (*acc)[TN]) {
+    const int tx = get_local_id(0);
+    const int ty = get_local_id(1);
+    const int tid = ty * BLOCK_SIZE + tx;
+    const int rowBase = (get_global_id(1) / BLOCK_SIZE) * TILE_ROWS;
+    const int colBase = (get_global_id(0) / BLOCK_SIZE) * TILE_COLUMNS;
+    for(int m = 0; m != TM; ++m) {
+        for(int n = 0; n != TN; ++n) acc[m][n] = 0;
+    }
+    for(int k0 = 0; k0 < K; k0 += TK) {
+        for(int i = tid; i < TILE_ROWS * TK; i += BLOCK_SIZE * BLOCK_SIZE) {
+            const int m = i / TK;
+            const int k = i % TK;
+            const int r = rowBase + m;
+            const int c = k0 + k;
+            a[k][m] = r < M && c < K ? A[r * lda + c] : 0;
+        }
+        for(int i = tid; i < TK * TILE_COLUMNS; i += BLOCK_SIZE * BLOCK_SIZE) {
+            const int k = i / TILE_COLUMNS;
+            const int n = i % TILE_COLUMNS;
+            const int r = k0 + k;
+            const int c = colBase + n;
+            b[k][n] = r < K && c < N ? B[r * ldb + c] : 0;
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+#pragma unroll
+        for(int k = 0; k != TK; ++k) {
+            real_t ra[TM];
+            real_t rb[TN];
+            for(int m = 0; m != TM; ++m) ra[m] = a[k][ty + m * BLOCK_SIZE];
+            for(int n = 0; n != TN; ++n) rb[n] = b[k][tx + n * BLOCK_SIZE];
+            for(int m = 0; m != TM; ++m) {
+                for(int n = 0; n != TN; ++n) acc[m][n] += ra[m] * rb[n];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+__kernel void gemm(__global const real_t* A,
+                   __global const real_t* B,
+                   __global real_t* C,
+                   int M,
+                   int N,
+                   int K,
+                   int lda,
+                   int ldb,
+                   int ldc) {
+    __local real_t a[TK][TILE_ROWS];
+    __local real_t b[TK][TILE_COLUMNS];
+    real_t acc[TM][TN];
+    gemm_accumulate(A, B, M, N, K, lda, ldb, a, b, acc);
+    const int rowBase = (get_global_id(1) / BLOCK_SIZE) * TILE_ROWS
+                        + get_local_id(1);
+    const int colBase = (get_global_id(0) / BLOCK_SIZE) * TILE_COLUMNS
+                        + get_local_id(0);
+    for(int m = 0; m != TM; ++m) {
+        const int r = rowBase + m * BLOCK_SIZE;
+        for(int n = 0; n != TN; ++n) {
+            const int c = colBase + n * BLOCK_SIZE;
+            if(r < M && c < N) C[r * ldc + c] = acc[m][n];
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//epilogue: C = act(alpha x A x B + beta x C + bias), each term is compiled in
+//only when enabled from the driver program through EPILOGUE_ALPHA,
+//EPILOGUE_BETA and EPILOGUE_BIAS; EPILOGUE_ACTIVATION selects the activation
+//function: 0 (or undefined) = none, 1 = relu, 2 = sigmoid, 3 = tanh.
+//With nothing defined gemm_epilogue is equivalent to gemm: the unused
+//arguments are never read
+#ifndef EPILOGUE_ACTIVATION
+#define EPILOGUE_ACTIVATION 0
+#endif
+real_t activation(real_t x) {
+#if EPILOGUE_ACTIVATION == 1
+    return fmax(x, (real_t)0);
+#elif EPILOGUE_ACTIVATION == 2
+    return 1 / (1 + exp(-x));
+#elif EPILOGUE_ACTIVATION == 3
+    return tanh(x);
+#else
+    return x;
+#endif
+}
+
+//------------------------------------------------------------------------------
+//gemm with fused epilogue: the epilogue is applied to the accumulators
+//before the single store of C, C is read only if EPILOGUE_BETA is defined;
+//bias: N elements, bias[j] is added to column j. Same grid as gemm
+__kernel void gemm_epilogue(__global const real_t* A,
+                            __global const real_t* B,
+                            __global real_t* C,
+                            int M,
+                            int N,
+                            int K,
+                            int lda,
+                            int ldb,
+                            int ldc,
+                            real_t alpha,
+                            real_t beta,
+                            __global const real_t* bias) {
+    __local real_t a[TK][TILE_ROWS];
+    __local real_t b[TK][TILE_COLUMNS];
+    real_t acc[TM][TN];
+    gemm_accumulate(A, B, M, N, K, lda, ldb, a, b, acc);
+    const int rowBase = (get_global_id(1) / BLOCK_SIZE) * TILE_ROWS
+                        + get_local_id(1);
+    const int colBase = (get_global_id(0) / BLOCK_SIZE) * TILE_COLUMNS
+                        + get_local_id(0);
+    for(int m = 0; m != TM; ++m) {
+        const int r = rowBase + m * BLOCK_SIZE;
+        for(int n = 0; n != TN; ++n) {
+            const int c = colBase + n * BLOCK_SIZE;
+            if(r >= M || c >= N) continue;
+            real_t e = acc[m][n];
+#ifdef EPILOGUE_ALPHA
+            e *= alpha;
+#endif
+#ifdef EPILOGUE_BETA
+            e += beta * C[r * ldc + c];
+#endif
+#ifdef EPILOGUE_BIAS
+            e += bias[c];
+#endif
+            C[r * ldc + c] = activation(e);
+        }
+    }
+}
+
+//------------------------------------------------------------------------------
+//unfused epilogue, one pass over C per term, for comparison with
+//gemm_epilogue; launch with 2d grid = [N, M]
+
+//Y = alpha x X + beta x Y, Y is read only if EPILOGUE_BETA is defined;
+//X and Y can be the same buffer
+__kernel void epilogue_axpby(__global const real_t* X,
+                             __global real_t* Y,
+                             int M,
+                             int N,
+                             int ldx,
+                             int ldy,
+                             real_t alpha,
+                             real_t beta) {
+    const int c = get_global_id(0);
+    const int r = get_global_id(1);
+    if(r >= M || c >= N) return;
+    real_t e = X[r * ldx + c];
+#ifdef EPILOGUE_ALPHA
+    e *= alpha;
+#endif
+#ifdef EPILOGUE_BETA
+    e += beta * Y[r * ldy + c];
+#endif
+    Y[r * ldy + c] = e;
+}
+
+//C = C + bias, bias[j] added to column j
+__kernel void epilogue_bias(__global real_t* C,
+                            int M,
+                            int N,
+                            int ldc,
+                            __global const real_t* bias) {
+    const int c = get_global_id(0);
+    const int r = get_global_id(1);
+    if(r >= M || c >= N) return;
+    C[r * ldc + c] += bias[c];
+}
+
+//C = act(C)
+__kernel void epilogue_activation(__global real_t* C,
+                                  int M,
+                                  int N,
+                                  int ldc) {
+    const int c = get_global_id(0);
+    const int r = get_global_id(1);
+    if(r >= M || c >= N) return;
+    C[r * ldc + c] = activation(C[r * ldc + c]);
+}
+
+//------------------------------------------------------------------------------
+//gemm with half precision storage: A and B are stored as half and converted
+//to float on load, products are accumulated and C is stored in float
+//independently of DOUBLE; half the memory traffic and footprint of float
+//inputs. Full groups of four elements are read with vload_half4 (any
+//alignment), edge elements with vload_half.
+//TK and BLOCK_SIZE x TN must be multiples of 4; same grid as gemm
+__kernel void gemm_half(__global const half* A,
+                        __global const half* B,
+                        __global float* C,
+                        int M,
+                        int N,
+                        int K,
+                        int lda,
+                        int ldb,
+                        int ldc) {
+    const int tx = get_local_id(0);
+    const int ty = get_local_id(1);
+    const int tid = ty * BLOCK_SIZE + tx;
+    const int rowBase = (get_global_id(1) / BLOCK_SIZE) * TILE_ROWS;
+    const int colBase = (get_global_id(0) / BLOCK_SIZE) * TILE_COLUMNS;
+    __local float a[TK][TILE_ROWS];
+    __local float b[TK][TILE_COLUMNS];
+    float acc[TM][TN];
+    for(int m = 0; m != TM; ++m) {
+        for(int n = 0; n != TN; ++n) acc[m][n] = 0;
+    }
+    for(int k0 = 0; k0 < K; k0 += TK) {
+        for(int i = tid; i < TILE_ROWS * TK / 4; i += BLOCK_SIZE * BLOCK_SIZE) {
+            const int m = i / (TK / 4);
+            const int k = (i % (TK / 4)) * 4;
+            const int r = rowBase + m;
+            const int c = k0 + k;
+            float4 v = (float4)(0);
+            if(r < M && c + 3 < K) {
+                v = vload_half4(0, A + r * lda + c);
+            } else if(r < M) {
+                v.x = c < K ? vload_half(r * lda + c, A) : 0;
+                v.y = c + 1 < K ? vload_half(r * lda + c + 1, A) : 0;
+                v.z = c + 2 < K ? vload_half(r * lda + c + 2, A) : 0;
+            }
+            a[k][m] = v.x;
+            a[k + 1][m] = v.y;
+            a[k + 2][m] = v.z;
+            a[k + 3][m] = v.w;
+        }
+        for(int i = tid; i < TK * TILE_COLUMNS / 4;
+            i += BLOCK_SIZE * BLOCK_SIZE) {
+            const int k = i / (TILE_COLUMNS / 4);
+            const int n = (i % (TILE_COLUMNS / 4)) * 4;
+            const int r = k0 + k;
+            const int c = colBase + n;
+            float4 v = (float4)(0);
+            if(r < K && c + 3 < N) {
+                v = vload_half4(0, B + r * ldb + c);
+            } else if(r < K) {
+                v.x = c < N ? vload_half(r * ldb + c, B) : 0;
+                v.y = c + 1 < N ? vload_half(r * ldb + c + 1, B) : 0;
+                v.z = c + 2 < N ? vload_half(r * ldb + c + 2, B) : 0;
+            }
+            vstore4(v, 0, &b[k][n]);
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+#pragma unroll
+        for(int k = 0; k != TK; ++k) {
+            float ra[TM];
+            float rb[TN];
+            for(int m = 0; m != TM; ++m) ra[m] = a[k][ty + m * BLOCK_SIZE];
+            for(int n = 0; n != TN; ++n) rb[n] = b[k][tx + n * BLOCK_SIZE];
+            for(int m = 0; m != TM; ++m) {
+                for(int n = 0; n != TN; ++n) acc[m][n] += ra[m] * rb[n];
+            }
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    for(int m = 0; m != TM; ++m) {
+        const int r = rowBase + ty + m * BLOCK_SIZE;
+        for(int n = 0; n != TN; ++n) {
+            const int c = colBase + tx + n * BLOCK_SIZE;
+            if(r < M && c < N) C[r * ldc + c] = acc[m][n];
+        }
+    }
+}
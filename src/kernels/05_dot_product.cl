@@ -45,6 +45,8 @@ __kernel void dotprod(__global const real_t* v1,
     	step /= 2;
     }
     //local work item 0 takes care of copying the data into
-    //the output buffer at position equal to this workgroup id
-    if(cache_idx == 0) reduced[get_group_id(0)] = cache[0];
+    //the output buffer at position equal to this workgroup id;
+    //the id is computed from the global id and not through get_group_id
+    //to support launches with a global offset
+    if(cache_idx == 0) reduced[id / BLOCK_SIZE] = cache[0];
 }
\ No newline at end of file
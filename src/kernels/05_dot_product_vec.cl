@@ -92,6 +92,49 @@ __kernel void dotprod(__global const vec_real_t* v1,
     	step /= 2;
     }
     //local work item 0 takes care of copying the data into
-    //the output buffer at position equal to this workgroup id
-    if(cache_idx == 0) reduced[get_group_id(0)] = cache[0];
-}
\ No newline at end of file
+    //the output buffer at position equal to this workgroup id;
+    //the id is computed from the global id and not through get_group_id
+    //to support launches with a global offset
+    if(cache_idx == 0) reduced[id / BLOCK_SIZE] = cache[0];
+}
+
+//------------------------------------------------------------------------------
+//half precision storage: VEC_WIDTH elements are loaded with vload_halfn and
+//converted to float, products are accumulated in float independently of
+//DOUBLE; half the memory traffic of float inputs
+#if VEC_WIDTH == 1
+typedef float vec_float_t;
+#define VLOAD_HALF vload_half
+#elif VEC_WIDTH == 4
+typedef float4 vec_float_t;
+#define VLOAD_HALF vload_half4
+#elif VEC_WIDTH == 8
+typedef float8 vec_float_t;
+#define VLOAD_HALF vload_half8
+#elif VEC_WIDTH == 16
+typedef float16 vec_float_t;
+#define VLOAD_HALF vload_half16
+#endif
+
+__kernel void dotprod_half(__global const half* v1,
+                           __global const half* v2,
+                           __global float* reduced) {
+
+    __local float cache[BLOCK_SIZE];
+
+    const int cache_idx = get_local_id(0);
+    const int id = get_global_id(0);
+    const vec_float_t r = VLOAD_HALF(id, v1) * VLOAD_HALF(id, v2);
+    cache[cache_idx] = VEC_SUM(r);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    //same reduction as dotprod
+    int step = BLOCK_SIZE / 2;
+    while(step > 0) {
+        if(cache_idx < step) {
+            cache[cache_idx] += cache[cache_idx + step];
+        }
+        barrier(CLK_LOCAL_MEM_FENCE);
+        step /= 2;
+    }
+    if(cache_idx == 0) reduced[id / BLOCK_SIZE] = cache[0];
+}
@@ -0,0 +1,123 @@
+//Batched matrix multiply of small matrices: C[i] = A[i] x B[i], all the
+//matrices of the batch are multiplied by a single kernel launch.
+//Author: Ugo Varetto
+
+//A[i]: MAT_M x MAT_K, B[i]: MAT_K x MAT_N, C[i]: MAT_M x MAT_N, row major,
+//each matrix stored contiguously. MATS_PER_GROUP matrices are assigned to
+//each workgroup, both operands of each matrix are kept in local memory:
+//local memory size must be at least
+//MATS_PER_GROUP x (MAT_M x MAT_K + MAT_K x MAT_N) x sizeof(real_t).
+//MATS_PER_GROUP = 0: the operands of one product do not fit into local
+//memory, one matrix is assigned to each workgroup and operands are read
+//directly from global memory.
+//MAT_M, MAT_N, MAT_K, MATS_PER_GROUP and DOUBLE are defined from outside
+//the kernel by prefixing the source code with "#define" statements from
+//within the driver program; any workgroup size is supported.
+//Launch with 1d grid = ceil(count / max(MATS_PER_GROUP, 1)) x workgroup size
+#ifdef DOUBLE
+#pragma OPENCL EXTENSION cl_khr_fp64: enable
+typedef double real_t;
+#else
+typedef float real_t;
+#endif
+
+#define A_SIZE (MAT_M * MAT_K)
+#define B_SIZE (MAT_K * MAT_N)
+#define C_SIZE (MAT_M * MAT_N)
+
+#if MATS_PER_GROUP > 0
+#define LOCAL_OPERANDS
+#define GROUP_MATRICES MATS_PER_GROUP
+#define LOCAL_A_SIZE (MATS_PER_GROUP * A_SIZE)
+#define LOCAL_B_SIZE (MATS_PER_GROUP * B_SIZE)
+#else
+#define GROUP_MATRICES 1
+#define LOCAL_A_SIZE 1
+#define LOCAL_B_SIZE 1
+#endif
+
+//------------------------------------------------------------------------------
+//multiplies the 'matrices' matrices assigned to the workgroup; element
+//offsets of the i-th A, B and C are stored in offsets[3 * i], [3 * i + 1],
+//[3 * i + 2]; a and b are not used if LOCAL_OPERANDS is not defined
+void multiply_group(__global const real_t* A,
+                    __global const real_t* B,
+                    __global real_t* C,
+                    __local const int* offsets,
+                    int matrices,
+                    __local real_t* a,
+                    __local real_t* b) {
+    const int lid = get_local_id(0);
+    const int groupSize = get_local_size(0);
+#ifdef LOCAL_OPERANDS
+    for(int i = lid; i < matrices * A_SIZE; i += groupSize) {
+        a[i] = A[offsets[3 * (i / A_SIZE)] + i % A_SIZE];
+    }
+    for(int i = lid; i < matrices * B_SIZE; i += groupSize) {
+        b[i] = B[offsets[3 * (i / B_SIZE) + 1] + i % B_SIZE];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+#endif
+    for(int i = lid; i < matrices * C_SIZE; i += groupSize) {
+        const int m = i / C_SIZE;
+        const int e = i % C_SIZE;
+#ifdef LOCAL_OPERANDS
+        __local const real_t* ra = a + m * A_SIZE + (e / MAT_N) * MAT_K;
+        __local const real_t* cb = b + m * B_SIZE + e % MAT_N;
+#else
+        __global const real_t* ra = A + offsets[3 * m] + (e / MAT_N) * MAT_K;
+        __global const real_t* cb = B + offsets[3 * m + 1] + e % MAT_N;
+#endif
+        real_t c = 0;
+#pragma unroll
+        for(int k = 0; k != MAT_K; ++k) c += ra[k] * cb[k * MAT_N];
+        C[offsets[3 * m + 2] + e] = c;
+    }
+}
+
+//------------------------------------------------------------------------------
+//strided batch: i-th matrices start at i x strideA, i x strideB,
+//i x strideC
+__kernel void batched_gemm(__global const real_t* A,
+                           __global const real_t* B,
+                           __global real_t* C,
+                           int count,
+                           int strideA,
+                           int strideB,
+                           int strideC) {
+    __local real_t a[LOCAL_A_SIZE];
+    __local real_t b[LOCAL_B_SIZE];
+    __local int offsets[3 * GROUP_MATRICES];
+    const int first = get_group_id(0) * GROUP_MATRICES;
+    for(int i = get_local_id(0); i < GROUP_MATRICES;
+        i += get_local_size(0)) {
+        offsets[3 * i] = (first + i) * strideA;
+        offsets[3 * i + 1] = (first + i) * strideB;
+        offsets[3 * i + 2] = (first + i) * strideC;
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    multiply_group(A, B, C, offsets, min(GROUP_MATRICES, count - first),
+                   a, b);
+}
+
+//------------------------------------------------------------------------------
+//indexed batch, equivalent of an array of pointers: element offsets of the
+//i-th matrices are read from offsets[3 * i] (A), [3 * i + 1] (B) and
+//[3 * i + 2] (C); matrices can be stored anywhere in the buffers and the
+//same operand can be shared by multiple products
+__kernel void batched_gemm_indexed(__global const real_t* A,
+                                   __global const real_t* B,
+                                   __global real_t* C,
+                                   int count,
+                                   __global const int* offsets) {
+    __local real_t a[LOCAL_A_SIZE];
+    __local real_t b[LOCAL_B_SIZE];
+    __local int groupOffsets[3 * GROUP_MATRICES];
+    const int first = get_group_id(0) * GROUP_MATRICES;
+    const int matrices = min(GROUP_MATRICES, count - first);
+    for(int i = get_local_id(0); i < 3 * matrices; i += get_local_size(0)) {
+        groupOffsets[i] = offsets[3 * first + i];
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+    multiply_group(A, B, C, groupOffsets, matrices, a, b);
+}
@@ -1,29 +1,48 @@
 #!/bin/bash
-PLATFORM=$1
+#platform name or auto | auto:bandwidth | auto:compute: the fastest device
+#is selected by probes cached in .cldevices; default: auto
+PLATFORM=${1:-auto}
 DIR=.
 RUN=aprun
 CLSRC=../src/kernels
 
 echo $'\n=== 01_device_query ==='
 $RUN $DIR/01_device_query
+#02 and 03 do not use clutil: a platform name is required
+if [ "${PLATFORM%%:*}" != auto ]; then
 echo $'\n=== 02_create_context ==='
 $RUN $DIR/02_create_context "$PLATFORM" default 0
 echo $'\n=== 03_kernel_load_and_exec ==='
 $RUN $DIR/03_kernel_load_and_exec "$PLATFORM" default 0 $CLSRC/03_kernel.cl arrayset
+fi
 echo $'\n=== 04_matrix_multiply ==='
 $RUN $DIR/04_matrix_multiply "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl matmul
 echo $'\n=== 04_matrix_multiply - block ==='
 $RUN $DIR/04_matrix_multiply "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl block_matmul
+echo $'\n=== 04_matrix_multiply - all kernels, single build ==='
+$RUN $DIR/04_matrix_multiply "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl all
 echo $'\n=== 05_dot_product ==='
 $RUN $DIR/05_dot_product "$PLATFORM" default 0 $CLSRC/05_dot_product.cl dotprod
 echo $'\n=== 06_matrix_multiply_timing ==='
 $RUN $DIR/06_matrix_multiply_timing "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl matmul 256 16
 echo $'\n=== 06_matrix_multiply_timing - block ==='
 $RUN $DIR/06_matrix_multiply_timing "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl block_matmul 256 16
+echo $'\n=== 06_matrix_multiply_timing - block, autotuned workgroup size ==='
+$RUN $DIR/06_matrix_multiply_timing "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl block_matmul 256 auto
+echo $'\n=== 06_matrix_multiply_timing - register tiled 4 x 4, compared with block ==='
+$RUN $DIR/06_matrix_multiply_timing "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl tiled_matmul 1024 16 4 4 16
+echo $'\n=== 06_matrix_multiply_timing - gemm, non-square, no padding ==='
+$RUN $DIR/06_matrix_multiply_timing "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl gemm 1000x700x500 16 4 4 16
+echo $'\n=== 06_matrix_multiply_timing - gemm on a submatrix ==='
+$RUN $DIR/06_matrix_multiply_timing "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl gemm 333x257x129 8 2 2 8 160 300 301
 echo $'\n=== 07_convolution'
 $RUN $DIR/07_convolution "$PLATFORM" default 0 $CLSRC/07_stencil.cl filter 258 16 std
+echo $'\n=== 07_convolution - autotuned workgroup size'
+$RUN $DIR/07_convolution "$PLATFORM" default 0 $CLSRC/07_stencil.cl filter 258 auto std
 echo $'\n=== 07_convolution - read from images write to buffer'
 $RUN $DIR/07_convolution "$PLATFORM" default 0 $CLSRC/07_stencil.cl filter_image 258 16 image
+echo $'\n=== 07_convolution - buffer and image kernels, single build'
+$RUN $DIR/07_convolution "$PLATFORM" default 0 $CLSRC/07_stencil.cl filter 258 16 both
 echo $'\n=== 07_convolution - read from images write to image'
 $RUN $DIR/07_convolution_image_write "$PLATFORM" default 0 $CLSRC/07_stencil.cl filter_image 258 16 image
 echo $'\n=== 08_cpp - platform 0'
@@ -31,3 +50,43 @@ $RUN $DIR/08_cpp 0 default $CLSRC/08_arrayset.cl arrayset
 echo $'\n=== 09_memcpy - if it fails try without page-locked switch'
 _128MB=134217728
 $RUN $DIR/09_memcpy 0 default 0 $_128MB page-locked 
+echo $'\n=== 14_multi_device - all devices'
+$RUN $DIR/14_multi_device "$PLATFORM" default all $CLSRC/04_matrix_multiply.cl block_matmul 256 16
+echo $'\n=== 14_multi_device - single CPU device split into two sub-devices'
+$RUN $DIR/14_multi_device "$PLATFORM" cpu 0/2 $CLSRC/05_dot_product.cl dotprod 1048576 256
+echo $'\n=== 05_dot_product_vec_timing - one partition per NUMA node'
+$RUN $DIR/05_dot_product_vec_timing "$PLATFORM" cpu/numa 0 $CLSRC/05_dot_product_vec.cl dotprod 16777216 256 4
+echo $'\n=== 07_convolution - one slab of rows per NUMA node'
+$RUN $DIR/07_convolution "$PLATFORM" cpu/numa 0 $CLSRC/07_stencil.cl filter 1026 16 std
+echo $'\n=== 15_task_graph - matmul and stencil pipelines, serialized vs concurrent'
+$RUN $DIR/15_task_graph "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl $CLSRC/07_stencil.cl 256 258 16 4
+echo $'\n=== 16_launch_overhead - clSetKernelArg at each step vs launcher'
+$RUN $DIR/16_launch_overhead "$PLATFORM" default 0 $CLSRC/07_stencil.cl 258 16 10000
+echo $'\n=== 17_kernel_variants - vector width x precision variants built concurrently'
+$RUN $DIR/17_kernel_variants "$PLATFORM" default 0 $CLSRC/05_dot_product_vec.cl 16777216 256
+echo $'\n=== 05_dot_product_vec_timing - streamed in 16 MiB chunks'
+CLUTIL_STREAM_CHUNK=16777216 $RUN $DIR/05_dot_product_vec_timing "$PLATFORM" default 0 $CLSRC/05_dot_product_vec.cl dotprod 16777216 256 4
+echo $'\n=== 07_convolution - rows streamed in 1 MiB chunks'
+CLUTIL_STREAM_CHUNK=1048576 $RUN $DIR/07_convolution "$PLATFORM" default 0 $CLSRC/07_stencil.cl filter 4098 16 stream
+echo $'\n=== 18_svm - matrix multiply, buffers vs shared virtual memory'
+$RUN $DIR/18_svm "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl block_matmul 512 16 compare
+echo $'\n=== 18_svm - dot product, buffers vs shared virtual memory'
+$RUN $DIR/18_svm "$PLATFORM" default 0 $CLSRC/05_dot_product.cl dotprod 16777216 256 compare
+echo $'\n=== 19_thread_submit - 8 threads, shared queue vs per-thread queues'
+$RUN $DIR/19_thread_submit "$PLATFORM" default 0 $CLSRC/08_arrayset.cl 1048576 8 1000
+echo $'\n=== 20_recorded_replay - per-step enqueue vs recorded replay'
+$RUN $DIR/20_recorded_replay "$PLATFORM" default 0 $CLSRC/07_stencil.cl 258 16 10000
+echo $'\n=== 21_batched_gemm - matrix size x batch size sweep, single launch per batch'
+$RUN $DIR/21_batched_gemm "$PLATFORM" default 0 $CLSRC/21_batched_gemm.cl 8,16,32,64 100,1000,10000
+echo $'\n=== 22_out_of_core_gemm - 1024 x 1024 tiles, double buffered'
+$RUN $DIR/22_out_of_core_gemm "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl 4096 1024 2
+echo $'\n=== 22_out_of_core_gemm - 1024 x 1024 tiles, single buffer set (no overlap)'
+$RUN $DIR/22_out_of_core_gemm "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl 4096 1024 1
+echo $'\n=== 23_half_precision - gemm, half vs float storage'
+$RUN $DIR/23_half_precision "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl gemm_half 1024 16
+echo $'\n=== 23_half_precision - dot product, half vs float storage'
+$RUN $DIR/23_half_precision "$PLATFORM" default 0 $CLSRC/05_dot_product_vec.cl dotprod_half 16777216 256
+echo $'\n=== 24_gemm_epilogue - fused vs unfused alpha, beta, bias, relu'
+$RUN $DIR/24_gemm_epilogue "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl 1024 alpha,beta,bias,relu
+echo $'\n=== 24_gemm_epilogue - fused vs unfused bias, sigmoid, non-square'
+$RUN $DIR/24_gemm_epilogue "$PLATFORM" default 0 $CLSRC/04_matrix_multiply.cl 1000x2000x300 bias,sigmoid